@@ -0,0 +1,184 @@
+/******************************************************************************
+* Per-connection throughput and latency metrics with a TCP stats port
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "lwip/tcp.h"
+#include "conn_metrics.h"
+
+#if defined (__arm__) || defined (__aarch64__) || defined (HOST_BUILD)
+#include "xil_printf.h"
+#include "xtime_l.h"
+#define METRICS_TICKS_PER_SEC COUNTS_PER_SECOND
+static u32_t metrics_now(void) {
+    XTime t;
+    XTime_GetTime(&t);
+    return (u32_t)t;
+}
+#else
+#include "lwip/sys.h"
+#define xil_printf printf
+#define METRICS_TICKS_PER_SEC 1000
+static u32_t metrics_now(void) {
+    return sys_now();
+}
+#endif
+
+static conn_metrics_t *registry[CONN_METRICS_MAX_CONNS];
+static u32_t next_conn_id = 1;
+static u32_t snapshot_buf[4 + CONN_METRICS_MAX_CONNS * CONN_METRICS_SNAPSHOT_WORDS];
+
+static u8_t log2_bin(u32_t v) {
+    u8_t bin = (v == 0) ? 0 : (u8_t)(32 - __builtin_clz(v));
+    return (bin < CONN_METRICS_HIST_BINS) ? bin : CONN_METRICS_HIST_BINS - 1;
+}
+
+void conn_metrics_open(conn_metrics_t *m) {
+    int i;
+
+    memset(m, 0, sizeof(conn_metrics_t));
+    m->id = next_conn_id++;
+    m->last_sample_ticks = metrics_now();
+
+    for (i = 0; i < CONN_METRICS_MAX_CONNS; i++) {
+        if (!registry[i]) {
+            registry[i] = m;
+            break;
+        }
+    }
+}
+
+void conn_metrics_close(conn_metrics_t *m) {
+    int i;
+
+    for (i = 0; i < CONN_METRICS_MAX_CONNS; i++) {
+        if (registry[i] == m) {
+            registry[i] = NULL;
+        }
+    }
+}
+
+void conn_metrics_on_recv(conn_metrics_t *m, u16_t len) {
+    m->bytes_in += len;
+    m->pbufs_in++;
+    m->pbuf_hist[log2_bin(len)]++;
+}
+
+void conn_metrics_on_write(conn_metrics_t *m, u32_t len) {
+    m->bytes_written += len;
+
+    // Remember when this range was queued; skip the sample if the table is full
+    if (m->inflight_count < CONN_METRICS_INFLIGHT) {
+        conn_metrics_write_t *w =
+            &m->inflight[(m->inflight_head + m->inflight_count) % CONN_METRICS_INFLIGHT];
+        w->end = m->bytes_written;
+        w->ticks = metrics_now();
+        m->inflight_count++;
+    }
+}
+
+void conn_metrics_on_ack(conn_metrics_t *m, u16_t len) {
+    u32_t now = metrics_now();
+
+    m->bytes_out += len;
+    while (m->inflight_count > 0) {
+        conn_metrics_write_t *w = &m->inflight[m->inflight_head];
+        if ((s32_t)(w->end - m->bytes_out) > 0) {
+            break;
+        }
+        m->ack_hist[log2_bin(now - w->ticks)]++;
+        m->inflight_head = (m->inflight_head + 1) % CONN_METRICS_INFLIGHT;
+        m->inflight_count--;
+    }
+}
+
+void conn_metrics_on_stall(conn_metrics_t *m) {
+    m->err_mem_stalls++;
+}
+
+// Called from tcp_poll, never from the receive path
+void conn_metrics_sample(conn_metrics_t *m) {
+    u32_t now = metrics_now();
+    u32_t elapsed = now - m->last_sample_ticks;
+
+    if (elapsed == 0) {
+        return;
+    }
+
+    m->rate_in = (u32_t)(((u64_t)(m->bytes_in - m->last_bytes_in) * METRICS_TICKS_PER_SEC) / elapsed);
+    m->rate_out = (u32_t)(((u64_t)(m->bytes_out - m->last_bytes_out) * METRICS_TICKS_PER_SEC) / elapsed);
+    m->echo_backlog = m->bytes_in - m->bytes_out;
+
+    m->last_sample_ticks = now;
+    m->last_bytes_in = m->bytes_in;
+    m->last_bytes_out = m->bytes_out;
+}
+
+void conn_metrics_report(const conn_metrics_t *m) {
+    xil_printf("Conn %lu: Recv Rate: %lu Kbps, Send Rate: %lu Kbps (Total Recv: %lu, Total Echoed: %lu, stalls %lu)\n\r",
+               (unsigned long)m->id, (unsigned long)(m->rate_in / 125), (unsigned long)(m->rate_out / 125),
+               (unsigned long)m->bytes_in, (unsigned long)m->bytes_out, (unsigned long)m->err_mem_stalls);
+}
+
+// Stats port: every connection gets one snapshot and is closed
+static err_t metrics_accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err) {
+    u32_t n = 0;
+    u32_t *out = &snapshot_buf[4];
+    int i;
+
+    LWIP_UNUSED_ARG(arg);
+    if (err != ERR_OK || newpcb == NULL) {
+        return ERR_VAL;
+    }
+
+    for (i = 0; i < CONN_METRICS_MAX_CONNS; i++) {
+        if (registry[i]) {
+            memcpy(out, &registry[i]->id, CONN_METRICS_SNAPSHOT_WORDS * sizeof(u32_t));
+            out += CONN_METRICS_SNAPSHOT_WORDS;
+            n++;
+        }
+    }
+    snapshot_buf[0] = CONN_METRICS_MAGIC;
+    snapshot_buf[1] = n;
+    snapshot_buf[2] = METRICS_TICKS_PER_SEC;
+    snapshot_buf[3] = CONN_METRICS_SNAPSHOT_WORDS;
+
+    if (tcp_write(newpcb, snapshot_buf, (u16_t)((4 + n * CONN_METRICS_SNAPSHOT_WORDS) * sizeof(u32_t)),
+                  TCP_WRITE_FLAG_COPY) != ERR_OK) {
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+    tcp_output(newpcb);
+    tcp_close(newpcb);
+    return ERR_OK;
+}
+
+err_t conn_metrics_server_init(u16_t port) {
+    struct tcp_pcb *pcb;
+    err_t err;
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        xil_printf("Stats: error creating PCB\n\r");
+        return ERR_MEM;
+    }
+
+    err = tcp_bind(pcb, IP_ANY_TYPE, port);
+    if (err != ERR_OK) {
+        xil_printf("Stats: unable to bind to port %d: err = %d\n\r", port, err);
+        tcp_abort(pcb);
+        return err;
+    }
+
+    pcb = tcp_listen(pcb);
+    if (!pcb) {
+        xil_printf("Stats: out of memory while tcp_listen\n\r");
+        return ERR_MEM;
+    }
+
+    tcp_accept(pcb, metrics_accept_callback);
+    xil_printf("Stats port started @ port %d\n\r", port);
+    return ERR_OK;
+}
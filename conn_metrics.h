@@ -0,0 +1,62 @@
+/******************************************************************************
+* Per-connection throughput and latency metrics with a TCP stats port
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* The receive path only bumps integer counters. Rates are computed from
+* tcp_poll, and a client connecting to CONN_METRICS_PORT gets a binary
+* snapshot of every registered connection (see stats_client.py).
+******************************************************************************/
+
+#ifndef CONN_METRICS_H
+#define CONN_METRICS_H
+
+#include "lwip/err.h"
+#include "lwip/arch.h"
+
+#define CONN_METRICS_PORT 6002
+#define CONN_METRICS_MAX_CONNS 8       // Connections visible on the stats port
+#define CONN_METRICS_HIST_BINS 32      // log2 buckets: bin b counts values in [2^(b-1), 2^b)
+#define CONN_METRICS_INFLIGHT 16       // Writes tracked for ACK delay
+#define CONN_METRICS_MAGIC 0x4D455431  // "MET1"
+
+typedef struct {
+    u32_t end;                         // Stream offset just past this write
+    u32_t ticks;                       // When it was handed to tcp_write
+} conn_metrics_write_t;
+
+typedef struct {
+    u32_t id;                          // Connection number since boot
+    u32_t bytes_in;                    // Bytes received (including headers)
+    u32_t bytes_out;                   // Bytes echoed and ACK'd
+    u32_t bytes_written;               // Bytes handed to tcp_write
+    u32_t pbufs_in;                    // recv_callback invocations with data
+    u32_t err_mem_stalls;              // tcp_write ERR_MEM / full send buffer
+    u32_t echo_backlog;                // Received but not yet ACK'd back
+    u32_t rate_in;                     // Bytes/s over the last poll interval
+    u32_t rate_out;
+    u32_t pbuf_hist[CONN_METRICS_HIST_BINS];
+    u32_t ack_hist[CONN_METRICS_HIST_BINS];   // tcp_write -> sent_callback, in ticks
+
+    // Sampling state, not part of the snapshot
+    u32_t last_sample_ticks;
+    u32_t last_bytes_in;
+    u32_t last_bytes_out;
+    conn_metrics_write_t inflight[CONN_METRICS_INFLIGHT];
+    u8_t inflight_head;
+    u8_t inflight_count;
+} conn_metrics_t;
+
+// Fields of conn_metrics_t sent on the stats port, in order (u32 each)
+#define CONN_METRICS_SNAPSHOT_WORDS (9 + 2 * CONN_METRICS_HIST_BINS)
+
+void conn_metrics_open(conn_metrics_t *m);
+void conn_metrics_close(conn_metrics_t *m);
+void conn_metrics_on_recv(conn_metrics_t *m, u16_t len);
+void conn_metrics_on_write(conn_metrics_t *m, u32_t len);
+void conn_metrics_on_ack(conn_metrics_t *m, u16_t len);
+void conn_metrics_on_stall(conn_metrics_t *m);
+void conn_metrics_sample(conn_metrics_t *m);
+void conn_metrics_report(const conn_metrics_t *m);
+err_t conn_metrics_server_init(u16_t port);
+
+#endif
@@ -0,0 +1,124 @@
+/******************************************************************************
+* Fixed-size connection table with admission control
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <string.h>
+#include "conn_pool.h"
+#include "xil_printf.h"
+
+#define SLOT_NONE 0xFFFF
+
+static u16_t slot_of(const conn_pool_t *pool, const void *conn)
+{
+    return (u16_t)(((const u8_t *)conn - pool->slots) / pool->size);
+}
+
+void conn_pool_init(conn_pool_t *pool, u16_t limit)
+{
+    u16_t i;
+
+    for (i = 0; i < pool->count; i++) {
+        pool->next[i] = (u16_t)(i + 1 < pool->count ? i + 1 : SLOT_NONE);
+        pool->gen[i] = 0;
+    }
+    pool->free_head = pool->count ? 0 : SLOT_NONE;
+    pool->in_use = 0;
+    pool->peak = 0;
+    pool->admitted = 0;
+    memset(pool->rejected, 0, sizeof(pool->rejected));
+    conn_pool_set_limit(pool, limit);
+}
+
+// Takes effect for the next accept; connections over a lowered limit stay
+void conn_pool_set_limit(conn_pool_t *pool, u16_t limit)
+{
+    pool->limit = (limit == 0 || limit > pool->count) ? pool->count : limit;
+}
+
+// A zeroed slot, or NULL with *reason set
+void *conn_pool_acquire(conn_pool_t *pool, conn_reject_t *reason)
+{
+    u16_t slot;
+    void *conn;
+
+    if (pool->in_use >= pool->limit) {
+        *reason = CONN_REJECT_LIMIT;
+    } else if (pool->free_head == SLOT_NONE) {
+        *reason = CONN_REJECT_FULL;
+    } else {
+        *reason = CONN_ADMITTED;
+    }
+    if (*reason != CONN_ADMITTED) {
+        pool->rejected[*reason]++;
+        return NULL;
+    }
+
+    slot = pool->free_head;
+    pool->free_head = pool->next[slot];
+    pool->gen[slot]++;
+    pool->in_use++;
+    pool->admitted++;
+    if (pool->in_use > pool->peak) {
+        pool->peak = pool->in_use;
+    }
+
+    conn = pool->slots + (u32_t)slot * pool->size;
+    memset(conn, 0, pool->size);
+    return conn;
+}
+
+void conn_pool_release(conn_pool_t *pool, void *conn)
+{
+    u16_t slot;
+
+    if (conn == NULL) {
+        return;
+    }
+    slot = slot_of(pool, conn);
+    if ((pool->gen[slot] & 1) == 0) {
+        xil_printf("%s: slot %d released twice\n\r", pool->name, slot);
+        return;
+    }
+
+    pool->gen[slot]++;
+    pool->next[slot] = pool->free_head;
+    pool->free_head = slot;
+    pool->in_use--;
+}
+
+conn_handle_t conn_pool_handle(const conn_pool_t *pool, const void *conn)
+{
+    u16_t slot = slot_of(pool, conn);
+
+    return ((conn_handle_t)pool->gen[slot] << 16) | slot;
+}
+
+// The connection behind handle, or NULL if it has been released since
+void *conn_pool_get(const conn_pool_t *pool, conn_handle_t handle)
+{
+    u16_t slot = (u16_t)(handle & 0xFFFF);
+
+    if (slot >= pool->count || pool->gen[slot] != (u16_t)(handle >> 16) || (pool->gen[slot] & 1) == 0) {
+        return NULL;
+    }
+    return pool->slots + (u32_t)slot * pool->size;
+}
+
+const char *conn_pool_reason(conn_reject_t reason)
+{
+    switch (reason) {
+    case CONN_ADMITTED: return "admitted";
+    case CONN_REJECT_LIMIT: return "connection limit";
+    case CONN_REJECT_FULL: return "table full";
+    default: return "?";
+    }
+}
+
+void conn_pool_report(const conn_pool_t *pool)
+{
+    xil_printf("%s: %d/%d in use (peak %d, limit %d), %lu admitted, rejected %lu at limit, %lu full\n\r",
+               pool->name, pool->in_use, pool->count, pool->peak, pool->limit,
+               (unsigned long)pool->admitted, (unsigned long)pool->rejected[CONN_REJECT_LIMIT],
+               (unsigned long)pool->rejected[CONN_REJECT_FULL]);
+}
@@ -0,0 +1,77 @@
+/******************************************************************************
+* Fixed-size connection table with admission control
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* The servers used to mem_malloc their connection struct on every accept.
+* It lives as long as the connection, in the same lwIP heap that
+* TCP_WRITE_FLAG_COPY segments and PBUF_RAM allocations churn through, so
+* under connection churn long-lived blocks end up scattered across it and
+* a tcp_write can fail with plenty of heap free. Each server now declares a
+* static table of slots with CONN_POOL_DECLARE (like LWIP_MEMPOOL_DECLARE):
+*
+*   acquire/release  O(1), LIFO free list of slot indices, slot zeroed
+*   handles          slot index + generation. The generation changes on every
+*                    acquire and release, so a handle kept by anything that
+*                    can outlive the connection resolves to NULL once it is
+*                    gone instead of to the slot's next owner.
+*   limit            admission limit (at most the table size), checked in
+*                    accept before anything else is allocated; a rejected
+*                    connection is aborted and counted by reason
+******************************************************************************/
+
+#ifndef CONN_POOL_H
+#define CONN_POOL_H
+
+#include "lwip/arch.h"
+
+#ifndef CONN_POOL_MAX_CONNECTIONS
+#define CONN_POOL_MAX_CONNECTIONS 16    // Table size per server, keep below MEMP_NUM_TCP_PCB
+#endif
+
+typedef u32_t conn_handle_t;            // Generation << 16 | slot; 0 is never valid
+#define CONN_HANDLE_NONE 0
+
+// Handles ride in the void * argument of completion callbacks
+#define CONN_HANDLE_ARG(handle) ((void *)(mem_ptr_t)(handle))
+#define CONN_HANDLE_OF(arg) ((conn_handle_t)(mem_ptr_t)(arg))
+
+typedef enum {
+    CONN_ADMITTED = 0,
+    CONN_REJECT_LIMIT,                  // Concurrency limit reached
+    CONN_REJECT_FULL,                   // Every slot in use
+    CONN_REJECT_REASONS
+} conn_reject_t;
+
+typedef struct {
+    const char *name;
+    u8_t *slots;                        // count * size bytes
+    u16_t *next;                        // Free list links
+    u16_t *gen;                         // Odd while the slot is in use
+    u32_t size;
+    u16_t count;
+    u16_t free_head;
+    u16_t in_use;
+    u16_t peak;
+    u16_t limit;
+    u32_t admitted;
+    u32_t rejected[CONN_REJECT_REASONS];
+} conn_pool_t;
+
+// Static storage for num connections of type; conn_pool_init() before use
+#define CONN_POOL_DECLARE(pool, type, num) \
+    static type pool##_slots[num]; \
+    static u16_t pool##_next[num]; \
+    static u16_t pool##_gen[num]; \
+    static conn_pool_t pool = { .name = #pool, .slots = (u8_t *)pool##_slots, .next = pool##_next, \
+                                .gen = pool##_gen, .size = sizeof(type), .count = (num) }
+
+void conn_pool_init(conn_pool_t *pool, u16_t limit);
+void conn_pool_set_limit(conn_pool_t *pool, u16_t limit);
+void *conn_pool_acquire(conn_pool_t *pool, conn_reject_t *reason);
+void conn_pool_release(conn_pool_t *pool, void *conn);
+conn_handle_t conn_pool_handle(const conn_pool_t *pool, const void *conn);
+void *conn_pool_get(const conn_pool_t *pool, conn_handle_t handle);
+const char *conn_pool_reason(conn_reject_t reason);
+void conn_pool_report(const conn_pool_t *pool);
+
+#endif
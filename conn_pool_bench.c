@@ -0,0 +1,218 @@
+/******************************************************************************
+* Host-side accept-rate benchmark: mem_malloc'd connection structs vs the
+* connection pool
+*
+* Simulates connection churn against the lwIP heap. Each cycle either
+* accepts a connection, closes one, or has a live connection tcp_write
+* (a TCP_WRITE_FLAG_COPY-sized heap allocation) or get an ACK (frees its
+* oldest one). The same seeded sequence runs once with the connection
+* struct from mem_malloc, as the servers used to, and once from a
+* conn_pool_t. A last check makes sure a released connection's handle no
+* longer resolves (exit status 1 if it does). Built by the host CMake build:
+*   ./build/conn_pool_bench [cycles] [max_live]
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lwip/init.h"
+#include "lwip/mem.h"
+#include "lwip/stats.h"
+
+#include "conn_pool.h"
+
+#define DEFAULT_CYCLES 1000000
+#define DEFAULT_MAX_LIVE 32
+#define BENCH_MAX_LIVE 64
+#define BENCH_CONN_SIZE 224       // About sizeof(image_connection_t)
+#define BENCH_SEGS 24             // Unacked copies per connection
+
+typedef struct {
+    u8_t state[BENCH_CONN_SIZE];
+    void *segs[BENCH_SEGS];       // Oldest first
+    int n_segs;
+} bench_conn_t;
+
+CONN_POOL_DECLARE(bench_pool, bench_conn_t, BENCH_MAX_LIVE);
+
+typedef struct {
+    unsigned long accepts;
+    unsigned long rejects;        // Connection struct not available
+    unsigned long closes;
+    unsigned long writes;
+    unsigned long write_fails;    // Segment copy did not fit in the heap
+    double conn_ns;               // Acquire + release time
+    double total_ns;
+} bench_result_t;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bench_conn_t *conn_new(int pooled) {
+    bench_conn_t *c;
+    conn_reject_t reason;
+
+    if (pooled) {
+        return (bench_conn_t *)conn_pool_acquire(&bench_pool, &reason);
+    }
+    c = (bench_conn_t *)mem_malloc(sizeof(bench_conn_t));
+    if (c) {
+        memset(c, 0, sizeof(bench_conn_t));
+    }
+    return c;
+}
+
+static void conn_delete(int pooled, bench_conn_t *c) {
+    if (pooled) {
+        conn_pool_release(&bench_pool, c);
+    } else {
+        mem_free(c);
+    }
+}
+
+static void run(int pooled, int cycles, int max_live, bench_result_t *r) {
+    bench_conn_t *live[BENCH_MAX_LIVE];
+    int n_live = 0;
+    double start, t0;
+    int i, j;
+
+    memset(r, 0, sizeof(bench_result_t));
+    srand(1);
+#if MEM_STATS
+    memset(&lwip_stats.mem, 0, sizeof(lwip_stats.mem));
+#endif
+    mem_init();
+    conn_pool_init(&bench_pool, (u16_t)max_live);
+
+    start = now_ns();
+    for (i = 0; i < cycles; i++) {
+        int op = rand() % 16;
+
+        if (op == 0 || n_live == 0) {
+            // Accept
+            bench_conn_t *c;
+
+            if (n_live >= max_live) {
+                continue;
+            }
+            t0 = now_ns();
+            c = conn_new(pooled);
+            r->conn_ns += now_ns() - t0;
+            if (!c) {
+                r->rejects++;
+                continue;
+            }
+            live[n_live++] = c;
+            r->accepts++;
+        } else if (op == 1) {
+            // Close: unacked copies go with it
+            int victim = rand() % n_live;
+            bench_conn_t *c = live[victim];
+
+            for (j = 0; j < c->n_segs; j++) {
+                mem_free(c->segs[j]);
+            }
+            t0 = now_ns();
+            conn_delete(pooled, c);
+            r->conn_ns += now_ns() - t0;
+            live[victim] = live[--n_live];
+            r->closes++;
+        } else {
+            bench_conn_t *c = live[rand() % n_live];
+
+            if (op < 10 && c->n_segs < BENCH_SEGS) {
+                // tcp_write: full segments mostly, a runt tail now and then
+                mem_size_t len = (mem_size_t)((rand() % 4) ? TCP_MSS : 64 + rand() % TCP_MSS);
+                void *seg = mem_malloc(len);
+
+                r->writes++;
+                if (seg) {
+                    c->segs[c->n_segs++] = seg;
+                } else {
+                    r->write_fails++;
+                }
+            } else if (c->n_segs > 0) {
+                // ACK of the oldest copy
+                mem_free(c->segs[0]);
+                memmove(&c->segs[0], &c->segs[1], (c->n_segs - 1) * sizeof(void *));
+                c->n_segs--;
+            }
+        }
+    }
+    r->total_ns = now_ns() - start;
+
+    while (n_live > 0) {
+        bench_conn_t *c = live[--n_live];
+        for (j = 0; j < c->n_segs; j++) {
+            mem_free(c->segs[j]);
+        }
+        conn_delete(pooled, c);
+    }
+}
+
+static void print_result(const char *name, const bench_result_t *r) {
+    unsigned long conn_ops = r->accepts + r->closes;
+
+    printf("%-10s %lu accepts (%.0f/s), %lu rejected, %.1f ns per acquire/release, "
+           "%lu of %lu writes failed on heap\n",
+           name, r->accepts, r->accepts / (r->total_ns / 1e9), r->rejects,
+           conn_ops ? r->conn_ns / conn_ops : 0.0, r->write_fails, r->writes);
+#if MEM_STATS
+    printf("%-10s heap peak %lu of %lu bytes, %lu errors\n", "",
+           (unsigned long)lwip_stats.mem.max, (unsigned long)lwip_stats.mem.avail,
+           (unsigned long)lwip_stats.mem.err);
+#endif
+}
+
+// A handle kept past release must not resolve, not even once the slot has
+// a new owner: the copy engine and storage completions rely on it
+static int check_handles(void) {
+    conn_reject_t reason;
+    bench_conn_t *a, *b;
+    conn_handle_t h;
+    int ok;
+
+    conn_pool_init(&bench_pool, BENCH_MAX_LIVE);
+    a = (bench_conn_t *)conn_pool_acquire(&bench_pool, &reason);
+    h = conn_pool_handle(&bench_pool, a);
+    ok = h != CONN_HANDLE_NONE && conn_pool_get(&bench_pool, h) == a &&
+         conn_pool_get(&bench_pool, CONN_HANDLE_OF(CONN_HANDLE_ARG(h))) == a;
+    conn_pool_release(&bench_pool, a);
+    ok = ok && conn_pool_get(&bench_pool, h) == NULL;
+
+    // LIFO free list: the same slot comes straight back
+    b = (bench_conn_t *)conn_pool_acquire(&bench_pool, &reason);
+    ok = ok && b == a && conn_pool_get(&bench_pool, h) == NULL &&
+         conn_pool_get(&bench_pool, conn_pool_handle(&bench_pool, b)) == b;
+    conn_pool_release(&bench_pool, b);
+
+    printf("handles: stale after release and reacquire %s\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int cycles = (argc > 1) ? atoi(argv[1]) : DEFAULT_CYCLES;
+    int max_live = (argc > 2) ? atoi(argv[2]) : DEFAULT_MAX_LIVE;
+    bench_result_t heap, pool;
+
+    if (max_live < 1 || max_live > BENCH_MAX_LIVE) {
+        max_live = BENCH_MAX_LIVE;
+    }
+
+    lwip_init();
+
+    run(0, cycles, max_live, &heap);
+    print_result("mem_malloc", &heap);
+
+    run(1, cycles, max_live, &pool);
+    print_result("conn_pool", &pool);
+    conn_pool_report(&bench_pool);
+
+    printf("cycles %d, max live %d, MEM_SIZE %d\n", cycles, max_live, MEM_SIZE);
+    return check_handles() ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+/******************************************************************************
+* tcp_poll supervisor for stalled and dead connections
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include "conn_watchdog.h"
+#include "xil_printf.h"
+#include "trace_log.h"
+
+static u32_t evictions;    // Since boot, over all connections
+
+void conn_watchdog_init(conn_watchdog_t *wd, u16_t deadline)
+{
+    wd->progress = 0;
+    wd->idle = 0;
+    wd->deadline = deadline ? deadline : CONN_WATCHDOG_IDLE_POLLS;
+    wd->polls = 0;
+    wd->stalls = 0;
+}
+
+// Called once per tcp_poll with a counter that grows whenever the
+// connection gets anywhere; pending says the server still has work queued
+conn_watchdog_verdict_t conn_watchdog_check(conn_watchdog_t *wd, u32_t progress, u8_t pending)
+{
+    wd->polls++;
+    if (progress != wd->progress) {
+        wd->progress = progress;
+        wd->idle = 0;
+        return CONN_WATCHDOG_OK;
+    }
+
+    if (++wd->idle >= wd->deadline) {
+        return CONN_WATCHDOG_EXPIRED;
+    }
+    if (pending) {
+        wd->stalls++;
+        TRACE_INFO(TRACE_EV_WATCHDOG, progress, wd->idle);
+        return CONN_WATCHDOG_STALLED;
+    }
+    return CONN_WATCHDOG_OK;
+}
+
+// Log an eviction; the caller aborts the connection
+void conn_watchdog_evict(const conn_watchdog_t *wd)
+{
+    evictions++;
+    xil_printf("Watchdog: no progress for %d polls (%lu stalled), evicting connection (%lu evicted)\n\r",
+               wd->idle, (unsigned long)wd->stalls, (unsigned long)evictions);
+}
+
+void conn_watchdog_report(const conn_watchdog_t *wd)
+{
+    xil_printf("Watchdog: %lu polls, %lu stalled, %lu evicted since boot\n\r",
+               (unsigned long)wd->polls, (unsigned long)wd->stalls, (unsigned long)evictions);
+}
@@ -0,0 +1,57 @@
+/******************************************************************************
+* tcp_poll supervisor for stalled and dead connections
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* The echo only moves on recv and sent callbacks. When tcp_write hits
+* ERR_MEM, or the send buffer is full when the last chain arrives, the
+* cursor parks and nothing restarts it unless another event comes in; a
+* peer that stops talking without a FIN or RST holds its connection slot
+* and DDR4 extent forever. Each server's poll callback now reports its
+* progress (bytes received plus bytes ACK'd) to a conn_watchdog_t:
+*
+*   OK       something moved since the last poll
+*   STALLED  nothing moved but work is pending (echo backlog, unACK'd
+*            data): the server re-drives the echo cursor and flushes its
+*            coalesced output, and the poll is counted as a stall
+*   EXPIRED  nothing moved for CONN_WATCHDOG_IDLE_POLLS polls, pending
+*            work or not: the server aborts the connection, which returns
+*            its extent and slot and frees the PCB (tcp_abort sends a RST)
+*
+* The deadline counts polls, so it is CONN_WATCHDOG_IDLE_POLLS times the
+* tcp_poll interval the server registered (CONN_WATCHDOG_POLL_INTERVAL by
+* default, 500 ms ticks).
+******************************************************************************/
+
+#ifndef CONN_WATCHDOG_H
+#define CONN_WATCHDOG_H
+
+#include "lwip/arch.h"
+
+#ifndef CONN_WATCHDOG_POLL_INTERVAL
+#define CONN_WATCHDOG_POLL_INTERVAL 2    // tcp_poll interval, 500 ms ticks
+#endif
+
+#ifndef CONN_WATCHDOG_IDLE_POLLS
+#define CONN_WATCHDOG_IDLE_POLLS 20      // Polls without progress before eviction (20 s)
+#endif
+
+typedef enum {
+    CONN_WATCHDOG_OK = 0,
+    CONN_WATCHDOG_STALLED,               // Re-drive and flush
+    CONN_WATCHDOG_EXPIRED                // Abort the connection
+} conn_watchdog_verdict_t;
+
+typedef struct {
+    u32_t progress;        // Progress counter seen at the last poll
+    u16_t idle;            // Consecutive polls without progress
+    u16_t deadline;        // Idle polls before eviction
+    u32_t polls;
+    u32_t stalls;          // Polls that found pending work and no progress
+} conn_watchdog_t;
+
+void conn_watchdog_init(conn_watchdog_t *wd, u16_t deadline);
+conn_watchdog_verdict_t conn_watchdog_check(conn_watchdog_t *wd, u32_t progress, u8_t pending);
+void conn_watchdog_evict(const conn_watchdog_t *wd);
+void conn_watchdog_report(const conn_watchdog_t *wd);
+
+#endif
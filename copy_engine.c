@@ -0,0 +1,283 @@
+/******************************************************************************
+* Asynchronous pbuf -> DDR4 copy engine
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <string.h>
+#include "copy_engine.h"
+#include "xil_cache.h"
+#include "ddr4_copy.h"
+#include "pbuf_iov.h"
+#include "xil_printf.h"
+
+#if defined (HOST_BUILD)
+#define COPY_ENGINE_WORKER 1
+#include "storage_pipeline.h"
+#elif defined (XPAR_XAXICDMA_NUM_INSTANCES) && !defined (COPY_ENGINE_CPU)
+#define COPY_ENGINE_CDMA 1
+#include "xaxicdma.h"
+#include "xparameters.h"
+#ifndef COPY_ENGINE_CDMA_DEVICE_ID
+#define COPY_ENGINE_CDMA_DEVICE_ID XPAR_AXICDMA_0_DEVICE_ID
+#endif
+#endif
+
+copy_engine_stats_t copy_engine_stats;
+
+#if defined (COPY_ENGINE_WORKER)
+
+// The storage worker already moves pbuf chains to DDR4 off the main loop;
+// the copy engine only adds the per-request callback.
+static storage_pipeline_t pipeline;
+static copy_done_fn job_done[STORAGE_PIPELINE_JOBS];
+
+static void worker_done(storage_job_t *job) {
+    u32_t i = (u32_t)(job - pipeline.jobs);
+
+    copy_engine_stats.completed++;
+    job_done[i](job->owner, job->len);
+}
+
+err_t copy_engine_init(void)
+{
+    memset(&copy_engine_stats, 0, sizeof(copy_engine_stats));
+    return storage_pipeline_start(&pipeline, worker_done) == 0 ? ERR_OK : ERR_MEM;
+}
+
+err_t copy_engine_submit(struct pbuf *p, UINTPTR dst, copy_done_fn done, void *arg)
+{
+    storage_job_t *job = storage_pipeline_job(&pipeline);
+    const struct pbuf *q;
+
+    if (!job) {
+        copy_engine_stats.full++;
+        return ERR_MEM;
+    }
+    job->p = p;
+    job->dst = dst;
+    job->len = p->tot_len;
+    job->owner = arg;
+    job_done[job - pipeline.jobs] = done;
+    for (q = p; q != NULL; q = q->next) {
+        copy_engine_stats.segments++;
+    }
+    copy_engine_stats.submitted++;
+    copy_engine_stats.bytes += p->tot_len;
+    storage_pipeline_submit(&pipeline, job);
+    return ERR_OK;
+}
+
+u8_t copy_engine_full(void)
+{
+    if (storage_pipeline_full(&pipeline)) {
+        copy_engine_stats.full++;
+        return 1;
+    }
+    return 0;
+}
+
+u32_t copy_engine_poll(void)
+{
+    return storage_pipeline_poll(&pipeline);
+}
+
+const char *copy_engine_backend(void)
+{
+    return "worker thread";
+}
+
+#else
+
+typedef struct {
+    struct pbuf *p;
+    UINTPTR dst;
+    u32_t len;
+    copy_done_fn done;
+    void *arg;
+} copy_req_t;
+
+// FIFO of requests: [tail, active) finished, [active, head) still copying
+static copy_req_t reqs[COPY_ENGINE_DEPTH];
+static u32_t head;
+static u32_t active;
+static u32_t tail;
+
+#if defined (COPY_ENGINE_CDMA)
+static XAxiCdma cdma;
+static struct pbuf *cur_seg;        // Segment of reqs[active] on the engine, NULL = none yet
+static UINTPTR cur_dst;
+static u8_t cdma_running;
+
+// Start the next segment of the active request. Returns 1 when the request
+// has no segments left.
+static int cdma_start_next(copy_req_t *r)
+{
+    cur_seg = cur_seg ? cur_seg->next : r->p;
+    if (!cur_seg) {
+        return 1;
+    }
+    if (cur_seg->len == 0) {
+        return cdma_start_next(r);
+    }
+    // Source lines to memory, destination lines dropped so no stale line is
+    // written back over what the engine stores
+    Xil_DCacheFlushRange((UINTPTR)cur_seg->payload, cur_seg->len);
+    Xil_DCacheInvalidateRange(cur_dst, cur_seg->len);
+    if (XAxiCdma_SimpleTransfer(&cdma, (UINTPTR)cur_seg->payload, cur_dst, cur_seg->len,
+                                NULL, NULL) != XST_SUCCESS) {
+        // Engine refused (busy or halted): move this segment on the CPU
+        copy_engine_stats.errors++;
+        memcpy((void *)cur_dst, cur_seg->payload, cur_seg->len);
+        Xil_DCacheFlushRange(cur_dst, cur_seg->len);
+        cur_dst += cur_seg->len;
+        copy_engine_stats.segments++;
+        return cdma_start_next(r);
+    }
+    cdma_running = 1;
+    return 0;
+}
+
+// Advance the engine as far as it has got; called from the main loop
+static void cdma_advance(void)
+{
+    while (active != head) {
+        copy_req_t *r = &reqs[active & (COPY_ENGINE_DEPTH - 1)];
+
+        if (cdma_running) {
+            if (XAxiCdma_IsBusy(&cdma)) {
+                return;
+            }
+            cdma_running = 0;
+            if (XAxiCdma_GetError(&cdma) != 0) {
+                // Redo the segment on the CPU and bring the engine back
+                copy_engine_stats.errors++;
+                XAxiCdma_Reset(&cdma);
+                while (!XAxiCdma_ResetIsDone(&cdma));
+                XAxiCdma_IntrDisable(&cdma, XAXICDMA_XR_IRQ_ALL_MASK);
+                memcpy((void *)cur_dst, cur_seg->payload, cur_seg->len);
+                Xil_DCacheFlushRange(cur_dst, cur_seg->len);
+            }
+            cur_dst += cur_seg->len;
+            copy_engine_stats.segments++;
+        } else if (!cur_seg) {
+            cur_dst = r->dst;
+        }
+        if (cdma_start_next(r)) {
+            cur_seg = NULL;
+            active++;
+        }
+    }
+}
+#endif
+
+err_t copy_engine_init(void)
+{
+    memset(&copy_engine_stats, 0, sizeof(copy_engine_stats));
+    head = active = tail = 0;
+#if defined (COPY_ENGINE_CDMA)
+    {
+        XAxiCdma_Config *cfg = XAxiCdma_LookupConfig(COPY_ENGINE_CDMA_DEVICE_ID);
+
+        if (!cfg || XAxiCdma_CfgInitialize(&cdma, cfg, cfg->BaseAddress) != XST_SUCCESS) {
+            xil_printf("AXI CDMA init failed\n\r");
+            return ERR_IF;
+        }
+        // Completion is polled from the main loop
+        XAxiCdma_IntrDisable(&cdma, XAXICDMA_XR_IRQ_ALL_MASK);
+        cur_seg = NULL;
+        cdma_running = 0;
+    }
+#endif
+    return ERR_OK;
+}
+
+err_t copy_engine_submit(struct pbuf *p, UINTPTR dst, copy_done_fn done, void *arg)
+{
+    copy_req_t *r;
+
+    if (head - tail >= COPY_ENGINE_DEPTH) {
+        copy_engine_stats.full++;
+        return ERR_MEM;
+    }
+    r = &reqs[head & (COPY_ENGINE_DEPTH - 1)];
+    r->p = p;
+    r->dst = dst;
+    r->len = p->tot_len;
+    r->done = done;
+    r->arg = arg;
+    head++;
+    copy_engine_stats.submitted++;
+    copy_engine_stats.bytes += p->tot_len;
+
+#if defined (COPY_ENGINE_CDMA)
+    cdma_advance();
+#else
+    {
+        const struct pbuf *q;
+
+        for (q = p; q != NULL; q = q->next) {
+            copy_engine_stats.segments++;
+        }
+        pbuf_iov_store(p, 0, p->tot_len, dst, NULL);
+        ddr4_copy_fence();
+        Xil_DCacheFlushRange(dst, p->tot_len);
+        active = head;
+    }
+#endif
+    return ERR_OK;
+}
+
+u8_t copy_engine_full(void)
+{
+    if (head - tail >= COPY_ENGINE_DEPTH) {
+        copy_engine_stats.full++;
+        return 1;
+    }
+    return 0;
+}
+
+// Free finished chains and run their callbacks, oldest first
+u32_t copy_engine_poll(void)
+{
+    u32_t n = 0;
+
+#if defined (COPY_ENGINE_CDMA)
+    cdma_advance();
+#endif
+    while (tail != active) {
+        copy_req_t *r = &reqs[tail & (COPY_ENGINE_DEPTH - 1)];
+
+        pbuf_free(r->p);
+        r->p = NULL;
+        tail++;
+        copy_engine_stats.completed++;
+        r->done(r->arg, r->len);
+        n++;
+    }
+    return n;
+}
+
+const char *copy_engine_backend(void)
+{
+#if defined (COPY_ENGINE_CDMA)
+    return "AXI CDMA";
+#else
+    return "CPU memcpy";
+#endif
+}
+
+#endif
+
+u32_t copy_engine_pending(void)
+{
+    return copy_engine_stats.submitted - copy_engine_stats.completed;
+}
+
+void copy_engine_report(void)
+{
+    xil_printf("Copy engine (%s): %lu requests, %lu segments, %lu KB, %lu pending, %lu full, %lu errors\n\r",
+               copy_engine_backend(), (unsigned long)copy_engine_stats.submitted,
+               (unsigned long)copy_engine_stats.segments, (unsigned long)(copy_engine_stats.bytes / 1024),
+               (unsigned long)copy_engine_pending(), (unsigned long)copy_engine_stats.full,
+               (unsigned long)copy_engine_stats.errors);
+}
@@ -0,0 +1,58 @@
+/******************************************************************************
+* Asynchronous pbuf -> DDR4 copy engine
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* copy_engine_submit() takes a received pbuf chain (the scatter list: one
+* segment per pbuf payload) and a DDR4 destination, and returns at once. The
+* copy runs in the background; copy_engine_poll(), called from the main loop,
+* frees each finished chain and then calls its completion callback, so the
+* pbufs live exactly as long as the copy and every lwIP call stays in the
+* tcpip context. Requests complete in submit order.
+*
+* A recv callback that may refuse a chain asks copy_engine_full() before it
+* strips or credits anything: lwIP offers refused data again as the same
+* pbuf, so it must come back unchanged.
+*
+* Backends:
+*   HOST_BUILD             storage worker thread (storage_pipeline.c)
+*   AXI CDMA in the design simple-mode transfers, one per segment, advanced
+*                          from copy_engine_poll() (no interrupt needed)
+*   otherwise              CPU memcpy at submit, completion on the next poll
+* Define COPY_ENGINE_CPU to force the memcpy backend on a design with a CDMA.
+*
+* The destination is flushed (worker, CPU) or invalidated before the DMA
+* writes it (CDMA), so on completion it can go straight to a zero-copy echo.
+******************************************************************************/
+
+#ifndef COPY_ENGINE_H
+#define COPY_ENGINE_H
+
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+#include "xil_types.h"
+
+#define COPY_ENGINE_DEPTH 256       // Requests in flight, power of two
+
+// Called from copy_engine_poll() after the chain has been freed
+typedef void (*copy_done_fn)(void *arg, u32_t len);
+
+typedef struct {
+    u32_t submitted;
+    u32_t completed;
+    u32_t bytes;
+    u32_t segments;                 // Scatter entries moved
+    u32_t full;                     // Submits refused with ERR_MEM, or copy_engine_full() hits
+    u32_t errors;                   // CDMA transfers that reported an error
+} copy_engine_stats_t;
+
+extern copy_engine_stats_t copy_engine_stats;
+
+err_t copy_engine_init(void);
+err_t copy_engine_submit(struct pbuf *p, UINTPTR dst, copy_done_fn done, void *arg);
+u8_t copy_engine_full(void);
+u32_t copy_engine_poll(void);
+u32_t copy_engine_pending(void);
+const char *copy_engine_backend(void);
+void copy_engine_report(void);
+
+#endif
@@ -0,0 +1,149 @@
+/******************************************************************************
+* Streaming CRC32C (Castagnoli) for the verify mode digest
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <string.h>
+#include "crc32c.h"
+
+#if defined (__aarch64__) && defined (__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_HW_ARM 1
+#elif defined (__x86_64__) && defined (__GNUC__) && !defined (CRC32C_NO_HW)
+#include <nmmintrin.h>
+#define CRC32C_HW_X86 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78 // Reflected Castagnoli polynomial
+
+static u32_t crc_table[8][256];
+static u8_t crc_ready;
+#if defined (CRC32C_HW_X86)
+static u8_t crc_use_sse42;
+#endif
+
+void crc32c_init(void)
+{
+    u32_t i, j, c;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (j = 0; j < 8; j++) {
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++) {
+        c = crc_table[0][i];
+        for (j = 1; j < 8; j++) {
+            c = crc_table[0][c & 0xFF] ^ (c >> 8);
+            crc_table[j][i] = c;
+        }
+    }
+#if defined (CRC32C_HW_X86)
+    __builtin_cpu_init();
+    crc_use_sse42 = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#endif
+    crc_ready = 1;
+}
+
+// Eight bytes per step through eight tables; the word load is little-endian
+static u32_t crc32c_sw(u32_t crc, const u8_t *p, u32_t len)
+{
+    while (len > 0 && ((mem_ptr_t)p & 7) != 0) {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        u32_t lo = crc ^ ((u32_t)p[0] | ((u32_t)p[1] << 8) | ((u32_t)p[2] << 16) | ((u32_t)p[3] << 24));
+        u32_t hi = (u32_t)p[4] | ((u32_t)p[5] << 8) | ((u32_t)p[6] << 16) | ((u32_t)p[7] << 24);
+        crc = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^
+              crc_table[5][(lo >> 16) & 0xFF] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+              crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+    return crc;
+}
+
+#if defined (CRC32C_HW_ARM)
+static u32_t crc32c_hw(u32_t crc, const u8_t *p, u32_t len)
+{
+    while (len > 0 && ((mem_ptr_t)p & 7) != 0) {
+        crc = __crc32cb(crc, *p++);
+        len--;
+    }
+    while (len >= 8) {
+        u64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = __crc32cb(crc, *p++);
+        len--;
+    }
+    return crc;
+}
+#elif defined (CRC32C_HW_X86)
+__attribute__((target("sse4.2")))
+static u32_t crc32c_hw(u32_t crc, const u8_t *p, u32_t len)
+{
+    u64_t c = crc;
+
+    while (len > 0 && ((mem_ptr_t)p & 7) != 0) {
+        c = _mm_crc32_u8((u32_t)c, *p++);
+        len--;
+    }
+    while (len >= 8) {
+        u64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        c = _mm_crc32_u8((u32_t)c, *p++);
+        len--;
+    }
+    return (u32_t)c;
+}
+#endif
+
+u32_t crc32c_update(u32_t crc, const void *data, u32_t len)
+{
+    const u8_t *p = (const u8_t *)data;
+
+    if (!crc_ready) {
+        crc32c_init();
+    }
+    crc = ~crc;
+#if defined (CRC32C_HW_ARM)
+    crc = crc32c_hw(crc, p, len);
+#elif defined (CRC32C_HW_X86)
+    crc = crc_use_sse42 ? crc32c_hw(crc, p, len) : crc32c_sw(crc, p, len);
+#else
+    crc = crc32c_sw(crc, p, len);
+#endif
+    return ~crc;
+}
+
+const char *crc32c_impl(void)
+{
+    if (!crc_ready) {
+        crc32c_init();
+    }
+#if defined (CRC32C_HW_ARM)
+    return "armv8-crc";
+#elif defined (CRC32C_HW_X86)
+    return crc_use_sse42 ? "sse4.2" : "slicing-by-8";
+#else
+    return "slicing-by-8";
+#endif
+}
@@ -0,0 +1,20 @@
+/******************************************************************************
+* Streaming CRC32C (Castagnoli) for the verify mode digest
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* crc32c_update(0, data, len) gives the standard CRC32C of data; feed the
+* previous result back in to continue over the next chunk. Uses the ARMv8
+* CRC32C instructions or SSE4.2 on the host when available, slicing-by-8
+* tables otherwise (MicroBlaze, Cortex-A9).
+******************************************************************************/
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include "lwip/arch.h"
+
+void crc32c_init(void);
+u32_t crc32c_update(u32_t crc, const void *data, u32_t len);
+const char *crc32c_impl(void);
+
+#endif
@@ -0,0 +1,230 @@
+/******************************************************************************
+* DDR4 Region Allocator for concurrent image uploads
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* Boundary-tag allocator over one DDR4 region. Free extents sit in one list
+* per power of two, so allocation takes the head of the first larger bin and
+* only first-fit scans its own bin. Release merges with both address
+* neighbours and is O(1).
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "ddr4_arena.h"
+
+#if defined (__arm__) || defined (__aarch64__) || defined (HOST_BUILD)
+#include "xil_printf.h"
+#else
+#define xil_printf printf
+#endif
+
+static struct {
+    ddr4_extent_t desc[DDR4_ARENA_MAX_EXTENTS];
+    ddr4_extent_t *spare;                    // Unused descriptors
+    ddr4_extent_t *bins[DDR4_ARENA_BINS];    // Free extents by floor(log2(size))
+    u32_t bin_mask;                          // Bit b set when bins[b] is non-empty
+    mem_ptr_t base;
+    u32_t size;
+    u32_t used;
+    u32_t peak_used;
+    u32_t free_extents;
+    u32_t live_extents;
+    u32_t alloc_failures;
+} arena;
+
+static u8_t size_to_bin(u32_t size) {
+    return (u8_t)(31 - __builtin_clz(size));
+}
+
+static void bin_insert(ddr4_extent_t *ext) {
+    u8_t bin = size_to_bin(ext->size);
+
+    ext->bin = bin;
+    ext->free_prev = NULL;
+    ext->free_next = arena.bins[bin];
+    if (arena.bins[bin]) {
+        arena.bins[bin]->free_prev = ext;
+    }
+    arena.bins[bin] = ext;
+    arena.bin_mask |= (1u << bin);
+    arena.free_extents++;
+}
+
+static void bin_remove(ddr4_extent_t *ext) {
+    if (ext->free_prev) {
+        ext->free_prev->free_next = ext->free_next;
+    } else {
+        arena.bins[ext->bin] = ext->free_next;
+    }
+    if (ext->free_next) {
+        ext->free_next->free_prev = ext->free_prev;
+    }
+    if (!arena.bins[ext->bin]) {
+        arena.bin_mask &= ~(1u << ext->bin);
+    }
+    arena.free_extents--;
+}
+
+static ddr4_extent_t *desc_get(void) {
+    ddr4_extent_t *ext = arena.spare;
+    if (ext) {
+        arena.spare = ext->free_next;
+        memset(ext, 0, sizeof(ddr4_extent_t));
+    }
+    return ext;
+}
+
+static void desc_put(ddr4_extent_t *ext) {
+    ext->free_next = arena.spare;
+    arena.spare = ext;
+}
+
+void ddr4_arena_init(mem_ptr_t base, u32_t size) {
+    ddr4_extent_t *ext;
+    int i;
+
+    memset(&arena, 0, sizeof(arena));
+    for (i = DDR4_ARENA_MAX_EXTENTS - 1; i >= 0; i--) {
+        desc_put(&arena.desc[i]);
+    }
+
+    arena.base = base;
+    arena.size = size - (size % DDR4_ARENA_ALIGN);
+
+    ext = desc_get();
+    ext->addr = base;
+    ext->size = arena.size;
+    bin_insert(ext);
+}
+
+ddr4_extent_t *ddr4_arena_alloc(u32_t size) {
+    ddr4_extent_t *ext = NULL;
+    u32_t higher;
+    u8_t bin;
+
+    if (size == 0 || size > arena.size) {
+        arena.alloc_failures++;
+        return NULL;
+    }
+    size = (size + DDR4_ARENA_ALIGN - 1) & ~(u32_t)(DDR4_ARENA_ALIGN - 1);
+    bin = size_to_bin(size);
+
+    // Any extent in a higher bin is big enough: take the head of the lowest one
+    higher = (bin < 31) ? (arena.bin_mask & ~((2u << bin) - 1)) : 0;
+    if (higher) {
+        ext = arena.bins[__builtin_ctz(higher)];
+    } else {
+        // Same bin holds sizes in [2^bin, 2^(bin+1)), first fit
+        for (ext = arena.bins[bin]; ext && ext->size < size; ext = ext->free_next) {
+        }
+    }
+
+    if (!ext) {
+        arena.alloc_failures++;
+        return NULL;
+    }
+
+    bin_remove(ext);
+
+    // Split off the tail if a descriptor is available for it
+    if (ext->size > size) {
+        ddr4_extent_t *rest = desc_get();
+        if (rest) {
+            rest->addr = ext->addr + size;
+            rest->size = ext->size - size;
+            rest->phys_prev = ext;
+            rest->phys_next = ext->phys_next;
+            if (ext->phys_next) {
+                ext->phys_next->phys_prev = rest;
+            }
+            ext->phys_next = rest;
+            ext->size = size;
+            bin_insert(rest);
+        }
+    }
+
+    ext->in_use = 1;
+    arena.used += ext->size;
+    arena.live_extents++;
+    if (arena.used > arena.peak_used) {
+        arena.peak_used = arena.used;
+    }
+    return ext;
+}
+
+void ddr4_arena_free(ddr4_extent_t *ext) {
+    ddr4_extent_t *nb;
+
+    if (!ext || !ext->in_use) {
+        return;
+    }
+
+    ext->in_use = 0;
+    arena.used -= ext->size;
+    arena.live_extents--;
+
+    // Absorb the following extent
+    nb = ext->phys_next;
+    if (nb && !nb->in_use) {
+        bin_remove(nb);
+        ext->size += nb->size;
+        ext->phys_next = nb->phys_next;
+        if (nb->phys_next) {
+            nb->phys_next->phys_prev = ext;
+        }
+        desc_put(nb);
+    }
+
+    // Fold into the preceding extent
+    nb = ext->phys_prev;
+    if (nb && !nb->in_use) {
+        bin_remove(nb);
+        nb->size += ext->size;
+        nb->phys_next = ext->phys_next;
+        if (ext->phys_next) {
+            ext->phys_next->phys_prev = nb;
+        }
+        desc_put(ext);
+        ext = nb;
+    }
+
+    bin_insert(ext);
+}
+
+void ddr4_arena_get_stats(ddr4_arena_stats_t *stats) {
+    ddr4_extent_t *ext;
+
+    memset(stats, 0, sizeof(ddr4_arena_stats_t));
+    stats->total_bytes = arena.size;
+    stats->used_bytes = arena.used;
+    stats->peak_used_bytes = arena.peak_used;
+    stats->free_bytes = arena.size - arena.used;
+    stats->free_extents = arena.free_extents;
+    stats->live_extents = arena.live_extents;
+    stats->alloc_failures = arena.alloc_failures;
+
+    // The largest free extent is in the highest non-empty bin
+    if (arena.bin_mask) {
+        for (ext = arena.bins[31 - __builtin_clz(arena.bin_mask)]; ext; ext = ext->free_next) {
+            if (ext->size > stats->largest_free) {
+                stats->largest_free = ext->size;
+            }
+        }
+    }
+    if (stats->free_bytes > 0) {
+        stats->fragmentation_pm = 1000 - (u32_t)(((u64_t)stats->largest_free * 1000) / stats->free_bytes);
+    }
+}
+
+void ddr4_arena_report(void) {
+    ddr4_arena_stats_t stats;
+
+    ddr4_arena_get_stats(&stats);
+    xil_printf("DDR4 arena: used %lu/%lu KB (peak %lu KB), %lu live, %lu free extents\n\r",
+               (unsigned long)(stats.used_bytes / 1024), (unsigned long)(stats.total_bytes / 1024),
+               (unsigned long)(stats.peak_used_bytes / 1024),
+               (unsigned long)stats.live_extents, (unsigned long)stats.free_extents);
+    xil_printf("DDR4 arena: largest free %lu KB, fragmentation %lu/1000, %lu failed allocs\n\r",
+               (unsigned long)(stats.largest_free / 1024), (unsigned long)stats.fragmentation_pm,
+               (unsigned long)stats.alloc_failures);
+}
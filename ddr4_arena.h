@@ -0,0 +1,48 @@
+/******************************************************************************
+* DDR4 Region Allocator for concurrent image uploads
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#ifndef DDR4_ARENA_H
+#define DDR4_ARENA_H
+
+#include "lwip/arch.h"
+
+#define DDR4_ARENA_BASE 0x90000000                 // Start of the upload region
+#define DDR4_ARENA_SIZE (1536u * 1024 * 1024)      // 1.5GB, leaves the low 256MB for code/heap
+#define DDR4_ARENA_ALIGN (64 * 1024)               // Extents are 64KB aligned and sized
+#define DDR4_ARENA_MAX_EXTENTS 64                  // Descriptor table size (live + free extents)
+#define DDR4_ARENA_BINS 32                         // One free list per power of two
+
+// Extent descriptors live in a static table, never inside DDR4 itself,
+// so a stored image can use its whole extent.
+typedef struct ddr4_extent {
+    mem_ptr_t addr;                 // DDR4 start address
+    u32_t size;                     // Extent size (multiple of DDR4_ARENA_ALIGN)
+    u8_t in_use;                    // 1 = owned by a connection
+    u8_t bin;                       // Free list index while free
+    struct ddr4_extent *phys_prev;  // Address-ordered neighbours, used for coalescing
+    struct ddr4_extent *phys_next;
+    struct ddr4_extent *free_prev;  // Free list links (spare list when descriptor is unused)
+    struct ddr4_extent *free_next;
+} ddr4_extent_t;
+
+typedef struct {
+    u32_t total_bytes;
+    u32_t used_bytes;
+    u32_t peak_used_bytes;
+    u32_t free_bytes;
+    u32_t largest_free;
+    u32_t free_extents;
+    u32_t live_extents;
+    u32_t alloc_failures;
+    u32_t fragmentation_pm;         // 1000 * (1 - largest_free / free_bytes)
+} ddr4_arena_stats_t;
+
+void ddr4_arena_init(mem_ptr_t base, u32_t size);
+ddr4_extent_t *ddr4_arena_alloc(u32_t size);
+void ddr4_arena_free(ddr4_extent_t *ext);
+void ddr4_arena_get_stats(ddr4_arena_stats_t *stats);
+void ddr4_arena_report(void);
+
+#endif
@@ -0,0 +1,106 @@
+/******************************************************************************
+* Host-side churn benchmark for the DDR4 region allocator
+*
+* Build on a Linux workstation (no DDR4 access needed, the arena only
+* tracks addresses):
+*   gcc -O2 -I$LWIP_DIR/src/include -I$LWIP_DIR/contrib/ports/unix/port/include \
+*       -I. ddr4_arena.c ddr4_arena_bench.c -o ddr4_arena_bench
+*   ./ddr4_arena_bench [cycles] [max_live]
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "ddr4_arena.h"
+
+#define DEFAULT_CYCLES 100000
+#define DEFAULT_MAX_LIVE 16
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Mix of thumbnail, image and video sized uploads
+static u32_t random_upload_size(void) {
+    switch (rand() % 4) {
+    case 0:  return 1024 + rand() % (256 * 1024);
+    case 1:  return 256 * 1024 + rand() % (8 * 1024 * 1024);
+    case 2:  return 8 * 1024 * 1024 + rand() % (64 * 1024 * 1024);
+    default: return 64 * 1024 * 1024 + rand() % (256 * 1024 * 1024);
+    }
+}
+
+int main(int argc, char **argv) {
+    int cycles = (argc > 1) ? atoi(argv[1]) : DEFAULT_CYCLES;
+    int max_live = (argc > 2) ? atoi(argv[2]) : DEFAULT_MAX_LIVE;
+    ddr4_extent_t *live[DDR4_ARENA_MAX_EXTENTS];
+    ddr4_arena_stats_t stats;
+    double alloc_ns = 0, free_ns = 0, t0;
+    unsigned long allocs = 0, frees = 0, fails = 0;
+    u64_t frag_sum = 0, occ_sum = 0;
+    int n_live = 0;
+    int i;
+
+    if (max_live > DDR4_ARENA_MAX_EXTENTS / 2) {
+        max_live = DDR4_ARENA_MAX_EXTENTS / 2;
+    }
+
+    srand(1);
+    ddr4_arena_init(DDR4_ARENA_BASE, DDR4_ARENA_SIZE);
+
+    for (i = 0; i < cycles; i++) {
+        // Grow while below target occupancy, otherwise release a random upload
+        if (n_live < max_live && (n_live == 0 || rand() % 2)) {
+            u32_t size = random_upload_size();
+            ddr4_extent_t *ext;
+
+            t0 = now_ns();
+            ext = ddr4_arena_alloc(size);
+            alloc_ns += now_ns() - t0;
+            allocs++;
+
+            if (ext) {
+                live[n_live++] = ext;
+            } else {
+                fails++;
+            }
+        } else {
+            int victim = rand() % n_live;
+
+            t0 = now_ns();
+            ddr4_arena_free(live[victim]);
+            free_ns += now_ns() - t0;
+            frees++;
+
+            live[victim] = live[--n_live];
+        }
+
+        ddr4_arena_get_stats(&stats);
+        frag_sum += stats.fragmentation_pm;
+        occ_sum += ((u64_t)stats.used_bytes * 1000) / stats.total_bytes;
+    }
+
+    ddr4_arena_report();
+
+    while (n_live > 0) {
+        ddr4_arena_free(live[--n_live]);
+    }
+    ddr4_arena_get_stats(&stats);
+
+    printf("cycles %d, max live %d\n", cycles, max_live);
+    printf("alloc: %lu calls, %lu failed, %.1f ns avg\n", allocs, fails, allocs ? alloc_ns / allocs : 0.0);
+    printf("free:  %lu calls, %.1f ns avg\n", frees, frees ? free_ns / frees : 0.0);
+    printf("avg occupancy %.1f%%, avg fragmentation %.1f%%\n",
+           occ_sum / (10.0 * cycles), frag_sum / (10.0 * cycles));
+
+    // After releasing everything the region must have coalesced back into one extent
+    if (stats.free_extents != 1 || stats.largest_free != stats.total_bytes) {
+        printf("FAIL: %u free extents, largest %u of %u bytes\n",
+               stats.free_extents, stats.largest_free, stats.total_bytes);
+        return 1;
+    }
+    printf("coalescing OK\n");
+    return 0;
+}
@@ -0,0 +1,104 @@
+/******************************************************************************
+* Batched D-cache maintenance for the DDR4 ingest path
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <stdio.h>
+#include "ddr4_cache.h"
+#include "ddr4_copy.h"
+#include "xil_printf.h"
+#include "xil_cache.h"
+
+#if DDR4_CACHE_UNCACHED && (defined (__arm__) || defined (__aarch64__))
+#include "xil_mmu.h"
+#if defined (__aarch64__)
+#define DDR4_CACHE_MMU_BLOCK 0x200000
+#else
+#define DDR4_CACHE_MMU_BLOCK 0x100000
+#endif
+#endif
+
+ddr4_cache_stats_t ddr4_cache_stats;
+
+// Map the storage region non-cacheable when built for it, otherwise nothing to do
+void ddr4_cache_region_init(UINTPTR base, u32_t size) {
+#if DDR4_CACHE_UNCACHED && (defined (__arm__) || defined (__aarch64__))
+    UINTPTR addr;
+
+    for (addr = base; addr < base + size; addr += DDR4_CACHE_MMU_BLOCK) {
+        Xil_SetTlbAttributes(addr, NORM_NONCACHE);
+    }
+#else
+    LWIP_UNUSED_ARG(base);
+    LWIP_UNUSED_ARG(size);
+#endif
+}
+
+void ddr4_cache_init(ddr4_cache_t *cache, u32_t threshold) {
+    cache->start = 0;
+    cache->end = 0;
+    cache->threshold = threshold;
+}
+
+void ddr4_cache_flush(ddr4_cache_t *cache) {
+#if !DDR4_CACHE_UNCACHED
+    UINTPTR start, end;
+#endif
+
+    // Streaming copies into the span must land before anyone reads it
+    ddr4_copy_fence();
+#if !DDR4_CACHE_UNCACHED
+    if (cache->end == cache->start) {
+        return;
+    }
+
+    start = cache->start & ~(UINTPTR)(DDR4_CACHE_LINE - 1);
+    end = (cache->end + DDR4_CACHE_LINE - 1) & ~(UINTPTR)(DDR4_CACHE_LINE - 1);
+    Xil_DCacheFlushRange(start, (u32)(end - start));
+
+    ddr4_cache_stats.flush_ops++;
+    ddr4_cache_stats.flushed_bytes += (u32_t)(end - start);
+#endif
+    cache->start = 0;
+    cache->end = 0;
+}
+
+void ddr4_cache_dirty(ddr4_cache_t *cache, UINTPTR addr, u32_t len) {
+    ddr4_cache_stats.dirty_calls++;
+    ddr4_cache_stats.dirty_bytes += len;
+
+#if !DDR4_CACHE_UNCACHED
+    if (len == 0) {
+        return;
+    }
+
+    // Extend the pending span when the new range touches it, else start over
+    if (cache->end != cache->start && (addr > cache->end || addr + len < cache->start)) {
+        ddr4_cache_flush(cache);
+    }
+    if (cache->end == cache->start) {
+        cache->start = addr;
+        cache->end = addr + len;
+    } else {
+        if (addr < cache->start) {
+            cache->start = addr;
+        }
+        if (addr + len > cache->end) {
+            cache->end = addr + len;
+        }
+    }
+
+    if (cache->end - cache->start >= cache->threshold) {
+        ddr4_cache_flush(cache);
+    }
+#else
+    LWIP_UNUSED_ARG(cache);
+    LWIP_UNUSED_ARG(addr);
+#endif
+}
+
+void ddr4_cache_report(void) {
+    xil_printf("DCache: %lu ranges (%lu bytes) dirtied, %lu flushes covering %lu bytes\n\r",
+               (unsigned long)ddr4_cache_stats.dirty_calls, (unsigned long)ddr4_cache_stats.dirty_bytes,
+               (unsigned long)ddr4_cache_stats.flush_ops, (unsigned long)ddr4_cache_stats.flushed_bytes);
+}
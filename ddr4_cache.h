@@ -0,0 +1,51 @@
+/******************************************************************************
+* Batched D-cache maintenance for the DDR4 ingest path
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* Instead of one Xil_DCacheFlushRange per pbuf, writers mark ranges dirty and
+* the layer coalesces contiguous ones into one cache-line aligned span. The
+* span is flushed when it reaches the threshold, when a non-contiguous write
+* arrives, or when the caller ends a batch / frame with ddr4_cache_flush().
+*
+* Anything the EMAC DMA will read (zero-copy echo) must be flushed before it
+* is handed to tcp_write. The flush also fences ddr4_copy()'s streaming stores.
+******************************************************************************/
+
+#ifndef DDR4_CACHE_H
+#define DDR4_CACHE_H
+
+#include "lwip/arch.h"
+#include "xil_types.h"
+
+#define DDR4_CACHE_LINE 64                      // Covers 32-byte A9/MicroBlaze lines too
+#define DDR4_CACHE_DEFAULT_THRESHOLD (256 * 1024)
+
+// Build with DDR4_CACHE_UNCACHED=1 when the storage region is mapped
+// non-cacheable (ARM: set here via the MMU; MicroBlaze: keep DDR4 outside the
+// cacheable range in the hardware design). Flushes then compile to nothing.
+#ifndef DDR4_CACHE_UNCACHED
+#define DDR4_CACHE_UNCACHED 0
+#endif
+
+typedef struct {
+    UINTPTR start;          // Pending dirty span [start, end)
+    UINTPTR end;
+    u32_t threshold;        // Flush once the span grows past this many bytes
+} ddr4_cache_t;
+
+typedef struct {
+    u32_t dirty_calls;      // Ranges marked dirty (= flushes the old per-pbuf code did)
+    u32_t dirty_bytes;
+    u32_t flush_ops;        // Xil_DCacheFlushRange calls actually made
+    u32_t flushed_bytes;    // Bytes covered by those calls (line aligned)
+} ddr4_cache_stats_t;
+
+extern ddr4_cache_stats_t ddr4_cache_stats;
+
+void ddr4_cache_region_init(UINTPTR base, u32_t size);
+void ddr4_cache_init(ddr4_cache_t *cache, u32_t threshold);
+void ddr4_cache_dirty(ddr4_cache_t *cache, UINTPTR addr, u32_t len);
+void ddr4_cache_flush(ddr4_cache_t *cache);
+void ddr4_cache_report(void);
+
+#endif
@@ -0,0 +1,275 @@
+/******************************************************************************
+* Copy kernels for the pbuf -> DDR4 store
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <string.h>
+#include "ddr4_copy.h"
+
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define DDR4_COPY_HAVE_NEON 1
+#if defined (__aarch64__)
+#define DDR4_COPY_HAVE_NEON_NT 1
+#endif
+#elif defined (__x86_64__) && defined (__GNUC__)
+#include <immintrin.h>
+#define DDR4_COPY_HAVE_X86 1
+#endif
+
+#define COPY_LINE 64
+
+typedef void (*copy_kernel_fn)(u8_t *d, const u8_t *s, u32_t len);
+
+static ddr4_copy_kernel_t active = DDR4_COPY_MEMCPY;
+static u8_t copy_ready;
+#if defined (DDR4_COPY_HAVE_X86)
+static u8_t copy_has_avx2;
+#endif
+
+// Bytes to copy with memcpy before d is on a cache line boundary
+static u32_t copy_head(const u8_t *d, u32_t len)
+{
+    u32_t head = (u32_t)(-(mem_ptr_t)d & (COPY_LINE - 1));
+    return head < len ? head : len;
+}
+
+static void copy_memcpy(u8_t *d, const u8_t *s, u32_t len)
+{
+    memcpy(d, s, len);
+}
+
+#if defined (DDR4_COPY_HAVE_NEON)
+static void copy_neon(u8_t *d, const u8_t *s, u32_t len)
+{
+    u32_t head = copy_head(d, len);
+
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    len -= head;
+    while (len >= COPY_LINE) {
+        uint8x16_t a = vld1q_u8(s);
+        uint8x16_t b = vld1q_u8(s + 16);
+        uint8x16_t c = vld1q_u8(s + 32);
+        uint8x16_t e = vld1q_u8(s + 48);
+        __builtin_prefetch(s + 4 * COPY_LINE);
+        vst1q_u8(d, a);
+        vst1q_u8(d + 16, b);
+        vst1q_u8(d + 32, c);
+        vst1q_u8(d + 48, e);
+        d += COPY_LINE;
+        s += COPY_LINE;
+        len -= COPY_LINE;
+    }
+    memcpy(d, s, len);
+}
+#endif
+
+#if defined (DDR4_COPY_HAVE_NEON_NT)
+static void copy_neon_nt(u8_t *d, const u8_t *s, u32_t len)
+{
+    u32_t head = copy_head(d, len);
+
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    len -= head;
+    while (len >= COPY_LINE) {
+        __asm__ volatile(
+            "ldp q0, q1, [%1]\n\t"
+            "ldp q2, q3, [%1, #32]\n\t"
+            "stnp q0, q1, [%0]\n\t"
+            "stnp q2, q3, [%0, #32]\n\t"
+            : : "r" (d), "r" (s) : "v0", "v1", "v2", "v3", "memory");
+        d += COPY_LINE;
+        s += COPY_LINE;
+        len -= COPY_LINE;
+    }
+    memcpy(d, s, len);
+}
+#endif
+
+#if defined (DDR4_COPY_HAVE_X86)
+__attribute__((target("sse2")))
+static void copy_sse2_nt(u8_t *d, const u8_t *s, u32_t len)
+{
+    u32_t head = copy_head(d, len);
+
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    len -= head;
+    while (len >= COPY_LINE) {
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_stream_si128((__m128i *)d, a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+        d += COPY_LINE;
+        s += COPY_LINE;
+        len -= COPY_LINE;
+    }
+    memcpy(d, s, len);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2_nt(u8_t *d, const u8_t *s, u32_t len)
+{
+    u32_t head = copy_head(d, len);
+
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    len -= head;
+    while (len >= 2 * COPY_LINE) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)s);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(s + 64));
+        __m256i e = _mm256_loadu_si256((const __m256i *)(s + 96));
+        _mm256_stream_si256((__m256i *)d, a);
+        _mm256_stream_si256((__m256i *)(d + 32), b);
+        _mm256_stream_si256((__m256i *)(d + 64), c);
+        _mm256_stream_si256((__m256i *)(d + 96), e);
+        d += 2 * COPY_LINE;
+        s += 2 * COPY_LINE;
+        len -= 2 * COPY_LINE;
+    }
+    if (len >= COPY_LINE) {
+        _mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+        _mm256_stream_si256((__m256i *)(d + 32), _mm256_loadu_si256((const __m256i *)(s + 32)));
+        d += COPY_LINE;
+        s += COPY_LINE;
+        len -= COPY_LINE;
+    }
+    memcpy(d, s, len);
+}
+#endif
+
+static const struct {
+    const char *name;
+    copy_kernel_fn fn;
+} kernels[DDR4_COPY_KERNELS] = {
+    { "memcpy", copy_memcpy },
+#if defined (DDR4_COPY_HAVE_NEON)
+    { "neon", copy_neon },
+#else
+    { "neon", NULL },
+#endif
+#if defined (DDR4_COPY_HAVE_NEON_NT)
+    { "neon-nt", copy_neon_nt },
+#else
+    { "neon-nt", NULL },
+#endif
+#if defined (DDR4_COPY_HAVE_X86)
+    { "sse2-nt", copy_sse2_nt },
+    { "avx2-nt", copy_avx2_nt },
+#else
+    { "sse2-nt", NULL },
+    { "avx2-nt", NULL },
+#endif
+};
+
+int ddr4_copy_available(ddr4_copy_kernel_t kernel)
+{
+    if (!copy_ready) {
+        ddr4_copy_init();
+    }
+    if ((u32_t)kernel >= DDR4_COPY_KERNELS || kernels[kernel].fn == NULL) {
+        return 0;
+    }
+#if defined (DDR4_COPY_HAVE_X86)
+    if (kernel == DDR4_COPY_AVX2_NT && !copy_has_avx2) {
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+void ddr4_copy_init(void)
+{
+#if defined (DDR4_COPY_HAVE_X86)
+    __builtin_cpu_init();
+    copy_has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+    copy_ready = 1;
+
+#if defined (DDR4_COPY_KERNEL)
+    active = ddr4_copy_available(DDR4_COPY_KERNEL) ? DDR4_COPY_KERNEL : DDR4_COPY_MEMCPY;
+#else
+    // Preference order: widest non-temporal kernel the CPU runs
+    if (ddr4_copy_available(DDR4_COPY_AVX2_NT)) {
+        active = DDR4_COPY_AVX2_NT;
+    } else if (ddr4_copy_available(DDR4_COPY_SSE2_NT)) {
+        active = DDR4_COPY_SSE2_NT;
+    } else if (ddr4_copy_available(DDR4_COPY_NEON_NT)) {
+        active = DDR4_COPY_NEON_NT;
+    } else if (ddr4_copy_available(DDR4_COPY_NEON)) {
+        active = DDR4_COPY_NEON;
+    } else {
+        active = DDR4_COPY_MEMCPY;
+    }
+#endif
+}
+
+int ddr4_copy_select(ddr4_copy_kernel_t kernel)
+{
+    if (!ddr4_copy_available(kernel)) {
+        return -1;
+    }
+    active = kernel;
+    return 0;
+}
+
+void ddr4_copy(void *dst, const void *src, u32_t len)
+{
+    if (!copy_ready) {
+        ddr4_copy_init();
+    }
+    if (len < DDR4_COPY_MIN) {
+        memcpy(dst, src, len);
+        return;
+    }
+    kernels[active].fn((u8_t *)dst, (const u8_t *)src, len);
+}
+
+// Kernel for a batch of pieces totalling total bytes, fenced once at the end
+ddr4_copy_kernel_t ddr4_copy_pick(u32_t total)
+{
+    if (!copy_ready) {
+        ddr4_copy_init();
+    }
+    return total < DDR4_COPY_MIN ? DDR4_COPY_MEMCPY : active;
+}
+
+void ddr4_copy_with(ddr4_copy_kernel_t kernel, void *dst, const void *src, u32_t len)
+{
+    kernels[kernel].fn((u8_t *)dst, (const u8_t *)src, len);
+}
+
+// The kernels leave this to the caller: one fence per batch, since a fence
+// per pbuf costs more than the streaming stores save on short copies
+void ddr4_copy_fence(void)
+{
+#if defined (DDR4_COPY_HAVE_NEON_NT)
+    __asm__ volatile("dmb ishst" : : : "memory");
+#elif defined (DDR4_COPY_HAVE_X86)
+    _mm_sfence();
+#endif
+}
+
+const char *ddr4_copy_name(ddr4_copy_kernel_t kernel)
+{
+    return (u32_t)kernel < DDR4_COPY_KERNELS ? kernels[kernel].name : "?";
+}
+
+const char *ddr4_copy_impl(void)
+{
+    if (!copy_ready) {
+        ddr4_copy_init();
+    }
+    return kernels[active].name;
+}
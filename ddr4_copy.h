@@ -0,0 +1,67 @@
+/******************************************************************************
+* Copy kernels for the pbuf -> DDR4 store
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* Ingested payload is never read back by the CPU (the EMAC DMA reads it for
+* the echo), so the wide kernels use non-temporal stores where the ISA has
+* them: the destination lines are not pulled into the small L1/L2, the
+* stack's own working set is not evicted, and the Xil_DCacheFlushRange that
+* follows finds little or nothing dirty to write back.
+*
+*   avx2-nt, sse2-nt   host, VMOVNTDQ / MOVNTDQ with unaligned loads
+*   neon-nt            AArch64 (A53), LDP + STNP, 64 bytes per step
+*   neon               ARMv7 / AArch64, VLD1 / VST1 with prefetch. The A9
+*                      has no non-temporal store; its write streaming mode
+*                      already skips allocation for full-line stores.
+*   memcpy             MicroBlaze, and copies below DDR4_COPY_MIN
+*
+* The head up to the next destination cache line and the tail are copied
+* with memcpy, so any pbuf payload offset works. ddr4_copy_init() picks the
+* fastest kernel the CPU has; -DDDR4_COPY_KERNEL=DDR4_COPY_<name> fixes it at
+* compile time instead.
+*
+* Streaming stores are weakly ordered. ddr4_copy_fence() must run before
+* the data is handed to the EMAC or another core; ddr4_cache_flush() does
+* it, so callers that already flush need nothing more.
+******************************************************************************/
+
+#ifndef DDR4_COPY_H
+#define DDR4_COPY_H
+
+#include "lwip/arch.h"
+
+// Shorter copies go straight to memcpy: below this the head/tail handling
+// and the caller's fence cost more than the streaming stores save. SFENCE
+// waits for the write-combining buffers to drain (~200ns per flush on the
+// host, see ddr4_copy_bench), so x86 only streams whole batches.
+#ifndef DDR4_COPY_MIN
+#if defined (__x86_64__)
+#define DDR4_COPY_MIN 4096
+#else
+#define DDR4_COPY_MIN 256
+#endif
+#endif
+
+typedef enum {
+    DDR4_COPY_MEMCPY = 0,
+    DDR4_COPY_NEON,
+    DDR4_COPY_NEON_NT,
+    DDR4_COPY_SSE2_NT,
+    DDR4_COPY_AVX2_NT,
+    DDR4_COPY_KERNELS
+} ddr4_copy_kernel_t;
+
+void ddr4_copy_init(void);
+void ddr4_copy(void *dst, const void *src, u32_t len);
+void ddr4_copy_fence(void);
+ddr4_copy_kernel_t ddr4_copy_pick(u32_t total);
+
+// Run one kernel regardless of the startup choice: batches (ddr4_copy_pick)
+// and benchmarks
+int ddr4_copy_available(ddr4_copy_kernel_t kernel);
+int ddr4_copy_select(ddr4_copy_kernel_t kernel);
+void ddr4_copy_with(ddr4_copy_kernel_t kernel, void *dst, const void *src, u32_t len);
+const char *ddr4_copy_name(ddr4_copy_kernel_t kernel);
+const char *ddr4_copy_impl(void);
+
+#endif
@@ -0,0 +1,155 @@
+/******************************************************************************
+* Host-side microbenchmark for the DDR4 copy kernels
+*
+* Streams pbuf-sized payloads (64 B to 64 KB, plus one full TCP segment)
+* into a 256MB window of emulated DDR4, the way the ingest path walks an
+* upload extent, once per kernel the CPU supports. The source sits two bytes
+* off alignment like a pbuf payload behind the 14-byte Ethernet header.
+* Three runs per cell: fenced once per 64KB (a batch flush), fenced after
+* every copy (a flush per pbuf), and fenced per copy with a small "stack"
+* working set read back between copies, standing in for the PCBs and pbuf
+* pool the next packet needs; kernels that pollute the cache pay for it
+* there. Built by the host CMake build:
+*   ./build/ddr4_copy_bench [MB per size]
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host/host_platform.h"
+#include "ddr4_copy.h"
+
+#define DEFAULT_MB 256
+#define BENCH_DDR4_BASE 0x90000000
+#define BENCH_DDR4_SIZE (256 * 1024 * 1024)    // Copies wrap inside this window
+#define BENCH_SRC_OFFSET 2                     // pbuf payload alignment
+#define BENCH_HOT_SIZE (128 * 1024)            // Stack state touched per packet
+#define BENCH_HOT_STRIDE 64
+#define BENCH_BATCH (64 * 1024)                // Bytes between fences when batched
+
+static u8_t src_buf[64 * 1024 + 64];
+static u8_t hot_buf[BENCH_HOT_SIZE];
+static volatile u32_t hot_sink;
+
+static const u32_t sizes[] = {
+    64, 128, 256, 512, 1024, 1446, 2048, 4096, 8192, 16384, 32768, 65536
+};
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Read one line in every BENCH_HOT_STRIDE of the working set
+static void touch_hot(u32_t lines) {
+    u32_t i, sum = 0;
+
+    for (i = 0; i < lines; i++) {
+        sum += hot_buf[(i * BENCH_HOT_STRIDE) % BENCH_HOT_SIZE];
+    }
+    hot_sink += sum;
+}
+
+// Every length 0..300 at every destination offset in a line
+static int self_check(ddr4_copy_kernel_t kernel) {
+    u8_t *dst = (u8_t *)BENCH_DDR4_BASE;
+    u32_t len, off;
+
+    for (len = 0; len <= 300; len++) {
+        for (off = 0; off < 64; off++) {
+            memset(dst, 0xEE, 512);
+            ddr4_copy_with(kernel, dst + off, src_buf + BENCH_SRC_OFFSET, len);
+            if (memcmp(dst + off, src_buf + BENCH_SRC_OFFSET, len) != 0 ||
+                dst[off + len] != 0xEE || (off > 0 && dst[off - 1] != 0xEE)) {
+                printf("FAIL: %s len %u dst offset %u\n", ddr4_copy_name(kernel), len, off);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// MB/s for a stream of copies of one size
+static double run(ddr4_copy_kernel_t kernel, u32_t size, u64_t total, int batched, u32_t hot_lines) {
+    const u8_t *src = src_buf + BENCH_SRC_OFFSET;
+    mem_ptr_t offset = 0;
+    u64_t done = 0;
+    u32_t unfenced = 0;
+    double t0 = now_ns();
+
+    while (done < total) {
+        if (offset + size > BENCH_DDR4_SIZE) {
+            offset = 0;
+        }
+        ddr4_copy_with(kernel, (void *)(BENCH_DDR4_BASE + offset), src, size);
+        unfenced += size;
+        if (!batched || unfenced >= BENCH_BATCH) {
+            ddr4_copy_fence();
+            unfenced = 0;
+        }
+        if (hot_lines) {
+            touch_hot(hot_lines);
+        }
+        offset += size;
+        done += size;
+    }
+    ddr4_copy_fence();
+    if (memcmp((void *)(BENCH_DDR4_BASE + offset - size), src, size) != 0) {
+        printf("FAIL: %s %u-byte copy mismatch\n", ddr4_copy_name(kernel), size);
+        exit(1);
+    }
+    return (double)done / 1e6 / ((now_ns() - t0) / 1e9);
+}
+
+int main(int argc, char **argv) {
+    u64_t total = (u64_t)((argc > 1) ? atoi(argv[1]) : DEFAULT_MB) * 1024 * 1024;
+    u32_t i, k;
+
+    if (host_ddr4_init() != 0) {
+        return 1;
+    }
+    for (i = 0; i < sizeof(src_buf); i++) {
+        src_buf[i] = (u8_t)(i * 7 + 1);
+    }
+    memset(hot_buf, 1, sizeof(hot_buf));
+    // Touch the window once so page faults are not charged to any kernel
+    memset((void *)BENCH_DDR4_BASE, 0, BENCH_DDR4_SIZE);
+
+    ddr4_copy_init();
+    printf("Startup choice: %s (copies under %u bytes use memcpy)\n", ddr4_copy_impl(), DDR4_COPY_MIN);
+    for (k = 0; k < DDR4_COPY_KERNELS; k++) {
+        if (ddr4_copy_available((ddr4_copy_kernel_t)k) && self_check((ddr4_copy_kernel_t)k) != 0) {
+            return 1;
+        }
+    }
+
+    printf("MB/s: fence per 64KB / fence per copy / fence per copy + stack working set read\n");
+    printf("%8s", "size");
+    for (k = 0; k < DDR4_COPY_KERNELS; k++) {
+        if (ddr4_copy_available((ddr4_copy_kernel_t)k)) {
+            printf("  %23s", ddr4_copy_name((ddr4_copy_kernel_t)k));
+        }
+    }
+    printf("\n");
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        // One hot line read per line copied
+        u32_t hot_lines = (sizes[i] + 63) / 64;
+
+        printf("%8u", sizes[i]);
+        for (k = 0; k < DDR4_COPY_KERNELS; k++) {
+            if (ddr4_copy_available((ddr4_copy_kernel_t)k)) {
+                double batched = run((ddr4_copy_kernel_t)k, sizes[i], total, 1, 0);
+                double each = run((ddr4_copy_kernel_t)k, sizes[i], total, 0, 0);
+                double loaded = run((ddr4_copy_kernel_t)k, sizes[i], total, 0, hot_lines);
+                printf("  %5.0f / %5.0f / %5.0f", batched, each, loaded);
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,191 @@
+/******************************************************************************
+* Echo-from-DDR4 helper shared by the image echo servers
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <string.h>
+#include "ddr4_echo.h"
+#include "xil_printf.h"
+#include "trace_log.h"
+
+#if defined (__arm__) || defined (__aarch64__) || defined (HOST_BUILD)
+#include "xtime_l.h"
+#define ECHO_TIME_NOW(t) XTime_GetTime(&(t))
+#else
+#define ECHO_TIME_NOW(t) ((t) = 0)
+#endif
+
+void ddr4_echo_init(ddr4_echo_t *echo, UINTPTR base, u8_t mode)
+{
+    memset(echo, 0, sizeof(ddr4_echo_t));
+    echo->base = base;
+    echo->mode = mode;
+    rx_window_init(&echo->win, RX_WINDOW_UNLIMITED);
+    tx_batch_init(&echo->tx, TX_BATCH_DEFAULT_BYTES);
+}
+
+// Echo mode requested by the client in a v2 header, or the server default
+u8_t ddr4_echo_mode(const frame_header_t *hdr, u8_t default_mode)
+{
+    if (hdr->flags & FRAME_FLAG_ECHO_ZERO_COPY) {
+        return DDR4_ECHO_ZERO_COPY;
+    }
+    if (hdr->flags & FRAME_FLAG_ECHO_COPY) {
+        return DDR4_ECHO_COPY;
+    }
+    return default_mode;
+}
+
+// Queue the next len bytes of the stored object (starting at base + queued) for echo.
+// The data always comes from DDR4, never from the pbuf, so the pbuf can be freed right away.
+err_t ddr4_echo_write(ddr4_echo_t *echo, struct tcp_pcb *pcb, u16_t len)
+{
+    u8_t flags = (echo->mode == DDR4_ECHO_ZERO_COPY) ? 0 : TCP_WRITE_FLAG_COPY;
+    u64 t_start, t_end;
+    err_t err;
+
+    if (len == 0) {
+        return ERR_OK;
+    }
+
+    ECHO_TIME_NOW(t_start);
+    err = tx_batch_write(&echo->tx, pcb, (const void *)(echo->base + echo->queued), len, flags);
+    ECHO_TIME_NOW(t_end);
+
+    if (err == ERR_OK) {
+        echo->queued += len;
+        echo->write_ticks += t_end - t_start;
+        echo->write_calls++;
+        TRACE_DBG(TRACE_EV_ECHO, len, echo->queued);
+        if (echo->metrics) {
+            conn_metrics_on_write(echo->metrics, len);
+        }
+    }
+    return err;
+}
+
+// Record that DDR4 now holds stored bytes of the object
+void ddr4_echo_stored(ddr4_echo_t *echo, u32_t stored)
+{
+    echo->stored = stored;
+}
+
+// Write as much of the stored backlog as the send buffer takes, one write per
+// tcp_sndbuf() worth, and leave the output to the caller. On a full buffer
+// the cursor parks and sent_callback or poll_callback pumps again. Only
+// fatal tcp_write errors are returned.
+err_t ddr4_echo_fill(ddr4_echo_t *echo, struct tcp_pcb *pcb)
+{
+    err_t err = ERR_OK;
+    u32_t backlog;
+
+    echo->parked = 0;
+    while ((backlog = echo->stored - echo->queued) > 0) {
+        u16_t len = (u16_t)LWIP_MIN(LWIP_MIN(backlog, tcp_sndbuf(pcb)), 0xFFFF);
+
+        if (len == 0) {
+            echo->parked = 1;
+            break;
+        }
+
+        err = ddr4_echo_write(echo, pcb, len);
+        if (err == ERR_MEM) {
+            // Out of segments or pbufs: park until some data is ACK'd
+            echo->parked = 1;
+            echo->stalls++;
+            TRACE_INFO(TRACE_EV_ECHO_STALL, backlog, tcp_sndbuf(pcb));
+            if (echo->metrics) {
+                conn_metrics_on_stall(echo->metrics);
+            }
+            err = ERR_OK;
+            break;
+        }
+        if (err != ERR_OK) {
+            return err;
+        }
+    }
+
+    // Reopen the receive window only for bytes that are now on their way back
+    rx_window_update(&echo->win, pcb, echo->queued);
+    return ERR_OK;
+}
+
+// As ddr4_echo_fill(), leaving the output to tx_batch_run(): for completions
+// handled in the main loop
+err_t ddr4_echo_queue(ddr4_echo_t *echo, struct tcp_pcb *pcb)
+{
+    err_t err = ddr4_echo_fill(echo, pcb);
+
+    if (err != ERR_OK) {
+        return err;
+    }
+    tx_batch_defer(&echo->tx, pcb);
+    return ERR_OK;
+}
+
+// As ddr4_echo_fill(), flushing once at the end: for lwIP callbacks, where
+// lwIP sends right after the callback returns anyway
+err_t ddr4_echo_pump(ddr4_echo_t *echo, struct tcp_pcb *pcb)
+{
+    err_t err = ddr4_echo_fill(echo, pcb);
+
+    if (err != ERR_OK) {
+        return err;
+    }
+    tx_batch_flush(&echo->tx, pcb, 0);
+    return ERR_OK;
+}
+
+// Called from tcp_poll: pump a parked or unqueued backlog, then push
+// whatever a deferred batch or Nagle still holds
+err_t ddr4_echo_poll(ddr4_echo_t *echo, struct tcp_pcb *pcb)
+{
+    if (echo->parked || echo->stored != echo->queued) {
+        err_t err = ddr4_echo_fill(echo, pcb);
+
+        if (err != ERR_OK) {
+            return err;
+        }
+        echo->redrives++;
+    }
+    tx_batch_poll(&echo->tx, pcb);
+    return ERR_OK;
+}
+
+// Called from sent_callback: the ACK'd bytes are no longer referenced by lwIP
+void ddr4_echo_acked(ddr4_echo_t *echo, u16_t len)
+{
+    echo->acked += len;
+    TRACE_DBG(TRACE_EV_ACK, len, echo->acked);
+    if (echo->metrics) {
+        conn_metrics_on_ack(echo->metrics, len);
+    }
+}
+
+// Bytes that lwIP may still read from DDR4 (zero-copy) or still holds in its heap (copy)
+u32_t ddr4_echo_pinned(const ddr4_echo_t *echo)
+{
+    return echo->queued - echo->acked;
+}
+
+// Bytes stored but not yet echoed and ACK'd: work a stalled connection still owes
+u32_t ddr4_echo_pending(const ddr4_echo_t *echo)
+{
+    return echo->stored - echo->acked;
+}
+
+void ddr4_echo_report(const ddr4_echo_t *echo)
+{
+    u64 ticks_per_kb = 0;
+
+    if (echo->queued > 0) {
+        ticks_per_kb = (echo->write_ticks * 1024) / echo->queued;
+    }
+
+    xil_printf("Echo %s: %lu bytes in %lu tcp_write calls, %lu ticks/KB, %lu stalls, %lu re-driven by poll\n\r",
+               echo->mode == DDR4_ECHO_ZERO_COPY ? "zero-copy" : "copy",
+               (unsigned long)echo->queued, (unsigned long)echo->write_calls,
+               (unsigned long)ticks_per_kb, (unsigned long)echo->stalls,
+               (unsigned long)echo->redrives);
+    tx_batch_report(&echo->tx);
+}
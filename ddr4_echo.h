@@ -0,0 +1,65 @@
+/******************************************************************************
+* Echo-from-DDR4 helper shared by the image echo servers
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#ifndef DDR4_ECHO_H
+#define DDR4_ECHO_H
+
+#include "lwip/err.h"
+#include "lwip/tcp.h"
+#include "xil_types.h"
+#include "conn_metrics.h"
+#include "rx_window.h"
+#include "tx_batch.h"
+#include "frame_parser.h"
+
+// Copy mode: tcp_write(..., TCP_WRITE_FLAG_COPY) duplicates every byte into the lwIP heap.
+// Zero-copy mode: tcp_write(..., 0) queues PBUF_ROM segments that point straight at DDR4,
+// so the queued range must stay untouched until sent_callback reports it ACK'd.
+//
+// The cursor only moves forward: acked <= queued <= stored. Received bytes are
+// credited back through the rx_window controller only once they have been
+// queued for echo, so a sender that outruns the echo is slowed by the TCP
+// window instead of losing echoes. Servers bound it by the extent with
+// rx_window_limit(&echo->win, size).
+//
+// Writes go through a tx_batch_t: ddr4_echo_pump() flushes once at the end,
+// for callers in lwIP callbacks; ddr4_echo_queue() defers the flush to
+// tx_batch_run(), for completions handled in the main loop only, so a batch
+// is never left on the deferred list by a callback. ddr4_echo_fill() writes
+// and leaves the output to the caller. ddr4_echo_poll() is the tcp_poll
+// side: it restarts a backlog no ACK came back to pump.
+#define DDR4_ECHO_COPY      0
+#define DDR4_ECHO_ZERO_COPY 1
+
+typedef struct {
+    UINTPTR base;          // DDR4 address of the stored object
+    u32_t queued;          // Bytes handed to tcp_write (next echo offset)
+    u32_t acked;           // Bytes ACK'd by the client; [acked, queued) is pinned
+    u32_t stored;          // Bytes in DDR4 available for echo
+    rx_window_t win;       // Receive window credit, ready = queued
+    tx_batch_t tx;         // Coalesced output and segment counters
+    u32_t stalls;          // Times the echo parked on a full send buffer
+    u32_t redrives;        // Times tcp_poll found a backlog and pumped it
+    u8_t parked;           // 1 = waiting for sent/poll callback to resume
+    u8_t mode;             // DDR4_ECHO_COPY or DDR4_ECHO_ZERO_COPY
+    u64 write_ticks;       // Time spent inside tcp_write (cost measurement)
+    u32_t write_calls;     // Number of successful tcp_write calls
+    conn_metrics_t *metrics; // Optional, fed with writes, ACKs and stalls
+} ddr4_echo_t;
+
+void ddr4_echo_init(ddr4_echo_t *echo, UINTPTR base, u8_t mode);
+u8_t ddr4_echo_mode(const frame_header_t *hdr, u8_t default_mode);
+err_t ddr4_echo_write(ddr4_echo_t *echo, struct tcp_pcb *pcb, u16_t len);
+void ddr4_echo_stored(ddr4_echo_t *echo, u32_t stored);
+err_t ddr4_echo_fill(ddr4_echo_t *echo, struct tcp_pcb *pcb);
+err_t ddr4_echo_queue(ddr4_echo_t *echo, struct tcp_pcb *pcb);
+err_t ddr4_echo_pump(ddr4_echo_t *echo, struct tcp_pcb *pcb);
+err_t ddr4_echo_poll(ddr4_echo_t *echo, struct tcp_pcb *pcb);
+void ddr4_echo_acked(ddr4_echo_t *echo, u16_t len);
+u32_t ddr4_echo_pinned(const ddr4_echo_t *echo);
+u32_t ddr4_echo_pending(const ddr4_echo_t *echo);
+void ddr4_echo_report(const ddr4_echo_t *echo);
+
+#endif
@@ -0,0 +1,229 @@
+/******************************************************************************
+* One producer, many viewers: frames fanned out from a single DDR4 copy
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <string.h>
+#include "ddr4_fanout.h"
+#include "ddr4_copy.h"
+#include "xil_printf.h"
+#include "trace_log.h"
+
+err_t ddr4_fanout_init(ddr4_fanout_t *fo, u32_t slot_size, u8_t mode)
+{
+    u16_t i;
+
+    memset(fo, 0, sizeof(ddr4_fanout_t));
+    fo->extent = ddr4_arena_alloc(DDR4_FANOUT_SLOTS * slot_size);
+    if (fo->extent == NULL) {
+        return ERR_MEM;
+    }
+    fo->slot_size = slot_size;
+    fo->mode = mode;
+    for (i = 0; i < DDR4_FANOUT_SLOTS; i++) {
+        fo->frame[i].addr = fo->extent->addr + (UINTPTR)i * slot_size;
+    }
+    fo->newest = DDR4_FANOUT_NIL;
+    fo->writing = DDR4_FANOUT_NIL;
+    ddr4_cache_init(&fo->cache, DDR4_CACHE_DEFAULT_THRESHOLD);
+    return ERR_OK;
+}
+
+// Every subscriber must be gone; zero-copy segments point into the extent
+void ddr4_fanout_free(ddr4_fanout_t *fo)
+{
+    ddr4_arena_free(fo->extent);
+    fo->extent = NULL;
+}
+
+ddr4_fanout_sub_t *ddr4_fanout_subscribe(ddr4_fanout_t *fo, struct tcp_pcb *pcb, u8_t raw,
+                                         conn_metrics_t *metrics)
+{
+    ddr4_fanout_sub_t *sub;
+    u16_t i;
+
+    for (i = 0; i < DDR4_FANOUT_MAX_SUBSCRIBERS; i++) {
+        sub = &fo->sub[i];
+        if (sub->pcb == NULL) {
+            memset(sub, 0, sizeof(ddr4_fanout_sub_t));
+            sub->pcb = pcb;
+            sub->raw = raw;
+            sub->metrics = metrics;
+            fo->subscribers++;
+            return sub;
+        }
+    }
+    return NULL;
+}
+
+// Drops the subscriber's frames. Only once they are ACK'd, or after the PCB
+// is aborted: queued zero-copy segments still read from the slots.
+void ddr4_fanout_unsubscribe(ddr4_fanout_t *fo, ddr4_fanout_sub_t *sub)
+{
+    while (sub->count > 0) {
+        fo->frame[sub->slot[sub->head]].refs--;
+        sub->head = (sub->head + 1) % DDR4_FANOUT_DEPTH;
+        sub->count--;
+    }
+    sub->pcb = NULL;
+    fo->subscribers--;
+}
+
+// Claims a slot for the producer's next frame. ERR_VAL if it cannot fit a
+// slot, ERR_WOULDBLOCK if every slot is in use (not with the ring sized as
+// in ddr4_fanout.h).
+err_t ddr4_fanout_begin(ddr4_fanout_t *fo, u32_t length)
+{
+    u16_t i;
+
+    if (length > fo->slot_size - DDR4_FANOUT_HEADER_SIZE) {
+        return ERR_VAL;
+    }
+    if (fo->writing != DDR4_FANOUT_NIL) {
+        ddr4_fanout_abandon(fo);
+    }
+    for (i = 0; i < DDR4_FANOUT_SLOTS; i++) {
+        if (fo->frame[i].refs == 0 && i != fo->newest) {
+            fo->writing = i;
+            fo->written = 0;
+            fo->length = length;
+            return ERR_OK;
+        }
+    }
+    return ERR_WOULDBLOCK;
+}
+
+void ddr4_fanout_write(ddr4_fanout_t *fo, const u8_t *data, u32_t len)
+{
+    UINTPTR dst = fo->frame[fo->writing].addr + DDR4_FANOUT_HEADER_SIZE + fo->written;
+
+    ddr4_copy((void *)dst, data, len);
+    ddr4_cache_dirty(&fo->cache, dst, len);
+    fo->written += len;
+}
+
+// The frame being written becomes the newest, and every subscriber with
+// room takes it
+void ddr4_fanout_publish(ddr4_fanout_t *fo, u32_t stream_id)
+{
+    ddr4_fanout_frame_t *frame = &fo->frame[fo->writing];
+    frame_header_t hdr;
+    u16_t i;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.length = fo->written;
+    hdr.sequence = ++fo->sequence;
+    hdr.stream_id = stream_id;
+    frame_header_encode((u8_t *)frame->addr, &hdr);
+    ddr4_cache_dirty(&fo->cache, frame->addr, DDR4_FANOUT_HEADER_SIZE);
+    ddr4_cache_flush(&fo->cache);
+
+    frame->length = fo->written;
+    frame->sequence = fo->sequence;
+    fo->newest = fo->writing;
+    fo->writing = DDR4_FANOUT_NIL;
+    TRACE_DBG(TRACE_EV_STORE, frame->length, frame->sequence);
+
+    // Errors surface again on the subscriber's own sent or poll callback,
+    // where its connection can be aborted
+    for (i = 0; i < DDR4_FANOUT_MAX_SUBSCRIBERS; i++) {
+        if (fo->sub[i].pcb != NULL) {
+            (void)ddr4_fanout_pump(fo, &fo->sub[i]);
+        }
+    }
+}
+
+// Producer went away inside a frame; the slot is simply not published
+void ddr4_fanout_abandon(ddr4_fanout_t *fo)
+{
+    if (fo->writing != DDR4_FANOUT_NIL) {
+        fo->writing = DDR4_FANOUT_NIL;
+        fo->abandoned++;
+    }
+}
+
+// Take the newest frame if there is room for it, then send the frames in
+// flight in order
+err_t ddr4_fanout_pump(ddr4_fanout_t *fo, ddr4_fanout_sub_t *sub)
+{
+    u8_t k;
+    err_t err;
+
+    if (!sub->stopped && sub->count < DDR4_FANOUT_DEPTH && fo->newest != DDR4_FANOUT_NIL &&
+        fo->frame[fo->newest].sequence != sub->last_sequence) {
+        ddr4_fanout_frame_t *frame = &fo->frame[fo->newest];
+        u8_t at = (sub->head + sub->count) % DDR4_FANOUT_DEPTH;
+        ddr4_echo_t *echo = &sub->echo[at];
+
+        if (sub->last_sequence != 0) {
+            sub->skipped += frame->sequence - sub->last_sequence - 1;
+            fo->skips += frame->sequence - sub->last_sequence - 1;
+        }
+        sub->last_sequence = frame->sequence;
+        sub->slot[at] = fo->newest;
+        sub->len[at] = frame->length + (sub->raw ? 0 : DDR4_FANOUT_HEADER_SIZE);
+        sub->count++;
+        frame->refs++;
+
+        // Nothing here came in on this PCB: no window to credit
+        ddr4_echo_init(echo, frame->addr + (sub->raw ? DDR4_FANOUT_HEADER_SIZE : 0), fo->mode);
+        echo->win.credited = sub->len[at];
+        echo->metrics = sub->metrics;
+        ddr4_echo_stored(echo, sub->len[at]);
+
+        // An empty raw frame is done as soon as it is taken
+        ddr4_fanout_acked(fo, sub, 0);
+    }
+
+    for (k = 0; k < sub->count; k++) {
+        u8_t at = (sub->head + k) % DDR4_FANOUT_DEPTH;
+
+        if (sub->echo[at].queued == sub->len[at]) {
+            continue;
+        }
+        err = ddr4_echo_pump(&sub->echo[at], sub->pcb);
+        if (err != ERR_OK || sub->echo[at].queued < sub->len[at]) {
+            return err;
+        }
+    }
+    return ERR_OK;
+}
+
+// Spread ACK'd bytes over the frames in flight, oldest first, and let go of
+// those fully ACK'd. The caller pumps afterwards to take the newest frame.
+void ddr4_fanout_acked(ddr4_fanout_t *fo, ddr4_fanout_sub_t *sub, u16_t len)
+{
+    while (sub->count > 0) {
+        u8_t at = sub->head;
+        ddr4_echo_t *echo = &sub->echo[at];
+        u16_t n = (u16_t)LWIP_MIN(len, echo->queued - echo->acked);
+
+        if (n > 0) {
+            ddr4_echo_acked(echo, n);
+            len -= n;
+        }
+        if (echo->acked < sub->len[at]) {
+            break;
+        }
+        fo->frame[sub->slot[at]].refs--;
+        sub->head = (sub->head + 1) % DDR4_FANOUT_DEPTH;
+        sub->count--;
+        sub->frames++;
+        fo->deliveries++;
+    }
+}
+
+void ddr4_fanout_report(const ddr4_fanout_t *fo)
+{
+    xil_printf("Fan-out: %lu frames published (%lu abandoned), %d subscribers, "
+               "%lu deliveries, %lu skipped\n\r",
+               (unsigned long)fo->sequence, (unsigned long)fo->abandoned, fo->subscribers,
+               (unsigned long)fo->deliveries, (unsigned long)fo->skips);
+}
+
+void ddr4_fanout_sub_report(const ddr4_fanout_sub_t *sub)
+{
+    xil_printf("Subscriber: %lu frames delivered, %lu skipped, last sequence %lu\n\r",
+               (unsigned long)sub->frames, (unsigned long)sub->skipped,
+               (unsigned long)sub->last_sequence);
+}
@@ -0,0 +1,94 @@
+/******************************************************************************
+* One producer, many viewers: frames fanned out from a single DDR4 copy
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* The producer's frames go into a ring of DDR4 slots, each laid out as a
+* 24-byte v2 header followed by the payload. Every subscriber PCB is sent
+* the slot through its own echo cursors, zero-copy by default, so N viewers
+* cost N cursors and no copies. A slot counts the subscribers sending from
+* it (refs) and is only rewritten once none are.
+*
+* A subscriber has at most DDR4_FANOUT_DEPTH frames in flight. When one is
+* fully ACK'd it takes the newest published frame, not the next one, so a
+* slow viewer skips frames (a jump in the header sequence) and never holds
+* the producer back. With DDR4_FANOUT_DEPTH slots per subscriber, one for
+* the newest frame and one being written, the producer always finds a free
+* slot.
+*
+* A raw subscriber gets payload only, without the header; the fan-out
+* server uses it to echo a legacy producer (trail06_3jpeg.py) its own
+* frames.
+******************************************************************************/
+
+#ifndef DDR4_FANOUT_H
+#define DDR4_FANOUT_H
+
+#include "lwip/err.h"
+#include "lwip/tcp.h"
+#include "ddr4_arena.h"
+#include "ddr4_cache.h"
+#include "ddr4_echo.h"
+#include "conn_metrics.h"
+#include "frame_parser.h"
+
+#define DDR4_FANOUT_MAX_SUBSCRIBERS 12
+#define DDR4_FANOUT_DEPTH 2                     // Frames in flight per subscriber
+#define DDR4_FANOUT_SLOTS (DDR4_FANOUT_MAX_SUBSCRIBERS * DDR4_FANOUT_DEPTH + 2)
+#define DDR4_FANOUT_HEADER_SIZE FRAME_HEADER_V2_SIZE
+#define DDR4_FANOUT_NIL 0xFFFF
+
+typedef struct {
+    UINTPTR addr;          // Header, then payload
+    u32_t length;          // Payload bytes
+    u32_t sequence;        // Publish number, 0 = never published
+    u16_t refs;            // Subscribers sending from this slot
+} ddr4_fanout_frame_t;
+
+typedef struct {
+    struct tcp_pcb *pcb;   // NULL = unused
+    u8_t raw;              // Payload only, no header
+    u8_t stopped;          // Takes no new frames (closing)
+    u8_t head;             // Oldest frame in flight
+    u8_t count;            // Frames in flight
+    u16_t slot[DDR4_FANOUT_DEPTH];
+    u32_t len[DDR4_FANOUT_DEPTH];          // Bytes to send of each, header included
+    ddr4_echo_t echo[DDR4_FANOUT_DEPTH];
+    u32_t last_sequence;   // Newest frame taken
+    u32_t frames;          // Frames fully ACK'd
+    u32_t skipped;         // Frames published while this one was busy
+    conn_metrics_t *metrics; // Optional, fed by the echo cursors
+} ddr4_fanout_sub_t;
+
+typedef struct {
+    ddr4_extent_t *extent; // DDR4_FANOUT_SLOTS slots
+    u32_t slot_size;
+    u8_t mode;             // DDR4_ECHO_ZERO_COPY or DDR4_ECHO_COPY
+    ddr4_fanout_frame_t frame[DDR4_FANOUT_SLOTS];
+    ddr4_fanout_sub_t sub[DDR4_FANOUT_MAX_SUBSCRIBERS];
+    u16_t subscribers;
+    u16_t newest;          // Last published slot
+    u16_t writing;         // Slot the producer is filling
+    u32_t written;         // Bytes in it
+    u32_t length;          // Bytes announced for it
+    u32_t sequence;        // Frames published
+    ddr4_cache_t cache;    // Dirty span of the slot being written
+    u32_t abandoned;       // Frames the producer did not finish
+    u32_t deliveries;      // Frames fully ACK'd, over all subscribers
+    u32_t skips;
+} ddr4_fanout_t;
+
+err_t ddr4_fanout_init(ddr4_fanout_t *fo, u32_t slot_size, u8_t mode);
+void ddr4_fanout_free(ddr4_fanout_t *fo);
+ddr4_fanout_sub_t *ddr4_fanout_subscribe(ddr4_fanout_t *fo, struct tcp_pcb *pcb, u8_t raw,
+                                         conn_metrics_t *metrics);
+void ddr4_fanout_unsubscribe(ddr4_fanout_t *fo, ddr4_fanout_sub_t *sub);
+err_t ddr4_fanout_begin(ddr4_fanout_t *fo, u32_t length);
+void ddr4_fanout_write(ddr4_fanout_t *fo, const u8_t *data, u32_t len);
+void ddr4_fanout_publish(ddr4_fanout_t *fo, u32_t stream_id);
+void ddr4_fanout_abandon(ddr4_fanout_t *fo);
+err_t ddr4_fanout_pump(ddr4_fanout_t *fo, ddr4_fanout_sub_t *sub);
+void ddr4_fanout_acked(ddr4_fanout_t *fo, ddr4_fanout_sub_t *sub, u16_t len);
+void ddr4_fanout_report(const ddr4_fanout_t *fo);
+void ddr4_fanout_sub_report(const ddr4_fanout_sub_t *sub);
+
+#endif
@@ -0,0 +1,514 @@
+/******************************************************************************
+* Host-side fan-out benchmark: one producer, 1 to 8 subscribers
+*
+* Runs the producer, the fan-out server side (ddr4_fanout.c) and the viewers
+* as lwIP PCBs in one process, joined by a loopback netif, so every frame
+* really goes through tcp_write, segmentation, checksums and ACKs. For 1, 2,
+* 4 and 8 subscribers the producer sends frames as fast as its send buffer
+* allows for a fixed time, once with viewers sent zero-copy from the DDR4
+* slots and once with a TCP_WRITE_FLAG_COPY per viewer. The last viewer of
+* each run returns its receive window at a capped rate (slow_kbps, 0 = off)
+* and should skip frames rather than slow the producer. Each frame is
+* filled with a pattern of its sequence number, and viewers check it, so a
+* slot rewritten while still pinned shows up as corruption. Built by the
+* host CMake build:
+*   ./build/ddr4_fanout_bench [seconds] [frame_size] [slow_kbps]
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lwip/init.h"
+#include "lwip/netif.h"
+#include "lwip/ip.h"
+#include "lwip/tcp.h"
+#include "lwip/timeouts.h"
+
+#include "host/host_platform.h"
+#include "ddr4_arena.h"
+#include "ddr4_fanout.h"
+#include "frame_parser.h"
+#include "trace_log.h"
+
+#define DEFAULT_SECONDS 2
+#define DEFAULT_FRAME_SIZE (64 * 1024)       // A 640x480 JPEG is 30-80 KB
+#define DEFAULT_SLOW_KBPS 2000
+#define BENCH_PORT 6001
+#define BENCH_SLOT_SIZE (1024 * 1024)
+#define BENCH_MAX_SUBS 8
+#define BENCH_PATTERNS 4                     // Frame n is filled with pattern n % 4
+#define LOOP_QUEUE 8192                      // Packets in flight on the loopback netif
+
+typedef struct {
+    struct tcp_pcb *pcb;
+    u8_t role;                  // 0 = unknown, 1 = producer, 2 = viewer
+    ddr4_fanout_sub_t *sub;
+    frame_parser_t parser;
+} bench_server_t;
+
+typedef struct {
+    struct tcp_pcb *pcb;
+    frame_parser_t parser;      // Frames coming back from the fan-out
+    u8_t slow;
+    u32_t owed;                 // Received but window not returned yet (slow viewer)
+    double credit;              // Bytes the slow viewer may return
+    u32_t sequence;             // Frame being received
+    u32_t last_sequence;
+    u8_t expect;                // Pattern byte of the frame being received
+    u32_t frames;
+    u32_t skipped;
+    u32_t corrupt;
+    u64_t bytes;
+} bench_viewer_t;
+
+typedef struct {
+    struct tcp_pcb *pcb;
+    u32_t frames;               // Frames fully handed to tcp_write
+    u32_t offset;               // Bytes of the current frame written (header included)
+    u8_t header[FRAME_HEADER_V2_SIZE];
+} bench_producer_t;
+
+static struct netif loop_netif;
+static struct pbuf *loop_ring[LOOP_QUEUE];
+static u32_t loop_head, loop_count, loop_drops;
+
+static ddr4_fanout_t fanout;
+static bench_server_t servers[BENCH_MAX_SUBS + 1];
+static bench_viewer_t viewers[BENCH_MAX_SUBS];
+static bench_producer_t producer;
+static u8_t *patterns[BENCH_PATTERNS];
+static u32_t frame_size;
+static u32_t errors;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Loopback netif: output copies the packet onto a ring, loop_deliver() feeds
+// it back to ip4_input outside of the stack
+static err_t loop_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
+    struct pbuf *q;
+
+    LWIP_UNUSED_ARG(netif);
+    LWIP_UNUSED_ARG(ipaddr);
+    if (loop_count == LOOP_QUEUE || (q = pbuf_clone(PBUF_RAW, PBUF_POOL, p)) == NULL) {
+        loop_drops++;
+        return ERR_OK;
+    }
+    loop_ring[(loop_head + loop_count++) % LOOP_QUEUE] = q;
+    return ERR_OK;
+}
+
+static err_t loop_init(struct netif *netif) {
+    netif->name[0] = 'l';
+    netif->name[1] = 'o';
+    netif->output = loop_output;
+    netif->mtu = 1500;
+    return ERR_OK;
+}
+
+static u32_t loop_deliver(void) {
+    u32_t n = 0;
+
+    while (loop_count > 0) {
+        struct pbuf *p = loop_ring[loop_head];
+
+        loop_head = (loop_head + 1) % LOOP_QUEUE;
+        loop_count--;
+        if (loop_netif.input(p, &loop_netif) != ERR_OK) {
+            pbuf_free(p);
+        }
+        n++;
+    }
+    return n;
+}
+
+// --- Fan-out server side, as trail263 without the pending input and metrics ---
+
+static err_t server_begin(void *arg, const frame_header_t *hdr) {
+    bench_server_t *s = (bench_server_t *)arg;
+
+    if (hdr->flags & FRAME_FLAG_SUBSCRIBE) {
+        s->sub = ddr4_fanout_subscribe(&fanout, s->pcb, 0, NULL);
+        s->role = 2;
+        return s->sub ? ERR_OK : ERR_MEM;
+    }
+    s->role = 1;
+    return ddr4_fanout_begin(&fanout, (u32_t)hdr->length);
+}
+
+static err_t server_data(void *arg, const u8_t *data, u32_t len) {
+    LWIP_UNUSED_ARG(arg);
+    ddr4_fanout_write(&fanout, data, len);
+    return ERR_OK;
+}
+
+static err_t server_end(void *arg) {
+    bench_server_t *s = (bench_server_t *)arg;
+
+    if (s->role == 1) {
+        ddr4_fanout_publish(&fanout, 0);
+    }
+    return ERR_OK;
+}
+
+static err_t server_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
+    bench_server_t *s = (bench_server_t *)arg;
+    u32_t used;
+
+    if (!p) {
+        return ERR_OK;
+    }
+    if (err != ERR_OK || frame_parser_input(&s->parser, p, &used) != ERR_OK || used != p->tot_len) {
+        errors++;
+    }
+    tcp_recved(tpcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static err_t server_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    bench_server_t *s = (bench_server_t *)arg;
+
+    LWIP_UNUSED_ARG(tpcb);
+    if (s->sub) {
+        ddr4_fanout_acked(&fanout, s->sub, len);
+        if (ddr4_fanout_pump(&fanout, s->sub) != ERR_OK) {
+            errors++;
+        }
+    }
+    return ERR_OK;
+}
+
+static err_t server_accept(void *arg, struct tcp_pcb *newpcb, err_t err) {
+    int i;
+
+    LWIP_UNUSED_ARG(arg);
+    if (err != ERR_OK || newpcb == NULL) {
+        return ERR_VAL;
+    }
+    for (i = 0; i <= BENCH_MAX_SUBS; i++) {
+        bench_server_t *s = &servers[i];
+
+        if (s->pcb == NULL) {
+            memset(s, 0, sizeof(bench_server_t));
+            s->pcb = newpcb;
+            frame_parser_init(&s->parser, server_begin, server_data, server_end, s);
+            tcp_arg(newpcb, s);
+            tcp_recv(newpcb, server_recv);
+            tcp_sent(newpcb, server_sent);
+            tcp_nagle_disable(newpcb);
+            return ERR_OK;
+        }
+    }
+    tcp_abort(newpcb);
+    return ERR_ABRT;
+}
+
+// --- Producer: header and frame back to back, as fast as sndbuf allows ---
+
+static void producer_pump(void) {
+    struct tcp_pcb *pcb = producer.pcb;
+
+    for (;;) {
+        u32_t frame_len = FRAME_HEADER_V2_SIZE + frame_size;
+        u16_t room = tcp_sndbuf(pcb);
+        u16_t len;
+        err_t err;
+
+        if (producer.offset == 0) {
+            frame_header_t hdr;
+
+            if (room < FRAME_HEADER_V2_SIZE) {
+                break;
+            }
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.flags = FRAME_FLAG_BENCH_SINK;
+            hdr.length = frame_size;
+            hdr.sequence = producer.frames + 1;
+            frame_header_encode(producer.header, &hdr);
+            if (tcp_write(pcb, producer.header, FRAME_HEADER_V2_SIZE, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+                break;
+            }
+            producer.offset = FRAME_HEADER_V2_SIZE;
+            continue;
+        }
+
+        // Payload straight from the pattern, which never changes
+        len = (u16_t)LWIP_MIN(LWIP_MIN(frame_len - producer.offset, room), 0xFFFF);
+        if (len == 0) {
+            break;
+        }
+        err = tcp_write(pcb, patterns[(producer.frames + 1) % BENCH_PATTERNS] +
+                        (producer.offset - FRAME_HEADER_V2_SIZE), len, 0);
+        if (err != ERR_OK) {
+            break;
+        }
+        producer.offset += len;
+        if (producer.offset == frame_len) {
+            producer.offset = 0;
+            producer.frames++;
+        }
+    }
+    tcp_output(pcb);
+}
+
+static err_t producer_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    LWIP_UNUSED_ARG(arg);
+    LWIP_UNUSED_ARG(tpcb);
+    LWIP_UNUSED_ARG(len);
+    producer_pump();
+    return ERR_OK;
+}
+
+static err_t producer_connected(void *arg, struct tcp_pcb *tpcb, err_t err) {
+    LWIP_UNUSED_ARG(arg);
+    tcp_sent(tpcb, producer_sent);
+    producer_pump();
+    return err;
+}
+
+// --- Viewers: parse frames, check the pattern, count skips ---
+
+static err_t viewer_begin(void *arg, const frame_header_t *hdr) {
+    bench_viewer_t *v = (bench_viewer_t *)arg;
+
+    if (v->last_sequence != 0 && hdr->sequence != v->last_sequence + 1) {
+        v->skipped += hdr->sequence - v->last_sequence - 1;
+    }
+    v->sequence = hdr->sequence;
+    v->expect = patterns[hdr->sequence % BENCH_PATTERNS][0];
+    if (hdr->length != frame_size) {
+        v->corrupt++;
+    }
+    return ERR_OK;
+}
+
+static err_t viewer_data(void *arg, const u8_t *data, u32_t len) {
+    bench_viewer_t *v = (bench_viewer_t *)arg;
+    u32_t i;
+
+    for (i = 0; i < len; i++) {
+        if (data[i] != v->expect) {
+            v->corrupt++;
+            break;
+        }
+    }
+    v->bytes += len;
+    return ERR_OK;
+}
+
+static err_t viewer_end(void *arg) {
+    bench_viewer_t *v = (bench_viewer_t *)arg;
+
+    v->last_sequence = v->sequence;
+    v->frames++;
+    return ERR_OK;
+}
+
+static err_t viewer_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
+    bench_viewer_t *v = (bench_viewer_t *)arg;
+    u32_t used;
+
+    if (!p) {
+        return ERR_OK;
+    }
+    if (err != ERR_OK || frame_parser_input(&v->parser, p, &used) != ERR_OK) {
+        errors++;
+    }
+    if (v->slow) {
+        v->owed += p->tot_len;
+    } else {
+        tcp_recved(tpcb, p->tot_len);
+    }
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static err_t viewer_connected(void *arg, struct tcp_pcb *tpcb, err_t err) {
+    u8_t cmd[FRAME_HEADER_V2_SIZE];
+    frame_header_t hdr;
+
+    LWIP_UNUSED_ARG(arg);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.flags = FRAME_FLAG_SUBSCRIBE;
+    frame_header_encode(cmd, &hdr);
+    tcp_write(tpcb, cmd, sizeof(cmd), TCP_WRITE_FLAG_COPY);
+    tcp_output(tpcb);
+    return err;
+}
+
+// The slow viewer opens its window at most slow_kbps
+static void viewer_credit(bench_viewer_t *v, double budget) {
+    v->credit = LWIP_MIN(v->credit + budget, (double)TCP_WND);
+    while (v->owed > 0 && v->credit >= 1.0) {
+        u16_t n = (u16_t)LWIP_MIN(LWIP_MIN(v->owed, (u32_t)v->credit), 0xFFFF);
+
+        tcp_recved(v->pcb, n);
+        v->owed -= n;
+        v->credit -= n;
+    }
+}
+
+static struct tcp_pcb *connect_client(void *arg, tcp_connected_fn connected) {
+    struct tcp_pcb *pcb = tcp_new();
+
+    tcp_arg(pcb, arg);
+    tcp_nagle_disable(pcb);
+    tcp_connect(pcb, &loop_netif.ip_addr, BENCH_PORT, connected);
+    return pcb;
+}
+
+// Everything goes with RSTs that nobody answers
+static void teardown(void) {
+    int i;
+
+    for (i = 0; i <= BENCH_MAX_SUBS; i++) {
+        if (servers[i].pcb) {
+            if (servers[i].sub) {
+                ddr4_fanout_unsubscribe(&fanout, servers[i].sub);
+            }
+            tcp_arg(servers[i].pcb, NULL);
+            tcp_abort(servers[i].pcb);
+            servers[i].pcb = NULL;
+        }
+    }
+    for (i = 0; i < BENCH_MAX_SUBS; i++) {
+        if (viewers[i].pcb) {
+            tcp_arg(viewers[i].pcb, NULL);
+            tcp_abort(viewers[i].pcb);
+            viewers[i].pcb = NULL;
+        }
+    }
+    tcp_arg(producer.pcb, NULL);
+    tcp_abort(producer.pcb);
+    producer.pcb = NULL;
+
+    while (loop_count > 0) {
+        pbuf_free(loop_ring[loop_head]);
+        loop_head = (loop_head + 1) % LOOP_QUEUE;
+        loop_count--;
+    }
+    ddr4_fanout_free(&fanout);
+}
+
+static int run(int subs, u8_t mode, double seconds, u32_t slow_kbps) {
+    double start, last, end, t, elapsed;
+    u64_t delivered = 0;
+    u32_t frames = 0, skipped = 0, corrupt = 0;
+    int i;
+
+    if (ddr4_fanout_init(&fanout, BENCH_SLOT_SIZE, mode) != ERR_OK) {
+        printf("No DDR4 for the frame ring\n");
+        return 1;
+    }
+    memset(viewers, 0, sizeof(viewers));
+    memset(&producer, 0, sizeof(producer));
+    loop_drops = 0;
+    errors = 0;
+
+    // Viewers first so they see the stream from its first frame
+    for (i = 0; i < subs; i++) {
+        bench_viewer_t *v = &viewers[i];
+
+        frame_parser_init(&v->parser, viewer_begin, viewer_data, viewer_end, v);
+        v->slow = (slow_kbps > 0 && subs > 1 && i == subs - 1);
+        v->pcb = connect_client(v, viewer_connected);
+        tcp_recv(v->pcb, viewer_recv);
+    }
+    while (fanout.subscribers < subs && loop_deliver() > 0) {
+    }
+    producer.pcb = connect_client(&producer, producer_connected);
+
+    start = last = now_ns();
+    end = start + seconds * 1e9;
+    while ((t = now_ns()) < end) {
+        loop_deliver();
+        sys_check_timeouts();
+        for (i = 0; i < subs; i++) {
+            if (viewers[i].slow) {
+                viewer_credit(&viewers[i], (t - last) * slow_kbps / 8e6);
+            }
+        }
+        last = t;
+    }
+    elapsed = (now_ns() - start) / 1e9;
+
+    for (i = 0; i < subs; i++) {
+        delivered += viewers[i].bytes;
+        frames += viewers[i].frames;
+        skipped += viewers[i].skipped;
+        corrupt += viewers[i].corrupt;
+    }
+    printf("%-9s %d viewer%s  producer %6.0f frames/s %8.1f MB/s  delivered %8.1f MB/s "
+           "(%.1f MB/s each)  %u skipped  %u corrupt  %u loop drops\n",
+           mode == DDR4_ECHO_ZERO_COPY ? "zero-copy" : "copy", subs, subs > 1 ? "s" : " ",
+           producer.frames / elapsed, (double)producer.frames * frame_size / elapsed / 1e6,
+           delivered / elapsed / 1e6, delivered / elapsed / 1e6 / subs, skipped, corrupt, loop_drops);
+    if (viewers[subs - 1].slow) {
+        printf("%-9s slow viewer %u frames, %u skipped\n", "", viewers[subs - 1].frames,
+               viewers[subs - 1].skipped);
+    }
+
+    teardown();
+    if (corrupt || errors || frames == 0) {
+        printf("FAIL: %u corrupt frames, %u stream errors, %u frames delivered\n", corrupt, errors, frames);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    double seconds = (argc > 1) ? atof(argv[1]) : DEFAULT_SECONDS;
+    u32_t slow_kbps = (argc > 3) ? (u32_t)atoi(argv[3]) : DEFAULT_SLOW_KBPS;
+    static const int counts[] = { 1, 2, 4, 8 };
+    static const u8_t modes[] = { DDR4_ECHO_ZERO_COPY, DDR4_ECHO_COPY };
+    ip4_addr_t addr, mask, gw;
+    struct tcp_pcb *lpcb;
+    int failed = 0;
+    u32_t i, m;
+
+    frame_size = (argc > 2) ? (u32_t)atoi(argv[2]) : DEFAULT_FRAME_SIZE;
+    if (frame_size == 0 || frame_size > BENCH_SLOT_SIZE - DDR4_FANOUT_HEADER_SIZE) {
+        frame_size = DEFAULT_FRAME_SIZE;
+    }
+
+    if (host_ddr4_init() != 0) {
+        return 1;
+    }
+    lwip_init();
+    trace_log_init();
+    ddr4_arena_init(DDR4_ARENA_BASE, DDR4_ARENA_SIZE);
+    ddr4_cache_region_init(DDR4_ARENA_BASE, DDR4_ARENA_SIZE);
+
+    for (i = 0; i < BENCH_PATTERNS; i++) {
+        patterns[i] = (u8_t *)malloc(frame_size);
+        memset(patterns[i], 'a' + i, frame_size);
+    }
+
+    IP4_ADDR(&addr, 10, 0, 0, 1);
+    IP4_ADDR(&mask, 255, 0, 0, 0);
+    ip4_addr_set_zero(&gw);
+    netif_add(&loop_netif, &addr, &mask, &gw, NULL, loop_init, ip4_input);
+    netif_set_default(&loop_netif);
+    netif_set_up(&loop_netif);
+    netif_set_link_up(&loop_netif);
+
+    lpcb = tcp_new();
+    tcp_bind(lpcb, IP_ADDR_ANY, BENCH_PORT);
+    lpcb = tcp_listen(lpcb);
+    tcp_accept(lpcb, server_accept);
+
+    printf("%u byte frames, %.1f s per run, slow viewer at %u kbit/s, %d DDR4 slots\n",
+           frame_size, seconds, slow_kbps, DDR4_FANOUT_SLOTS);
+    for (m = 0; m < sizeof(modes); m++) {
+        for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+            failed |= run(counts[i], modes[m], seconds, slow_kbps);
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,305 @@
+/******************************************************************************
+* DDR4 object store: uploads kept by id, served back by GET
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <string.h>
+#include "ddr4_store.h"
+#include "xil_printf.h"
+
+#define INDEX_MASK (DDR4_STORE_INDEX_SLOTS - 1)
+
+static struct {
+    ddr4_store_entry_t *index;   // DDR4_STORE_INDEX_SLOTS entries, in index_ext
+    ddr4_extent_t *index_ext;
+    u16_t lru_head;              // Most recently used
+    u16_t lru_tail;              // Eviction candidate
+    u32_t objects;
+    u32_t bytes;                 // Committed object bytes
+    u32_t next_id;
+    u32_t puts;
+    u32_t gets;
+    u32_t misses;
+    u32_t evictions;
+    u32_t evicted_bytes;
+    u32_t no_space;
+} store;
+
+// Fibonacci hashing: ids are mostly sequential, the top bits spread them
+static u16_t slot_of(u32_t id)
+{
+    return (u16_t)((id * 2654435761u) >> (32 - DDR4_STORE_INDEX_BITS));
+}
+
+static u16_t find(u32_t id)
+{
+    u16_t i;
+
+    for (i = slot_of(id); store.index[i].id != 0; i = (i + 1) & INDEX_MASK) {
+        if (store.index[i].id == id) {
+            return i;
+        }
+    }
+    return DDR4_STORE_NIL;
+}
+
+static void lru_unlink(u16_t i)
+{
+    ddr4_store_entry_t *e = &store.index[i];
+
+    if (e->lru_prev != DDR4_STORE_NIL) {
+        store.index[e->lru_prev].lru_next = e->lru_next;
+    } else {
+        store.lru_head = e->lru_next;
+    }
+    if (e->lru_next != DDR4_STORE_NIL) {
+        store.index[e->lru_next].lru_prev = e->lru_prev;
+    } else {
+        store.lru_tail = e->lru_prev;
+    }
+}
+
+static void lru_push(u16_t i)
+{
+    ddr4_store_entry_t *e = &store.index[i];
+
+    e->lru_prev = DDR4_STORE_NIL;
+    e->lru_next = store.lru_head;
+    if (store.lru_head != DDR4_STORE_NIL) {
+        store.index[store.lru_head].lru_prev = i;
+    } else {
+        store.lru_tail = i;
+    }
+    store.lru_head = i;
+}
+
+// Entry i was copied here from another slot: point its neighbours at it
+static void lru_relink(u16_t i)
+{
+    ddr4_store_entry_t *e = &store.index[i];
+
+    if (e->lru_prev != DDR4_STORE_NIL) {
+        store.index[e->lru_prev].lru_next = i;
+    } else {
+        store.lru_head = i;
+    }
+    if (e->lru_next != DDR4_STORE_NIL) {
+        store.index[e->lru_next].lru_prev = i;
+    } else {
+        store.lru_tail = i;
+    }
+}
+
+// Drops the entry in slot i and frees its extent. Later entries of the same
+// probe run shift back into the hole, so lookups never need tombstones.
+static void remove_slot(u16_t i)
+{
+    ddr4_store_entry_t *e = &store.index[i];
+    u16_t j = i;
+    u16_t home;
+
+    if (e->ready) {
+        store.bytes -= e->length;
+    }
+    ddr4_arena_free(e->ext);
+    lru_unlink(i);
+    store.objects--;
+
+    for (;;) {
+        store.index[i].id = 0;
+        do {
+            j = (j + 1) & INDEX_MASK;
+            if (store.index[j].id == 0) {
+                return;
+            }
+            home = slot_of(store.index[j].id);
+            // Entry j stays if its home lies cyclically in (i, j]
+        } while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+
+        store.index[i] = store.index[j];
+        lru_relink(i);
+        i = j;
+    }
+}
+
+// Evicts the least recently used unpinned object; 0 if there is none
+static u8_t evict_one(void)
+{
+    u16_t i;
+
+    for (i = store.lru_tail; i != DDR4_STORE_NIL; i = store.index[i].lru_prev) {
+        if (store.index[i].refs == 0) {
+            store.evictions++;
+            store.evicted_bytes += store.index[i].length;
+            remove_slot(i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void fill_object(u16_t i, ddr4_object_t *obj)
+{
+    const ddr4_store_entry_t *e = &store.index[i];
+
+    obj->id = e->id;
+    obj->length = e->length;
+    obj->crc = e->crc;
+    obj->addr = e->ext->addr;
+}
+
+// Needs the arena initialised; takes one extent for the index
+err_t ddr4_store_init(void)
+{
+    memset(&store, 0, sizeof(store));
+    store.index_ext = ddr4_arena_alloc(DDR4_STORE_INDEX_SLOTS * sizeof(ddr4_store_entry_t));
+    if (store.index_ext == NULL) {
+        xil_printf("Object store: no DDR4 for the index\n\r");
+        return ERR_MEM;
+    }
+    store.index = (ddr4_store_entry_t *)store.index_ext->addr;
+    memset(store.index, 0, DDR4_STORE_INDEX_SLOTS * sizeof(ddr4_store_entry_t));
+    store.lru_head = DDR4_STORE_NIL;
+    store.lru_tail = DDR4_STORE_NIL;
+    store.next_id = 1;
+    return ERR_OK;
+}
+
+// Reserves length bytes under id (0 = assign one) for a writer, evicting as
+// needed. The object is pinned and invisible to GET until committed; an
+// unpinned object with the same id is replaced.
+ddr4_store_status_t ddr4_store_create(u32_t id, u32_t length, ddr4_object_t *obj)
+{
+    ddr4_arena_stats_t stats;
+    ddr4_extent_t *ext;
+    ddr4_store_entry_t *e;
+    u16_t i;
+
+    if (id == 0) {
+        do {
+            id = store.next_id++;
+            if (store.next_id == 0) {
+                store.next_id = 1;
+            }
+        } while (find(id) != DDR4_STORE_NIL);
+    }
+
+    i = find(id);
+    if (i != DDR4_STORE_NIL) {
+        if (store.index[i].refs) {
+            return DDR4_STORE_BUSY;
+        }
+        remove_slot(i);
+    }
+
+    // Evicting cannot make room for more than the whole arena
+    ddr4_arena_get_stats(&stats);
+    if (length > stats.total_bytes - store.index_ext->size) {
+        store.no_space++;
+        return DDR4_STORE_NO_SPACE;
+    }
+
+    while (store.objects >= DDR4_STORE_MAX_OBJECTS) {
+        if (!evict_one()) {
+            store.no_space++;
+            return DDR4_STORE_NO_SPACE;
+        }
+    }
+    while ((ext = ddr4_arena_alloc(length ? length : 1)) == NULL) {
+        if (!evict_one()) {
+            store.no_space++;
+            return DDR4_STORE_NO_SPACE;
+        }
+    }
+
+    for (i = slot_of(id); store.index[i].id != 0; i = (i + 1) & INDEX_MASK) {
+    }
+    e = &store.index[i];
+    e->id = id;
+    e->length = length;
+    e->crc = 0;
+    e->reads = 0;
+    e->ext = ext;
+    e->refs = 1;
+    e->ready = 0;
+    lru_push(i);
+    store.objects++;
+
+    fill_object(i, obj);
+    return DDR4_STORE_OK;
+}
+
+// The writer is done: publish the object and drop its pin
+void ddr4_store_commit(u32_t id, u32_t crc)
+{
+    u16_t i = find(id);
+
+    if (i == DDR4_STORE_NIL || store.index[i].ready) {
+        return;
+    }
+    store.index[i].crc = crc;
+    store.index[i].ready = 1;
+    store.index[i].refs--;
+    store.bytes += store.index[i].length;
+    store.puts++;
+}
+
+// The writer gave up: drop the half-written object
+void ddr4_store_discard(u32_t id)
+{
+    u16_t i = find(id);
+
+    if (i != DDR4_STORE_NIL && !store.index[i].ready) {
+        remove_slot(i);
+    }
+}
+
+// Pins a committed object for reading and marks it most recently used
+ddr4_store_status_t ddr4_store_open(u32_t id, ddr4_object_t *obj)
+{
+    u16_t i = find(id);
+
+    if (i == DDR4_STORE_NIL || !store.index[i].ready) {
+        store.misses++;
+        return DDR4_STORE_NOT_FOUND;
+    }
+    store.index[i].refs++;
+    store.index[i].reads++;
+    lru_unlink(i);
+    lru_push(i);
+    store.gets++;
+
+    fill_object(i, obj);
+    return DDR4_STORE_OK;
+}
+
+void ddr4_store_close(u32_t id)
+{
+    u16_t i = find(id);
+
+    if (i != DDR4_STORE_NIL && store.index[i].ready && store.index[i].refs) {
+        store.index[i].refs--;
+    }
+}
+
+const char *ddr4_store_status_name(ddr4_store_status_t status)
+{
+    switch (status) {
+    case DDR4_STORE_OK: return "ok";
+    case DDR4_STORE_NOT_FOUND: return "not found";
+    case DDR4_STORE_NO_SPACE: return "no space";
+    case DDR4_STORE_BUSY: return "busy";
+    case DDR4_STORE_BAD_RANGE: return "bad range";
+    default: return "?";
+    }
+}
+
+void ddr4_store_report(void)
+{
+    xil_printf("Object store: %lu objects, %lu KB, %lu puts, %lu gets, %lu misses\n\r",
+               (unsigned long)store.objects, (unsigned long)(store.bytes / 1024),
+               (unsigned long)store.puts, (unsigned long)store.gets, (unsigned long)store.misses);
+    xil_printf("Object store: %lu evicted (%lu KB), %lu refused for space\n\r",
+               (unsigned long)store.evictions, (unsigned long)(store.evicted_bytes / 1024),
+               (unsigned long)store.no_space);
+}
@@ -0,0 +1,72 @@
+/******************************************************************************
+* DDR4 object store: uploads kept by id, served back by GET
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* A stored upload keeps its arena extent after the connection closes and is
+* found again by a u32 id: the client's v2 stream id, or one the store
+* assigns. The index is an open-addressed hash table (linear probing,
+* backward-shift deletion, no tombstones) in a DDR4 extent of its own;
+* only the LRU head/tail and counters live in BSS. Entries are threaded on
+* an LRU list by slot index, most recently stored or read first.
+*
+* When the arena cannot fit a new object, or DDR4_STORE_MAX_OBJECTS are
+* stored, objects are evicted from the LRU tail until it can. Objects that
+* are still being written or are streaming to a reader are pinned (refs)
+* and skipped. Readers get a copy of the address and length while pinned;
+* entries move inside the table on deletion, so callers hold ids, never
+* entry pointers.
+******************************************************************************/
+
+#ifndef DDR4_STORE_H
+#define DDR4_STORE_H
+
+#include "lwip/err.h"
+#include "lwip/arch.h"
+#include "ddr4_arena.h"
+
+#define DDR4_STORE_INDEX_BITS 7                         // 128 index slots
+#define DDR4_STORE_INDEX_SLOTS (1 << DDR4_STORE_INDEX_BITS)
+#define DDR4_STORE_MAX_OBJECTS 48                       // Below DDR4_ARENA_MAX_EXTENTS, load factor <= 0.375
+#define DDR4_STORE_NIL 0xFFFF
+
+// Receipt status, sent to the client as is (frame_receipt_encode)
+typedef enum {
+    DDR4_STORE_OK = 0,
+    DDR4_STORE_NOT_FOUND,                // No committed object with that id
+    DDR4_STORE_NO_SPACE,                 // Does not fit even with everything unpinned evicted
+    DDR4_STORE_BUSY,                     // Id is being written or read, cannot be replaced
+    DDR4_STORE_BAD_RANGE                 // GET offset past the end of the object
+} ddr4_store_status_t;
+
+// Index entry, in DDR4
+typedef struct {
+    u32_t id;              // 0 = empty slot
+    u32_t length;          // Object bytes
+    u32_t crc;             // CRC32C of the object, set on commit
+    u32_t reads;           // GETs served
+    ddr4_extent_t *ext;    // Arena extent holding the object
+    u16_t refs;            // Writer or readers; pinned entries are not evicted
+    u8_t ready;            // Committed, visible to GET
+    u8_t reserved;
+    u16_t lru_prev;        // Slot indices, DDR4_STORE_NIL at the ends
+    u16_t lru_next;
+} ddr4_store_entry_t;
+
+// What a writer or reader gets back
+typedef struct {
+    u32_t id;
+    u32_t length;
+    u32_t crc;
+    mem_ptr_t addr;        // DDR4 address, valid while pinned
+} ddr4_object_t;
+
+err_t ddr4_store_init(void);
+ddr4_store_status_t ddr4_store_create(u32_t id, u32_t length, ddr4_object_t *obj);
+void ddr4_store_commit(u32_t id, u32_t crc);
+void ddr4_store_discard(u32_t id);
+ddr4_store_status_t ddr4_store_open(u32_t id, ddr4_object_t *obj);
+void ddr4_store_close(u32_t id);
+const char *ddr4_store_status_name(ddr4_store_status_t status);
+void ddr4_store_report(void);
+
+#endif
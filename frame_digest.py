@@ -0,0 +1,49 @@
+import struct
+
+# Digest trailer returned by the servers in verify mode (see frame_parser.h):
+# u32 magic "CRCC", u32 CRC32C, u64 payload length, all big-endian.
+DIGEST_MAGIC = 0x43524343
+DIGEST_SIZE = 16
+FLAG_VERIFY = 0x8
+
+try:
+    # C implementation if installed (pip install crc32c)
+    from crc32c import crc32c as _crc32c_native
+except ImportError:
+    _crc32c_native = None
+
+
+def _make_table():
+    table = []
+    for i in range(256):
+        c = i
+        for _ in range(8):
+            c = (c >> 1) ^ 0x82F63B78 if c & 1 else c >> 1
+        table.append(c)
+    return table
+
+
+_TABLE = _make_table()
+
+
+def crc32c_update(crc, data):
+    """Continue a CRC32C over data; crc32c_update(0, b'123456789') == 0xE3069283."""
+    if _crc32c_native is not None:
+        return _crc32c_native(data, crc)
+    c = crc ^ 0xFFFFFFFF
+    table = _TABLE
+    for b in data:
+        c = table[(c ^ b) & 0xFF] ^ (c >> 8)
+    return c ^ 0xFFFFFFFF
+
+
+def parse_digest(trailer):
+    """Return (crc, length) from a 16-byte trailer, or raise ValueError."""
+    magic, crc, length = struct.unpack('>IIQ', trailer)
+    if magic != DIGEST_MAGIC:
+        raise ValueError(f"Bad digest magic 0x{magic:08x}")
+    return crc, length
+
+
+if __name__ == "__main__":
+    print(f"{crc32c_update(0, b'123456789'):08x}")
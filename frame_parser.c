@@ -0,0 +1,212 @@
+/******************************************************************************
+* Streaming parser for size-prefixed frames on a persistent connection
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <string.h>
+#include "frame_parser.h"
+
+static u32_t get_be32(const u8_t *b) {
+    return ((u32_t)b[0] << 24) | ((u32_t)b[1] << 16) | ((u32_t)b[2] << 8) | b[3];
+}
+
+// Header size implied by the first have bytes. Grows from 4 to the v2 header
+// length once that field has arrived, so callers can collect byte by byte.
+u32_t frame_header_size(const u8_t *buf, u32_t have)
+{
+    u32_t size;
+
+    if (have < FRAME_HEADER_LEGACY_SIZE || buf[0] != FRAME_HEADER_V2_MARKER) {
+        return FRAME_HEADER_LEGACY_SIZE;
+    }
+    size = ((u32_t)buf[2] << 8) | buf[3];
+    if (size < FRAME_HEADER_V2_SIZE || size > FRAME_HEADER_MAX) {
+        return FRAME_HEADER_LEGACY_SIZE;    // Rejected by frame_header_decode
+    }
+    return size;
+}
+
+// Decode a complete header of len = frame_header_size() bytes
+err_t frame_header_decode(const u8_t *buf, u32_t len, frame_header_t *hdr)
+{
+    memset(hdr, 0, sizeof(frame_header_t));
+
+    if (len < FRAME_HEADER_LEGACY_SIZE) {
+        return ERR_VAL;
+    }
+    if (buf[0] != FRAME_HEADER_V2_MARKER) {
+        hdr->version = 1;
+        hdr->size = FRAME_HEADER_LEGACY_SIZE;
+        hdr->length = get_be32(buf);
+        return ERR_OK;
+    }
+
+    if (buf[1] != 2 || len < FRAME_HEADER_V2_SIZE || len != frame_header_size(buf, len)) {
+        return ERR_VAL;
+    }
+    hdr->version = 2;
+    hdr->size = (u16_t)len;
+    hdr->flags = get_be32(buf + 4);
+    hdr->length = ((u64_t)get_be32(buf + 8) << 32) | get_be32(buf + 12);
+    hdr->sequence = get_be32(buf + 16);
+    hdr->stream_id = get_be32(buf + 20);
+    if (len >= FRAME_HEADER_V2_STRIPE_SIZE) {
+        hdr->offset = ((u64_t)get_be32(buf + 24) << 32) | get_be32(buf + 28);
+        hdr->total = ((u64_t)get_be32(buf + 32) << 32) | get_be32(buf + 36);
+    }
+    return ERR_OK;
+}
+
+// For servers that expect the header at the start of the first pbuf chain.
+// ERR_INPROGRESS means the chain is shorter than the header.
+err_t frame_header_from_pbuf(const struct pbuf *p, frame_header_t *hdr)
+{
+    u8_t buf[FRAME_HEADER_MAX];
+    u16_t have = pbuf_copy_partial(p, buf, FRAME_HEADER_MAX, 0);
+    u32_t size = frame_header_size(buf, have);
+
+    if (have < size) {
+        return ERR_INPROGRESS;
+    }
+    return frame_header_decode(buf, size, hdr);
+}
+
+static void put_be32(u8_t *b, u32_t v) {
+    b[0] = (u8_t)(v >> 24);
+    b[1] = (u8_t)(v >> 16);
+    b[2] = (u8_t)(v >> 8);
+    b[3] = (u8_t)v;
+}
+
+// 24-byte v2 header (FRAME_HEADER_V2_SIZE), for frames the board sends
+void frame_header_encode(u8_t *out, const frame_header_t *hdr)
+{
+    out[0] = FRAME_HEADER_V2_MARKER;
+    out[1] = 2;
+    out[2] = 0;
+    out[3] = FRAME_HEADER_V2_SIZE;
+    put_be32(out + 4, hdr->flags);
+    put_be32(out + 8, (u32_t)(hdr->length >> 32));
+    put_be32(out + 12, (u32_t)hdr->length);
+    put_be32(out + 16, hdr->sequence);
+    put_be32(out + 20, hdr->stream_id);
+}
+
+// Digest trailer sent back in verify mode
+void frame_digest_encode(u8_t *out, u32_t crc, u64_t length)
+{
+    put_be32(out, FRAME_DIGEST_MAGIC);
+    put_be32(out + 4, crc);
+    put_be32(out + 8, (u32_t)(length >> 32));
+    put_be32(out + 12, (u32_t)length);
+}
+
+// Object store reply, see frame_parser.h
+void frame_receipt_encode(u8_t *out, u32_t status, u32_t id, u32_t crc, u64_t length)
+{
+    put_be32(out, FRAME_RECEIPT_MAGIC);
+    put_be32(out + 4, status);
+    put_be32(out + 8, id);
+    put_be32(out + 12, crc);
+    put_be32(out + 16, (u32_t)(length >> 32));
+    put_be32(out + 20, (u32_t)length);
+}
+
+void frame_parser_init(frame_parser_t *fp, frame_begin_fn begin, frame_data_fn data,
+                       frame_end_fn end, void *arg)
+{
+    memset(fp, 0, sizeof(frame_parser_t));
+    fp->begin = begin;
+    fp->data = data;
+    fp->end = end;
+    fp->arg = arg;
+}
+
+static err_t frame_finish(frame_parser_t *fp)
+{
+    fp->in_frame = 0;
+    fp->hdr_len = 0;
+    fp->frames++;
+    return fp->end(fp->arg);
+}
+
+// Consume as much of data as possible. *used is how far the parser got,
+// which is less than len only when an error or ERR_WOULDBLOCK is returned.
+err_t frame_parser_feed(frame_parser_t *fp, const u8_t *data, u32_t len, u32_t *used)
+{
+    u32_t pos = 0;
+    err_t err = ERR_OK;
+
+    while (pos < len || (!fp->in_frame && fp->hdr_len > 0 &&
+                         fp->hdr_len == frame_header_size(fp->hdr, fp->hdr_len))) {
+        if (!fp->in_frame) {
+            // Collect the header, possibly across calls
+            while (fp->hdr_len < frame_header_size(fp->hdr, fp->hdr_len) && pos < len) {
+                fp->hdr[fp->hdr_len++] = data[pos++];
+                fp->header_bytes++;
+            }
+            if (fp->hdr_len < frame_header_size(fp->hdr, fp->hdr_len)) {
+                break;
+            }
+
+            err = frame_header_decode(fp->hdr, fp->hdr_len, &fp->header);
+            if (err != ERR_OK) {
+                break;
+            }
+            if (fp->header.version == 1) {
+                fp->header.sequence = fp->frames;
+            }
+            err = fp->begin(fp->arg, &fp->header);
+            if (err != ERR_OK) {
+                break;
+            }
+            fp->in_frame = 1;
+            fp->remaining = fp->header.length;
+            if (fp->remaining == 0) {
+                err = frame_finish(fp);
+                if (err != ERR_OK) {
+                    break;
+                }
+            }
+            continue;
+        }
+
+        {
+            u32_t n = (u32_t)LWIP_MIN(fp->remaining, (u64_t)(len - pos));
+
+            err = fp->data(fp->arg, data + pos, n);
+            if (err != ERR_OK) {
+                break;
+            }
+            pos += n;
+            fp->remaining -= n;
+            if (fp->remaining == 0) {
+                err = frame_finish(fp);
+                if (err != ERR_OK) {
+                    break;
+                }
+            }
+        }
+    }
+
+    *used = pos;
+    return err;
+}
+
+// Feed every segment of a pbuf chain
+err_t frame_parser_input(frame_parser_t *fp, const struct pbuf *p, u32_t *used)
+{
+    const struct pbuf *q;
+    u32_t n;
+    err_t err = ERR_OK;
+
+    *used = 0;
+    for (q = p; q != NULL; q = q->next) {
+        err = frame_parser_feed(fp, (const u8_t *)q->payload, q->len, &n);
+        *used += n;
+        if (err != ERR_OK) {
+            break;
+        }
+    }
+    return err;
+}
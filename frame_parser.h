@@ -0,0 +1,119 @@
+/******************************************************************************
+* Streaming parser for size-prefixed frames on a persistent connection
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* The byte stream is <header><payload>, repeated. Headers may straddle pbufs
+* and one pbuf may carry the end of one frame, several whole frames and the
+* start of the next. The parser hands each frame to the server through
+* begin/data/end callbacks.
+*
+* begin() may return ERR_WOULDBLOCK when there is nowhere to put the frame
+* yet. The parser then stops with the header held and the caller keeps the
+* rest of the input until it feeds it again.
+*
+* Two header formats are accepted, all fields big-endian:
+*
+*   legacy (4 bytes):  u32 length
+*   v2 (24+ bytes):    u8 0xFF, u8 version (2), u16 header length,
+*                      u32 flags, u64 length, u32 sequence, u32 stream id
+*
+* A legacy length never starts with 0xFF (that would be over 4 GB - 16 MB),
+* so the first byte tells the formats apart. The v2 header length covers
+* the whole header; fields added later go after stream id and older servers
+* skip them. A 40-byte header adds the striped upload fields:
+*
+*   v2 stripe (40):    ..., u64 offset in the object, u64 object size
+*
+* With FRAME_FLAG_VERIFY the server does not echo the payload. It stores it,
+* computes CRC32C over it and answers with a 16-byte digest trailer:
+*
+*   u32 0x43524343 ("CRCC"), u32 crc32c, u64 payload length
+*
+* Object store commands (trail260, ddr4_store.h) answer with a 24-byte
+* receipt instead:
+*
+*   u32 0x4F424A31 ("OBJ1"), u32 status, u32 object id, u32 crc32c,
+*   u64 length
+*
+* FRAME_FLAG_STORE_PUT stores the payload under stream id (0 = assign one).
+* FRAME_FLAG_STORE_GET has no payload; stream id names the object and a
+* 40-byte header gives the byte range as offset and total (0 = to the end).
+* The receipt of a GET is followed by the range.
+*
+* FRAME_FLAG_SUBSCRIBE (no payload) turns a connection into a viewer of the
+* fan-out server (trail263, ddr4_fanout.h). Each frame it is sent starts
+* with a 24-byte v2 header; a jump in sequence means frames were skipped.
+******************************************************************************/
+
+#ifndef FRAME_PARSER_H
+#define FRAME_PARSER_H
+
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+
+#define FRAME_HEADER_LEGACY_SIZE 4
+#define FRAME_HEADER_V2_SIZE 24
+#define FRAME_HEADER_V2_STRIPE_SIZE 40
+#define FRAME_HEADER_MAX 64
+#define FRAME_HEADER_V2_MARKER 0xFF
+
+// v2 flags
+#define FRAME_FLAG_ECHO_COPY      0x00000001 // Echo through the lwIP heap
+#define FRAME_FLAG_ECHO_ZERO_COPY 0x00000002 // Echo straight from DDR4
+#define FRAME_FLAG_COMPRESSED     0x00000004 // Payload is compressed, stored as-is
+#define FRAME_FLAG_VERIFY         0x00000008 // Reply with a digest trailer instead of the echo
+#define FRAME_FLAG_BENCH_SINK     0x00000010 // Benchmark: client -> board only
+#define FRAME_FLAG_BENCH_SOURCE   0x00000020 // Benchmark: board -> client only (both = bidirectional)
+#define FRAME_FLAG_STRIPE         0x00000040 // One stripe of a multi-connection upload (stream id = object)
+#define FRAME_FLAG_STORE_PUT      0x00000080 // Keep the payload in the object store (stream id = object)
+#define FRAME_FLAG_STORE_GET      0x00000100 // Send a stored object back, no payload
+#define FRAME_FLAG_SUBSCRIBE      0x00000200 // Receive the published frames, no payload
+
+#define FRAME_DIGEST_MAGIC 0x43524343
+#define FRAME_DIGEST_SIZE 16
+
+#define FRAME_RECEIPT_MAGIC 0x4F424A31
+#define FRAME_RECEIPT_SIZE 24
+
+typedef struct {
+    u8_t version;           // 1 = legacy 4-byte header, 2 = v2
+    u16_t size;             // Header bytes on the wire
+    u32_t flags;
+    u64_t length;           // Payload bytes
+    u32_t sequence;         // Legacy: frame index on the connection
+    u32_t stream_id;        // Legacy: 0
+    u64_t offset;           // Stripe offset, 0 unless the header carries it
+    u64_t total;            // Object size, 0 unless the header carries it
+} frame_header_t;
+
+u32_t frame_header_size(const u8_t *buf, u32_t have);
+err_t frame_header_decode(const u8_t *buf, u32_t len, frame_header_t *hdr);
+err_t frame_header_from_pbuf(const struct pbuf *p, frame_header_t *hdr);
+void frame_header_encode(u8_t *out, const frame_header_t *hdr);
+void frame_digest_encode(u8_t *out, u32_t crc, u64_t length);
+void frame_receipt_encode(u8_t *out, u32_t status, u32_t id, u32_t crc, u64_t length);
+
+typedef err_t (*frame_begin_fn)(void *arg, const frame_header_t *hdr);
+typedef err_t (*frame_data_fn)(void *arg, const u8_t *data, u32_t len);
+typedef err_t (*frame_end_fn)(void *arg);
+
+typedef struct {
+    frame_begin_fn begin;
+    frame_data_fn data;
+    frame_end_fn end;
+    void *arg;
+    u8_t hdr[FRAME_HEADER_MAX];
+    u8_t hdr_len;           // Header bytes collected so far
+    u8_t in_frame;          // 1 = begin() accepted the frame, payload follows
+    frame_header_t header;  // Header of the current frame
+    u64_t remaining;        // Payload bytes still to come
+    u32_t frames;           // Frames completed
+    u32_t header_bytes;     // Header bytes consumed (for receive window credit)
+} frame_parser_t;
+
+void frame_parser_init(frame_parser_t *fp, frame_begin_fn begin, frame_data_fn data,
+                       frame_end_fn end, void *arg);
+err_t frame_parser_feed(frame_parser_t *fp, const u8_t *data, u32_t len, u32_t *used);
+err_t frame_parser_input(frame_parser_t *fp, const struct pbuf *p, u32_t *used);
+
+#endif
@@ -0,0 +1,86 @@
+/******************************************************************************
+* Host build main loop: runs one echo server on lwIP's unix tap port
+*
+* Mirrors the Xilinx lwIP template: init the stack, start the application,
+* then poll the interface, run timers and call transfer_data() forever.
+* HOST_APP_INIT names the server's init function (set per target in CMake).
+******************************************************************************/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lwip/init.h"
+#include "lwip/netif.h"
+#include "lwip/timeouts.h"
+#include "lwip/ip_addr.h"
+#include "netif/tapif.h"
+
+#include "host_platform.h"
+
+#ifndef HOST_APP_INIT
+#define HOST_APP_INIT start_application
+#endif
+
+// Same addressing as the board, host side of tap0 is the gateway
+#define HOST_DEFAULT_IP "192.168.1.10"
+#define HOST_DEFAULT_NETMASK "255.255.255.0"
+#define HOST_DEFAULT_GW "192.168.1.1"
+
+int HOST_APP_INIT();
+int transfer_data();
+
+static struct netif server_netif;
+static volatile sig_atomic_t host_stop;
+
+static void host_on_signal(int sig) {
+    (void)sig;
+    host_stop = 1;
+}
+
+static const char *env_or(const char *name, const char *def) {
+    const char *v = getenv(name);
+    return v ? v : def;
+}
+
+int main(void) {
+    ip4_addr_t ipaddr, netmask, gw;
+
+    if (host_ddr4_init() != 0) {
+        return 1;
+    }
+
+    if (!ip4addr_aton(env_or("HOST_IP", HOST_DEFAULT_IP), &ipaddr) ||
+        !ip4addr_aton(env_or("HOST_NETMASK", HOST_DEFAULT_NETMASK), &netmask) ||
+        !ip4addr_aton(env_or("HOST_GW", HOST_DEFAULT_GW), &gw)) {
+        fprintf(stderr, "Invalid HOST_IP/HOST_NETMASK/HOST_GW\n");
+        return 1;
+    }
+
+    lwip_init();
+
+    // tapif uses the interface named by PRECONFIGURED_TAPIF if set, else creates tap0
+    if (!netif_add(&server_netif, &ipaddr, &netmask, &gw, NULL, tapif_init, netif_input)) {
+        fprintf(stderr, "Error adding tap interface\n");
+        return 1;
+    }
+    netif_set_default(&server_netif);
+    netif_set_up(&server_netif);
+    netif_set_link_up(&server_netif);
+
+    printf("Board IP: %s\n", ip4addr_ntoa(&ipaddr));
+    HOST_APP_INIT();
+
+    // Ctrl-C leaves the loop so the cache mock counters get printed
+    signal(SIGINT, host_on_signal);
+    signal(SIGTERM, host_on_signal);
+
+    while (!host_stop) {
+        tapif_select(&server_netif);
+        sys_check_timeouts();
+        transfer_data();
+    }
+    host_cache_report();
+    host_lwip_report();
+    return 0;
+}
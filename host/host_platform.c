@@ -0,0 +1,106 @@
+/******************************************************************************
+* Host build platform: DDR4 emulation and board shims
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "host_platform.h"
+#include "xil_cache.h"
+#include "xtime_l.h"
+#include "lwip/opt.h"
+#include "lwip/stats.h"
+#include "lwip/memp.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+static const struct {
+    UINTPTR base;
+    size_t size;
+} host_ddr4_regions[] = {
+    { HOST_DDR4_LOW_BASE, HOST_DDR4_LOW_SIZE },
+    { HOST_DDR4_HIGH_BASE, HOST_DDR4_HIGH_SIZE },
+};
+
+// Reserve the DDR4 windows lazily; pages are only backed once touched
+int host_ddr4_init(void) {
+    size_t i;
+
+    for (i = 0; i < sizeof(host_ddr4_regions) / sizeof(host_ddr4_regions[0]); i++) {
+        void *want = (void *)host_ddr4_regions[i].base;
+        void *got = mmap(want, host_ddr4_regions[i].size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+        if (got != want) {
+            fprintf(stderr, "Unable to map emulated DDR4 at %p (%zu bytes)\n",
+                    want, host_ddr4_regions[i].size);
+            if (got != MAP_FAILED) {
+                munmap(got, host_ddr4_regions[i].size);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void XTime_GetTime(XTime *xtime_global) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *xtime_global = (XTime)ts.tv_sec * COUNTS_PER_SECOND + (XTime)ts.tv_nsec;
+}
+
+// Caches are coherent here; only count what the board would have paid for
+host_cache_counters_t host_cache_counters;
+
+void Xil_DCacheFlush(void) {
+    host_cache_counters.full_flushes++;
+}
+
+void Xil_DCacheFlushRange(INTPTR adr, u32 len) {
+    (void)adr;
+    host_cache_counters.range_flushes++;
+    host_cache_counters.range_bytes += len;
+}
+
+void Xil_DCacheInvalidateRange(INTPTR adr, u32 len) {
+    (void)adr;
+    host_cache_counters.invalidates++;
+    host_cache_counters.invalidate_bytes += len;
+}
+
+void Xil_ICacheInvalidate(void) {
+}
+
+void host_cache_report(void) {
+    printf("Host cache mock: %llu full flushes, %llu range flushes (%llu bytes), %llu invalidates (%llu bytes)\n",
+           (unsigned long long)host_cache_counters.full_flushes,
+           (unsigned long long)host_cache_counters.range_flushes,
+           (unsigned long long)host_cache_counters.range_bytes,
+           (unsigned long long)host_cache_counters.invalidates,
+           (unsigned long long)host_cache_counters.invalidate_bytes);
+}
+
+// Heap and pool high-water marks against what the configuration reserves,
+// plus allocation failures (each one an ERR_MEM somewhere in the stack).
+// Only built with -DLWIP_STATS=1, as lwip_autotune.py does.
+void host_lwip_report(void) {
+#if LWIP_STATS && MEM_STATS && MEMP_STATS
+    unsigned long pool_bytes = 0, pool_peak = 0, pool_err = 0;
+    int i;
+
+    for (i = 0; i < MEMP_MAX; i++) {
+        const struct memp_desc *desc = memp_pools[i];
+
+        pool_bytes += (unsigned long)desc->num * desc->size;
+        pool_peak += (unsigned long)desc->stats->max * desc->size;
+        pool_err += desc->stats->err;
+    }
+    printf("lwIP memory: heap %lu/%lu bytes peak, %lu errors; pools %lu/%lu bytes peak, %lu errors\n",
+           (unsigned long)lwip_stats.mem.max, (unsigned long)MEM_SIZE, (unsigned long)lwip_stats.mem.err,
+           pool_peak, pool_bytes, pool_err);
+#endif
+}
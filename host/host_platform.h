@@ -0,0 +1,30 @@
+/******************************************************************************
+* Host build platform: DDR4 emulation and board shims
+******************************************************************************/
+
+#ifndef HOST_PLATFORM_H
+#define HOST_PLATFORM_H
+
+// The servers address DDR4 through fixed 32-bit physical addresses, so the
+// host maps anonymous memory at exactly those addresses.
+#define HOST_DDR4_LOW_BASE  0x10000000   // trail06_1 / trail251 buffers
+#define HOST_DDR4_LOW_SIZE  0x08000000   // 128MB
+#define HOST_DDR4_HIGH_BASE 0x8F000000   // Trace ring + upload arena
+#define HOST_DDR4_HIGH_SIZE 0x61000000   // Up to 0xF0000000
+
+// Maintenance calls seen by the Xil_DCache* shims
+typedef struct {
+    unsigned long long full_flushes;
+    unsigned long long range_flushes;
+    unsigned long long range_bytes;
+    unsigned long long invalidates;
+    unsigned long long invalidate_bytes;
+} host_cache_counters_t;
+
+extern host_cache_counters_t host_cache_counters;
+
+int host_ddr4_init(void);
+void host_cache_report(void);
+void host_lwip_report(void);
+
+#endif
@@ -0,0 +1,78 @@
+/******************************************************************************
+* lwIP options for the host build (NO_SYS raw API, unix tap port)
+*
+* Sizes follow the board's lwipopts.h so host numbers are comparable. The
+* tunables below can be overridden with -D (lwip_autotune.py sweeps them).
+******************************************************************************/
+
+#ifndef LWIPOPTS_H
+#define LWIPOPTS_H
+
+#define NO_SYS                      1
+#define LWIP_TIMERS                 1
+#define LWIP_SOCKET                 0
+#define LWIP_NETCONN                0
+#define SYS_LIGHTWEIGHT_PROT        0
+
+#define LWIP_IPV4                   1
+#define LWIP_IPV6                   0
+#define LWIP_ARP                    1
+#define LWIP_ETHERNET               1
+#define LWIP_ICMP                   1
+#define LWIP_DHCP                   0
+#define LWIP_TCP                    1
+#define LWIP_UDP                    1
+
+#define MEM_ALIGNMENT               8
+#ifndef MEM_SIZE
+#define MEM_SIZE                    (512 * 1024)
+#endif
+#ifndef MEMP_NUM_PBUF
+#define MEMP_NUM_PBUF               1024
+#endif
+#define MEMP_NUM_TCP_PCB            32
+#define MEMP_NUM_TCP_PCB_LISTEN     8
+#ifndef MEMP_NUM_TCP_SEG
+#define MEMP_NUM_TCP_SEG            1024
+#endif
+#define MEMP_NUM_SYS_TIMEOUT        16
+#ifndef PBUF_POOL_SIZE
+#define PBUF_POOL_SIZE              2048
+#endif
+#ifndef PBUF_POOL_BUFSIZE
+#define PBUF_POOL_BUFSIZE           1700
+#endif
+
+#ifndef TCP_MSS
+#define TCP_MSS                     1446
+#endif
+#ifndef TCP_SND_BUF
+#define TCP_SND_BUF                 (32 * TCP_MSS)
+#endif
+#ifndef TCP_SND_QUEUELEN
+#define TCP_SND_QUEUELEN            (4 * TCP_SND_BUF / TCP_MSS)
+#endif
+#ifndef LWIP_WND_SCALE
+#define LWIP_WND_SCALE              1
+#endif
+#ifndef TCP_RCV_SCALE
+#define TCP_RCV_SCALE               2
+#endif
+#ifndef TCP_WND
+#define TCP_WND                     (64 * TCP_MSS)
+#endif
+#define TCP_QUEUE_OOSEQ             1
+#define LWIP_TCP_TIMESTAMPS         0
+
+#define LWIP_NETIF_STATUS_CALLBACK  1
+#ifndef LWIP_STATS
+#define LWIP_STATS                  0
+#endif
+#if LWIP_STATS
+// Off by default with NO_SYS; host_lwip_report() needs both
+#define MEM_STATS                   1
+#define MEMP_STATS                  1
+#endif
+// LWIP_DEBUG stays undefined: lwIP tests it with #ifdef, so even 0 turns it on
+
+#endif
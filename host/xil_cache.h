@@ -0,0 +1,18 @@
+/******************************************************************************
+* Host build shim for the Xilinx standalone BSP
+*
+* The host has coherent caches, so maintenance calls only bump the counters
+* in host_platform.h.
+******************************************************************************/
+
+#ifndef XIL_CACHE_H
+#define XIL_CACHE_H
+
+#include "xil_types.h"
+
+void Xil_DCacheFlush(void);
+void Xil_DCacheFlushRange(INTPTR adr, u32 len);
+void Xil_DCacheInvalidateRange(INTPTR adr, u32 len);
+void Xil_ICacheInvalidate(void);
+
+#endif
@@ -0,0 +1,10 @@
+/******************************************************************************
+* Host build shim for the Xilinx standalone BSP
+******************************************************************************/
+
+#ifndef XIL_EXCEPTION_H
+#define XIL_EXCEPTION_H
+
+#include "xil_types.h"
+
+#endif
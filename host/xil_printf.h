@@ -0,0 +1,12 @@
+/******************************************************************************
+* Host build shim for the Xilinx standalone BSP
+******************************************************************************/
+
+#ifndef XIL_PRINTF_H
+#define XIL_PRINTF_H
+
+#include <stdio.h>
+
+#define xil_printf printf
+
+#endif
@@ -0,0 +1,10 @@
+/******************************************************************************
+* Host build shim for the Xilinx standalone BSP
+******************************************************************************/
+
+#ifndef XPARAMETERS_H
+#define XPARAMETERS_H
+
+#include "xil_types.h"
+
+#endif
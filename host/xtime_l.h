@@ -0,0 +1,18 @@
+/******************************************************************************
+* Host build shim for the Xilinx standalone BSP
+*
+* XTime counts nanoseconds from CLOCK_MONOTONIC.
+******************************************************************************/
+
+#ifndef XTIME_L_H
+#define XTIME_L_H
+
+#include "xil_types.h"
+
+typedef u64 XTime;
+
+#define COUNTS_PER_SECOND 1000000000ULL
+
+void XTime_GetTime(XTime *xtime_global);
+
+#endif
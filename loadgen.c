@@ -0,0 +1,456 @@
+/******************************************************************************
+* Native load generator for the echo servers
+*
+* Replaces the stop-and-wait Python clients when the goal is to saturate the
+* board: N non-blocking connections on one epoll loop, the input file mmap'd
+* and sent straight from the mapping, up to a window of unacknowledged echo
+* bytes per connection, and every echo byte compared against the mapping as
+* it arrives. Per-send latency (send -> echo of its last byte) and 100 ms
+* throughput samples are summarised as percentiles on stdout and in a CSV.
+*
+* Linux only. Build on a workstation:
+*   gcc -O2 -o loadgen loadgen.c
+*   ./loadgen -c 4 -w 262144 -o run.csv 192.168.1.10 6001 input_video.mp4
+*
+* Each connection sends one header (legacy 4-byte length, or the 24-byte v2
+* header with -2 / for files over 4 GB) followed by the file, like
+* trail061.py, and expects the whole file echoed back.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_CONNS 1
+#define DEFAULT_WINDOW (256 * 1024)    // Unechoed bytes allowed per connection
+#define DEFAULT_CHUNK (64 * 1024)      // Largest single send()
+#define RECV_BUF_SIZE (256 * 1024)
+#define INFLIGHT_SENDS 4096            // Sends tracked for latency per connection
+#define RATE_INTERVAL_NS 100000000ULL  // Throughput sample period
+#define MAX_EVENTS 64
+
+typedef struct {
+    uint64_t end;                      // File offset just past this send
+    uint64_t ns;                       // When it went out
+} send_mark_t;
+
+typedef struct {
+    int fd;
+    int id;
+    int want_out;                      // EPOLLOUT currently registered
+    uint8_t header[24];
+    uint32_t header_len;
+    uint32_t header_sent;
+    uint64_t sent;                     // File bytes handed to send()
+    uint64_t echoed;                   // File bytes received and checked
+    uint64_t mismatches;               // Bytes that differed
+    uint64_t first_mismatch;
+    send_mark_t marks[INFLIGHT_SENDS];
+    uint32_t mark_head;
+    uint32_t mark_count;
+    uint64_t start_ns;
+    uint64_t done_ns;
+    int done;
+} lg_conn_t;
+
+typedef struct {
+    uint64_t *v;
+    size_t n;
+    size_t cap;
+} sample_set_t;
+
+static const uint8_t *file_map;
+static uint64_t file_size;
+static uint64_t window = DEFAULT_WINDOW;
+static uint64_t chunk = DEFAULT_CHUNK;
+static int use_v2;
+static int verify = 1;
+static sample_set_t latency_ns;
+static sample_set_t rate_bps;
+static uint8_t recv_buf[RECV_BUF_SIZE];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sample_add(sample_set_t *s, uint64_t v) {
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 4096;
+        s->v = realloc(s->v, s->cap * sizeof(uint64_t));
+        if (!s->v) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    s->v[s->n++] = v;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const sample_set_t *s, double p) {
+    size_t i;
+    if (s->n == 0) {
+        return 0;
+    }
+    i = (size_t)(p / 100.0 * (double)(s->n - 1) + 0.5);
+    return s->v[i];
+}
+
+static double mean(const sample_set_t *s) {
+    double sum = 0;
+    size_t i;
+    for (i = 0; i < s->n; i++) {
+        sum += (double)s->v[i];
+    }
+    return s->n ? sum / (double)s->n : 0;
+}
+
+static void put_be32(uint8_t *b, uint32_t v) {
+    b[0] = (uint8_t)(v >> 24);
+    b[1] = (uint8_t)(v >> 16);
+    b[2] = (uint8_t)(v >> 8);
+    b[3] = (uint8_t)v;
+}
+
+// Same layouts as frame_parser.h
+static void build_header(lg_conn_t *c) {
+    if (!use_v2 && file_size < 0xFF000000ULL) {
+        put_be32(c->header, (uint32_t)file_size);
+        c->header_len = 4;
+        return;
+    }
+    memset(c->header, 0, sizeof(c->header));
+    c->header[0] = 0xFF;
+    c->header[1] = 2;
+    c->header[3] = 24;
+    put_be32(c->header + 8, (uint32_t)(file_size >> 32));
+    put_be32(c->header + 12, (uint32_t)file_size);
+    put_be32(c->header + 20, (uint32_t)c->id);
+    c->header_len = 24;
+}
+
+static int open_conn(lg_conn_t *c, const struct addrinfo *ai, int epfd) {
+    struct epoll_event ev;
+    int one = 1;
+    int bufsize = 4 * 1024 * 1024;
+
+    c->fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(c->fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    if (connect(c->fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        perror("connect");
+        return -1;
+    }
+    build_header(c);
+    c->start_ns = now_ns();
+    c->want_out = 1;
+
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = c;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+static void set_want_out(lg_conn_t *c, int epfd, int want) {
+    struct epoll_event ev;
+
+    if (c->want_out == want) {
+        return;
+    }
+    ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_out = want;
+}
+
+// Send path: header, then the file from the mapping while the window allows
+static int do_send(lg_conn_t *c, int epfd) {
+    while (c->header_sent < c->header_len) {
+        ssize_t n = send(c->fd, c->header + c->header_sent, c->header_len - c->header_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        c->header_sent += (uint32_t)n;
+    }
+
+    while (c->sent < file_size && c->sent - c->echoed < window && c->mark_count < INFLIGHT_SENDS) {
+        uint64_t len = file_size - c->sent;
+        ssize_t n;
+
+        if (len > chunk) len = chunk;
+        if (len > window - (c->sent - c->echoed)) len = window - (c->sent - c->echoed);
+        n = send(c->fd, file_map + c->sent, (size_t)len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        c->sent += (uint64_t)n;
+        c->marks[(c->mark_head + c->mark_count) % INFLIGHT_SENDS].end = c->sent;
+        c->marks[(c->mark_head + c->mark_count) % INFLIGHT_SENDS].ns = now_ns();
+        c->mark_count++;
+    }
+
+    // Window full or file sent: wait for echo instead of spinning on EPOLLOUT
+    set_want_out(c, epfd, c->sent < file_size && c->sent - c->echoed < window &&
+                          c->mark_count < INFLIGHT_SENDS);
+    return 0;
+}
+
+// Receive path: compare against the mapping as bytes arrive
+static int do_recv(lg_conn_t *c, int epfd, uint64_t *interval_bytes) {
+    for (;;) {
+        uint64_t room = file_size - c->echoed;
+        ssize_t n;
+        uint64_t now;
+
+        if (room == 0) {
+            return 0;
+        }
+        n = recv(c->fd, recv_buf, room < RECV_BUF_SIZE ? (size_t)room : RECV_BUF_SIZE, 0);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (n == 0) {
+            fprintf(stderr, "conn %d: server closed after %llu/%llu echo bytes\n", c->id,
+                    (unsigned long long)c->echoed, (unsigned long long)file_size);
+            return -1;
+        }
+        if (verify && memcmp(recv_buf, file_map + c->echoed, (size_t)n) != 0) {
+            ssize_t i;
+            for (i = 0; i < n; i++) {
+                if (recv_buf[i] != file_map[c->echoed + i]) {
+                    if (c->mismatches == 0) {
+                        c->first_mismatch = c->echoed + i;
+                    }
+                    c->mismatches++;
+                }
+            }
+        }
+        c->echoed += (uint64_t)n;
+        *interval_bytes += (uint64_t)n;
+
+        now = now_ns();
+        while (c->mark_count > 0 && c->marks[c->mark_head].end <= c->echoed) {
+            sample_add(&latency_ns, now - c->marks[c->mark_head].ns);
+            c->mark_head = (c->mark_head + 1) % INFLIGHT_SENDS;
+            c->mark_count--;
+        }
+        if (c->echoed == file_size) {
+            c->done = 1;
+            c->done_ns = now;
+            return 0;
+        }
+        if (!c->want_out && c->sent < file_size) {
+            set_want_out(c, epfd, 1);
+        }
+    }
+}
+
+static void write_csv(const char *path, double seconds, uint64_t bytes) {
+    FILE *f = fopen(path, "w");
+    static const double pcts[] = { 50, 90, 99, 99.9 };
+    size_t i;
+
+    if (!f) {
+        perror(path);
+        return;
+    }
+    fprintf(f, "metric,unit,count,mean,p50,p90,p99,p99.9,max\n");
+    fprintf(f, "latency,us,%zu,%.1f", latency_ns.n, mean(&latency_ns) / 1e3);
+    for (i = 0; i < 4; i++) {
+        fprintf(f, ",%.1f", (double)percentile(&latency_ns, pcts[i]) / 1e3);
+    }
+    fprintf(f, ",%.1f\n", (double)percentile(&latency_ns, 100) / 1e3);
+    fprintf(f, "throughput,Mbps,%zu,%.2f", rate_bps.n, mean(&rate_bps) / 1e6);
+    for (i = 0; i < 4; i++) {
+        fprintf(f, ",%.2f", (double)percentile(&rate_bps, pcts[i]) / 1e6);
+    }
+    fprintf(f, ",%.2f\n", (double)percentile(&rate_bps, 100) / 1e6);
+    fprintf(f, "total,Mbps,1,%.2f,,,,,\n", seconds > 0 ? (double)bytes * 8 / seconds / 1e6 : 0);
+    fclose(f);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-c conns] [-w window] [-s chunk] [-2] [-n] [-o out.csv] host port file\n"
+            "  -c  concurrent connections (default %d)\n"
+            "  -w  unechoed bytes allowed per connection (default %d)\n"
+            "  -s  largest single send (default %d)\n"
+            "  -2  send the 24-byte v2 header instead of the 4-byte length\n"
+            "  -n  do not verify the echo\n"
+            "  -o  write latency/throughput percentiles as CSV\n",
+            prog, DEFAULT_CONNS, DEFAULT_WINDOW, DEFAULT_CHUNK);
+}
+
+int main(int argc, char **argv) {
+    int conns = DEFAULT_CONNS;
+    const char *csv = NULL;
+    struct addrinfo hints, *ai;
+    struct epoll_event events[MAX_EVENTS];
+    struct stat st;
+    lg_conn_t *c;
+    uint64_t start, last_rate, interval_bytes = 0, total_echoed = 0, mismatches = 0;
+    int opt, fd, epfd, i, active, failed = 0;
+    double seconds;
+
+    while ((opt = getopt(argc, argv, "c:w:s:2no:")) != -1) {
+        switch (opt) {
+        case 'c': conns = atoi(optarg); break;
+        case 'w': window = strtoull(optarg, NULL, 0); break;
+        case 's': chunk = strtoull(optarg, NULL, 0); break;
+        case '2': use_v2 = 1; break;
+        case 'n': verify = 0; break;
+        case 'o': csv = optarg; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (argc - optind != 3 || conns < 1 || window == 0 || chunk == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    fd = open(argv[optind + 2], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        perror(argv[optind + 2]);
+        return 1;
+    }
+    file_size = (uint64_t)st.st_size;
+    file_map = mmap(NULL, (size_t)file_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (file_map == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    madvise((void *)file_map, (size_t)file_size, MADV_SEQUENTIAL);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(argv[optind], argv[optind + 1], &hints, &ai) != 0) {
+        fprintf(stderr, "cannot resolve %s\n", argv[optind]);
+        return 1;
+    }
+
+    epfd = epoll_create1(0);
+    c = calloc((size_t)conns, sizeof(lg_conn_t));
+    if (epfd < 0 || !c) {
+        perror("setup");
+        return 1;
+    }
+
+    printf("%d connection(s) to %s:%s, %llu bytes each, window %llu, chunk %llu\n", conns,
+           argv[optind], argv[optind + 1], (unsigned long long)file_size,
+           (unsigned long long)window, (unsigned long long)chunk);
+
+    start = last_rate = now_ns();
+    for (i = 0; i < conns; i++) {
+        c[i].id = i;
+        if (open_conn(&c[i], ai, epfd) < 0) {
+            return 1;
+        }
+    }
+    active = conns;
+
+    while (active > 0) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, 100);
+        uint64_t now;
+
+        for (i = 0; i < n; i++) {
+            lg_conn_t *conn = (lg_conn_t *)events[i].data.ptr;
+            int err = 0;
+
+            if (conn->done || conn->fd < 0) {
+                continue;
+            }
+            errno = 0;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                err = (events[i].events & EPOLLIN) ? 0 : -1;
+            }
+            if (!err && (events[i].events & EPOLLOUT)) {
+                err = do_send(conn, epfd);
+            }
+            if (!err && (events[i].events & EPOLLIN)) {
+                err = do_recv(conn, epfd, &interval_bytes);
+            }
+            if (err || conn->done) {
+                if (err) {
+                    fprintf(stderr, "conn %d: %s\n", conn->id, errno ? strerror(errno) : "closed");
+                    failed++;
+                }
+                epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+                close(conn->fd);
+                conn->fd = -1;
+                conn->done = 1;
+                active--;
+            }
+        }
+
+        now = now_ns();
+        if (now - last_rate >= RATE_INTERVAL_NS) {
+            sample_add(&rate_bps, interval_bytes * 8 * 1000000000ULL / (now - last_rate));
+            interval_bytes = 0;
+            last_rate = now;
+        }
+    }
+    if (interval_bytes > 0 && now_ns() > last_rate) {
+        sample_add(&rate_bps, interval_bytes * 8 * 1000000000ULL / (now_ns() - last_rate));
+    }
+    seconds = (double)(now_ns() - start) / 1e9;
+
+    for (i = 0; i < conns; i++) {
+        total_echoed += c[i].echoed;
+        mismatches += c[i].mismatches;
+        if (c[i].mismatches) {
+            printf("conn %d: %llu bytes differ, first at offset %llu\n", i,
+                   (unsigned long long)c[i].mismatches, (unsigned long long)c[i].first_mismatch);
+        }
+    }
+    qsort(latency_ns.v, latency_ns.n, sizeof(uint64_t), cmp_u64);
+    qsort(rate_bps.v, rate_bps.n, sizeof(uint64_t), cmp_u64);
+
+    printf("Echoed %llu bytes in %.2f s: %.2f Mbps aggregate\n", (unsigned long long)total_echoed,
+           seconds, seconds > 0 ? (double)total_echoed * 8 / seconds / 1e6 : 0);
+    printf("Latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f (%zu sends)\n",
+           percentile(&latency_ns, 50) / 1e3, percentile(&latency_ns, 90) / 1e3,
+           percentile(&latency_ns, 99) / 1e3, percentile(&latency_ns, 99.9) / 1e3,
+           percentile(&latency_ns, 100) / 1e3, latency_ns.n);
+    printf("Throughput Mbps per %llu ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+           (unsigned long long)(RATE_INTERVAL_NS / 1000000),
+           percentile(&rate_bps, 50) / 1e6, percentile(&rate_bps, 90) / 1e6,
+           percentile(&rate_bps, 99) / 1e6, percentile(&rate_bps, 100) / 1e6);
+    if (verify) {
+        printf("%s\n", mismatches ? "Echo MISMATCH" : "Echo verified");
+    }
+    if (csv) {
+        write_csv(csv, seconds, total_echoed);
+    }
+
+    freeaddrinfo(ai);
+    munmap((void *)file_map, (size_t)file_size);
+    close(fd);
+    free(c);
+    return (failed || mismatches) ? 1 : 0;
+}
@@ -0,0 +1,321 @@
+import csv
+import itertools
+import os
+import random
+import re
+import signal
+import statistics
+import subprocess
+import sys
+import time
+
+# Sweeps the lwipopts.h tunables against the host build of an echo server.
+# Every configuration is built with -D overrides of host/lwipopts.h (plus
+# LWIP_STATS so the server prints heap/pool high-water marks and allocation
+# failures on exit), runs the same loadgen transfer RUNS times over the tap
+# interface, and is ranked by median echo throughput. The best configuration
+# whose reserved heap + pools fit the RAM budget is written out as lwipopts.h.
+#
+# Needs the tap setup from README.md (tap0 up as 192.168.1.1) and cmake/gcc:
+#   python3 lwip_autotune.py /path/to/lwip [RAM budget in KB]
+# Results land in autotune/: report.md, results.csv, lwipopts.h, logs.
+
+# --- Configuration ---
+LWIP_DIR = None                    # First argument
+RAM_BUDGET = 8 * 1024 * 1024       # Bytes of lwIP heap + pools (second argument, in KB)
+SERVER = 'trail06_1'               # Any add_trail_server target that echoes the upload
+SERVER_IP = '192.168.1.10'
+SERVER_PORT = 6001
+TAPIF = 'tap0'
+WORKLOAD_SIZE = 64 * 1024 * 1024   # trail06_1 takes up to 100 MB
+WORKLOAD_SEED = 1                  # Same bytes for every configuration
+CONNS = 1                          # trail06_1 serves one connection at a time
+WINDOW = 256 * 1024                # loadgen unechoed bytes per connection
+RUNS = 3                           # Throughput is the median of these
+RUN_TIMEOUT = 120                  # Seconds before a stuck transfer counts as failed
+SERVER_START_DELAY = 1.0
+WORK_DIR = 'autotune'
+FULL_GRID = False                  # False: one axis at a time around BASELINE, then the winners combined
+
+REPO_DIR = os.path.dirname(os.path.abspath(__file__))
+LWIPOPTS = os.path.join(REPO_DIR, 'host', 'lwipopts.h')
+
+# TCP_SND_BUF and TCP_WND are in multiples of TCP_MSS, so they follow the MSS
+BASELINE = {
+    'TCP_MSS': 1446,
+    'TCP_SND_BUF': 32,
+    'TCP_WND': 64,
+    'PBUF_POOL_SIZE': 2048,
+    'PBUF_POOL_BUFSIZE': 1700,
+    'MEM_SIZE': 512 * 1024,
+    'LWIP_WND_SCALE': 1,
+}
+
+AXES = {
+    'TCP_MSS': [536, 1024, 1446],
+    'TCP_SND_BUF': [8, 16, 32, 64],
+    'TCP_WND': [16, 32, 44, 64],
+    'PBUF_POOL_SIZE': [256, 512, 1024, 2048],
+    'PBUF_POOL_BUFSIZE': [1600, 1700, 2048],
+    'MEM_SIZE': [128 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024],
+    'LWIP_WND_SCALE': [0, 1],
+}
+
+TCP_RCV_SCALE = 2                  # As in host/lwipopts.h
+SEGMENT_HEADERS = 40 + 14          # TCP/IP + Ethernet, one segment per pool pbuf
+
+RE_ECHOED = re.compile(r'Echoed (\d+) bytes in ([\d.]+) s: ([\d.]+) Mbps aggregate')
+RE_MEMORY = re.compile(r'lwIP memory: heap (\d+)/(\d+) bytes peak, (\d+) errors; '
+                       r'pools (\d+)/(\d+) bytes peak, (\d+) errors')
+RE_STALLS = re.compile(r'(\d+) stalls|stalls (\d+)')   # ddr4_echo_report / conn_metrics_report
+
+
+def defines(cfg):
+    """Absolute -D values for one configuration."""
+    mss = cfg['TCP_MSS']
+    return {
+        'TCP_MSS': mss,
+        'TCP_SND_BUF': cfg['TCP_SND_BUF'] * mss,
+        'TCP_WND': cfg['TCP_WND'] * mss,
+        'PBUF_POOL_SIZE': cfg['PBUF_POOL_SIZE'],
+        'PBUF_POOL_BUFSIZE': cfg['PBUF_POOL_BUFSIZE'],
+        'MEM_SIZE': cfg['MEM_SIZE'],
+        'LWIP_WND_SCALE': cfg['LWIP_WND_SCALE'],
+    }
+
+
+def invalid_reason(cfg):
+    """lwIP's compile-time checks (init.c), plus the budget lower bound."""
+    d = defines(cfg)
+    if not d['LWIP_WND_SCALE'] and d['TCP_WND'] > 0xFFFF:
+        return 'TCP_WND over 64 KB without LWIP_WND_SCALE'
+    if d['LWIP_WND_SCALE'] and d['TCP_WND'] > (0xFFFF << TCP_RCV_SCALE):
+        return 'TCP_WND over the scaled maximum'
+    if d['TCP_SND_BUF'] < 2 * d['TCP_MSS']:
+        return 'TCP_SND_BUF below 2 * TCP_MSS'
+    if d['PBUF_POOL_BUFSIZE'] < d['TCP_MSS'] + SEGMENT_HEADERS:
+        return 'PBUF_POOL_BUFSIZE cannot hold a full segment'
+    if d['MEM_SIZE'] + d['PBUF_POOL_SIZE'] * d['PBUF_POOL_BUFSIZE'] > RAM_BUDGET:
+        return 'heap + pbuf pool alone exceed the RAM budget'
+    return None
+
+
+def config_key(cfg):
+    return '_'.join(f"{cfg[name]}" for name in AXES)
+
+
+def run_cmd(args, log_path, **kwargs):
+    with open(log_path, 'a') as log:
+        return subprocess.run(args, stdout=log, stderr=subprocess.STDOUT, **kwargs).returncode == 0
+
+
+def build(cfg):
+    """Configure and build SERVER with this configuration, return the binary or None."""
+    key = config_key(cfg)
+    build_dir = os.path.join(WORK_DIR, 'build-' + key)
+    log_path = os.path.join(WORK_DIR, 'logs', key + '.build.log')
+    binary = os.path.join(build_dir, SERVER)
+    if os.path.exists(binary):
+        return binary
+
+    cflags = ' '.join(f'-D{name}={value}' for name, value in defines(cfg).items())
+    cflags += ' -DLWIP_STATS=1'
+    if not run_cmd(['cmake', '-S', REPO_DIR, '-B', build_dir, f'-DLWIP_DIR={LWIP_DIR}',
+                    f'-DCMAKE_C_FLAGS={cflags}', '-DCMAKE_BUILD_TYPE=Release'], log_path):
+        return None
+    if not run_cmd(['cmake', '--build', build_dir, '--target', SERVER, '-j', str(os.cpu_count() or 1)], log_path):
+        return None
+    return binary
+
+
+def make_workload():
+    """Fixed pseudo-random payload, so every configuration moves the same bytes."""
+    path = os.path.join(WORK_DIR, 'workload.bin')
+    if os.path.exists(path) and os.path.getsize(path) == WORKLOAD_SIZE:
+        return path
+    rng = random.Random(WORKLOAD_SEED)
+    with open(path, 'wb') as f:
+        remaining = WORKLOAD_SIZE
+        while remaining > 0:
+            n = min(remaining, 1024 * 1024)
+            f.write(rng.getrandbits(8 * n).to_bytes(n, 'little'))
+            remaining -= n
+    return path
+
+
+def make_loadgen():
+    path = os.path.join(WORK_DIR, 'loadgen')
+    if not os.path.exists(path):
+        subprocess.run(['gcc', '-O2', '-o', path, os.path.join(REPO_DIR, 'loadgen.c')], check=True)
+    return path
+
+
+def run_once(binary, loadgen, workload, log_path):
+    """One transfer: (Mbps, verified, memory match, ERR_MEM count seen by the server)."""
+    env = dict(os.environ, PRECONFIGURED_TAPIF=TAPIF)
+    with open(log_path, 'w') as log:
+        server = subprocess.Popen([os.path.abspath(binary)], stdout=log, stderr=subprocess.STDOUT, env=env)
+        time.sleep(SERVER_START_DELAY)
+        try:
+            lg = subprocess.run([loadgen, '-c', str(CONNS), '-w', str(WINDOW), SERVER_IP, str(SERVER_PORT), workload],
+                                capture_output=True, text=True, timeout=RUN_TIMEOUT)
+            out = lg.stdout
+        except subprocess.TimeoutExpired:
+            out = ''
+        server.send_signal(signal.SIGINT)
+        try:
+            server.wait(timeout=10)
+        except subprocess.TimeoutExpired:
+            server.kill()
+            server.wait()
+
+    with open(log_path) as log:
+        server_out = log.read()
+    echoed = RE_ECHOED.search(out)
+    mbps = float(echoed.group(3)) if echoed else 0.0
+    verified = echoed is not None and int(echoed.group(1)) == WORKLOAD_SIZE * CONNS and 'Echo verified' in out
+    memory = RE_MEMORY.search(server_out)
+    # Both count the same tcp_write failures, whichever the server prints
+    stalls = [int(a or b) for a, b in RE_STALLS.findall(server_out)]
+    err_mem = max(server_out.count('ERR_MEM'), max(stalls) if stalls else 0)
+    return mbps, verified, memory, err_mem
+
+
+def measure(cfg, loadgen, workload):
+    """Build and run one configuration RUNS times."""
+    result = dict(cfg)
+    result.update(status='ok', mbps=0.0, peak=0, reserved=0, err_mem=0)
+
+    reason = invalid_reason(cfg)
+    if reason:
+        result['status'] = 'skipped: ' + reason
+        return result
+    binary = build(cfg)
+    if binary is None:
+        result['status'] = 'build failed'
+        return result
+
+    rates = []
+    for run in range(RUNS):
+        log_path = os.path.join(WORK_DIR, 'logs', f'{config_key(cfg)}.run{run}.log')
+        mbps, verified, memory, err_mem = run_once(binary, loadgen, workload, log_path)
+        if not verified:
+            result['status'] = 'echo failed'
+        rates.append(mbps)
+        result['err_mem'] += err_mem
+        if memory:
+            heap_peak, heap_size, heap_err, pool_peak, pool_size, pool_err = map(int, memory.groups())
+            result['peak'] = max(result['peak'], heap_peak + pool_peak)
+            result['reserved'] = heap_size + pool_size
+            result['err_mem'] += heap_err + pool_err
+    result['mbps'] = statistics.median(rates)
+    if result['status'] == 'ok' and result['reserved'] > RAM_BUDGET:
+        result['status'] = 'over budget'
+    print(f"{config_key(cfg)}: {result['status']}, {result['mbps']:.1f} Mbps, "
+          f"peak {result['peak'] // 1024} KB of {result['reserved'] // 1024} KB, ERR_MEM {result['err_mem']}")
+    return result
+
+
+def best_of(results):
+    ok = [r for r in results if r['status'] == 'ok']
+    # Fastest first; at equal speed the smaller footprint wins
+    ok.sort(key=lambda r: (-r['mbps'], r['reserved'], r['err_mem']))
+    return ok
+
+
+def sweep(loadgen, workload):
+    results = {}
+
+    def run(cfg):
+        key = config_key(cfg)
+        if key not in results:
+            results[key] = measure(cfg, loadgen, workload)
+        return results[key]
+
+    if FULL_GRID:
+        for values in itertools.product(*AXES.values()):
+            run(dict(zip(AXES, values)))
+        return list(results.values())
+
+    run(dict(BASELINE))
+    winners = dict(BASELINE)
+    for name, values in AXES.items():
+        axis = [run(dict(BASELINE, **{name: v})) for v in values]
+        ranked = best_of(axis)
+        if ranked:
+            winners[name] = ranked[0][name]
+    run(winners)
+    return list(results.values())
+
+
+def write_report(results):
+    ranked = best_of(results)
+    others = [r for r in results if r['status'] != 'ok']
+    columns = list(AXES)
+
+    with open(os.path.join(WORK_DIR, 'results.csv'), 'w', newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(columns + ['mbps', 'peak_bytes', 'reserved_bytes', 'err_mem', 'status'])
+        for r in ranked + others:
+            writer.writerow([r[c] for c in columns] + [f"{r['mbps']:.2f}", r['peak'], r['reserved'],
+                                                       r['err_mem'], r['status']])
+
+    with open(os.path.join(WORK_DIR, 'report.md'), 'w') as f:
+        f.write(f"# lwipopts.h sweep: {SERVER}, {WORKLOAD_SIZE // (1024 * 1024)} MB x {CONNS}, "
+                f"RAM budget {RAM_BUDGET // 1024} KB\n\n")
+        f.write("TCP_SND_BUF and TCP_WND in multiples of TCP_MSS. Peak and reserved are lwIP heap + pools.\n\n")
+        f.write('| rank | ' + ' | '.join(columns) + ' | Mbps | peak KB | reserved KB | ERR_MEM | status |\n')
+        f.write('|' + '---|' * (len(columns) + 6) + '\n')
+        for rank, r in enumerate(ranked + others, 1):
+            label = str(rank) if r['status'] == 'ok' else '-'
+            f.write(f"| {label} | " + ' | '.join(str(r[c]) for c in columns) +
+                    f" | {r['mbps']:.1f} | {r['peak'] // 1024} | {r['reserved'] // 1024} | {r['err_mem']} | {r['status']} |\n")
+    return ranked[0] if ranked else None
+
+
+def format_define(name, value):
+    if name in ('TCP_SND_BUF', 'TCP_WND'):
+        return f'({value} * TCP_MSS)'
+    if name == 'MEM_SIZE' and value % 1024 == 0:
+        return f'({value // 1024} * 1024)'
+    return str(value)
+
+
+def write_lwipopts(best):
+    """host/lwipopts.h with the winning values substituted."""
+    with open(LWIPOPTS) as f:
+        text = f.read()
+    for name in AXES:
+        text = re.sub(rf'^(#define {name}\s+).*$', lambda m: m.group(1) + format_define(name, best[name]),
+                      text, count=1, flags=re.M)
+    banner = (f"/* Generated by lwip_autotune.py: {SERVER} echoed {best['mbps']:.1f} Mbps, "
+              f"lwIP heap + pools {best['reserved'] // 1024} KB (peak {best['peak'] // 1024} KB) "
+              f"of a {RAM_BUDGET // 1024} KB budget, {best['err_mem']} ERR_MEM */\n")
+    with open(os.path.join(WORK_DIR, 'lwipopts.h'), 'w') as f:
+        f.write(banner + text)
+
+
+def main():
+    os.makedirs(os.path.join(WORK_DIR, 'logs'), exist_ok=True)
+    loadgen = make_loadgen()
+    workload = make_workload()
+
+    results = sweep(loadgen, workload)
+    best = write_report(results)
+    if best is None:
+        print("No configuration passed within the RAM budget, see autotune/report.md")
+        return 1
+    write_lwipopts(best)
+    print(f"Best: {config_key(best)} at {best['mbps']:.1f} Mbps, "
+          f"{best['reserved'] // 1024} KB reserved -> {WORK_DIR}/lwipopts.h")
+    return 0
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print("usage: lwip_autotune.py /path/to/lwip [RAM budget KB]")
+        sys.exit(2)
+    LWIP_DIR = os.path.abspath(sys.argv[1])
+    if len(sys.argv) > 2:
+        RAM_BUDGET = int(sys.argv[2]) * 1024
+    sys.exit(main())
@@ -0,0 +1,115 @@
+/******************************************************************************
+* Chain-aware pbuf ingest
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include "pbuf_iov.h"
+#include "ddr4_copy.h"
+#include "crc32c.h"
+
+// Position the iterator on byte offset of the chain, limited to len bytes
+void pbuf_iter_init(pbuf_iter_t *it, const struct pbuf *p, u32_t offset, u32_t len)
+{
+    while (p != NULL && offset >= p->len) {
+        offset -= p->len;
+        p = p->next;
+    }
+    it->q = p;
+    it->off = offset;
+    it->left = (p != NULL) ? len : 0;
+}
+
+// Next contiguous piece of the range. Returns its length, 0 when done.
+u32_t pbuf_iter_next(pbuf_iter_t *it, const u8_t **data)
+{
+    u32_t n;
+
+    while (it->q != NULL && it->off >= it->q->len) {
+        it->off = 0;
+        it->q = it->q->next;
+    }
+    if (it->q == NULL || it->left == 0) {
+        return 0;
+    }
+    n = LWIP_MIN((u32_t)it->q->len - it->off, it->left);
+    *data = (const u8_t *)it->q->payload + it->off;
+    it->off += n;
+    it->left -= n;
+    return n;
+}
+
+// Copy the range to dst: one kernel for the whole batch, one dirty range.
+// The cache layer's flush fences the streaming stores. Returns bytes stored,
+// less than len only if the chain is shorter.
+u32_t pbuf_iov_store(const struct pbuf *p, u32_t offset, u32_t len, UINTPTR dst, ddr4_cache_t *cache)
+{
+    ddr4_copy_kernel_t kernel = ddr4_copy_pick(len);
+    pbuf_iter_t it;
+    const u8_t *data;
+    u32_t n, done = 0;
+
+    pbuf_iter_init(&it, p, offset, len);
+    while ((n = pbuf_iter_next(&it, &data)) > 0) {
+        ddr4_copy_with(kernel, (void *)(dst + done), data, n);
+        done += n;
+    }
+    if (cache) {
+        ddr4_cache_dirty(cache, dst, done);
+    }
+    return done;
+}
+
+u32_t pbuf_iov_crc32c(u32_t crc, const struct pbuf *p, u32_t offset, u32_t len)
+{
+    pbuf_iter_t it;
+    const u8_t *data;
+    u32_t n;
+
+    pbuf_iter_init(&it, p, offset, len);
+    while ((n = pbuf_iter_next(&it, &data)) > 0) {
+        crc = crc32c_update(crc, data, n);
+    }
+    return crc;
+}
+
+// tcp_recved takes a u16_t; with LWIP_WND_SCALE a credit can be larger
+void pbuf_iov_recved(struct tcp_pcb *pcb, u32_t len)
+{
+    while (len > 0) {
+        u16_t n = (u16_t)LWIP_MIN(len, 0xFFFF);
+        tcp_recved(pcb, n);
+        len -= n;
+    }
+}
+
+// Held input is a plain list of pbufs linked through next. tot_len is not
+// kept up to date: with window scaling the backlog can exceed 64 KB.
+void pbuf_iov_append(struct pbuf **list, struct pbuf *p)
+{
+    struct pbuf *q;
+
+    if (!*list) {
+        *list = p;
+        return;
+    }
+    for (q = *list; q->next != NULL; q = q->next) {
+    }
+    q->next = p;
+}
+
+// Drop the first used bytes of a held list
+void pbuf_iov_consume(struct pbuf **list, u32_t used)
+{
+    while (used > 0 && *list) {
+        struct pbuf *q = *list;
+
+        if (used < q->len) {
+            pbuf_remove_header(q, used);
+            break;
+        }
+        used -= q->len;
+        *list = q->next;
+        q->next = NULL;
+        pbuf_free(q);
+    }
+}
@@ -0,0 +1,40 @@
+/******************************************************************************
+* Chain-aware pbuf ingest
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* lwIP hands recv callbacks a pbuf chain; under load it is often several
+* segments coalesced from refused data or out-of-order queues, so neither
+* p->payload nor p->len describes the received bytes. These helpers walk a
+* byte range [offset, offset + len) of a chain as (pointer, length) pieces,
+* store it to contiguous DDR4 with one kernel choice, one fence and one
+* dirty range, and return window credit in one call. All lengths are u32_t.
+*
+* Servers that parse a stream across callbacks hold unparsed input as a
+* list of pbufs (pbuf_iov_append) and drop what the parser took
+* (pbuf_iov_consume).
+******************************************************************************/
+
+#ifndef PBUF_IOV_H
+#define PBUF_IOV_H
+
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "xil_types.h"
+#include "ddr4_cache.h"
+
+typedef struct {
+    const struct pbuf *q;   // Segment holding the next byte
+    u32_t off;              // Offset of the next byte in q
+    u32_t left;             // Bytes left in the range
+} pbuf_iter_t;
+
+void pbuf_iter_init(pbuf_iter_t *it, const struct pbuf *p, u32_t offset, u32_t len);
+u32_t pbuf_iter_next(pbuf_iter_t *it, const u8_t **data);
+
+u32_t pbuf_iov_store(const struct pbuf *p, u32_t offset, u32_t len, UINTPTR dst, ddr4_cache_t *cache);
+u32_t pbuf_iov_crc32c(u32_t crc, const struct pbuf *p, u32_t offset, u32_t len);
+void pbuf_iov_recved(struct tcp_pcb *pcb, u32_t len);
+void pbuf_iov_append(struct pbuf **list, struct pbuf *p);
+void pbuf_iov_consume(struct pbuf **list, u32_t used);
+
+#endif
@@ -0,0 +1,51 @@
+/******************************************************************************
+* Storage-aware receive window
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include "rx_window.h"
+#include "pbuf_iov.h"
+#include "xil_printf.h"
+
+void rx_window_init(rx_window_t *win, u32_t limit)
+{
+    win->credited = 0;
+    win->limit = limit;
+    win->held = 0;
+}
+
+// The destination gained room (or was sized after the header arrived)
+void rx_window_limit(rx_window_t *win, u32_t limit)
+{
+    win->limit = limit;
+}
+
+// Return credit for everything up to ready that the destination has room
+// behind. Returns the bytes credited by this call.
+u32_t rx_window_update(rx_window_t *win, struct tcp_pcb *pcb, u32_t ready)
+{
+    u32_t target = ready;
+    u32_t credit;
+
+    if (win->limit != RX_WINDOW_UNLIMITED) {
+        u32_t edge = (win->limit > TCP_WND) ? win->limit - TCP_WND : 0;
+        if (target > edge) {
+            target = edge;
+            win->held++;
+        }
+    }
+    if (target <= win->credited) {
+        return 0;
+    }
+
+    credit = target - win->credited;
+    pbuf_iov_recved(pcb, credit);
+    win->credited = target;
+    return credit;
+}
+
+void rx_window_report(const rx_window_t *win)
+{
+    xil_printf("RX window: %lu bytes credited, %lu updates held at the limit (%lu)\n\r",
+               (unsigned long)win->credited, (unsigned long)win->held, (unsigned long)win->limit);
+}
@@ -0,0 +1,40 @@
+/******************************************************************************
+* Storage-aware receive window
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* lwIP closes the advertised window by every byte delivered to recv and
+* reopens it by what tcp_recved returns, so the right edge the sender may
+* fill up to is credited + TCP_WND. Instead of crediting on arrival, the
+* servers credit through this controller:
+*
+*   ready   bytes the sink is finished with: in DDR4, and for echo servers
+*           also queued for echo (ddr4_echo_pump), so a sender that outruns
+*           the copy engine, the storage worker or the echo is slowed by
+*           the window instead of refused data, drops or aborts
+*   limit   stream offset the destination has room up to; credit is held
+*           back so the right edge never passes it
+*
+* Credit is u32_t and returned in u16_t steps, so windows above 64KB
+* (LWIP_WND_SCALE, see host/lwipopts.h) work unchanged.
+******************************************************************************/
+
+#ifndef RX_WINDOW_H
+#define RX_WINDOW_H
+
+#include "lwip/tcp.h"
+#include "xil_types.h"
+
+#define RX_WINDOW_UNLIMITED 0xFFFFFFFF
+
+typedef struct {
+    u32_t credited;        // Payload bytes returned with tcp_recved
+    u32_t limit;           // Destination room, as a stream offset
+    u32_t held;            // Updates where the limit cut the credit short
+} rx_window_t;
+
+void rx_window_init(rx_window_t *win, u32_t limit);
+void rx_window_limit(rx_window_t *win, u32_t limit);
+u32_t rx_window_update(rx_window_t *win, struct tcp_pcb *pcb, u32_t ready);
+void rx_window_report(const rx_window_t *win);
+
+#endif
@@ -0,0 +1,50 @@
+/******************************************************************************
+* Lock-free single-producer / single-consumer pointer queue
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include "spsc_queue.h"
+
+// capacity must be a power of two
+void spsc_init(spsc_queue_t *q, void **slots, u32_t capacity)
+{
+    q->slots = slots;
+    q->mask = capacity - 1;
+    q->head = 0;
+    q->tail = 0;
+}
+
+// Producer side. Returns -1 when full.
+int spsc_push(spsc_queue_t *q, void *item)
+{
+    u32_t head = q->head;
+    u32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail > q->mask) {
+        return -1;
+    }
+    q->slots[head & q->mask] = item;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Consumer side. Returns NULL when empty.
+void *spsc_pop(spsc_queue_t *q)
+{
+    u32_t tail = q->tail;
+    u32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    void *item;
+
+    if (tail == head) {
+        return NULL;
+    }
+    item = q->slots[tail & q->mask];
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+// Either side; a snapshot that may be stale by the time it is used
+u32_t spsc_count(const spsc_queue_t *q)
+{
+    return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
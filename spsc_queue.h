@@ -0,0 +1,28 @@
+/******************************************************************************
+* Lock-free single-producer / single-consumer pointer queue
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* One thread pushes, one other thread pops; no locks and no lwIP calls, so
+* it can sit between the tcpip context and a worker task. The producer only
+* writes head, the consumer only writes tail, and each publishes with a
+* release store that the other side reads with an acquire load.
+******************************************************************************/
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include "lwip/arch.h"
+
+typedef struct {
+    void **slots;
+    u32_t mask;             // Capacity - 1, capacity is a power of two
+    u32_t head;             // Next slot to push (producer)
+    u32_t tail;             // Next slot to pop (consumer)
+} spsc_queue_t;
+
+void spsc_init(spsc_queue_t *q, void **slots, u32_t capacity);
+int spsc_push(spsc_queue_t *q, void *item);
+void *spsc_pop(spsc_queue_t *q);
+u32_t spsc_count(const spsc_queue_t *q);
+
+#endif
@@ -0,0 +1,70 @@
+import socket
+import struct
+import sys
+
+# Fetches one binary snapshot from the board's stats port (conn_metrics.c)
+SERVER_IP = '192.168.1.10'  # Replace with your FPGA's IP address
+STATS_PORT = 6002
+CONN_METRICS_MAGIC = 0x4D455431
+HIST_BINS = 32
+
+COUNTER_NAMES = ['id', 'bytes_in', 'bytes_out', 'bytes_written', 'pbufs_in',
+                 'err_mem_stalls', 'echo_backlog', 'rate_in', 'rate_out']
+
+
+def fetch_snapshot():
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.settimeout(5)
+    sock.connect((SERVER_IP, STATS_PORT))
+    data = bytearray()
+    while True:
+        chunk = sock.recv(4096)
+        if not chunk:
+            break
+        data.extend(chunk)
+    sock.close()
+    return bytes(data)
+
+
+def bin_label(b):
+    # Bin b holds values in [2^(b-1), 2^b)
+    return '0' if b == 0 else f'<{1 << b}'
+
+
+def print_histogram(title, hist, unit):
+    print(f"  {title}:")
+    for b, count in enumerate(hist):
+        if count:
+            print(f"    {bin_label(b):>12} {unit}: {count}")
+
+
+def decode(data):
+    magic, n_conns, ticks_per_sec, words = struct.unpack_from('<4I', data, 0)
+    if magic != CONN_METRICS_MAGIC:
+        print(f"Error: bad magic 0x{magic:08x}")
+        return False
+
+    print(f"{n_conns} connection(s), {ticks_per_sec} ticks/s")
+    offset = 16
+    for _ in range(n_conns):
+        values = struct.unpack_from(f'<{words}I', data, offset)
+        offset += words * 4
+        counters = dict(zip(COUNTER_NAMES, values))
+        pbuf_hist = values[9:9 + HIST_BINS]
+        ack_hist = values[9 + HIST_BINS:9 + 2 * HIST_BINS]
+
+        print(f"Connection {counters['id']}:")
+        print(f"  in  {counters['bytes_in']} bytes in {counters['pbufs_in']} pbufs, "
+              f"{counters['rate_in'] * 8 / 1e6:.2f} Mbps")
+        print(f"  out {counters['bytes_out']} bytes ACK'd ({counters['bytes_written']} written), "
+              f"{counters['rate_out'] * 8 / 1e6:.2f} Mbps")
+        print(f"  backlog {counters['echo_backlog']} bytes, {counters['err_mem_stalls']} ERR_MEM stalls")
+        print_histogram("pbuf size", pbuf_hist, "bytes")
+        print_histogram("ACK delay", ack_hist, "ticks")
+    return True
+
+
+if __name__ == "__main__":
+    if len(sys.argv) > 1:
+        SERVER_IP = sys.argv[1]
+    sys.exit(0 if decode(fetch_snapshot()) else 1)
@@ -0,0 +1,215 @@
+/******************************************************************************
+* Storage worker pipeline: DDR4 copy and cache flush off the tcpip context
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <string.h>
+#include "lwip/opt.h"
+#include "storage_pipeline.h"
+#include "pbuf_iov.h"
+#include "xil_printf.h"
+
+#if defined (HOST_BUILD)
+#include <pthread.h>
+#include <semaphore.h>
+static pthread_t worker_thread;
+static sem_t worker_sem;
+#define WORKER_WAIT() sem_wait(&worker_sem)
+#define WORKER_WAKE() sem_post(&worker_sem)
+#elif defined (OS_IS_FREERTOS)
+#include "FreeRTOS.h"
+#include "task.h"
+#define STORAGE_WORKER_PRIO (tskIDLE_PRIORITY + 1)   // Below the tcpip thread
+#define STORAGE_WORKER_STACK 1024
+static TaskHandle_t worker_task;
+#define WORKER_WAIT() ulTaskNotifyTake(pdTRUE, portMAX_DELAY)
+#define WORKER_WAKE() xTaskNotifyGive(worker_task)
+#endif
+
+#if !NO_SYS
+#include "lwip/tcpip.h"
+#endif
+
+#define STORAGE_WORKER_SPINS 1000   // Empty polls before the worker blocks
+
+// Worker side: copy one chain to DDR4 and make it visible to the EMAC
+static void storage_run_job(storage_pipeline_t *sp, storage_job_t *job)
+{
+    pbuf_iov_store(job->p, 0, job->len, job->dst, &sp->cache);
+    ddr4_cache_flush(&sp->cache);
+}
+
+// Worker side: everything queued so far. Returns the number of jobs done.
+static u32_t storage_work(storage_pipeline_t *sp)
+{
+    storage_job_t *job;
+    u32_t n = 0;
+
+    while ((job = (storage_job_t *)spsc_pop(&sp->submit)) != NULL) {
+        storage_run_job(sp, job);
+        // Cannot fail: at most STORAGE_PIPELINE_JOBS jobs exist
+        spsc_push(&sp->done, job);
+        n++;
+    }
+    return n;
+}
+
+#if !NO_SYS
+static void storage_drain_cb(void *arg)
+{
+    storage_pipeline_t *sp = (storage_pipeline_t *)arg;
+
+    __atomic_store_n(&sp->drain_pending, 0, __ATOMIC_RELEASE);
+    storage_pipeline_poll(sp);
+}
+#endif
+
+#if STORAGE_PIPELINE_THREADED
+#if defined (HOST_BUILD)
+static void *storage_worker(void *arg)
+#else
+static void storage_worker(void *arg)
+#endif
+{
+    storage_pipeline_t *sp = (storage_pipeline_t *)arg;
+
+    u32_t spins = 0;
+
+    while (!sp->stop) {
+        if (spsc_count(&sp->submit) == 0 && ++spins >= STORAGE_WORKER_SPINS) {
+            // Announce the sleep, then look once more so a racing submit is not missed
+            __atomic_store_n(&sp->worker_idle, 1, __ATOMIC_SEQ_CST);
+            if (spsc_count(&sp->submit) == 0 && !sp->stop) {
+                WORKER_WAIT();
+                sp->worker_wakeups++;
+            }
+            __atomic_store_n(&sp->worker_idle, 0, __ATOMIC_SEQ_CST);
+            spins = 0;
+        }
+        if (storage_work(sp) > 0) {
+            spins = 0;
+#if !NO_SYS
+            if (!__atomic_exchange_n(&sp->drain_pending, 1, __ATOMIC_ACQ_REL) &&
+                tcpip_try_callback(storage_drain_cb, sp) != ERR_OK) {
+                __atomic_store_n(&sp->drain_pending, 0, __ATOMIC_RELEASE);
+            }
+#endif
+        }
+    }
+#if defined (HOST_BUILD)
+    return NULL;
+#else
+    vTaskDelete(NULL);
+#endif
+}
+#endif
+
+int storage_pipeline_start(storage_pipeline_t *sp, storage_done_fn done_fn)
+{
+    u32_t i;
+
+    memset(sp, 0, sizeof(storage_pipeline_t));
+    spsc_init(&sp->submit, sp->submit_slots, STORAGE_PIPELINE_JOBS);
+    spsc_init(&sp->done, sp->done_slots, STORAGE_PIPELINE_JOBS);
+    for (i = 0; i < STORAGE_PIPELINE_JOBS; i++) {
+        sp->free_jobs[i] = &sp->jobs[i];
+    }
+    sp->free_count = STORAGE_PIPELINE_JOBS;
+    sp->done_fn = done_fn;
+    ddr4_cache_init(&sp->cache, DDR4_CACHE_DEFAULT_THRESHOLD);
+
+#if defined (HOST_BUILD)
+    if (sem_init(&worker_sem, 0, 0) != 0 ||
+        pthread_create(&worker_thread, NULL, storage_worker, sp) != 0) {
+        xil_printf("Failed to start the storage worker\n\r");
+        return -1;
+    }
+#elif defined (OS_IS_FREERTOS)
+    if (xTaskCreate(storage_worker, "storage", STORAGE_WORKER_STACK, sp,
+                    STORAGE_WORKER_PRIO, &worker_task) != pdPASS) {
+        xil_printf("Failed to start the storage worker\n\r");
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+void storage_pipeline_stop(storage_pipeline_t *sp)
+{
+    sp->stop = 1;
+#if STORAGE_PIPELINE_THREADED
+    WORKER_WAKE();
+#endif
+#if defined (HOST_BUILD)
+    pthread_join(worker_thread, NULL);
+    sem_destroy(&worker_sem);
+#endif
+}
+
+// tcpip side. NULL when every job is in flight; the caller backs off.
+storage_job_t *storage_pipeline_job(storage_pipeline_t *sp)
+{
+    if (sp->free_count == 0) {
+        sp->job_stalls++;
+        return NULL;
+    }
+    return sp->free_jobs[--sp->free_count];
+}
+
+// tcpip side: nonzero when storage_pipeline_job() would return NULL. Lets a
+// recv callback refuse a chain before it has touched it.
+u8_t storage_pipeline_full(storage_pipeline_t *sp)
+{
+    if (sp->free_count == 0) {
+        sp->job_stalls++;
+        return 1;
+    }
+    return 0;
+}
+
+// tcpip side: hand a job from storage_pipeline_job() to the worker
+void storage_pipeline_submit(storage_pipeline_t *sp, storage_job_t *job)
+{
+    // Cannot fail: the job came from the pool of STORAGE_PIPELINE_JOBS
+    spsc_push(&sp->submit, job);
+    sp->submitted++;
+#if STORAGE_PIPELINE_THREADED
+    // Only pay for the wakeup when the worker is going to sleep
+    if (__atomic_exchange_n(&sp->worker_idle, 0, __ATOMIC_SEQ_CST)) {
+        WORKER_WAKE();
+    }
+#endif
+}
+
+// tcpip side: finish completed jobs. Without a worker thread this also does
+// the storage work itself. Returns the number of jobs finished.
+u32_t storage_pipeline_poll(storage_pipeline_t *sp)
+{
+    storage_job_t *job;
+    u32_t n = 0;
+
+#if !STORAGE_PIPELINE_THREADED
+    storage_work(sp);
+#endif
+    while ((job = (storage_job_t *)spsc_pop(&sp->done)) != NULL) {
+        pbuf_free(job->p);
+        job->p = NULL;
+        sp->completed++;
+        sp->done_fn(job);
+        sp->free_jobs[sp->free_count++] = job;
+        n++;
+    }
+    return n;
+}
+
+u32_t storage_pipeline_in_flight(const storage_pipeline_t *sp)
+{
+    return sp->submitted - sp->completed;
+}
+
+void storage_pipeline_report(const storage_pipeline_t *sp)
+{
+    xil_printf("Storage pipeline: %lu jobs, %lu in flight, %lu job stalls, %lu worker wakeups\n\r",
+               (unsigned long)sp->submitted, (unsigned long)storage_pipeline_in_flight(sp),
+               (unsigned long)sp->job_stalls, (unsigned long)sp->worker_wakeups);
+}
@@ -0,0 +1,77 @@
+/******************************************************************************
+* Storage worker pipeline: DDR4 copy and cache flush off the tcpip context
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* recv_callback wraps each pbuf chain in a job and pushes it on the submit
+* queue instead of copying it inline. The storage worker copies the chain to
+* job->dst, flushes the range and pushes the job on the done queue. The tcpip
+* context drains the done queue, frees the pbufs (lwIP calls stay on that
+* side) and hands each job to the done callback, which queues the echo.
+*
+* Jobs complete in submit order, so a connection's stored count only moves
+* forward. Worker per platform:
+*   HOST_BUILD      pthread, woken through a semaphore
+*   OS_IS_FREERTOS  FreeRTOS task, woken through a task notification
+*   otherwise       no thread; storage_pipeline_poll() runs the work from
+*                   the main loop (same ordering, no overlap)
+*
+* With NO_SYS the main loop is the tcpip context and calls
+* storage_pipeline_poll() from transfer_data(). With an OS build and the
+* tcpip thread, the worker schedules the drain with tcpip_try_callback().
+******************************************************************************/
+
+#ifndef STORAGE_PIPELINE_H
+#define STORAGE_PIPELINE_H
+
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+#include "xil_types.h"
+#include "spsc_queue.h"
+#include "ddr4_cache.h"
+
+#define STORAGE_PIPELINE_JOBS 256           // Power of two; covers several receive windows
+
+#if defined (HOST_BUILD) || defined (OS_IS_FREERTOS)
+#define STORAGE_PIPELINE_THREADED 1
+#else
+#define STORAGE_PIPELINE_THREADED 0
+#endif
+
+typedef struct storage_job {
+    struct pbuf *p;         // Chain to store, freed on the tcpip side once done
+    UINTPTR dst;            // DDR4 destination of the first byte
+    u32_t len;              // p->tot_len
+    void *owner;            // Connection the job belongs to
+} storage_job_t;
+
+typedef void (*storage_done_fn)(storage_job_t *job);
+
+typedef struct {
+    spsc_queue_t submit;    // tcpip -> worker
+    spsc_queue_t done;      // worker -> tcpip
+    void *submit_slots[STORAGE_PIPELINE_JOBS];
+    void *done_slots[STORAGE_PIPELINE_JOBS];
+    storage_job_t jobs[STORAGE_PIPELINE_JOBS];
+    storage_job_t *free_jobs[STORAGE_PIPELINE_JOBS];  // tcpip side only
+    u32_t free_count;
+    storage_done_fn done_fn;
+    ddr4_cache_t cache;     // Worker side only
+    u32_t submitted;
+    u32_t completed;
+    u32_t job_stalls;       // storage_pipeline_job() found no free job
+    u32_t worker_wakeups;
+    u8_t drain_pending;     // tcpip_try_callback() already scheduled
+    u8_t worker_idle;       // Worker is (about to be) blocked, submit must wake it
+    volatile u8_t stop;
+} storage_pipeline_t;
+
+int storage_pipeline_start(storage_pipeline_t *sp, storage_done_fn done_fn);
+void storage_pipeline_stop(storage_pipeline_t *sp);
+storage_job_t *storage_pipeline_job(storage_pipeline_t *sp);
+u8_t storage_pipeline_full(storage_pipeline_t *sp);
+void storage_pipeline_submit(storage_pipeline_t *sp, storage_job_t *job);
+u32_t storage_pipeline_poll(storage_pipeline_t *sp);
+u32_t storage_pipeline_in_flight(const storage_pipeline_t *sp);
+void storage_pipeline_report(const storage_pipeline_t *sp);
+
+#endif
@@ -0,0 +1,65 @@
+import struct
+import sys
+
+# Decodes a raw dump of the trace ring written by trace_log.c.
+# Dump it from the board with XSCT, e.g.:
+#   mrd -bin -file trace.bin 0x8F000000 262152
+# (header is 8 words, then 65536 records of 4 words each)
+
+TRACE_FILE = 'trace.bin'
+TRACE_RING_MAGIC = 0x54524331
+HEADER_FORMAT = '<8I'
+RECORD_FORMAT = '<IHHII'
+
+# Must match trace_event_t in trace_log.h (append only)
+EVENTS = [
+    ('none',       'a0',      'a1'),
+    ('recv',       'len',     'total'),
+    ('store',      'len',     'total'),
+    ('echo',       'len',     'queued'),
+    ('echo-stall', 'backlog', 'sndbuf'),
+    ('ack',        'len',     'acked'),
+    ('error',      'err',     'total'),
+    ('watchdog',   'progress', 'idle'),
+]
+
+
+def decode(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    header_size = struct.calcsize(HEADER_FORMAT)
+    magic, head, tail, drops, capacity, record_size, ticks_per_sec, _ = \
+        struct.unpack_from(HEADER_FORMAT, data, 0)
+    if magic != TRACE_RING_MAGIC:
+        print(f"Error: bad magic 0x{magic:08x}, is this a trace ring dump?")
+        return False
+
+    print(f"Trace ring: head {head}, tail {tail}, {drops} dropped, "
+          f"{capacity} x {record_size} byte records, {ticks_per_sec} ticks/s")
+
+    # Oldest record still present in the ring
+    first = max(0, head - capacity)
+    prev_ts = None
+    for seq in range(first, head):
+        offset = header_size + (seq % capacity) * record_size
+        if offset + record_size > len(data):
+            print(f"Dump truncated at record {seq}")
+            break
+        ts, event, _, a0, a1 = struct.unpack_from(RECORD_FORMAT, data, offset)
+        name, l0, l1 = EVENTS[event] if event < len(EVENTS) else (f'ev{event}', 'a0', 'a1')
+
+        # Timestamps are the low 32 bits of the tick counter, deltas survive wrap
+        delta_us = 0.0
+        if prev_ts is not None:
+            delta_us = ((ts - prev_ts) & 0xFFFFFFFF) * 1e6 / ticks_per_sec
+        prev_ts = ts
+
+        drained = '' if seq >= tail else ' (drained)'
+        print(f"{seq:8d} +{delta_us:10.1f}us {name:<10} {l0}={a0} {l1}={a1}{drained}")
+    return True
+
+
+if __name__ == "__main__":
+    path = sys.argv[1] if len(sys.argv) > 1 else TRACE_FILE
+    sys.exit(0 if decode(path) else 1)
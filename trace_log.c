@@ -0,0 +1,115 @@
+/******************************************************************************
+* Deferred binary trace log for the echo server hot path
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <stdio.h>
+#include "trace_log.h"
+
+#if defined (__arm__) || defined (__aarch64__) || defined (HOST_BUILD)
+#include "xil_printf.h"
+#include "xtime_l.h"
+#define TRACE_TICKS_PER_SEC COUNTS_PER_SECOND
+static u32_t trace_now(void) {
+    XTime t;
+    XTime_GetTime(&t);
+    return (u32_t)t;
+}
+#else
+#include "lwip/sys.h"
+#define xil_printf printf
+#define TRACE_TICKS_PER_SEC 1000
+static u32_t trace_now(void) {
+    return sys_now();
+}
+#endif
+
+#define TRACE_RING_MASK (TRACE_RING_RECORDS - 1)
+
+// Single producer (lwIP callbacks), single consumer (main loop drain).
+// The producer owns head and drops, the consumer owns tail.
+static trace_ring_t *const ring = (trace_ring_t *)TRACE_RING_ADDR;
+static u32_t last_seen_head;
+
+static const char *const trace_names[TRACE_EV_COUNT][3] = {
+    [TRACE_EV_NONE]       = { "none",       "a0",      "a1" },
+    [TRACE_EV_RECV]       = { "recv",       "len",     "total" },
+    [TRACE_EV_STORE]      = { "store",      "len",     "total" },
+    [TRACE_EV_ECHO]       = { "echo",       "len",     "queued" },
+    [TRACE_EV_ECHO_STALL] = { "echo-stall", "backlog", "sndbuf" },
+    [TRACE_EV_ACK]        = { "ack",        "len",     "acked" },
+    [TRACE_EV_ERROR]      = { "error",      "err",     "total" },
+    [TRACE_EV_WATCHDOG]   = { "watchdog",   "progress", "idle" },
+};
+
+void trace_log_init(void) {
+    ring->magic = TRACE_RING_MAGIC;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->drops = 0;
+    ring->capacity = TRACE_RING_RECORDS;
+    ring->record_size = sizeof(trace_record_t);
+    ring->ticks_per_sec = TRACE_TICKS_PER_SEC;
+    last_seen_head = 0;
+}
+
+void trace_log_write(u16_t event, u32_t a0, u32_t a1) {
+    u32_t head = ring->head;
+    trace_record_t *rec;
+
+    // Never block the hot path: drop the record if the drain fell behind
+    if (head - ring->tail >= TRACE_RING_RECORDS) {
+        ring->drops++;
+        return;
+    }
+
+    rec = &ring->rec[head & TRACE_RING_MASK];
+    rec->timestamp = trace_now();
+    rec->event = event;
+    rec->reserved = 0;
+    rec->arg[0] = a0;
+    rec->arg[1] = a1;
+
+    // Publish the record before moving head
+    __sync_synchronize();
+    ring->head = head + 1;
+}
+
+static void trace_log_format(u32_t max_records) {
+    u32_t head = ring->head;
+    u32_t tail = ring->tail;
+    u32_t n = 0;
+
+    __sync_synchronize();
+    while (tail != head && n < max_records) {
+        const trace_record_t *rec = &ring->rec[tail & TRACE_RING_MASK];
+        u16_t ev = (rec->event < TRACE_EV_COUNT) ? rec->event : TRACE_EV_NONE;
+
+        xil_printf("[%lu] %s %s=%lu %s=%lu\n\r", (unsigned long)rec->timestamp,
+                   trace_names[ev][0], trace_names[ev][1], (unsigned long)rec->arg[0],
+                   trace_names[ev][2], (unsigned long)rec->arg[1]);
+        tail++;
+        n++;
+    }
+    __sync_synchronize();
+    ring->tail = tail;
+}
+
+// Called from the main loop. Formats a few records, but only when nothing
+// was logged since the previous call, so the UART never competes with traffic.
+void trace_log_drain(u32_t max_records) {
+    u32_t head = ring->head;
+
+    if (head != last_seen_head) {
+        last_seen_head = head;
+        return;
+    }
+    trace_log_format(max_records);
+}
+
+// Format everything pending regardless of load
+void trace_log_dump(void) {
+    trace_log_format(TRACE_RING_RECORDS);
+    xil_printf("Trace: %lu records written, %lu dropped\n\r",
+               (unsigned long)ring->head, (unsigned long)ring->drops);
+}
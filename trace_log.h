@@ -0,0 +1,87 @@
+/******************************************************************************
+* Deferred binary trace log for the echo server hot path
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* Hot-path sites write fixed 16-byte records into a ring in DDR4 instead of
+* calling xil_printf. transfer_data() drains and formats them from the main
+* loop when no new records arrived since the last pass. The raw ring can also
+* be pulled over JTAG and decoded on the host with trace_decode.py.
+******************************************************************************/
+
+#ifndef TRACE_LOG_H
+#define TRACE_LOG_H
+
+#include "lwip/arch.h"
+
+#define TRACE_LEVEL_OFF  0
+#define TRACE_LEVEL_ERR  1
+#define TRACE_LEVEL_INFO 2
+#define TRACE_LEVEL_DBG  3
+
+// Sites above this level compile away completely
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_DBG
+#endif
+
+#define TRACE_RING_ADDR 0x8F000000   // 16MB below the upload arena
+#define TRACE_RING_RECORDS 65536     // Power of two, 1MB of records
+#define TRACE_RING_MAGIC 0x54524331  // "TRC1"
+#define TRACE_DRAIN_BATCH 16         // Records formatted per idle drain pass
+
+// Event ids are part of the dump format, append only (see trace_decode.py)
+typedef enum {
+    TRACE_EV_NONE = 0,
+    TRACE_EV_RECV,          // pbuf len, total received
+    TRACE_EV_STORE,         // bytes stored in DDR4, total stored
+    TRACE_EV_ECHO,          // bytes queued for echo, total queued
+    TRACE_EV_ECHO_STALL,    // echo backlog, tcp_sndbuf
+    TRACE_EV_ACK,           // bytes ACK'd, total ACK'd
+    TRACE_EV_ERROR,         // err_t, total received
+    TRACE_EV_WATCHDOG,      // progress, idle polls
+    TRACE_EV_COUNT
+} trace_event_t;
+
+typedef struct {
+    u32_t timestamp;        // Low 32 bits of XTime (ARM) or sys_now() ms
+    u16_t event;            // trace_event_t
+    u16_t reserved;
+    u32_t arg[2];
+} trace_record_t;
+
+// Ring header lives at TRACE_RING_ADDR, records follow it
+typedef struct {
+    u32_t magic;
+    u32_t head;             // Next record to write (producer)
+    u32_t tail;             // Next record to format (consumer)
+    u32_t drops;            // Records lost because the ring was full
+    u32_t capacity;
+    u32_t record_size;
+    u32_t ticks_per_sec;
+    u32_t reserved;
+    trace_record_t rec[TRACE_RING_RECORDS];
+} trace_ring_t;
+
+void trace_log_init(void);
+void trace_log_write(u16_t event, u32_t a0, u32_t a1);
+void trace_log_drain(u32_t max_records);
+void trace_log_dump(void);
+
+#if TRACE_LEVEL >= TRACE_LEVEL_ERR
+#define TRACE_ERR(ev, a0, a1) trace_log_write((ev), (u32_t)(a0), (u32_t)(a1))
+#else
+#define TRACE_ERR(ev, a0, a1) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO(ev, a0, a1) trace_log_write((ev), (u32_t)(a0), (u32_t)(a1))
+#else
+#define TRACE_INFO(ev, a0, a1) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_DBG
+#define TRACE_DBG(ev, a0, a1) trace_log_write((ev), (u32_t)(a0), (u32_t)(a1))
+#else
+#define TRACE_DBG(ev, a0, a1) ((void)0)
+#endif
+
+#endif
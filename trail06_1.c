@@ -6,16 +6,20 @@
 #include "lwip/pbuf.h"
 #include "lwip/opt.h"
 
-#if defined (__arm__) || defined (__aarch64__)
+#if defined (__arm__) || defined (__aarch64__) || defined (HOST_BUILD)
 #include "xil_printf.h"
 #include "xil_types.h"
 #include "xil_cache.h"
 #include "xil_io.h"     // For XTime_GetTime
-#include "xtime_l.h"    // For XTime
-#include "xparameters.h" // For XPAR_CPU_CORTEXA9_0_CPU_CLK_FREQ_HZ or similar
 #else
 #define xil_printf printf
 #endif
+#include "conn_metrics.h"
+#include "ddr4_cache.h"
+#include "pbuf_iov.h"
+#include "rx_window.h"
+#include "tx_batch.h"
+#include "conn_watchdog.h"
 
 // Configuration for video buffer and network
 #define MAX_VIDEO_BUFFER_SIZE (1024 * 1024 * 100) // 100 MB max video
@@ -33,16 +37,21 @@ static u8_t header_bytes_in_buffer_global = 0;
 
 static u32_t total_received_data_len_global = 0;
 static u32_t total_echoed_data_len_global = 0;
+static ddr4_cache_t cache_global; // Dirty DDR4 span, flushed per threshold and per video
+static rx_window_t window_global; // Payload credit, returned once it is in DDR4
+static tx_batch_t tx_global; // Echo writes, sent once per received chain
+static conn_watchdog_t wd_global; // Idle supervision from tcp_poll
 
-// Variables for rate calculation
-static XTime last_report_time_ticks = 0;
-static u32_t last_reported_received_bytes = 0;
-static u32_t last_reported_echoed_bytes = 0;
-#define REPORT_INTERVAL_MS 1000 // Report rates every 1000 milliseconds (1 second)
+// Counters and rates, sampled from tcp_poll instead of the receive path
+static conn_metrics_t metrics_global;
+#define REPORT_POLL_INTERVAL 2 // tcp_poll runs every 500 ms: report rates every second
 
 // Function prototypes
 err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
 err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err);
+err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len);
+err_t poll_callback(void *arg, struct tcp_pcb *tpcb);
+void err_callback(void *arg, err_t err);
 void video_echo_server_init(void);
 
 // Helper to reset all global state variables for a new connection
@@ -55,11 +64,25 @@ static void reset_global_state(void) {
     total_received_data_len_global = 0;
     total_echoed_data_len_global = 0;
     memset(header_byte_collection_buffer_global, 0, 4);
+    rx_window_init(&window_global, MAX_VIDEO_BUFFER_SIZE);
+    tx_batch_cancel(&tx_global);
+    tx_batch_init(&tx_global, TX_BATCH_DEFAULT_BYTES);
+    conn_watchdog_init(&wd_global, CONN_WATCHDOG_IDLE_POLLS);
+    ddr4_cache_init(&cache_global, DDR4_CACHE_DEFAULT_THRESHOLD);
+
+    // Drop the finished connection from the stats port
+    conn_metrics_close(&metrics_global);
+}
 
-    // Reset rate calculation variables as well for a fresh start
-    last_report_time_ticks = 0;
-    last_reported_received_bytes = 0;
-    last_reported_echoed_bytes = 0;
+// Close the active connection; the closing PCB keeps no callbacks into the
+// globals, which the next client reuses
+static void close_connection(struct tcp_pcb *tpcb) {
+    tcp_recv(tpcb, NULL);
+    tcp_sent(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_poll(tpcb, NULL, 0);
+    tcp_close(tpcb);
+    reset_global_state();
 }
 
 void print_app_header() {
@@ -81,27 +104,28 @@ err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
             xil_printf("SERVER: Receive error: %d.\n\r", err);
             pbuf_free(p);
         }
-        tcp_close(tpcb);
-        tcp_recv(tpcb, NULL);
-        reset_global_state();
+        close_connection(tpcb);
         return ERR_OK;
     }
 
-    tcp_recved(tpcb, p->tot_len);
+    conn_metrics_on_recv(&metrics_global, p->tot_len);
 
-    u16_t current_pbuf_data_len = p->tot_len;
-    char *pbuf_current_ptr = (char *)p->payload;
+    // Walk the whole chain: lwIP hands over several segments when it
+    // coalesces under load, p->payload only holds the first p->len bytes
+    u32_t skip = 0;
+    u32_t stored_now = 0;
+    u32_t current_pbuf_data_len = p->tot_len;
 
     // 1. Header Processing
     if (!is_header_processed_global) {
-        u16_t bytes_needed = 4 - header_bytes_in_buffer_global;
-        u16_t bytes_from_this_pbuf = LWIP_MIN(current_pbuf_data_len, bytes_needed);
+        u32_t bytes_needed = 4 - header_bytes_in_buffer_global;
+        u32_t bytes_from_this_pbuf = LWIP_MIN(current_pbuf_data_len, bytes_needed);
 
-        memcpy(header_byte_collection_buffer_global + header_bytes_in_buffer_global,
-               pbuf_current_ptr, bytes_from_this_pbuf);
+        pbuf_copy_partial(p, header_byte_collection_buffer_global + header_bytes_in_buffer_global,
+                          (u16_t)bytes_from_this_pbuf, 0);
         header_bytes_in_buffer_global += bytes_from_this_pbuf;
 
-        pbuf_current_ptr += bytes_from_this_pbuf;
+        skip = bytes_from_this_pbuf;
         current_pbuf_data_len -= bytes_from_this_pbuf;
 
         if (header_bytes_in_buffer_global == 4) {
@@ -117,93 +141,69 @@ err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
                 xil_printf("SERVER: ERROR: Invalid video size (%lu). Max allowed: %lu. Closing.\n\r",
                            (unsigned long)expected_total_video_size_global, (unsigned long)MAX_VIDEO_BUFFER_SIZE);
                 pbuf_free(p);
-                tcp_close(tpcb);
-                tcp_recv(tpcb, NULL);
-                reset_global_state();
+                close_connection(tpcb);
                 return ERR_ABRT;
             }
-            // Initialize timer for rate calculation after header is received
-            XTime_GetTime(&last_report_time_ticks);
-            last_reported_received_bytes = 0;
-            last_reported_echoed_bytes = 0;
         } else {
+            tcp_recved(tpcb, p->tot_len);
             pbuf_free(p);
             return ERR_OK;
         }
     }
 
-    // 2. Video Data Processing and Echoing
+    // 2. Video Data Processing and Echoing, one bounds check for the chain
     if (is_header_processed_global && current_pbuf_data_len > 0) {
-        u16_t copy_len = LWIP_MIN(current_pbuf_data_len,
-                                  (u16_t)(expected_total_video_size_global - total_received_data_len_global));
-        copy_len = LWIP_MIN(copy_len,
-                                  (u16_t)(MAX_VIDEO_BUFFER_SIZE - current_buffer_offset_global));
+        u32_t copy_len = LWIP_MIN(current_pbuf_data_len,
+                                  expected_total_video_size_global - total_received_data_len_global);
+        copy_len = LWIP_MIN(copy_len, MAX_VIDEO_BUFFER_SIZE - current_buffer_offset_global);
 
         if (copy_len > 0) {
-            memcpy(video_storage_buffer_global + current_buffer_offset_global, pbuf_current_ptr, copy_len);
+            pbuf_iter_t it;
+            const u8_t *data;
+            u32_t n;
 
-            #if defined (__arm__) || defined (__aarch64__)
-            Xil_DCacheFlushRange((UINTPTR)(video_storage_buffer_global + current_buffer_offset_global), copy_len);
-            #endif
+            // The echo is copied from the pbuf, so the DDR4 copy can be flushed in batches
+            pbuf_iov_store(p, skip, copy_len,
+                           (UINTPTR)(video_storage_buffer_global + current_buffer_offset_global), &cache_global);
 
             current_buffer_offset_global += copy_len;
             total_received_data_len_global += copy_len;
-
-            err_t write_err = tcp_write(tpcb, pbuf_current_ptr, copy_len, TCP_WRITE_FLAG_COPY);
-            if (write_err == ERR_OK) {
-                total_echoed_data_len_global += copy_len;
-                tcp_output(tpcb);
-            } else if (write_err == ERR_MEM) {
-                xil_printf("SERVER: tcp_write (echo) failed, ERR_MEM. Send buffer full. Echo might be incomplete.\n\r");
-            } else {
-                xil_printf("SERVER: tcp_write (echo) error: %d\n\r", write_err);
-                pbuf_free(p);
-                tcp_close(tpcb);
-                tcp_recv(tpcb, NULL);
-                reset_global_state();
-                return write_err;
+            stored_now = copy_len;
+
+            pbuf_iter_init(&it, p, skip, copy_len);
+            while ((n = pbuf_iter_next(&it, &data)) > 0) {
+                err_t write_err = tx_batch_write(&tx_global, tpcb, data, (u16_t)n, TCP_WRITE_FLAG_COPY);
+                if (write_err == ERR_OK) {
+                    total_echoed_data_len_global += n;
+                    conn_metrics_on_write(&metrics_global, n);
+                } else if (write_err == ERR_MEM) {
+                    conn_metrics_on_stall(&metrics_global);
+                    xil_printf("SERVER: tcp_write (echo) failed, ERR_MEM. Send buffer full. Echo might be incomplete.\n\r");
+                    break;
+                } else {
+                    xil_printf("SERVER: tcp_write (echo) error: %d\n\r", write_err);
+                    pbuf_free(p);
+                    close_connection(tpcb);
+                    return write_err;
+                }
             }
+            // One output for the chain, not one per segment; push the tail at the end of the video
+            tx_batch_flush(&tx_global, tpcb, total_echoed_data_len_global == expected_total_video_size_global);
         } else {
             if (total_received_data_len_global >= expected_total_video_size_global) {
                 xil_printf("SERVER: Video complete. Discarding extra data.\n\r");
             } else {
                 xil_printf("SERVER: DDR4 buffer full or video size mismatch. Closing.\n\r");
                 pbuf_free(p);
-                tcp_close(tpcb);
-                tcp_recv(tpcb, NULL);
-                reset_global_state();
+                close_connection(tpcb);
                 return ERR_ABRT;
             }
         }
     }
 
-    // Rate Calculation and Reporting
-    #if defined (__arm__) || defined (__aarch64__)
-    XTime current_time_ticks;
-    XTime_GetTime(&current_time_ticks);
-    
-    // Convert ticks to milliseconds for comparison
-    double delta_time_ms = (double)(current_time_ticks - last_report_time_ticks) * 1000.0 / XPAR_CPU_CORTEXA9_0_CPU_CLK_FREQ_HZ;
-
-    if (delta_time_ms >= REPORT_INTERVAL_MS) {
-        double delta_time_s = delta_time_ms / 1000.0;
-        
-        u32_t delta_received_bytes = total_received_data_len_global - last_reported_received_bytes;
-        u32_t delta_echoed_bytes = total_echoed_data_len_global - last_reported_echoed_bytes;
-
-        double recv_rate_kbps = (delta_received_bytes * 8.0) / (delta_time_s * 1000.0); // Bytes to Kbits per second
-        double send_rate_kbps = (delta_echoed_bytes * 8.0) / (delta_time_s * 1000.0); // Bytes to Kbits per second
-
-        xil_printf("SERVER: Recv Rate: %.2f Kbps, Send Rate: %.2f Kbps (Total Recv: %lu, Total Echoed: %lu)\n\r",
-                   recv_rate_kbps, send_rate_kbps,
-                   (unsigned long)total_received_data_len_global, (unsigned long)total_echoed_data_len_global);
-
-        // Update for next interval
-        last_report_time_ticks = current_time_ticks;
-        last_reported_received_bytes = total_received_data_len_global;
-        last_reported_echoed_bytes = total_echoed_data_len_global;
-    }
-    #endif
+    // Header and discarded bytes go straight back, payload once it is in DDR4
+    pbuf_iov_recved(tpcb, p->tot_len - stored_now);
+    rx_window_update(&window_global, tpcb, total_received_data_len_global);
 
     // Check if total video is received and echoed
     if (total_received_data_len_global == expected_total_video_size_global &&
@@ -211,15 +211,58 @@ err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
         is_header_processed_global) {
         xil_printf("SERVER: All %lu bytes of video received and echoed. Closing connection.\n\r",
                    (unsigned long)total_echoed_data_len_global);
-        tcp_close(tpcb);
-        tcp_recv(tpcb, NULL);
-        reset_global_state();
+        ddr4_cache_flush(&cache_global);
+        ddr4_cache_report();
+        tx_batch_report(&tx_global);
+        close_connection(tpcb);
     }
     
     pbuf_free(p);
     return ERR_OK;
 }
 
+err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    LWIP_UNUSED_ARG(arg);
+    LWIP_UNUSED_ARG(tpcb);
+
+    // ACK delay histogram and echoed byte count
+    conn_metrics_on_ack(&metrics_global, len);
+    return ERR_OK;
+}
+
+void err_callback(void *arg, err_t err) {
+    LWIP_UNUSED_ARG(arg);
+
+    // The PCB is already freed; give the slot to the next client
+    xil_printf("SERVER: Connection error %d. Resetting state.\n\r", err);
+    reset_global_state();
+}
+
+err_t poll_callback(void *arg, struct tcp_pcb *tpcb) {
+    LWIP_UNUSED_ARG(arg);
+
+    // A peer that stopped sending and ACKing gives up the single slot
+    if (conn_watchdog_check(&wd_global, metrics_global.bytes_in + metrics_global.bytes_out,
+                            tx_global.bytes > metrics_global.bytes_out) == CONN_WATCHDOG_EXPIRED) {
+        conn_watchdog_evict(&wd_global);
+        tcp_recv(tpcb, NULL);
+        tcp_sent(tpcb, NULL);
+        tcp_err(tpcb, NULL);
+        tcp_poll(tpcb, NULL, 0);
+        tcp_abort(tpcb);
+        reset_global_state();
+        return ERR_ABRT;
+    }
+
+    // Integer rate calculation, once per poll interval
+    if (is_header_processed_global) {
+        conn_metrics_sample(&metrics_global);
+        conn_metrics_report(&metrics_global);
+        tx_batch_poll(&tx_global, tpcb);
+    }
+    return ERR_OK;
+}
+
 err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err) {
     LWIP_UNUSED_ARG(arg);
 
@@ -234,12 +277,15 @@ err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err) {
         return ERR_ABRT;
     }
 
+    reset_global_state();
     active_pcb_global = newpcb;
-    reset_global_state(); // This resets rate counters for the new connection
+    conn_metrics_open(&metrics_global);
 
     tcp_recv(newpcb, recv_callback);
+    tcp_sent(newpcb, sent_callback);
+    tcp_err(newpcb, err_callback);
+    tcp_poll(newpcb, poll_callback, REPORT_POLL_INTERVAL);
     tcp_arg(newpcb, NULL); 
-    tcp_set_recv_wnd(newpcb, TCP_WND);
 
     xil_printf("SERVER: Accepted new connection (PCB: %lu). Waiting for 4-byte header...\n\r", (UINTPTR)newpcb);
 
@@ -271,6 +317,7 @@ void echo_server_init(void) {
     }
 
     tcp_accept(listen_pcb, accept_callback);
+    conn_metrics_server_init(CONN_METRICS_PORT);
 
     xil_printf("SERVER: TCP video echo server started @ port %d\n\r", port);
     xil_printf("SERVER: DDR4 Video Buffer Address: 0x%08lX, Max Buffer Size: %lu bytes\n\r",
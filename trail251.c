@@ -5,17 +5,23 @@
 #include "lwip/tcp.h"
 #include "lwip/pbuf.h"
 
-#if defined (__arm__) || defined (__aarch64__)
+#if defined (__arm__) || defined (__aarch64__) || defined (HOST_BUILD)
 #include "xil_printf.h"
 #include "xil_types.h"
 #include "xil_cache.h"
 #else
 #define xil_printf printf
 #endif
+#include "ddr4_echo.h"
+#include "conn_watchdog.h"
+#include "ddr4_cache.h"
+#include "pbuf_iov.h"
+#include "trace_log.h"
 
 // Configuration for image buffer and network
 #define MAX_IMAGE_BUFFER_SIZE (1024 * 1024 * 10) // 10 MB max image
 #define DDR4_IMAGE_BUFFER_START_ADDR 0x10000000
+#define ECHO_MODE DDR4_ECHO_ZERO_COPY // Echo straight from DDR4, no lwIP heap copy
 
 // Global variables for single connection state
 static struct tcp_pcb *active_pcb_global = NULL;
@@ -28,6 +34,10 @@ static u8_t header_bytes_in_buffer_global = 0;
 static u32_t total_received_data_len_global = 0;
 static u32_t total_echoed_data_len_global = 0;
 static int echoing_in_progress_global = 0; // 0=idle, 1=echo pending ACK
+static u8_t closing_global = 0;            // Client sent FIN, close once the echo is ACK'd
+static ddr4_echo_t echo_global;            // Echo cursor over the DDR4 copy
+static ddr4_cache_t cache_global;          // Dirty DDR4 span not yet flushed
+static conn_watchdog_t wd_global;          // Stall and idle supervision from tcp_poll
 
 // Function prototypes
 static err_t server_recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
@@ -35,69 +45,80 @@ static err_t server_sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len);
 static err_t server_accept_callback(void *arg, struct tcp_pcb *new_pcb, err_t err);
 static void server_error_callback(void *arg, err_t err);
 static void server_close_connection(struct tcp_pcb *pcb);
+static void server_close_when_acked(struct tcp_pcb *pcb);
+static void server_abort_connection(struct tcp_pcb *pcb);
 static err_t server_poll_callback(void *arg, struct tcp_pcb *tpcb);
 
-static void try_echo_chunk(struct tcp_pcb *pcb, const char *data_ptr, u16_t len) {
+// Reset all global state for next connection
+static void reset_connection_state(void) {
+    tx_batch_cancel(&echo_global.tx);
+    active_pcb_global = NULL;
+    is_header_processed_global = 0;
+    header_bytes_in_buffer_global = 0;
+    expected_total_image_size_global = 0;
+    current_buffer_offset_global = 0;
+    total_received_data_len_global = 0;
+    total_echoed_data_len_global = 0;
+    echoing_in_progress_global = 0;
+    closing_global = 0;
+    ddr4_echo_init(&echo_global, (UINTPTR)image_storage_buffer_global, ECHO_MODE);
+}
+
+// Queue the stored range the echo cursor has not reached yet. A full send
+// buffer or ERR_MEM parks the cursor and sent or poll resumes from the same
+// offset, so a refused chunk is echoed late instead of never.
+static err_t try_echo(struct tcp_pcb *pcb) {
     err_t err;
 
-    if (len > 0 && tcp_sndbuf(pcb) >= len) {
-        err = tcp_write(pcb, data_ptr, len, TCP_WRITE_FLAG_COPY);
-        if (err == ERR_OK) {
-            total_echoed_data_len_global += len;
-            echoing_in_progress_global = 1;
-            xil_printf("SERVER: Echo %u bytes. Total echoed: %lu/%lu\n\r",
-                       len, (unsigned long)total_echoed_data_len_global, (unsigned long)total_received_data_len_global);
-        } else if (err == ERR_MEM) {
-            xil_printf("SERVER: Echo failed, ERR_MEM. Retry on sent_callback.\n\r");
-            echoing_in_progress_global = 0;
-        } else {
-            xil_printf("SERVER: Echo error: %d\n\r", err);
-            server_close_connection(pcb);
-            return;
-        }
-    } else {
-        xil_printf("SERVER: Cannot echo %u bytes (buffer full or no data). snd_buf: %u\n\r", len, tcp_sndbuf(pcb));
-        echoing_in_progress_global = 0;
+    ddr4_echo_stored(&echo_global, total_received_data_len_global);
+    err = ddr4_echo_fill(&echo_global, pcb);
+    if (err != ERR_OK) {
+        xil_printf("SERVER: Echo error: %d\n\r", err);
+        return err;
     }
+    total_echoed_data_len_global = echo_global.queued;
+    echoing_in_progress_global = ddr4_echo_pinned(&echo_global) > 0;
 
-    err = tcp_output(pcb);
+    // One output per callback; push the tail once the image is all queued
+    err = tx_batch_flush(&echo_global.tx, pcb,
+                         total_echoed_data_len_global == expected_total_image_size_global);
     if (err != ERR_OK) {
         xil_printf("SERVER: tcp_output error: %d\n\r", err);
-        server_close_connection(pcb);
     }
+    return err;
 }
 
 static err_t server_recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
     LWIP_UNUSED_ARG(arg);
 
     if (err != ERR_OK) {
-        xil_printf("SERVER: Receive error: %d. Closing.\n\r", err);
+        xil_printf("SERVER: Receive error: %d. Aborting.\n\r", err);
         if (p) pbuf_free(p);
-        server_close_connection(tpcb);
-        return ERR_OK;
+        server_abort_connection(tpcb);
+        return ERR_ABRT;
     }
 
     if (!p) {
         xil_printf("SERVER: Client closed connection. Total received: %lu, Total echoed: %lu. Closing.\n\r",
                    (unsigned long)total_received_data_len_global, (unsigned long)total_echoed_data_len_global);
-        server_close_connection(tpcb);
+        server_close_when_acked(tpcb);
         return ERR_OK;
     }
 
-    tcp_recved(tpcb, p->tot_len);
-
-    u16_t current_incoming_packet_length = p->tot_len;
-    char *current_packet_data_pointer = (char *)p->payload;
+    // The chain may hold several segments, only the first p->len bytes are at p->payload
+    u32_t current_incoming_packet_length = p->tot_len;
+    u32_t skip = 0;
+    u32_t stored_now = 0;
 
     if (!is_header_processed_global) {
-        u16_t bytes_needed_for_header = 4 - header_bytes_in_buffer_global;
-        u16_t bytes_available_in_pbuf_for_header = LWIP_MIN(current_incoming_packet_length, bytes_needed_for_header);
+        u32_t bytes_needed_for_header = 4 - header_bytes_in_buffer_global;
+        u32_t bytes_available_in_pbuf_for_header = LWIP_MIN(current_incoming_packet_length, bytes_needed_for_header);
 
-        memcpy(header_byte_collection_buffer_global + header_bytes_in_buffer_global,
-               current_packet_data_pointer, bytes_available_in_pbuf_for_header);
+        pbuf_copy_partial(p, header_byte_collection_buffer_global + header_bytes_in_buffer_global,
+                          (u16_t)bytes_available_in_pbuf_for_header, 0);
         header_bytes_in_buffer_global += bytes_available_in_pbuf_for_header;
 
-        current_packet_data_pointer += bytes_available_in_pbuf_for_header;
+        skip = bytes_available_in_pbuf_for_header;
         current_incoming_packet_length -= bytes_available_in_pbuf_for_header;
 
         if (header_bytes_in_buffer_global == 4) {
@@ -110,63 +131,86 @@ static err_t server_recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *
             xil_printf("SERVER: Header processed. Expected image size: %lu bytes.\n\r",
                        (unsigned long)expected_total_image_size_global);
 
+            ddr4_echo_init(&echo_global, (UINTPTR)image_storage_buffer_global, ECHO_MODE);
+            rx_window_limit(&echo_global.win, MAX_IMAGE_BUFFER_SIZE);
+            ddr4_cache_init(&cache_global, DDR4_CACHE_DEFAULT_THRESHOLD);
+
             if (expected_total_image_size_global == 0 || expected_total_image_size_global > MAX_IMAGE_BUFFER_SIZE) {
                 xil_printf("SERVER: ERROR: Invalid image size (%lu). Max allowed: %lu. Closing.\n\r",
                            (unsigned long)expected_total_image_size_global, (unsigned long)MAX_IMAGE_BUFFER_SIZE);
                 pbuf_free(p);
-                server_close_connection(tpcb);
+                server_abort_connection(tpcb);
                 return ERR_ABRT;
             }
         }
     }
 
+    // One bounds check and one copy for the whole chain
     if (is_header_processed_global && current_incoming_packet_length > 0) {
-        u16_t bytes_to_copy_to_ddr = LWIP_MIN(current_incoming_packet_length,
-                                              (u16_t)(expected_total_image_size_global - total_received_data_len_global));
+        u32_t bytes_to_copy_to_ddr = LWIP_MIN(current_incoming_packet_length,
+                                              expected_total_image_size_global - total_received_data_len_global);
         bytes_to_copy_to_ddr = LWIP_MIN(bytes_to_copy_to_ddr,
-                                              (u16_t)(MAX_IMAGE_BUFFER_SIZE - current_buffer_offset_global));
+                                        MAX_IMAGE_BUFFER_SIZE - current_buffer_offset_global);
 
         if (bytes_to_copy_to_ddr > 0) {
-            memcpy(image_storage_buffer_global + current_buffer_offset_global,
-                   current_packet_data_pointer, bytes_to_copy_to_ddr);
-
-            #if defined (__arm__) || defined (__aarch64__)
-            Xil_DCacheFlushRange((UINTPTR)(image_storage_buffer_global + current_buffer_offset_global), bytes_to_copy_to_ddr);
-            #endif
+            // Echoed zero-copy right away, so the range must reach DDR4 now
+            pbuf_iov_store(p, skip, bytes_to_copy_to_ddr,
+                           (UINTPTR)(image_storage_buffer_global + current_buffer_offset_global), &cache_global);
+            ddr4_cache_flush(&cache_global);
 
             current_buffer_offset_global += bytes_to_copy_to_ddr;
             total_received_data_len_global += bytes_to_copy_to_ddr;
 
-            xil_printf("SERVER: Recv %u image bytes. Total: %lu/%lu.\n\r",
-                       bytes_to_copy_to_ddr, (unsigned long)total_received_data_len_global, (unsigned long)expected_total_image_size_global);
+            TRACE_DBG(TRACE_EV_STORE, bytes_to_copy_to_ddr, total_received_data_len_global);
 
-            try_echo_chunk(tpcb, current_packet_data_pointer, bytes_to_copy_to_ddr);
+            stored_now = bytes_to_copy_to_ddr;
+            if (try_echo(tpcb) != ERR_OK) {
+                pbuf_free(p);
+                server_abort_connection(tpcb);
+                return ERR_ABRT;
+            }
         } else {
             if (total_received_data_len_global >= expected_total_image_size_global) {
                 xil_printf("SERVER: Image complete. Discarding extra data.\n\r");
             } else {
-                xil_printf("SERVER: DDR4 buffer full or image size mismatch. Closing.\n\r");
+                xil_printf("SERVER: DDR4 buffer full or image size mismatch. Aborting.\n\r");
                 pbuf_free(p);
-                server_close_connection(tpcb);
+                server_abort_connection(tpcb);
                 return ERR_ABRT;
             }
         }
     }
 
+    // Header and discarded bytes go straight back, payload once it is in DDR4
+    pbuf_iov_recved(tpcb, p->tot_len - stored_now);
+    if (is_header_processed_global) {
+        rx_window_update(&echo_global.win, tpcb, total_received_data_len_global);
+    }
     pbuf_free(p);
     return ERR_OK;
 }
 
 static err_t server_sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
     LWIP_UNUSED_ARG(arg);
-    xil_printf("SERVER: Sent/ACK'd: %u bytes. Total echoed: %lu.\n\r", len, (unsigned long)total_echoed_data_len_global);
+    ddr4_echo_acked(&echo_global, len);
     echoing_in_progress_global = 0;
 
+    // Room in the send buffer again: resume a parked echo
+    if (echo_global.parked && try_echo(tpcb) != ERR_OK) {
+        server_abort_connection(tpcb);
+        return ERR_ABRT;
+    }
+
     if (total_echoed_data_len_global == expected_total_image_size_global &&
         total_received_data_len_global == expected_total_image_size_global &&
-        is_header_processed_global) {
+        is_header_processed_global && ddr4_echo_pinned(&echo_global) == 0) {
         xil_printf("SERVER: All %lu bytes of image received and echoed. Closing.\n\r",
                    (unsigned long)total_echoed_data_len_global);
+        ddr4_echo_report(&echo_global);
+        ddr4_cache_report();
+        conn_watchdog_report(&wd_global);
+        server_close_connection(tpcb);
+    } else if (closing_global && ddr4_echo_pending(&echo_global) == 0) {
         server_close_connection(tpcb);
     }
     return ERR_OK;
@@ -176,18 +220,39 @@ static void server_error_callback(void *arg, err_t err) {
     LWIP_UNUSED_ARG(arg);
     xil_printf("SERVER: Connection error %d. Resetting state.\n\r", err);
     // lwIP handles PCB freeing in error path. Just reset global state.
-    active_pcb_global = NULL;
-    is_header_processed_global = 0;
-    header_bytes_in_buffer_global = 0;
-    expected_total_image_size_global = 0;
-    current_buffer_offset_global = 0;
-    total_received_data_len_global = 0;
-    total_echoed_data_len_global = 0;
-    echoing_in_progress_global = 0;
+    reset_connection_state();
 }
 
 static err_t server_poll_callback(void *arg, struct tcp_pcb *tpcb) {
+    u32_t progress = header_bytes_in_buffer_global + total_received_data_len_global;
+    u8_t pending = 0;
+
     LWIP_UNUSED_ARG(arg);
+
+    if (is_header_processed_global) {
+        progress += echo_global.acked;
+        pending = ddr4_echo_pending(&echo_global) > 0;
+    }
+
+    // A peer that stopped sending and ACKing gives up the single slot
+    if (conn_watchdog_check(&wd_global, progress, pending) == CONN_WATCHDOG_EXPIRED) {
+        conn_watchdog_evict(&wd_global);
+        server_abort_connection(tpcb);
+        return ERR_ABRT;
+    }
+
+    // Resume an echo no ACK came back to restart; nothing stays behind
+    // Nagle for more than a poll interval
+    if (is_header_processed_global) {
+        if (ddr4_echo_poll(&echo_global, tpcb) != ERR_OK) {
+            server_abort_connection(tpcb);
+            return ERR_ABRT;
+        }
+        total_echoed_data_len_global = echo_global.queued;
+    }
+    if (closing_global && ddr4_echo_pending(&echo_global) == 0) {
+        server_close_connection(tpcb);
+    }
     return ERR_OK;
 }
 
@@ -200,20 +265,34 @@ static void server_close_connection(struct tcp_pcb *pcb) {
         tcp_poll(pcb, NULL, 0);
         tcp_close(pcb);
     }
-    
-    // Reset all global state for next connection
-    active_pcb_global = NULL;
-    is_header_processed_global = 0;
-    header_bytes_in_buffer_global = 0;
-    expected_total_image_size_global = 0;
-    current_buffer_offset_global = 0;
-    total_received_data_len_global = 0;
-    total_echoed_data_len_global = 0;
-    echoing_in_progress_global = 0;
-
+    reset_connection_state();
     xil_printf("SERVER: Connection closed and state reset.\n\r");
 }
 
+// Zero-copy echo segments point into the one fixed buffer, and tcp_close
+// keeps them for retransmits: close only once every echoed byte is ACK'd.
+// Until then active_pcb_global stays set, so the next client is refused
+// instead of overwriting the buffer, and sent or poll finishes the close.
+static void server_close_when_acked(struct tcp_pcb *pcb) {
+    if (ddr4_echo_pending(&echo_global) > 0) {
+        closing_global = 1;
+        return;
+    }
+    server_close_connection(pcb);
+}
+
+// Drop the connection with a RST and free its PCB right away
+static void server_abort_connection(struct tcp_pcb *pcb) {
+    tcp_arg(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_err(pcb, NULL);
+    tcp_poll(pcb, NULL, 0);
+    tcp_abort(pcb);
+    reset_connection_state();
+    xil_printf("SERVER: Connection aborted and state reset.\n\r");
+}
+
 static err_t server_accept_callback(void *arg, struct tcp_pcb *new_pcb, err_t err) {
     LWIP_UNUSED_ARG(arg);
 
@@ -229,15 +308,14 @@ static err_t server_accept_callback(void *arg, struct tcp_pcb *new_pcb, err_t er
     }
 
     active_pcb_global = new_pcb;
+    conn_watchdog_init(&wd_global, CONN_WATCHDOG_IDLE_POLLS);
     // No struct to pass, so arg will remain NULL for now, or just pass a dummy value like 1
     tcp_arg(new_pcb, NULL); // We are not using `arg` in callbacks, but lwIP requires it to be set.
 
     tcp_recv(new_pcb, server_recv_callback);
     tcp_sent(new_pcb, server_sent_callback);
     tcp_err(new_pcb, server_error_callback);
-    tcp_poll(new_pcb, server_poll_callback, 4);
-
-    tcp_set_recv_wnd(new_pcb, TCP_WND);
+    tcp_poll(new_pcb, server_poll_callback, CONN_WATCHDOG_POLL_INTERVAL);
 
     xil_printf("SERVER: Accepted new connection (PCB: %lu). Waiting for header...\n\r", (UINTPTR)new_pcb);
 
@@ -269,7 +347,14 @@ void echo_server_init(void) {
     }
 
     tcp_accept(listen_pcb, server_accept_callback);
+    trace_log_init();
 
     xil_printf("SERVER: TCP image echo server started @ port %d.\n\r", port);
     xil_printf("SERVER: DDR4 Image Buffer Address: 0x%08lX.\n\r", (UINTPTR)DDR4_IMAGE_BUFFER_START_ADDR);
+}
+
+// Main-loop hook: format trace records while the link is quiet
+int transfer_data() {
+    trace_log_drain(TRACE_DRAIN_BATCH);
+    return 0;
 }
\ No newline at end of file
@@ -13,6 +13,14 @@
 #include "xil_printf.h"
 #include "xil_cache.h"
 #include "xil_exception.h"
+#include "ddr4_arena.h"
+#include "ddr4_cache.h"
+#include "conn_pool.h"
+#include "conn_watchdog.h"
+#include "ddr4_echo.h"
+#include "pbuf_iov.h"
+#include "trace_log.h"
+#include "frame_parser.h"
 
 #define SERVER_PORT 6001
 #define MAX_IMAGE_SIZE (512 * 1024 * 1024) // 512MB (safe margin within 2GB DDR4)
@@ -23,19 +31,122 @@ typedef struct {
     u32_t received_bytes;  // Total bytes received
     u32_t file_size;       // Expected file size
     struct tcp_pcb *pcb;   // Connection PCB
+    ddr4_extent_t *extent; // DDR4 region owned by this upload
+    ddr4_cache_t cache;    // Dirty DDR4 span not yet flushed
+    ddr4_echo_t echo;      // Echo cursor after FIN; echo.win credits payload
+    conn_watchdog_t wd;    // Stall and idle supervision from tcp_poll
+    struct pbuf *held;     // Partial header, waiting for the rest
     u8_t header_received;  // Flag for size header
+    u8_t closing;          // Client sent FIN, echo in progress
+    u8_t verify;           // FRAME_FLAG_VERIFY: reply with a digest, no echo
+    u32_t crc;             // Running CRC32C of the stored bytes (verify mode)
+    u8_t digest[FRAME_DIGEST_SIZE];
 } image_connection_t;
 
+// Connection slots, acquired in accept_callback
+CONN_POOL_DECLARE(connections, image_connection_t, CONN_POOL_MAX_CONNECTIONS);
+
 void init_ddr_memory() {
     Xil_DCacheFlush();
     Xil_ICacheInvalidate();
+    ddr4_arena_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    ddr4_cache_region_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    trace_log_init();
     xil_printf("DDR4 Memory initialized at 0x%08x\n\r", DDR4_IMAGE_BUFFER_START_ADDR);
 }
 
+// Return the connection's DDR4 extent to the arena and free the struct
+static void free_connection(image_connection_t *conn) {
+    tx_batch_cancel(&conn->echo.tx);
+    if (conn->held) {
+        pbuf_free(conn->held);
+    }
+    ddr4_arena_free(conn->extent);
+    conn_pool_release(&connections, conn);
+}
+
+static void abort_connection(image_connection_t *conn, struct tcp_pcb *tpcb) {
+    free_connection(conn);
+    tcp_arg(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_abort(tpcb);
+}
+
+static void close_connection(image_connection_t *conn, struct tcp_pcb *tpcb) {
+    if (conn->closing) {
+        ddr4_echo_report(&conn->echo);
+        conn_watchdog_report(&conn->wd);
+    }
+    tcp_arg(tpcb, NULL);
+    tcp_recv(tpcb, NULL);
+    tcp_sent(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_poll(tpcb, NULL, 0);
+    tcp_close(tpcb);
+    free_connection(conn);
+}
+
+err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    image_connection_t *conn = (image_connection_t *)arg;
+
+    if (!conn || !conn->closing) {
+        return ERR_OK;
+    }
+
+    // Room in the send buffer again: queue the next part of the echo
+    ddr4_echo_acked(&conn->echo, len);
+    if (ddr4_echo_pump(&conn->echo, tpcb) != ERR_OK) {
+        xil_printf("Echo failed at offset %d\n\r", conn->echo.queued);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    if (conn->echo.acked >= conn->received_bytes) {
+        xil_printf("All data echoed, closing connection\n\r");
+        close_connection(conn, tpcb);
+    }
+    return ERR_OK;
+}
+
+void err_callback(void *arg, err_t err) {
+    image_connection_t *conn = (image_connection_t *)arg;
+
+    // The PCB is already freed
+    if (conn) {
+        TRACE_ERR(TRACE_EV_ERROR, err, conn->received_bytes);
+        free_connection(conn);
+    }
+}
+
+err_t poll_callback(void *arg, struct tcp_pcb *tpcb) {
+    image_connection_t *conn = (image_connection_t *)arg;
+    u8_t pending;
+
+    if (!conn) {
+        return ERR_OK;
+    }
+
+    // Evict a client that stopped sending (or ACKing the echo), with its extent
+    pending = conn->closing && ddr4_echo_pending(&conn->echo) > 0;
+    if (conn_watchdog_check(&conn->wd, conn->received_bytes + conn->echo.acked, pending) == CONN_WATCHDOG_EXPIRED) {
+        conn_watchdog_evict(&conn->wd);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    // Resume an echo no ACK came back to restart
+    if (conn->closing && ddr4_echo_poll(&conn->echo, tpcb) != ERR_OK) {
+        xil_printf("Echo failed at offset %d\n\r", conn->echo.queued);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
 err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 {
     image_connection_t *conn = (image_connection_t *)arg;
     err_t ret_err = ERR_OK;
+    u32_t skip = 0, len;
     
     if (!conn) {
         tcp_close(tpcb);
@@ -43,74 +154,107 @@ err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
     }
 
     if (!p) {
-        // Connection closed - echo back the image
-        if (conn->received_bytes > 0) {
-            xil_printf("Echoing back %d bytes from DDR4\n\r", conn->received_bytes);
-            
-            u32_t remaining = conn->received_bytes;
-            u32_t offset = 0;
-            
-            while (remaining > 0) {
-                u32_t chunk_size = (remaining > TCP_MSS) ? TCP_MSS : remaining;
-                err_t err = tcp_write(tpcb, (void*)(conn->buffer_addr + offset), 
-                                    chunk_size, TCP_WRITE_FLAG_COPY);
-                
-                if (err != ERR_OK) {
-                    xil_printf("Echo failed at offset %d: %d\n\r", offset, err);
-                    ret_err = err;
-                    break;
-                }
-                
-                offset += chunk_size;
-                remaining -= chunk_size;
-            }
-            
+        // Connection closed - send the digest, or echo back the image
+        if (conn->verify) {
+            xil_printf("Stored %d bytes, CRC32C 0x%08lx\n\r", conn->received_bytes, (unsigned long)conn->crc);
+            frame_digest_encode(conn->digest, conn->crc, conn->received_bytes);
+            ret_err = tcp_write(tpcb, conn->digest, FRAME_DIGEST_SIZE, TCP_WRITE_FLAG_COPY);
             if (ret_err == ERR_OK) {
                 tcp_output(tpcb);
             }
+        } else if (conn->received_bytes > 0) {
+            // Echo what the send buffer takes now; sent_callback queues the
+            // rest as ACKs free room, poll_callback if none come back
+            xil_printf("Echoing back %d bytes from DDR4\n\r", conn->received_bytes);
+            ddr4_cache_flush(&conn->cache);
+            conn->closing = 1;
+            ddr4_echo_stored(&conn->echo, conn->received_bytes);
+            if (ddr4_echo_pump(&conn->echo, tpcb) != ERR_OK) {
+                xil_printf("Echo failed at offset %d\n\r", conn->echo.queued);
+                abort_connection(conn, tpcb);
+                return ERR_ABRT;
+            }
+            return ERR_OK;
         }
         
-        // Clean up
-        Xil_DCacheFlushRange(conn->buffer_addr, conn->received_bytes);
-        tcp_arg(tpcb, NULL);
-        tcp_recv(tpcb, NULL);
-        tcp_close(tpcb);
-        mem_free(conn);
+        // Clean up, writing back whatever is still below the flush threshold
+        ddr4_cache_flush(&conn->cache);
+        close_connection(conn, tpcb);
         return ret_err;
     }
 
-    // Handle file size header (first 4 bytes)
-    if (!conn->header_received && conn->received_bytes < 4) {
-        if (p->len >= 4) {
-            memcpy(&conn->file_size, p->payload, 4);
-            xil_printf("Expected file size: %d bytes\n\r", conn->file_size);
+    // Handle the header (legacy 4-byte size or v2, see frame_parser.h)
+    if (!conn->header_received) {
+        frame_header_t hdr;
+        err_t herr;
+
+        // Keep a partial header until the rest arrives; not credited yet
+        if (conn->held) {
+            pbuf_cat(conn->held, p);
+            p = conn->held;
+            conn->held = NULL;
+        }
+        herr = frame_header_from_pbuf(p, &hdr);
+        if (herr == ERR_INPROGRESS) {
+            conn->held = p;
+            return ERR_OK;
+        }
+        if (herr == ERR_OK) {
+            xil_printf("Expected file size: %lu KB (header v%d, stream %lu, seq %lu)\n\r",
+                       (unsigned long)(hdr.length / 1024), hdr.version,
+                       (unsigned long)hdr.stream_id, (unsigned long)hdr.sequence);
+            conn->file_size = (u32_t)hdr.length;
             
-            conn->buffer_addr = DDR4_IMAGE_BUFFER_START_ADDR;
+            // Reserve a DDR4 extent sized for this upload
+            if (hdr.length == 0 || hdr.length > MAX_IMAGE_SIZE ||
+                (conn->extent = ddr4_arena_alloc(conn->file_size)) == NULL) {
+                xil_printf("No DDR4 space for %d bytes, rejecting upload\n\r", conn->file_size);
+                ddr4_arena_report();
+                pbuf_free(p);
+                free_connection(conn);
+                tcp_arg(tpcb, NULL);
+                tcp_abort(tpcb);
+                return ERR_ABRT;
+            }
+            conn->buffer_addr = (u32_t)conn->extent->addr;
             conn->header_received = 1;
-            
-            pbuf_header(p, -4); // Remove header from pbuf
+            ddr4_echo_init(&conn->echo, conn->buffer_addr, DDR4_ECHO_COPY);
+            rx_window_limit(&conn->echo.win, conn->extent->size);
+            conn->verify = (hdr.flags & FRAME_FLAG_VERIFY) ? 1 : 0;
+            skip = hdr.size;    // Payload starts after the header, in whichever segment
             xil_printf("DDR4 buffer ready at 0x%08x\n\r", conn->buffer_addr);
+        } else {
+            xil_printf("Malformed header, rejecting upload\n\r");
+            pbuf_free(p);
+            free_connection(conn);
+            tcp_arg(tpcb, NULL);
+            tcp_abort(tpcb);
+            return ERR_ABRT;
         }
     }
 
-    // Check DDR4 space
-    if (conn->received_bytes + p->len > MAX_IMAGE_SIZE) {
-        xil_printf("Image exceeds maximum size (%d MB)\n\r", MAX_IMAGE_SIZE/(1024*1024));
+    // Check DDR4 space, once for the whole chain
+    len = p->tot_len - skip;
+    if (conn->received_bytes + len > conn->extent->size) {
+        xil_printf("Image exceeds its DDR4 extent (%d bytes)\n\r", conn->extent->size);
         pbuf_free(p);
-        tcp_close(tpcb);
-        mem_free(conn);
-        return ERR_MEM;
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
     }
 
-    // Copy to DDR4
-    if (conn->header_received) {
-        memcpy((void*)(conn->buffer_addr + conn->received_bytes), p->payload, p->len);
-        conn->received_bytes += p->len;
-        Xil_DCacheFlushRange(conn->buffer_addr + conn->received_bytes - p->len, p->len);
-        xil_printf("Received %d bytes (total: %d)\n\r", p->len, conn->received_bytes);
+    // Copy the chain to DDR4
+    if (len > 0) {
+        pbuf_iov_store(p, skip, len, conn->buffer_addr + conn->received_bytes, &conn->cache);
+        if (conn->verify) {
+            conn->crc = pbuf_iov_crc32c(conn->crc, p, skip, len);
+        }
+        conn->received_bytes += len;
+        TRACE_DBG(TRACE_EV_STORE, len, conn->received_bytes);
     }
 
-    tcp_recved(tpcb, p->len);
+    // Header bytes go straight back, payload once it is in DDR4
+    tcp_recved(tpcb, skip);
+    rx_window_update(&conn->echo.win, tpcb, conn->received_bytes);
     pbuf_free(p);
     return ERR_OK;
 }
@@ -118,36 +262,51 @@ err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
 {
     image_connection_t *conn;
+    conn_reject_t reason;
 
     if (err != ERR_OK || newpcb == NULL) {
         return ERR_VAL;
     }
 
-    conn = (image_connection_t *)mem_malloc(sizeof(image_connection_t));
+    // Admission control before anything else is allocated
+    conn = (image_connection_t *)conn_pool_acquire(&connections, &reason);
     if (!conn) {
-        xil_printf("Failed to allocate connection struct\n\r");
-        return ERR_MEM;
+        xil_printf("Connection rejected: %s (%d/%d in use)\n\r",
+                   conn_pool_reason(reason), connections.in_use, connections.limit);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
     }
-
-    memset(conn, 0, sizeof(image_connection_t));
     conn->pcb = newpcb;
     conn->buffer_addr = 0;
     conn->received_bytes = 0;
     conn->header_received = 0;
+    ddr4_cache_init(&conn->cache, DDR4_CACHE_DEFAULT_THRESHOLD);
+    ddr4_echo_init(&conn->echo, 0, DDR4_ECHO_COPY);
+    conn_watchdog_init(&conn->wd, CONN_WATCHDOG_IDLE_POLLS);
 
     tcp_arg(newpcb, conn);
     tcp_recv(newpcb, recv_callback);
+    tcp_sent(newpcb, sent_callback);
+    tcp_err(newpcb, err_callback);
+    tcp_poll(newpcb, poll_callback, CONN_WATCHDOG_POLL_INTERVAL);
 
     xil_printf("New connection established\n\r");
     return ERR_OK;
 }
 
+// Main-loop hook: format trace records while the link is quiet
+int transfer_data() {
+    trace_log_drain(TRACE_DRAIN_BATCH);
+    return 0;
+}
+
 int start_application()
 {
     struct tcp_pcb *pcb;
     err_t err;
 
     init_ddr_memory();
+    conn_pool_init(&connections, CONN_POOL_MAX_CONNECTIONS);
 
     pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
     if (!pcb) {
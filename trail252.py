@@ -2,6 +2,7 @@ import socket
 import os
 import time
 import struct
+from frame_digest import crc32c_update, parse_digest, DIGEST_SIZE, FLAG_VERIFY
 
 # Configuration
 SERVER_IP = '192.168.1.10'  # Replace with your FPGA's IP address
@@ -9,6 +10,7 @@ SERVER_PORT = 6001
 CHUNK_SIZE = 1446           # Size of each data chunk
 IMAGE_FILE = 'inputImage.png' # Path to your original input PNG file
 OUTPUT_IMAGE_FILE = 'echoedImage.png' # Name for the file to save the echoed data
+VERIFY_MODE = True          # Server returns a CRC32C digest instead of the echo
 
 def send_and_receive_image():
     # Verify input file exists
@@ -41,9 +43,13 @@ def send_and_receive_image():
         print("\nConnecting to server...")
         sock.connect((SERVER_IP, SERVER_PORT))
         
-        # Send file size header (4 bytes)
+        # Send file size header: v2 with the verify flag, or legacy 4 bytes
         print("Sending file size header...")
-        sock.sendall(struct.pack('!I', file_size))
+        if VERIFY_MODE:
+            sock.sendall(struct.pack('>BBHIQII', 0xFF, 2, 24, FLAG_VERIFY, file_size, 0, 0))
+        else:
+            sock.sendall(struct.pack('!I', file_size))
+        crc = 0
         
         # Send image data in specified chunks
         print("Sending image data...")
@@ -55,6 +61,8 @@ def send_and_receive_image():
             sent = sock.send(chunk)
             if sent == 0:
                 raise RuntimeError("Socket connection broken")
+            if VERIFY_MODE:
+                crc = crc32c_update(crc, chunk[:sent])
             total_sent += sent
             print(f"Progress: {total_sent}/{file_size} bytes ({total_sent/file_size:.1%})", end='\r')
         
@@ -65,6 +73,22 @@ def send_and_receive_image():
         # Shutdown sending side
         sock.shutdown(socket.SHUT_WR)
         
+        if VERIFY_MODE:
+            # Only the 16-byte digest trailer comes back
+            trailer = b''
+            while len(trailer) < DIGEST_SIZE:
+                chunk = sock.recv(DIGEST_SIZE - len(trailer))
+                if not chunk:
+                    raise RuntimeError("Connection closed before the digest")
+                trailer += chunk
+            board_crc, board_len = parse_digest(trailer)
+            print(f"\nBoard digest: CRC32C 0x{board_crc:08x} over {board_len} bytes, local 0x{crc:08x}")
+            if board_crc != crc or board_len != file_size:
+                print("Error: Digest mismatch")
+                return False
+            print("\nTest successful! Board copy verified by digest")
+            return True
+
         # Receive echoed image
         print("\nWaiting for echoed image...")
         received_data = bytearray()
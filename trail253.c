@@ -13,30 +13,196 @@
 #include "xil_printf.h"
 #include "xil_cache.h"
 #include "xil_exception.h"
+#include "ddr4_arena.h"
+#include "ddr4_cache.h"
+#include "conn_pool.h"
+#include "conn_watchdog.h"
+#include "pbuf_iov.h"
+#include "tx_batch.h"
+#include "trace_log.h"
+#include "frame_parser.h"
 
 #define SERVER_PORT 6001
 #define MAX_IMAGE_SIZE (512 * 1024 * 1024) // 512MB (safe margin within 2GB DDR4)
 #define DDR4_IMAGE_BUFFER_START_ADDR 0x90000000 // KCU105 DDR4 buffer address
-#define HEADER_SIZE 4  // File size header is 4 bytes
 
 typedef struct {
     u32_t buffer_addr;     // DDR4 memory address
-    u32_t received_bytes;  // Total bytes received
-    u32_t file_size;       // Expected file size
+    u64_t received_bytes;  // Total bytes received
+    u64_t file_size;       // Expected file size (v2 headers allow more than 4 GB)
     struct tcp_pcb *pcb;   // Connection PCB
+    ddr4_extent_t *extent; // DDR4 region owned by this upload
+    ddr4_cache_t cache;    // Dirty DDR4 span not yet flushed
+    tx_batch_t tx;         // Echo writes, sent once per received chain
+    u64_t acked;           // Echo bytes ACK'd by the client
+    conn_watchdog_t wd;    // Stall and idle supervision from tcp_poll
+    struct pbuf *held;     // Partial header, waiting for the rest
+    struct pbuf *unsent;   // Echo bytes tcp_write had no room for, not credited yet;
+                           // a pbuf_iov list, so tot_len is not kept up to date
+    u32_t unsent_len;      // Bytes in unsent, can exceed 64 KB with window scaling
     u8_t header_received;  // Flag for size header
+    u8_t closing;          // Client sent FIN, unsent echo still draining
 } image_connection_t;
 
+// Connection slots, acquired in accept_callback
+CONN_POOL_DECLARE(connections, image_connection_t, CONN_POOL_MAX_CONNECTIONS);
+
 void init_ddr_memory() {
     Xil_DCacheFlush();
     Xil_ICacheInvalidate();
+    ddr4_arena_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    ddr4_cache_region_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    trace_log_init();
     xil_printf("DDR4 Memory initialized at 0x%08x\n\r", DDR4_IMAGE_BUFFER_START_ADDR);
 }
 
+// Return the connection's DDR4 extent to the arena and free the struct
+static void free_connection(image_connection_t *conn) {
+    if (conn->held) {
+        pbuf_free(conn->held);
+    }
+    if (conn->unsent) {
+        pbuf_free(conn->unsent);
+    }
+    ddr4_arena_free(conn->extent);
+    conn_pool_release(&connections, conn);
+}
+
+static void abort_connection(image_connection_t *conn, struct tcp_pcb *tpcb) {
+    free_connection(conn);
+    tcp_arg(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_abort(tpcb);
+}
+
+static void close_connection(image_connection_t *conn, struct tcp_pcb *tpcb) {
+    xil_printf("Connection closed. Total KB stored: %lu\n\r", (unsigned long)(conn->received_bytes / 1024));
+    tx_batch_report(&conn->tx);
+    conn_watchdog_report(&conn->wd);
+    ddr4_cache_flush(&conn->cache);
+    tcp_arg(tpcb, NULL);
+    tcp_recv(tpcb, NULL);
+    tcp_sent(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_poll(tpcb, NULL, 0);
+    tcp_close(tpcb);
+    free_connection(conn);
+}
+
+// Echo as much of the unsent list as the send buffer takes, one tcp_write
+// per segment, and credit the window for exactly what went out. Running out
+// of room (ERR_MEM) is not an error: sent_callback or poll_callback goes on.
+static err_t echo_unsent(image_connection_t *conn, struct tcp_pcb *tpcb) {
+    pbuf_iter_t it;
+    const u8_t *data;
+    u32_t seg, n, written = 0;
+    err_t err = ERR_OK;
+
+    if (!conn->unsent) {
+        return ERR_OK;
+    }
+    pbuf_iter_init(&it, conn->unsent, 0, conn->unsent_len);
+    while ((seg = pbuf_iter_next(&it, &data)) > 0) {
+        n = LWIP_MIN(seg, tcp_sndbuf(tpcb));
+        if (n == 0) {
+            break;
+        }
+        err = tx_batch_write(&conn->tx, tpcb, data, (u16_t)n, TCP_WRITE_FLAG_COPY);
+        if (err != ERR_OK) {
+            break;
+        }
+        tcp_recved(tpcb, (u16_t)n);
+        written += n;
+        if (n < seg) {
+            break;
+        }
+    }
+    if (written > 0) {
+        pbuf_iov_consume(&conn->unsent, written);
+        conn->unsent_len -= written;
+        if (conn->unsent_len == 0 && conn->unsent) {
+            // Only empty pbufs left
+            pbuf_free(conn->unsent);
+            conn->unsent = NULL;
+        }
+    }
+    if (err != ERR_OK && err != ERR_MEM) {
+        xil_printf("tcp_write failed: %d\n\r", err);
+        TRACE_ERR(TRACE_EV_ERROR, err, (u32_t)conn->received_bytes);
+        return err;
+    }
+
+    // Send the echoed data, the tail straight away once the image is complete
+    err = tx_batch_flush(&conn->tx, tpcb, conn->unsent == NULL && conn->received_bytes == conn->file_size);
+    if (err != ERR_OK) {
+        xil_printf("tcp_output failed: %d\n\r", err);
+    }
+    return ERR_OK;
+}
+
+err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    image_connection_t *conn = (image_connection_t *)arg;
+
+    if (!conn) {
+        return ERR_OK;
+    }
+    conn->acked += len;
+    TRACE_DBG(TRACE_EV_ACK, len, (u32_t)conn->acked);
+
+    // Room freed up: carry on with the echo tail
+    if (echo_unsent(conn, tpcb) != ERR_OK) {
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    if (conn->closing && !conn->unsent) {
+        close_connection(conn, tpcb);
+    }
+    return ERR_OK;
+}
+
+void err_callback(void *arg, err_t err) {
+    image_connection_t *conn = (image_connection_t *)arg;
+
+    // The PCB is already freed
+    if (conn) {
+        TRACE_ERR(TRACE_EV_ERROR, err, (u32_t)conn->received_bytes);
+        free_connection(conn);
+    }
+}
+
+err_t poll_callback(void *arg, struct tcp_pcb *tpcb) {
+    image_connection_t *conn = (image_connection_t *)arg;
+
+    if (!conn) {
+        return ERR_OK;
+    }
+
+    // Evict a client that stopped sending and ACKing, with its extent
+    if (conn_watchdog_check(&conn->wd, (u32_t)(conn->received_bytes + conn->acked),
+                            conn->tx.bytes > conn->acked || conn->unsent != NULL) == CONN_WATCHDOG_EXPIRED) {
+        conn_watchdog_evict(&conn->wd);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    // Resume an echo tail if no ACK came back to do it, then push whatever
+    // Nagle still holds
+    if (echo_unsent(conn, tpcb) != ERR_OK) {
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    if (conn->closing && !conn->unsent) {
+        close_connection(conn, tpcb);
+        return ERR_OK;
+    }
+    tx_batch_poll(&conn->tx, tpcb);
+    return ERR_OK;
+}
+
 err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 {
     image_connection_t *conn = (image_connection_t *)arg;
-    err_t ret_err = ERR_OK;
+    u32_t skip = 0, len, offset, first;
     
     if (!conn) {
         tcp_close(tpcb);
@@ -44,121 +210,151 @@ err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
     }
 
     if (!p) {
-        // Connection closed by client
-        xil_printf("Connection closed. Total bytes stored: %d\n\r", conn->received_bytes);
-        tcp_arg(tpcb, NULL);
-        tcp_recv(tpcb, NULL);
-        tcp_close(tpcb);
-        mem_free(conn);
+        // Connection closed by client; close once the echo tail is written
+        if (conn->unsent) {
+            conn->closing = 1;
+        } else {
+            close_connection(conn, tpcb);
+        }
         return ERR_OK;
     }
 
     // Handle file size header if not yet received
     if (!conn->header_received) {
-        if (p->tot_len < HEADER_SIZE) {
+        frame_header_t hdr;
+        err_t herr;
+
+        // Keep a partial header until the rest arrives; not credited yet
+        if (conn->held) {
+            pbuf_cat(conn->held, p);
+            p = conn->held;
+            conn->held = NULL;
+        }
+        herr = frame_header_from_pbuf(p, &hdr);
+        if (herr == ERR_INPROGRESS) {
             xil_printf("Waiting for more header data...\n\r");
+            conn->held = p;
             return ERR_OK;
         }
 
-        // Extract file size from header (big-endian)
-        u8_t *header = p->payload;
-        conn->file_size = (header[0] << 24) | (header[1] << 16) | 
-                         (header[2] << 8) | header[3];
-        
-        conn->buffer_addr = DDR4_IMAGE_BUFFER_START_ADDR;
-        conn->header_received = 1;
-        xil_printf("Expected file size: %d bytes\n\r", conn->file_size);
+        // Legacy 4-byte or v2 header, see frame_parser.h
+        conn->file_size = hdr.length;
         
-        // Remove header from pbuf
-        if (pbuf_header(p, -HEADER_SIZE) != 0) {
-            xil_printf("Header removal failed\n\r");
-            tcp_close(tpcb);
+        // Reserve a DDR4 extent sized for this upload. Larger objects are
+        // kept as a ring of the last MAX_IMAGE_SIZE bytes, the echo comes
+        // from the pbufs so nothing needs the overwritten part.
+        if (herr != ERR_OK || conn->file_size == 0 ||
+            (conn->extent = ddr4_arena_alloc((u32_t)LWIP_MIN(conn->file_size, (u64_t)MAX_IMAGE_SIZE))) == NULL) {
+            xil_printf("No DDR4 space for %lu KB, rejecting upload\n\r", (unsigned long)(conn->file_size / 1024));
+            ddr4_arena_report();
             pbuf_free(p);
-            mem_free(conn);
-            return ERR_VAL;
+            free_connection(conn);
+            tcp_arg(tpcb, NULL);
+            tcp_abort(tpcb);
+            return ERR_ABRT;
         }
+        conn->buffer_addr = (u32_t)conn->extent->addr;
+        conn->header_received = 1;
+        xil_printf("Expected file size: %lu KB (header v%d, stream %lu, seq %lu)\n\r",
+                   (unsigned long)(conn->file_size / 1024), hdr.version,
+                   (unsigned long)hdr.stream_id, (unsigned long)hdr.sequence);
+        
+        skip = hdr.size;    // Payload starts after the header, in whichever segment
     }
 
-    // Check if we have enough DDR4 space
-    if (conn->received_bytes + p->tot_len > MAX_IMAGE_SIZE) {
-        xil_printf("Image exceeds maximum size (%d MB)\n\r", MAX_IMAGE_SIZE/(1024*1024));
+    // Check the object does not run past its announced size, once per chain
+    len = p->tot_len - skip;
+    if (conn->received_bytes + len > conn->file_size) {
+        xil_printf("Image exceeds its announced size (%lu KB)\n\r", (unsigned long)(conn->file_size / 1024));
         pbuf_free(p);
-        tcp_close(tpcb);
-        mem_free(conn);
-        return ERR_MEM;
+        free_connection(conn);
+        tcp_arg(tpcb, NULL);
+        tcp_err(tpcb, NULL);
+        tcp_abort(tpcb);
+        return ERR_ABRT;
     }
 
-    // Process received data
-    struct pbuf *q = p;
-    while (q) {
-        // Store in DDR4
-        memcpy((void*)(conn->buffer_addr + conn->received_bytes), q->payload, q->len);
-        Xil_DCacheFlushRange(conn->buffer_addr + conn->received_bytes, q->len);
-        
-        // Echo back immediately
-        err_t err = tcp_write(tpcb, q->payload, q->len, TCP_WRITE_FLAG_COPY);
-        if (err != ERR_OK) {
-            xil_printf("tcp_write failed: %d\n\r", err);
-            ret_err = err;
-            break;
-        }
-        
-        conn->received_bytes += q->len;
-        xil_printf("Processed %d bytes (total: %d)\n\r", q->len, conn->received_bytes);
-        q = q->next;
+    // Store in DDR4, wrapping inside the extent for objects larger than it
+    offset = (u32_t)(conn->received_bytes % conn->extent->size);
+    first = LWIP_MIN(len, conn->extent->size - offset);
+    pbuf_iov_store(p, skip, first, conn->buffer_addr + offset, &conn->cache);
+    if (first < len) {
+        pbuf_iov_store(p, skip + first, len - first, conn->buffer_addr, &conn->cache);
     }
 
-    // Send the echoed data
-    if (ret_err == ERR_OK) {
-        err = tcp_output(tpcb);
-        if (err != ERR_OK) {
-            xil_printf("tcp_output failed: %d\n\r", err);
-            ret_err = err;
-        }
-    }
+    conn->received_bytes += len;
+    TRACE_DBG(TRACE_EV_STORE, len, (u32_t)conn->received_bytes);
 
-    // Update TCP receive window
-    tcp_recved(tpcb, p->tot_len);
-    
-    // Free the pbuf
-    pbuf_free(p);
+    // The echo comes from the pbufs, so DDR4 only needs to be clean per image
+    if (conn->received_bytes == conn->file_size) {
+        ddr4_cache_flush(&conn->cache);
+    }
 
-    return ret_err;
+    // Header bytes go straight back. The payload queues behind any echo
+    // tail still waiting for room, and is credited as tcp_write takes it.
+    if (skip > 0) {
+        tcp_recved(tpcb, (u16_t)skip);
+        p = pbuf_free_header(p, skip);
+    }
+    if (p) {
+        conn->unsent_len += p->tot_len;
+        pbuf_iov_append(&conn->unsent, p);
+    }
+    if (echo_unsent(conn, tpcb) != ERR_OK) {
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
 }
 
 err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
 {
     image_connection_t *conn;
+    conn_reject_t reason;
 
     if (err != ERR_OK || newpcb == NULL) {
         return ERR_VAL;
     }
 
-    conn = (image_connection_t *)mem_malloc(sizeof(image_connection_t));
+    // Admission control before anything else is allocated
+    conn = (image_connection_t *)conn_pool_acquire(&connections, &reason);
     if (!conn) {
-        xil_printf("Failed to allocate connection struct\n\r");
-        return ERR_MEM;
+        xil_printf("Connection rejected: %s (%d/%d in use)\n\r",
+                   conn_pool_reason(reason), connections.in_use, connections.limit);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
     }
-
-    memset(conn, 0, sizeof(image_connection_t));
     conn->pcb = newpcb;
     conn->buffer_addr = 0;
     conn->received_bytes = 0;
     conn->header_received = 0;
+    ddr4_cache_init(&conn->cache, DDR4_CACHE_DEFAULT_THRESHOLD);
+    tx_batch_init(&conn->tx, TX_BATCH_DEFAULT_BYTES);
+    conn_watchdog_init(&conn->wd, CONN_WATCHDOG_IDLE_POLLS);
 
     tcp_arg(newpcb, conn);
     tcp_recv(newpcb, recv_callback);
+    tcp_sent(newpcb, sent_callback);
+    tcp_err(newpcb, err_callback);
+    tcp_poll(newpcb, poll_callback, CONN_WATCHDOG_POLL_INTERVAL);
 
     xil_printf("New connection established\n\r");
     return ERR_OK;
 }
 
+// Main-loop hook: format trace records while the link is quiet
+int transfer_data() {
+    trace_log_drain(TRACE_DRAIN_BATCH);
+    return 0;
+}
+
 int start_application()
 {
     struct tcp_pcb *pcb;
     err_t err;
 
     init_ddr_memory();
+    conn_pool_init(&connections, CONN_POOL_MAX_CONNECTIONS);
 
     pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
     if (!pcb) {
@@ -1,4 +1,5 @@
 import socket
+import struct
 import os
 import time
 import sys
@@ -9,6 +10,14 @@ SERVER_PORT = 6001
 CHUNK_SIZE = 1446           # Size of each data chunk
 IMAGE_FILE = 'inputImage.png' # Path to your original input PNG file
 OUTPUT_IMAGE_FILE = 'echoedImage.png' # Name for the file to save the echoed data
+HEADER_VERSION = 2          # 1 = legacy 4-byte size, 2 = v2 header with 64-bit size
+STREAM_ID = 0
+
+def pack_header(size):
+    """Legacy: >I size. v2: marker, version, header length, flags, u64 size, sequence, stream id."""
+    if HEADER_VERSION == 1:
+        return struct.pack('>I', size)
+    return struct.pack('>BBHIQII', 0xFF, 2, 24, 0, size, 0, STREAM_ID)
 
 def send_and_receive_image():
     # Verify input file exists
@@ -43,13 +52,8 @@ def send_and_receive_image():
         sock.connect((SERVER_IP, SERVER_PORT))
         print(f"Connected in {time.time() - start_connect:.3f} seconds")
         
-        # Send file size header (4 bytes, big-endian)
-        header = bytes([
-            (file_size >> 24) & 0xFF,
-            (file_size >> 16) & 0xFF,
-            (file_size >> 8) & 0xFF,
-            file_size & 0xFF
-        ])
+        # Send file size header (big-endian, legacy or v2)
+        header = pack_header(file_size)
         
         print("Sending file size header...")
         sock.sendall(header)
@@ -1,6 +1,12 @@
 /******************************************************************************
 * Robust Streaming Image Echo Server with DDR4 Storage
 * For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* Received chains go to the copy engine (copy_engine.h) instead of a memcpy
+* in recv_callback; the echo advances as copies complete on the main loop.
+* A connection that goes away with copies in flight is only marked dead and
+* freed when its last copy completes, since the engine is still writing to
+* its extent.
 ******************************************************************************/
 
 #include <stdio.h>
@@ -13,29 +19,131 @@
 #include "xil_printf.h"
 #include "xil_cache.h"
 #include "xil_exception.h"
+#include "ddr4_arena.h"
+#include "ddr4_cache.h"
+#include "conn_pool.h"
+#include "conn_watchdog.h"
+#include "trace_log.h"
+#include "ddr4_echo.h"
+#include "frame_parser.h"
+#include "copy_engine.h"
 
 #define SERVER_PORT 6001
 #define MAX_IMAGE_SIZE (512 * 1024 * 1024) // 512MB
 #define DDR4_IMAGE_BUFFER_START_ADDR 0x90000000
-#define HEADER_SIZE 4
-#define CHUNK_SIZE 1446
+#define ECHO_MODE DDR4_ECHO_ZERO_COPY // Default, v2 header flags can override it
 
 typedef struct {
     u32_t buffer_addr;     // DDR4 memory address
-    u32_t received_bytes;  // Total bytes received
+    u32_t submitted;       // Bytes handed to the copy engine
+    u32_t received_bytes;  // Bytes copied into DDR4
     u32_t file_size;       // Expected file size
-    u32_t echoed_bytes;    // Bytes already echoed back
-    struct tcp_pcb *pcb;   // Connection PCB
+    u32_t copies;          // Copy requests in flight
+    ddr4_echo_t echo;      // Echo cursor over the DDR4 copy
+    conn_watchdog_t wd;    // Stall and idle supervision from tcp_poll
+    struct tcp_pcb *pcb;   // Connection PCB, NULL once dead
+    ddr4_extent_t *extent; // DDR4 region owned by this upload
+    struct pbuf *held;     // Partial header, waiting for the rest
     u8_t header_received;  // Flag for size header
     u8_t closing;          // Connection closing flag
+    u8_t dead;             // PCB gone, waiting for copies to complete
 } image_connection_t;
 
+// Connection slots, acquired in accept_callback
+CONN_POOL_DECLARE(connections, image_connection_t, CONN_POOL_MAX_CONNECTIONS);
+
 void init_ddr_memory() {
     Xil_DCacheFlush();
     Xil_ICacheInvalidate();
+    ddr4_arena_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    ddr4_cache_region_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    trace_log_init();
     xil_printf("DDR4 Memory initialized at 0x%08x\n\r", DDR4_IMAGE_BUFFER_START_ADDR);
 }
 
+// Return the connection's DDR4 extent to the arena and free the struct,
+// or mark it dead until the copy engine is done with the extent
+static void free_connection(image_connection_t *conn) {
+    tx_batch_cancel(&conn->echo.tx);
+    if (conn->held) {
+        pbuf_free(conn->held);
+        conn->held = NULL;
+    }
+    conn->pcb = NULL;
+    conn->dead = 1;
+    if (conn->copies == 0) {
+        ddr4_arena_free(conn->extent);
+        conn_pool_release(&connections, conn);
+    }
+}
+
+static void abort_connection(image_connection_t *conn, struct tcp_pcb *tpcb) {
+    tcp_arg(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_abort(tpcb);
+    free_connection(conn);
+}
+
+static void close_connection(image_connection_t *conn, struct tcp_pcb *tpcb) {
+    xil_printf("Connection closed. Total bytes stored: %d\n\r", conn->received_bytes);
+    ddr4_echo_report(&conn->echo);
+    conn_watchdog_report(&conn->wd);
+    copy_engine_report();
+    tcp_arg(tpcb, NULL);
+    tcp_sent(tpcb, NULL);
+    tcp_recv(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_close(tpcb);
+    free_connection(conn);
+}
+
+// Everything the client sent is in DDR4 and echoed
+static int all_echoed(const image_connection_t *conn) {
+    return conn->copies == 0 && conn->echo.acked >= conn->submitted;
+}
+
+// Main loop: one chain is in DDR4 (and flushed), its pbufs already freed.
+// arg is the connection's handle; the slot stays held (dead) while copies
+// are in flight, so a stale handle means a completion for an old owner.
+static void copy_done(void *arg, u32_t len) {
+    image_connection_t *conn = (image_connection_t *)conn_pool_get(&connections, CONN_HANDLE_OF(arg));
+
+    if (!conn) {
+        return;
+    }
+    conn->copies--;
+    if (conn->dead) {
+        free_connection(conn);
+        return;
+    }
+
+    conn->received_bytes += len;
+    TRACE_DBG(TRACE_EV_STORE, len, conn->received_bytes);
+
+    // Echo back as much as the send buffer takes; the receive window is
+    // reopened by the echo cursor as the backlog drains. The output waits
+    // for tx_batch_run(), so completions from one poll share segments.
+    ddr4_echo_stored(&conn->echo, conn->received_bytes);
+    if (ddr4_echo_queue(&conn->echo, conn->pcb) != ERR_OK) {
+        xil_printf("Echo failed, aborting connection\n\r");
+        abort_connection(conn, conn->pcb);
+        return;
+    }
+    if (conn->closing && all_echoed(conn)) {
+        close_connection(conn, conn->pcb);
+    }
+}
+
+void err_callback(void *arg, err_t err) {
+    image_connection_t *conn = (image_connection_t *)arg;
+
+    // The PCB is already freed
+    if (conn) {
+        TRACE_ERR(TRACE_EV_ERROR, err, conn->received_bytes);
+        free_connection(conn);
+    }
+}
+
 err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
     image_connection_t *conn = (image_connection_t *)arg;
     
@@ -43,23 +151,51 @@ err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
         return ERR_ARG;
     }
     
-    // Update echoed bytes count
-    conn->echoed_bytes += len;
-    xil_printf("Sent %d bytes (total echoed: %d)\n\r", len, conn->echoed_bytes);
+    // ACK'd bytes are no longer pinned in DDR4
+    ddr4_echo_acked(&conn->echo, len);
+    
+    // Room in the send buffer again: resume a parked echo
+    if (ddr4_echo_pump(&conn->echo, tpcb) != ERR_OK) {
+        xil_printf("Echo failed, aborting connection\n\r");
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
     
     // Check if we should close the connection
-    if (conn->closing && conn->echoed_bytes >= conn->received_bytes) {
+    if (conn->closing && all_echoed(conn)) {
         xil_printf("All data echoed, closing connection\n\r");
-        tcp_arg(tpcb, NULL);
-        tcp_sent(tpcb, NULL);
-        tcp_recv(tpcb, NULL);
-        tcp_close(tpcb);
-        mem_free(conn);
+        close_connection(conn, tpcb);
     }
     
     return ERR_OK;
 }
 
+err_t poll_callback(void *arg, struct tcp_pcb *tpcb) {
+    image_connection_t *conn = (image_connection_t *)arg;
+    u8_t pending;
+
+    if (!conn) {
+        return ERR_OK;
+    }
+
+    // Evict a client that stopped sending and ACKing, with its extent
+    pending = conn->copies > 0 || (conn->header_received && ddr4_echo_pending(&conn->echo) > 0);
+    if (conn_watchdog_check(&conn->wd, conn->submitted + conn->echo.acked, pending) == CONN_WATCHDOG_EXPIRED) {
+        conn_watchdog_evict(&conn->wd);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    // Resume a parked echo if no ACK arrived to do it, otherwise push
+    // whatever a deferred batch or Nagle still holds
+    if (conn->header_received && ddr4_echo_poll(&conn->echo, tpcb) != ERR_OK) {
+        xil_printf("Echo failed, aborting connection\n\r");
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
 err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 {
     image_connection_t *conn = (image_connection_t *)arg;
@@ -71,119 +207,122 @@ err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 
     // Handle connection closure
     if (!p) {
-        if (conn->echoed_bytes < conn->received_bytes) {
-            // Still have data to echo back
-            conn->closing = 1;
+        conn->closing = 1;
+        if (!all_echoed(conn)) {
+            // Still have data to copy or echo back
             xil_printf("Client closed connection, waiting to echo remaining data\n\r");
+            if (conn->header_received) {
+                ddr4_echo_pump(&conn->echo, tpcb);
+            }
         } else {
             // All data echoed back, close immediately
-            xil_printf("Connection closed. Total bytes stored: %d\n\r", conn->received_bytes);
-            tcp_arg(tpcb, NULL);
-            tcp_sent(tpcb, NULL);
-            tcp_recv(tpcb, NULL);
-            tcp_close(tpcb);
-            mem_free(conn);
+            close_connection(conn, tpcb);
         }
         return ERR_OK;
     }
 
+    // No room to take the data: refuse it untouched, lwIP offers it again
+    // later. Once the header is stripped or credited it can no longer be refused.
+    if (copy_engine_full()) {
+        return ERR_MEM;
+    }
+
     // Handle file size header if not yet received
     if (!conn->header_received) {
-        if (p->tot_len < HEADER_SIZE) {
+        frame_header_t hdr;
+        err_t herr;
+
+        // Keep a partial header until the rest arrives; not credited yet
+        if (conn->held) {
+            pbuf_cat(conn->held, p);
+            p = conn->held;
+            conn->held = NULL;
+        }
+        herr = frame_header_from_pbuf(p, &hdr);
+        if (herr == ERR_INPROGRESS) {
             xil_printf("Waiting for more header data...\n\r");
+            conn->held = p;
             return ERR_OK;
         }
 
-        // Extract file size from header
-        u8_t *header = p->payload;
-        conn->file_size = (header[0] << 24) | (header[1] << 16) | 
-                         (header[2] << 8) | header[3];
+        // Legacy 4-byte or v2 header, see frame_parser.h
+        conn->file_size = (u32_t)hdr.length;
         
-        conn->buffer_addr = DDR4_IMAGE_BUFFER_START_ADDR;
+        // Reserve a DDR4 extent sized for this upload
+        if (herr != ERR_OK || hdr.length == 0 || hdr.length > MAX_IMAGE_SIZE ||
+            (conn->extent = ddr4_arena_alloc(conn->file_size)) == NULL) {
+            xil_printf("No DDR4 space for %d bytes, rejecting upload\n\r", conn->file_size);
+            ddr4_arena_report();
+            pbuf_free(p);
+            abort_connection(conn, tpcb);
+            return ERR_ABRT;
+        }
+        conn->buffer_addr = (u32_t)conn->extent->addr;
         conn->header_received = 1;
-        xil_printf("Expected file size: %d bytes\n\r", conn->file_size);
+        ddr4_echo_init(&conn->echo, conn->buffer_addr, ddr4_echo_mode(&hdr, ECHO_MODE));
+        rx_window_limit(&conn->echo.win, conn->extent->size);
+        xil_printf("Expected file size: %d bytes (header v%d, stream %lu, seq %lu, %s echo)\n\r",
+                   conn->file_size, hdr.version, (unsigned long)hdr.stream_id, (unsigned long)hdr.sequence,
+                   conn->echo.mode == DDR4_ECHO_ZERO_COPY ? "zero-copy" : "copy");
         
-        // Remove header from pbuf
-        if (pbuf_header(p, -HEADER_SIZE) != 0) {
-            xil_printf("Header removal failed\n\r");
-            tcp_close(tpcb);
-            pbuf_free(p);
-            mem_free(conn);
-            return ERR_VAL;
+        // Drop the header, even when it spans segments of the chain
+        p = pbuf_free_header(p, hdr.size);
+        tcp_recved(tpcb, hdr.size);
+        if (p == NULL) {
+            return ERR_OK;
         }
     }
 
     // Check DDR4 space
-    if (conn->received_bytes + p->tot_len > MAX_IMAGE_SIZE) {
-        xil_printf("Image exceeds maximum size (%d MB)\n\r", MAX_IMAGE_SIZE/(1024*1024));
+    if (conn->submitted + p->tot_len > conn->extent->size) {
+        xil_printf("Image exceeds its DDR4 extent (%d bytes)\n\r", conn->extent->size);
         pbuf_free(p);
-        tcp_close(tpcb);
-        mem_free(conn);
-        return ERR_MEM;
-    }
-
-    // Process received data
-    u32_t bytes_processed = 0;
-    struct pbuf *q = p;
-    while (q) {
-        u32_t chunk_len = q->len;
-        
-        // Store in DDR4
-        memcpy((void*)(conn->buffer_addr + conn->received_bytes), q->payload, chunk_len);
-        Xil_DCacheFlushRange(conn->buffer_addr + conn->received_bytes, chunk_len);
-        
-        // Echo back immediately
-        err_t err = tcp_write(tpcb, q->payload, chunk_len, TCP_WRITE_FLAG_COPY);
-        if (err != ERR_OK) {
-            xil_printf("tcp_write failed: %d\n\r", err);
-            pbuf_free(p);
-            return err;
-        }
-        
-        conn->received_bytes += chunk_len;
-        bytes_processed += chunk_len;
-        q = q->next;
+        // Abort so queued zero-copy segments are dropped before the extent is reused
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
     }
 
-    xil_printf("Processed %d bytes (total: %d)\n\r", bytes_processed, conn->received_bytes);
-
-    // Update TCP receive window
-    tcp_recved(tpcb, p->tot_len);
-    
-    // Free the pbuf
-    pbuf_free(p);
-
-    // Send the echoed data immediately
-    tcp_output(tpcb);
-    
+    // Hand the chain to the copy engine; it owns p until copy_done(). Cannot
+    // fail, the engine had room above.
+    (void)copy_engine_submit(p, conn->buffer_addr + conn->submitted, copy_done,
+                             CONN_HANDLE_ARG(conn_pool_handle(&connections, conn)));
+    conn->submitted += p->tot_len;
+    conn->copies++;
     return ERR_OK;
 }
 
 err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
 {
     image_connection_t *conn;
+    conn_reject_t reason;
 
     if (err != ERR_OK || newpcb == NULL) {
         return ERR_VAL;
     }
 
-    conn = (image_connection_t *)mem_malloc(sizeof(image_connection_t));
+    // Admission control before anything else is allocated
+    conn = (image_connection_t *)conn_pool_acquire(&connections, &reason);
     if (!conn) {
-        xil_printf("Failed to allocate connection struct\n\r");
-        return ERR_MEM;
+        xil_printf("Connection rejected: %s (%d/%d in use)\n\r",
+                   conn_pool_reason(reason), connections.in_use, connections.limit);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
     }
-
-    memset(conn, 0, sizeof(image_connection_t));
     conn->pcb = newpcb;
     conn->buffer_addr = 0;
+    conn->submitted = 0;
     conn->received_bytes = 0;
-    conn->echoed_bytes = 0;
+    conn->copies = 0;
+    conn->dead = 0;
     conn->header_received = 0;
     conn->closing = 0;
+    conn_watchdog_init(&conn->wd, CONN_WATCHDOG_IDLE_POLLS);
 
     tcp_arg(newpcb, conn);
     tcp_recv(newpcb, recv_callback);
     tcp_sent(newpcb, sent_callback);
+    tcp_err(newpcb, err_callback);
+    tcp_poll(newpcb, poll_callback, CONN_WATCHDOG_POLL_INTERVAL);
     
     // Disable Nagle's algorithm for low latency
     tcp_nagle_disable(newpcb);
@@ -192,12 +331,25 @@ err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
     return ERR_OK;
 }
 
+// Main-loop hook: complete finished copies, send their echoes, then format
+// trace records
+int transfer_data() {
+    copy_engine_poll();
+    tx_batch_run();
+    trace_log_drain(TRACE_DRAIN_BATCH);
+    return 0;
+}
+
 int start_application()
 {
     struct tcp_pcb *pcb;
     err_t err;
 
     init_ddr_memory();
+    conn_pool_init(&connections, CONN_POOL_MAX_CONNECTIONS);
+    if (copy_engine_init() != ERR_OK) {
+        return -1;
+    }
 
     pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
     if (!pcb) {
@@ -219,7 +371,8 @@ int start_application()
 
     tcp_accept(pcb, accept_callback);
 
-    xil_printf("TCP streaming echo server started @ port %d\n\r", SERVER_PORT);
+    xil_printf("TCP streaming echo server started @ port %d (copy engine: %s)\n\r",
+               SERVER_PORT, copy_engine_backend());
     xil_printf("Using DDR4 at 0x%08x (max %d MB)\n\r", 
               DDR4_IMAGE_BUFFER_START_ADDR, MAX_IMAGE_SIZE/(1024*1024));
     return 0;
@@ -0,0 +1,444 @@
+/******************************************************************************
+* Persistent Frame Echo Server with rotating DDR4 slots
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* One connection carries any number of <header><frame> records, legacy 4-byte
+* or v2 headers (trail06_1.py, trail06_2.py, trail06_3jpeg.py, trail255.py).
+* v2 flags pick the echo mode per frame, or verify mode, where only a CRC32C
+* digest trailer goes back instead of the frame. Every frame is
+* stored in the next DDR4 slot of the connection and echoed from there. A slot
+* is reused once its echo is ACK'd; when all slots are busy the remaining input
+* is held and the receive window stays closed until one frees up.
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "lwip/err.h"
+#include "lwip/tcp.h"
+#include "xil_printf.h"
+#include "xil_cache.h"
+#include "xil_exception.h"
+#include "ddr4_arena.h"
+#include "ddr4_cache.h"
+#include "conn_pool.h"
+#include "conn_watchdog.h"
+#include "ddr4_copy.h"
+#include "pbuf_iov.h"
+#include "trace_log.h"
+#include "conn_metrics.h"
+#include "ddr4_echo.h"
+#include "frame_parser.h"
+#include "crc32c.h"
+
+#define SERVER_PORT 6001
+#define DDR4_IMAGE_BUFFER_START_ADDR 0x90000000
+#define FRAME_SLOTS 8                        // Frames in flight per connection
+#define FRAME_SLOT_SIZE (8 * 1024 * 1024)    // Largest frame accepted
+#define ECHO_MODE DDR4_ECHO_ZERO_COPY        // Echo straight from DDR4, no lwIP heap copy
+
+typedef struct {
+    ddr4_echo_t echo;      // Echo cursor over the slot, or over digest in verify mode
+    UINTPTR addr;          // DDR4 address of the slot
+    u32_t stored;          // Payload bytes in the slot
+    u32_t len;             // Bytes to echo: frame length, or the digest size
+    u8_t verify;           // FRAME_FLAG_VERIFY
+    u32_t crc;             // Running CRC32C of the payload (verify mode)
+    u8_t digest[FRAME_DIGEST_SIZE];
+} frame_slot_t;
+
+typedef struct {
+    frame_parser_t parser; // Frame boundaries across pbufs
+    frame_slot_t slot[FRAME_SLOTS];
+    u32_t next_frame;      // Frames started; frame n lives in slot n % FRAME_SLOTS
+    u32_t echo_frame;      // Frame the echo is working on
+    u32_t ack_frame;       // Oldest frame whose echo is not fully ACK'd
+    u32_t header_credited; // Header bytes returned to the receive window
+    u32_t verify_credit;   // Verify-mode payload parsed but not yet credited
+    u32_t next_sequence;   // Sequence number expected in the next v2 header
+    u32_t sequence_gaps;   // v2 frames that skipped or repeated a sequence number
+    struct pbuf *pending;  // Input not yet parsed (all slots busy)
+    conn_metrics_t metrics; // Counters served on CONN_METRICS_PORT
+    conn_watchdog_t wd;    // Stall and idle supervision from tcp_poll
+    struct tcp_pcb *pcb;   // Connection PCB
+    ddr4_extent_t *extent; // FRAME_SLOTS slots of DDR4
+    ddr4_cache_t cache;    // Dirty DDR4 span not yet flushed
+    u8_t closing;          // Client closed its side
+} frame_connection_t;
+
+// Connection slots, acquired in accept_callback
+CONN_POOL_DECLARE(connections, frame_connection_t, CONN_POOL_MAX_CONNECTIONS);
+
+void init_ddr_memory() {
+    Xil_DCacheFlush();
+    Xil_ICacheInvalidate();
+    ddr4_arena_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    ddr4_cache_region_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    trace_log_init();
+    xil_printf("DDR4 Memory initialized at 0x%08x\n\r", DDR4_IMAGE_BUFFER_START_ADDR);
+}
+
+// Return the connection's DDR4 slots to the arena and free the struct
+static void free_connection(frame_connection_t *conn) {
+    if (conn->pending) {
+        pbuf_free(conn->pending);
+    }
+    conn_metrics_close(&conn->metrics);
+    ddr4_arena_free(conn->extent);
+    conn_pool_release(&connections, conn);
+}
+
+static void abort_connection(frame_connection_t *conn, struct tcp_pcb *tpcb) {
+    free_connection(conn);
+    tcp_arg(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_abort(tpcb);
+}
+
+static frame_slot_t *frame_slot(frame_connection_t *conn, u32_t frame) {
+    return &conn->slot[frame % FRAME_SLOTS];
+}
+
+// Parser callbacks: claim a slot, copy payload in, count the frame
+static err_t frame_begin(void *arg, const frame_header_t *hdr) {
+    frame_connection_t *conn = (frame_connection_t *)arg;
+    frame_slot_t *slot;
+
+    if (hdr->length > FRAME_SLOT_SIZE) {
+        xil_printf("Frame of %lu KB exceeds the %d byte slot\n\r", (unsigned long)(hdr->length / 1024),
+                   FRAME_SLOT_SIZE);
+        return ERR_VAL;
+    }
+    if (conn->next_frame - conn->ack_frame >= FRAME_SLOTS) {
+        return ERR_WOULDBLOCK;
+    }
+
+    if (hdr->version == 2) {
+        if (hdr->sequence != conn->next_sequence) {
+            conn->sequence_gaps++;
+        }
+        conn->next_sequence = hdr->sequence + 1;
+    }
+
+    slot = frame_slot(conn, conn->next_frame);
+    slot->addr = conn->extent->addr + (conn->next_frame % FRAME_SLOTS) * FRAME_SLOT_SIZE;
+    slot->stored = 0;
+    slot->verify = (hdr->flags & FRAME_FLAG_VERIFY) ? 1 : 0;
+    if (slot->verify) {
+        // Only the digest goes back. It is copied into the lwIP heap, and the
+        // payload is credited to the window as it is stored, not by the echo.
+        ddr4_echo_init(&slot->echo, (UINTPTR)slot->digest, DDR4_ECHO_COPY);
+        slot->echo.win.credited = FRAME_DIGEST_SIZE;
+        slot->len = FRAME_DIGEST_SIZE;
+        slot->crc = 0;
+    } else {
+        ddr4_echo_init(&slot->echo, slot->addr, ddr4_echo_mode(hdr, ECHO_MODE));
+        slot->len = (u32_t)hdr->length;
+    }
+    slot->echo.metrics = &conn->metrics;
+    conn->next_frame++;
+    return ERR_OK;
+}
+
+static err_t frame_data(void *arg, const u8_t *data, u32_t len) {
+    frame_connection_t *conn = (frame_connection_t *)arg;
+    frame_slot_t *slot = frame_slot(conn, conn->next_frame - 1);
+    UINTPTR dst = slot->addr + slot->stored;
+
+    ddr4_copy((void *)dst, data, len);
+    ddr4_cache_dirty(&conn->cache, dst, len);
+    slot->stored += len;
+    if (slot->verify) {
+        slot->crc = crc32c_update(slot->crc, data, len);
+        conn->verify_credit += len;
+    } else {
+        ddr4_echo_stored(&slot->echo, slot->stored);
+    }
+    return ERR_OK;
+}
+
+static err_t frame_end(void *arg) {
+    frame_connection_t *conn = (frame_connection_t *)arg;
+    frame_slot_t *slot = frame_slot(conn, conn->next_frame - 1);
+
+    if (slot->verify) {
+        frame_digest_encode(slot->digest, slot->crc, slot->stored);
+        ddr4_echo_stored(&slot->echo, FRAME_DIGEST_SIZE);
+    }
+    TRACE_DBG(TRACE_EV_STORE, slot->stored, conn->parser.frames);
+    return ERR_OK;
+}
+
+// Echo stored frames in order. A frame is left once all of it is queued.
+static err_t pump_frames(frame_connection_t *conn, struct tcp_pcb *tpcb) {
+    err_t err;
+
+    // The EMAC reads these bytes for the echo
+    ddr4_cache_flush(&conn->cache);
+
+    while (conn->echo_frame != conn->next_frame) {
+        frame_slot_t *slot = frame_slot(conn, conn->echo_frame);
+
+        err = ddr4_echo_pump(&slot->echo, tpcb);
+        if (err != ERR_OK) {
+            return err;
+        }
+        if (slot->echo.queued < slot->len) {
+            break;
+        }
+        conn->echo_frame++;
+    }
+    return ERR_OK;
+}
+
+// Spread ACK'd bytes over the frames in order and release the slots of
+// frames the echo has moved past and that are fully ACK'd
+static void frames_acked(frame_connection_t *conn, u16_t len) {
+    while (conn->ack_frame != conn->next_frame) {
+        frame_slot_t *slot = frame_slot(conn, conn->ack_frame);
+        u16_t n = (u16_t)LWIP_MIN(len, slot->echo.queued - slot->echo.acked);
+
+        if (n > 0) {
+            ddr4_echo_acked(&slot->echo, n);
+            len -= n;
+        }
+        if (conn->ack_frame == conn->echo_frame || slot->echo.acked < slot->len) {
+            break;
+        }
+        conn->ack_frame++;
+    }
+}
+
+// Parse held input into free slots, credit header bytes and echo.
+// Payload bytes are credited by the echo cursors once queued.
+static err_t process_input(frame_connection_t *conn, struct tcp_pcb *tpcb) {
+    u32_t used;
+    err_t err;
+
+    if (conn->pending) {
+        err = frame_parser_input(&conn->parser, conn->pending, &used);
+        pbuf_iov_consume(&conn->pending, used);
+    } else {
+        // A header may be waiting for a slot with no payload behind it yet
+        err = frame_parser_feed(&conn->parser, NULL, 0, &used);
+    }
+    if (err != ERR_OK && err != ERR_WOULDBLOCK) {
+        return err;
+    }
+
+    // One window update for the headers and verify-mode payload of the chain
+    pbuf_iov_recved(tpcb, conn->parser.header_bytes - conn->header_credited + conn->verify_credit);
+    conn->header_credited = conn->parser.header_bytes;
+    conn->verify_credit = 0;
+
+    return pump_frames(conn, tpcb);
+}
+
+static int connection_done(const frame_connection_t *conn) {
+    return conn->closing && conn->pending == NULL && conn->ack_frame == conn->next_frame;
+}
+
+static void close_connection(frame_connection_t *conn, struct tcp_pcb *tpcb) {
+    xil_printf("Connection closed after %lu frames (%lu sequence gaps)\n\r",
+               (unsigned long)conn->parser.frames, (unsigned long)conn->sequence_gaps);
+    conn_metrics_report(&conn->metrics);
+    conn_watchdog_report(&conn->wd);
+    tcp_arg(tpcb, NULL);
+    tcp_sent(tpcb, NULL);
+    tcp_recv(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_poll(tpcb, NULL, 0);
+    tcp_close(tpcb);
+    free_connection(conn);
+}
+
+err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    frame_connection_t *conn = (frame_connection_t *)arg;
+
+    if (!conn) {
+        return ERR_ARG;
+    }
+
+    // ACK'd bytes are no longer pinned in DDR4; freed slots let held input in
+    frames_acked(conn, len);
+    if (process_input(conn, tpcb) != ERR_OK) {
+        xil_printf("Frame echo failed, aborting connection\n\r");
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    if (connection_done(conn)) {
+        close_connection(conn, tpcb);
+    }
+    return ERR_OK;
+}
+
+void err_callback(void *arg, err_t err) {
+    frame_connection_t *conn = (frame_connection_t *)arg;
+
+    // The PCB is already freed
+    if (conn) {
+        TRACE_ERR(TRACE_EV_ERROR, err, conn->parser.frames);
+        free_connection(conn);
+    }
+}
+
+err_t poll_callback(void *arg, struct tcp_pcb *tpcb) {
+    frame_connection_t *conn = (frame_connection_t *)arg;
+    u8_t pending;
+
+    if (!conn) {
+        return ERR_OK;
+    }
+
+    // Rates are sampled here rather than per pbuf
+    conn_metrics_sample(&conn->metrics);
+
+    // Evict a client that stopped sending and ACKing, with its slots
+    pending = conn->pending != NULL || conn->ack_frame != conn->next_frame;
+    if (conn_watchdog_check(&conn->wd, conn->metrics.bytes_in + conn->metrics.bytes_out, pending) ==
+        CONN_WATCHDOG_EXPIRED) {
+        conn_watchdog_evict(&conn->wd);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    // Resume a parked echo if no ACK arrived to do it
+    if (process_input(conn, tpcb) != ERR_OK) {
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    frame_connection_t *conn = (frame_connection_t *)arg;
+
+    if (!conn || err != ERR_OK) {
+        if (p) pbuf_free(p);
+        return ERR_ARG;
+    }
+
+    // Client is done sending; close once every frame is echoed
+    if (!p) {
+        conn->closing = 1;
+
+        // A frame cut short by the client is echoed as far as it got
+        if (conn->parser.in_frame) {
+            frame_slot_t *slot = frame_slot(conn, conn->next_frame - 1);
+            xil_printf("Client closed inside a frame (%lu of %lu bytes)\n\r",
+                       (unsigned long)slot->stored, (unsigned long)conn->parser.header.length);
+            slot->len = slot->echo.stored;
+            conn->parser.in_frame = 0;
+            if (pump_frames(conn, tpcb) != ERR_OK) {
+                abort_connection(conn, tpcb);
+                return ERR_ABRT;
+            }
+            frames_acked(conn, 0);
+        }
+        if (connection_done(conn)) {
+            close_connection(conn, tpcb);
+        }
+        return ERR_OK;
+    }
+
+    conn_metrics_on_recv(&conn->metrics, p->tot_len);
+
+    // Queue behind anything still waiting for a slot
+    pbuf_iov_append(&conn->pending, p);
+
+    err = process_input(conn, tpcb);
+    if (err != ERR_OK) {
+        xil_printf("Frame stream error %d after %lu frames, aborting\n\r", err,
+                   (unsigned long)conn->parser.frames);
+        TRACE_ERR(TRACE_EV_ERROR, err, conn->parser.frames);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    frame_connection_t *conn;
+    conn_reject_t reason;
+
+    if (err != ERR_OK || newpcb == NULL) {
+        return ERR_VAL;
+    }
+
+    // Admission control before anything else is allocated
+    conn = (frame_connection_t *)conn_pool_acquire(&connections, &reason);
+    if (!conn) {
+        xil_printf("Connection rejected: %s (%d/%d in use)\n\r",
+                   conn_pool_reason(reason), connections.in_use, connections.limit);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+    conn->extent = ddr4_arena_alloc(FRAME_SLOTS * FRAME_SLOT_SIZE);
+    if (!conn->extent) {
+        xil_printf("No DDR4 space for frame slots, rejecting connection\n\r");
+        ddr4_arena_report();
+        conn_pool_release(&connections, conn);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+    conn->pcb = newpcb;
+    frame_parser_init(&conn->parser, frame_begin, frame_data, frame_end, conn);
+    ddr4_cache_init(&conn->cache, DDR4_CACHE_DEFAULT_THRESHOLD);
+    conn_metrics_open(&conn->metrics);
+    conn_watchdog_init(&conn->wd, CONN_WATCHDOG_IDLE_POLLS);
+
+    tcp_arg(newpcb, conn);
+    tcp_recv(newpcb, recv_callback);
+    tcp_sent(newpcb, sent_callback);
+    tcp_err(newpcb, err_callback);
+    tcp_poll(newpcb, poll_callback, CONN_WATCHDOG_POLL_INTERVAL);
+
+    // Disable Nagle's algorithm for low latency
+    tcp_nagle_disable(newpcb);
+
+    xil_printf("New frame connection, %d slots of %d MB\n\r", FRAME_SLOTS, FRAME_SLOT_SIZE / (1024 * 1024));
+    return ERR_OK;
+}
+
+// Main-loop hook: format trace records while the link is quiet
+int transfer_data() {
+    trace_log_drain(TRACE_DRAIN_BATCH);
+    return 0;
+}
+
+int start_application()
+{
+    struct tcp_pcb *pcb;
+    err_t err;
+
+    init_ddr_memory();
+    conn_pool_init(&connections, CONN_POOL_MAX_CONNECTIONS);
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        xil_printf("Error creating PCB. Out of Memory\n\r");
+        return -1;
+    }
+
+    err = tcp_bind(pcb, IP_ANY_TYPE, SERVER_PORT);
+    if (err != ERR_OK) {
+        xil_printf("Unable to bind to port %d: err = %d\n\r", SERVER_PORT, err);
+        return -2;
+    }
+
+    pcb = tcp_listen(pcb);
+    if (!pcb) {
+        xil_printf("Out of memory while tcp_listen\n\r");
+        return -3;
+    }
+
+    tcp_accept(pcb, accept_callback);
+    conn_metrics_server_init(CONN_METRICS_PORT);
+
+    xil_printf("TCP frame echo server started @ port %d\n\r", SERVER_PORT);
+    xil_printf("Using DDR4 at 0x%08x, %d slots of %d MB per connection\n\r",
+               DDR4_IMAGE_BUFFER_START_ADDR, FRAME_SLOTS, FRAME_SLOT_SIZE / (1024 * 1024));
+    return 0;
+}
@@ -0,0 +1,104 @@
+import socket
+import struct
+import os
+import time
+import random
+import threading
+from frame_digest import crc32c_update, parse_digest, DIGEST_SIZE, FLAG_VERIFY
+
+# --- Configuration ---
+SERVER_IP = '192.168.1.10'  # Replace with your FPGA's IP address
+SERVER_PORT = 6001
+FRAME_COUNT = 300           # Frames sent on the one connection
+MIN_FRAME_SIZE = 0
+MAX_FRAME_SIZE = 256 * 1024 # Must fit the server's FRAME_SLOT_SIZE
+SEED = 1
+HEADER_VERSION = 2          # 1 = legacy 4-byte size, 2 = v2 header (see frame_parser.h)
+STREAM_ID = 1
+FLAGS = 0                   # 0x1 = copy echo, 0x2 = zero-copy echo, 0x4 = compressed, 0x8 = verify
+
+
+def pack_header(size, sequence):
+    """Legacy: >I size. v2: marker, version, header length, flags, u64 size, sequence, stream id."""
+    if HEADER_VERSION == 1:
+        return struct.pack('>I', size)
+    return struct.pack('>BBHIQII', 0xFF, 2, 24, FLAGS, size, sequence, STREAM_ID)
+
+
+def make_frames():
+    """Random frame sizes, including empty and tiny ones so headers share pbufs."""
+    rng = random.Random(SEED)
+    frames = []
+    for i in range(FRAME_COUNT):
+        if i % 10 == 0:
+            size = rng.randint(0, 16)
+        else:
+            size = rng.randint(MIN_FRAME_SIZE, MAX_FRAME_SIZE)
+        frames.append(os.urandom(size))
+    return frames
+
+
+def receiver_thread(sock, frames, result):
+    """Read the echo (or digest in verify mode) back frame by frame and compare."""
+    verify = HEADER_VERSION == 2 and (FLAGS & FLAG_VERIFY)
+    mismatches = 0
+    received = 0
+    try:
+        for i, frame in enumerate(frames):
+            expect = DIGEST_SIZE if verify else len(frame)
+            data = b''
+            while len(data) < expect:
+                chunk = sock.recv(expect - len(data))
+                if not chunk:
+                    raise ConnectionError(f"Server closed the connection during frame {i}")
+                data += chunk
+            if verify:
+                received += len(frame)
+                if parse_digest(data) != (crc32c_update(0, frame), len(frame)):
+                    mismatches += 1
+                    print(f"Frame {i}: digest mismatch ({len(frame)} bytes)")
+                continue
+            received += len(data)
+            if data != frame:
+                mismatches += 1
+                print(f"Frame {i}: echo mismatch ({len(frame)} bytes)")
+    except Exception as e:
+        print(f"Receiver error: {e}")
+    result['received'] = received
+    result['mismatches'] = mismatches
+
+
+def run_client():
+    frames = make_frames()
+    total = sum(len(f) for f in frames)
+    print(f"Sending {len(frames)} frames ({total} bytes) on one connection to {SERVER_IP}:{SERVER_PORT}")
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    sock.connect((SERVER_IP, SERVER_PORT))
+
+    result = {}
+    rx = threading.Thread(target=receiver_thread, args=(sock, frames, result))
+    rx.start()
+
+    start = time.time()
+    for seq, frame in enumerate(frames):
+        # Header and frame in one send so several frames can share a segment
+        sock.sendall(pack_header(len(frame), seq) + frame)
+    sock.shutdown(socket.SHUT_WR)
+
+    rx.join()
+    elapsed = time.time() - start
+    sock.close()
+
+    print(f"Echoed {result.get('received', 0)}/{total} bytes in {elapsed:.2f} s "
+          f"({len(frames) / elapsed:.1f} frames/s, {total * 8 / elapsed / 1e6:.2f} Mbps)")
+    if result.get('mismatches', 0) == 0 and result.get('received', 0) == total:
+        print("All frames echoed intact.")
+        return True
+    print(f"{result.get('mismatches', 0)} frames differ.")
+    return False
+
+
+if __name__ == "__main__":
+    run_client()
@@ -0,0 +1,443 @@
+/******************************************************************************
+* Sink / Source / Bidirectional Benchmark Server with DDR4 Storage
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* Measures one direction at a time instead of the combined echo path:
+*   sink    client -> board, stored in a DDR4 ring, nothing sent back
+*   source  board -> client, N bytes streamed zero-copy out of DDR4
+*   bidir   both at once, each direction independent
+* The mode comes from the v2 header flags (FRAME_FLAG_BENCH_SINK/SOURCE) and
+* the header length is the byte count for each active direction. Legacy
+* 4-byte headers use BENCH_DEFAULT_MODE. Rates are printed every second and
+* totals at the end; trail256.py is the matching client.
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "lwip/err.h"
+#include "lwip/tcp.h"
+#include "xil_printf.h"
+#include "xil_cache.h"
+#include "xil_exception.h"
+#include "ddr4_arena.h"
+#include "ddr4_cache.h"
+#include "conn_pool.h"
+#include "conn_watchdog.h"
+#include "pbuf_iov.h"
+#include "tx_batch.h"
+#include "trace_log.h"
+#include "conn_metrics.h"
+#include "frame_parser.h"
+
+#if defined (__arm__) || defined (__aarch64__) || defined (HOST_BUILD)
+#include "xtime_l.h"
+#define BENCH_TICKS_PER_SEC COUNTS_PER_SECOND
+static u64_t bench_now(void) {
+    XTime t;
+    XTime_GetTime(&t);
+    return (u64_t)t;
+}
+#else
+#include "lwip/sys.h"
+#define BENCH_TICKS_PER_SEC 1000
+static u64_t bench_now(void) {
+    return sys_now();
+}
+#endif
+
+#define SERVER_PORT 6001
+#define DDR4_IMAGE_BUFFER_START_ADDR 0x90000000
+#define BENCH_SINK_RING_SIZE (64 * 1024 * 1024)  // Sink data wraps inside this extent
+#define BENCH_SOURCE_SIZE (1024 * 1024)          // Source data repeats this pattern
+#define BENCH_REPORT_INTERVAL 2                  // tcp_poll ticks (500 ms each)
+
+#define BENCH_SINK   FRAME_FLAG_BENCH_SINK
+#define BENCH_SOURCE FRAME_FLAG_BENCH_SOURCE
+#define BENCH_BIDIR  (FRAME_FLAG_BENCH_SINK | FRAME_FLAG_BENCH_SOURCE)
+
+#ifndef BENCH_DEFAULT_MODE
+#define BENCH_DEFAULT_MODE BENCH_SINK            // Used for legacy 4-byte headers
+#endif
+
+typedef struct {
+    u32_t mode;            // BENCH_SINK, BENCH_SOURCE or BENCH_BIDIR
+    u64_t length;          // Bytes per active direction
+    u64_t received;        // Sink bytes stored
+    u64_t queued;          // Source bytes handed to tcp_write
+    u64_t acked;           // Source bytes ACK'd
+    u64_t start_ticks;     // Header arrival
+    u64_t sink_done_ticks;
+    u64_t source_done_ticks;
+    conn_metrics_t metrics; // Per-second rates, also on CONN_METRICS_PORT
+    ddr4_extent_t *extent; // Sink ring
+    ddr4_cache_t cache;    // Dirty DDR4 span not yet flushed
+    tx_batch_t tx;         // Source writes and segment counters
+    conn_watchdog_t wd;    // Stall and idle supervision from tcp_poll
+    struct pbuf *held;     // Partial header, waiting for the rest
+    u8_t header_received;
+} bench_connection_t;
+
+// Connection slots, acquired in accept_callback
+CONN_POOL_DECLARE(connections, bench_connection_t, CONN_POOL_MAX_CONNECTIONS);
+
+static UINTPTR source_addr;    // Shared, read-only source pattern in DDR4
+
+static const char *mode_name(u32_t mode) {
+    switch (mode) {
+    case BENCH_SINK: return "sink";
+    case BENCH_SOURCE: return "source";
+    default: return "bidir";
+    }
+}
+
+void init_ddr_memory() {
+    ddr4_extent_t *src;
+    u32_t i;
+
+    Xil_DCacheFlush();
+    Xil_ICacheInvalidate();
+    ddr4_arena_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    ddr4_cache_region_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    trace_log_init();
+
+    // The source pattern lives for the whole run; the EMAC reads it directly
+    src = ddr4_arena_alloc(BENCH_SOURCE_SIZE);
+    if (src) {
+        source_addr = src->addr;
+        for (i = 0; i < BENCH_SOURCE_SIZE / 4; i++) {
+            ((u32_t *)source_addr)[i] = i;
+        }
+        Xil_DCacheFlushRange(source_addr, BENCH_SOURCE_SIZE);
+    }
+    xil_printf("DDR4 Memory initialized at 0x%08x\n\r", DDR4_IMAGE_BUFFER_START_ADDR);
+}
+
+static void free_connection(bench_connection_t *conn) {
+    conn_metrics_close(&conn->metrics);
+    if (conn->held) {
+        pbuf_free(conn->held);
+    }
+    ddr4_arena_free(conn->extent);
+    conn_pool_release(&connections, conn);
+}
+
+static void abort_connection(bench_connection_t *conn, struct tcp_pcb *tpcb) {
+    free_connection(conn);
+    tcp_arg(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_abort(tpcb);
+}
+
+// Rate in Kbps over a tick interval
+// Bits per ms is Kbps. Ticks go to ms first: bytes * 8 * ticks-per-second
+// overflows u64 past a few GB with the host's nanosecond ticks.
+static unsigned long bench_kbps(u64_t bytes, u64_t ticks) {
+    u64_t ms = (ticks * 1000) / BENCH_TICKS_PER_SEC;
+
+    if (ms == 0) {
+        return 0;
+    }
+    return (unsigned long)((bytes * 8) / ms);
+}
+
+static int bench_done(const bench_connection_t *conn) {
+    if ((conn->mode & BENCH_SINK) && conn->received < conn->length) {
+        return 0;
+    }
+    if ((conn->mode & BENCH_SOURCE) && conn->acked < conn->length) {
+        return 0;
+    }
+    return 1;
+}
+
+static void bench_report_totals(const bench_connection_t *conn) {
+    if (conn->mode & BENCH_SINK) {
+        xil_printf("Bench %s: sink %lu KB in %lu ms, %lu Kbps\n\r", mode_name(conn->mode),
+                   (unsigned long)(conn->received / 1024),
+                   (unsigned long)(((conn->sink_done_ticks - conn->start_ticks) * 1000) / BENCH_TICKS_PER_SEC),
+                   bench_kbps(conn->received, conn->sink_done_ticks - conn->start_ticks));
+    }
+    if (conn->mode & BENCH_SOURCE) {
+        xil_printf("Bench %s: source %lu KB in %lu ms, %lu Kbps\n\r", mode_name(conn->mode),
+                   (unsigned long)(conn->acked / 1024),
+                   (unsigned long)(((conn->source_done_ticks - conn->start_ticks) * 1000) / BENCH_TICKS_PER_SEC),
+                   bench_kbps(conn->acked, conn->source_done_ticks - conn->start_ticks));
+        tx_batch_report(&conn->tx);
+    }
+}
+
+static void bench_finish(bench_connection_t *conn, struct tcp_pcb *tpcb) {
+    bench_report_totals(conn);
+    conn_watchdog_report(&conn->wd);
+    tcp_arg(tpcb, NULL);
+    tcp_sent(tpcb, NULL);
+    tcp_recv(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_poll(tpcb, NULL, 0);
+    tcp_close(tpcb);
+    free_connection(conn);
+}
+
+// Queue source data as far as the send buffer allows, straight from DDR4
+static err_t source_pump(bench_connection_t *conn, struct tcp_pcb *tpcb) {
+    err_t err;
+
+    while (conn->queued < conn->length) {
+        u32_t offset = (u32_t)(conn->queued % BENCH_SOURCE_SIZE);
+        u32_t len = (u32_t)LWIP_MIN(conn->length - conn->queued, (u64_t)(BENCH_SOURCE_SIZE - offset));
+
+        len = LWIP_MIN(LWIP_MIN(len, (u32_t)tcp_sndbuf(tpcb)), 0xFFFF);
+        if (len == 0) {
+            break;
+        }
+        err = tx_batch_write(&conn->tx, tpcb, (const void *)(source_addr + offset), (u16_t)len, 0);
+        if (err == ERR_MEM) {
+            conn_metrics_on_stall(&conn->metrics);
+            break;
+        }
+        if (err != ERR_OK) {
+            return err;
+        }
+        conn->queued += len;
+        conn_metrics_on_write(&conn->metrics, len);
+    }
+    tx_batch_flush(&conn->tx, tpcb, conn->queued == conn->length);
+    return ERR_OK;
+}
+
+err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    bench_connection_t *conn = (bench_connection_t *)arg;
+
+    if (!conn) {
+        return ERR_ARG;
+    }
+
+    conn->acked += len;
+    conn_metrics_on_ack(&conn->metrics, len);
+    if (conn->acked >= conn->length && conn->source_done_ticks == 0) {
+        conn->source_done_ticks = bench_now();
+    }
+
+    if (source_pump(conn, tpcb) != ERR_OK) {
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    if (bench_done(conn)) {
+        bench_finish(conn, tpcb);
+    }
+    return ERR_OK;
+}
+
+void err_callback(void *arg, err_t err) {
+    bench_connection_t *conn = (bench_connection_t *)arg;
+
+    // The PCB is already freed
+    if (conn) {
+        TRACE_ERR(TRACE_EV_ERROR, err, (u32_t)conn->received);
+        free_connection(conn);
+    }
+}
+
+err_t poll_callback(void *arg, struct tcp_pcb *tpcb) {
+    bench_connection_t *conn = (bench_connection_t *)arg;
+
+    if (!conn) {
+        return ERR_OK;
+    }
+
+    // Evict a client that stopped sending and ACKing, with its sink ring
+    if (conn_watchdog_check(&conn->wd, (u32_t)(conn->received + conn->acked),
+                            conn->queued > conn->acked) == CONN_WATCHDOG_EXPIRED) {
+        conn_watchdog_evict(&conn->wd);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    if (!conn->header_received) {
+        return ERR_OK;
+    }
+
+    // Per-second rates for each direction
+    conn_metrics_sample(&conn->metrics);
+    conn_metrics_report(&conn->metrics);
+
+    if ((conn->mode & BENCH_SOURCE) && source_pump(conn, tpcb) != ERR_OK) {
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    bench_connection_t *conn = (bench_connection_t *)arg;
+    u32_t skip = 0;
+
+    if (!conn || err != ERR_OK) {
+        if (p) pbuf_free(p);
+        return ERR_ARG;
+    }
+
+    if (!p) {
+        // Client finished; a source run keeps going until its data is ACK'd
+        if (!conn->header_received || bench_done(conn)) {
+            bench_finish(conn, tpcb);
+        }
+        return ERR_OK;
+    }
+
+    conn_metrics_on_recv(&conn->metrics, p->tot_len);
+
+    if (!conn->header_received) {
+        frame_header_t hdr;
+        err_t herr;
+
+        // Keep a partial header until the rest arrives; not credited yet
+        if (conn->held) {
+            pbuf_cat(conn->held, p);
+            p = conn->held;
+            conn->held = NULL;
+        }
+        herr = frame_header_from_pbuf(p, &hdr);
+        if (herr == ERR_INPROGRESS) {
+            xil_printf("Waiting for more header data...\n\r");
+            conn->held = p;
+            return ERR_OK;
+        }
+        conn->mode = (hdr.version == 2) ? (hdr.flags & BENCH_BIDIR) : BENCH_DEFAULT_MODE;
+        if (conn->mode == 0) {
+            conn->mode = BENCH_DEFAULT_MODE;
+        }
+        if (herr != ERR_OK || hdr.length == 0) {
+            xil_printf("Bad benchmark header, rejecting\n\r");
+            pbuf_free(p);
+            abort_connection(conn, tpcb);
+            return ERR_ABRT;
+        }
+        skip = hdr.size;
+
+        conn->length = hdr.length;
+        conn->header_received = 1;
+        conn->start_ticks = bench_now();
+        xil_printf("Bench %s: %lu KB per direction\n\r", mode_name(conn->mode),
+                   (unsigned long)(conn->length / 1024));
+
+        if (conn->mode & BENCH_SOURCE) {
+            if (!source_addr) {
+                xil_printf("No DDR4 source buffer, rejecting\n\r");
+                pbuf_free(p);
+                abort_connection(conn, tpcb);
+                return ERR_ABRT;
+            }
+            if (source_pump(conn, tpcb) != ERR_OK) {
+                pbuf_free(p);
+                abort_connection(conn, tpcb);
+                return ERR_ABRT;
+            }
+        }
+    }
+
+    // Sink: store the chain into the DDR4 ring and reopen the window immediately
+    if (conn->mode & BENCH_SINK) {
+        u32_t len = p->tot_len - skip;
+        u32_t offset = (u32_t)(conn->received % conn->extent->size);
+        u32_t first = LWIP_MIN(len, conn->extent->size - offset);
+
+        pbuf_iov_store(p, skip, first, conn->extent->addr + offset, &conn->cache);
+        if (first < len) {
+            pbuf_iov_store(p, skip + first, len - first, conn->extent->addr, &conn->cache);
+        }
+        conn->received += len;
+        TRACE_DBG(TRACE_EV_STORE, len, (u32_t)conn->received);
+        if (conn->received >= conn->length && conn->sink_done_ticks == 0) {
+            ddr4_cache_flush(&conn->cache);
+            conn->sink_done_ticks = bench_now();
+        }
+    }
+
+    tcp_recved(tpcb, p->tot_len);
+    pbuf_free(p);
+
+    if (bench_done(conn)) {
+        bench_finish(conn, tpcb);
+    }
+    return ERR_OK;
+}
+
+err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    bench_connection_t *conn;
+    conn_reject_t reason;
+
+    if (err != ERR_OK || newpcb == NULL) {
+        return ERR_VAL;
+    }
+
+    // Admission control before anything else is allocated
+    conn = (bench_connection_t *)conn_pool_acquire(&connections, &reason);
+    if (!conn) {
+        xil_printf("Connection rejected: %s (%d/%d in use)\n\r",
+                   conn_pool_reason(reason), connections.in_use, connections.limit);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+    conn->extent = ddr4_arena_alloc(BENCH_SINK_RING_SIZE);
+    if (!conn->extent) {
+        xil_printf("No DDR4 space for the sink ring, rejecting connection\n\r");
+        conn_pool_release(&connections, conn);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+    ddr4_cache_init(&conn->cache, DDR4_CACHE_DEFAULT_THRESHOLD);
+    tx_batch_init(&conn->tx, TX_BATCH_DEFAULT_BYTES);
+    conn_metrics_open(&conn->metrics);
+    conn_watchdog_init(&conn->wd, CONN_WATCHDOG_IDLE_POLLS);
+
+    tcp_arg(newpcb, conn);
+    tcp_recv(newpcb, recv_callback);
+    tcp_sent(newpcb, sent_callback);
+    tcp_err(newpcb, err_callback);
+    tcp_poll(newpcb, poll_callback, BENCH_REPORT_INTERVAL);
+
+    xil_printf("New benchmark connection\n\r");
+    return ERR_OK;
+}
+
+// Main-loop hook: format trace records while the link is quiet
+int transfer_data() {
+    trace_log_drain(TRACE_DRAIN_BATCH);
+    return 0;
+}
+
+int start_application()
+{
+    struct tcp_pcb *pcb;
+    err_t err;
+
+    init_ddr_memory();
+    conn_pool_init(&connections, CONN_POOL_MAX_CONNECTIONS);
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        xil_printf("Error creating PCB. Out of Memory\n\r");
+        return -1;
+    }
+
+    err = tcp_bind(pcb, IP_ANY_TYPE, SERVER_PORT);
+    if (err != ERR_OK) {
+        xil_printf("Unable to bind to port %d: err = %d\n\r", SERVER_PORT, err);
+        return -2;
+    }
+
+    pcb = tcp_listen(pcb);
+    if (!pcb) {
+        xil_printf("Out of memory while tcp_listen\n\r");
+        return -3;
+    }
+
+    tcp_accept(pcb, accept_callback);
+    conn_metrics_server_init(CONN_METRICS_PORT);
+
+    xil_printf("TCP benchmark server started @ port %d (legacy headers: %s)\n\r", SERVER_PORT,
+               mode_name(BENCH_DEFAULT_MODE));
+    return 0;
+}
@@ -0,0 +1,133 @@
+import socket
+import struct
+import time
+import threading
+
+# --- Configuration ---
+SERVER_IP = '192.168.1.10'  # Replace with your FPGA's IP address
+SERVER_PORT = 6001
+MODE = 'bidir'              # 'sink' (client -> board), 'source' (board -> client) or 'bidir'
+SIZE = 256 * 1024 * 1024    # Bytes per active direction
+CHUNK_SIZE = 256 * 1024
+VERIFY_SOURCE = False       # Check the board's pattern (u32 counter, little-endian, 1 MB period)
+SOURCE_PERIOD = 1024 * 1024 # Must match BENCH_SOURCE_SIZE in trail256.c
+
+FLAG_SINK = 0x10
+FLAG_SOURCE = 0x20
+MODE_FLAGS = {'sink': FLAG_SINK, 'source': FLAG_SOURCE, 'bidir': FLAG_SINK | FLAG_SOURCE}
+
+
+def pack_header(size, flags):
+    """v2 header: marker, version, header length, flags, u64 size, sequence, stream id."""
+    return struct.pack('>BBHIQII', 0xFF, 2, 24, flags, size, 0, 0)
+
+
+class Counter:
+    """Byte counter shared with the per-second reporter."""
+    def __init__(self):
+        self.bytes = 0
+        self.start = None
+        self.end = None
+
+
+def sink_thread(sock, counter):
+    """Send SIZE bytes of one reused buffer as fast as the socket takes them."""
+    chunk = bytes(CHUNK_SIZE)
+    counter.start = time.time()
+    remaining = SIZE
+    while remaining > 0:
+        n = min(remaining, CHUNK_SIZE)
+        sock.sendall(chunk[:n] if n < CHUNK_SIZE else chunk)
+        remaining -= n
+        counter.bytes += n
+    counter.end = time.time()
+
+
+def source_thread(sock, counter, result):
+    """Drain SIZE bytes from the board, optionally checking the pattern."""
+    pattern = b''.join(struct.pack('<I', i) for i in range(SOURCE_PERIOD // 4)) if VERIFY_SOURCE else None
+    buf = bytearray(CHUNK_SIZE)
+    view = memoryview(buf)
+    counter.start = time.time()
+    mismatches = 0
+    try:
+        while counter.bytes < SIZE:
+            n = sock.recv_into(view, min(CHUNK_SIZE, SIZE - counter.bytes))
+            if n == 0:
+                raise ConnectionError(f"Server closed the connection after {counter.bytes} bytes")
+            if pattern is not None:
+                offset = counter.bytes % SOURCE_PERIOD
+                expect = (pattern * 2)[offset:offset + n] if offset + n > SOURCE_PERIOD else pattern[offset:offset + n]
+                if buf[:n] != expect:
+                    mismatches += 1
+            counter.bytes += n
+    except Exception as e:
+        print(f"Source error: {e}")
+    counter.end = time.time()
+    result['mismatches'] = mismatches
+
+
+def report_thread(counters, done):
+    """Print each active direction's rate once per second."""
+    last = {name: 0 for name in counters}
+    tick = 0
+    while not done.wait(1.0):
+        tick += 1
+        parts = []
+        for name, c in counters.items():
+            parts.append(f"{name} {(c.bytes - last[name]) * 8 / 1e6:8.2f} Mbps")
+            last[name] = c.bytes
+        print(f"[{tick:3d}s] " + "  ".join(parts))
+
+
+def run_client():
+    flags = MODE_FLAGS[MODE]
+    print(f"Benchmark {MODE}: {SIZE} bytes per direction to {SERVER_IP}:{SERVER_PORT}")
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 * 1024 * 1024)
+    sock.connect((SERVER_IP, SERVER_PORT))
+    sock.sendall(pack_header(SIZE, flags))
+
+    counters = {}
+    threads = []
+    result = {}
+    if flags & FLAG_SINK:
+        counters['sink'] = Counter()
+        threads.append(threading.Thread(target=sink_thread, args=(sock, counters['sink'])))
+    if flags & FLAG_SOURCE:
+        counters['source'] = Counter()
+        threads.append(threading.Thread(target=source_thread, args=(sock, counters['source'], result)))
+
+    done = threading.Event()
+    reporter = threading.Thread(target=report_thread, args=(counters, done))
+    reporter.start()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    # Sink data is only stored once the board closes the connection
+    sock.shutdown(socket.SHUT_WR)
+    try:
+        while sock.recv(CHUNK_SIZE):
+            pass
+    except OSError:
+        pass
+    closed = time.time()
+    done.set()
+    reporter.join()
+    sock.close()
+
+    for name, c in counters.items():
+        end = closed if name == 'sink' else c.end
+        elapsed = max(end - c.start, 1e-9)
+        print(f"Total {name}: {c.bytes} bytes in {elapsed:.2f} s, {c.bytes * 8 / elapsed / 1e6:.2f} Mbps")
+    if result.get('mismatches'):
+        print(f"{result['mismatches']} source chunks did not match the pattern.")
+        return False
+    return True
+
+
+if __name__ == "__main__":
+    run_client()
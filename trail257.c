@@ -0,0 +1,545 @@
+/******************************************************************************
+* UDP Video Frame Echo with NACK Retransmit from DDR4
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* UDP alternative to the TCP MJPEG echo (trail06_3jpeg.py -> port 6001). A
+* lost segment only delays the frame it belongs to, and a frame that misses
+* its deadline is dropped instead of holding up the ones behind it.
+*
+* Each frame travels as fixed-size chunks; every datagram starts with this
+* 24-byte header, all fields big-endian:
+*
+*   u16 magic 0x5644 ("VD"), u8 type, u8 reserved,
+*   u32 frame id, u32 frame size, u16 chunk index, u16 chunk count,
+*   u32 sender timestamp (ms, echoed back), u16 deadline (ms, 0 = default),
+*   u16 reserved
+*
+*   VIDEO_DATA   chunk payload follows, at offset index * VIDEO_CHUNK_SIZE
+*   VIDEO_NACK   u16 count, then count u16 chunk indices still missing
+*   VIDEO_STATS  request (empty) / reply (VIDEO_STAT_WORDS u32 counters)
+*
+* Chunks are reassembled straight into a DDR4 slot. Missing chunks are
+* NACK'd to the sender after VIDEO_NACK_DELAY_MS of silence. A complete frame
+* is echoed chunk by chunk from the slot, and the client's NACKs for echo
+* chunks are served from the same stored copy. Frames still incomplete at
+* their deadline are dropped and the slot reused.
+*
+* Build with VIDEO_DROP_PERMILLE=n to discard n/1000 of the data datagrams in
+* each direction; with the host build this is the loopback test for the NACK
+* and deadline paths (see README.md).
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "lwip/err.h"
+#include "lwip/udp.h"
+#include "lwip/sys.h"
+#include "xil_printf.h"
+#include "xil_cache.h"
+#include "ddr4_arena.h"
+#include "ddr4_cache.h"
+
+#define SERVER_PORT 6001
+#define DDR4_IMAGE_BUFFER_START_ADDR 0x90000000
+
+#define VIDEO_MAGIC 0x5644
+#define VIDEO_HEADER_SIZE 24
+#define VIDEO_CHUNK_SIZE 1400               // Fits a 1500-byte MTU with IP/UDP and our header
+#define VIDEO_DATA 1
+#define VIDEO_NACK 2
+#define VIDEO_STATS 3
+
+#define VIDEO_SLOTS 16
+#define VIDEO_SLOT_SIZE (1024 * 1024)        // Largest frame accepted
+#define VIDEO_MAX_CHUNKS ((VIDEO_SLOT_SIZE + VIDEO_CHUNK_SIZE - 1) / VIDEO_CHUNK_SIZE)
+#define VIDEO_BITMAP_WORDS ((VIDEO_MAX_CHUNKS + 31) / 32)
+#define VIDEO_NACK_MAX 256                  // Chunk indices per NACK datagram
+
+#define VIDEO_NACK_DELAY_MS 10              // Silence on a partial frame before NACKing
+#define VIDEO_MAX_NACKS 8                   // NACK rounds per frame
+#define VIDEO_DEADLINE_MS 100               // Used when the sender gives no deadline
+#define VIDEO_REPORT_MS 1000
+
+#ifndef VIDEO_DROP_PERMILLE
+#define VIDEO_DROP_PERMILLE 0               // Simulated loss, data datagrams only
+#endif
+
+#define SLOT_FREE 0
+#define SLOT_DROPPED 1                      // Missed its deadline, id kept so late chunks are ignored
+#define SLOT_COMPLETE 2                     // Echoed, kept for retransmits until reused
+#define SLOT_FILLING 3
+
+typedef struct {
+    u8_t type;
+    u32_t frame_id;
+    u32_t frame_size;
+    u16_t chunk;
+    u16_t chunks;
+    u32_t timestamp;
+    u16_t deadline;
+} video_header_t;
+
+typedef struct {
+    u8_t state;
+    u8_t nacks;                             // NACK rounds sent
+    u16_t chunks;
+    u16_t have;                             // Distinct chunks received
+    u16_t deadline;
+    u32_t frame_id;
+    u32_t size;
+    u32_t timestamp;                        // Sender's, from the first chunk seen
+    u32_t first_ms;                         // First chunk arrival
+    u32_t last_ms;                          // Last chunk or NACK
+    UINTPTR addr;                           // DDR4 slot
+    ip_addr_t peer;
+    u16_t peer_port;
+    u32_t bitmap[VIDEO_BITMAP_WORDS];
+} video_slot_t;
+
+// Counters, also sent in the VIDEO_STATS reply in this order
+typedef struct {
+    u32_t datagrams_in;
+    u32_t duplicates;
+    u32_t stale;                            // Chunks for frames already finished or dropped
+    u32_t frames_started;
+    u32_t frames_complete;
+    u32_t frames_late;                      // Dropped at the deadline
+    u32_t frames_evicted;                   // Slot taken by a newer frame while filling
+    u32_t nacks_sent;
+    u32_t nack_chunks_requested;
+    u32_t nacks_received;
+    u32_t retransmits;                      // Echo chunks resent from DDR4
+    u32_t retransmit_misses;                // NACK'd frame no longer stored
+    u32_t simulated_drops;
+    u32_t assembly_ms_total;                // First chunk -> complete, summed
+    u32_t assembly_ms_max;
+} video_stats_t;
+
+#define VIDEO_STAT_WORDS (sizeof(video_stats_t) / 4)
+
+static struct udp_pcb *video_pcb;
+static video_slot_t slots[VIDEO_SLOTS];
+static video_stats_t stats;
+static video_stats_t last_stats;
+static ddr4_cache_t video_cache;
+static u32_t newest_id;                      // Highest frame id started
+static u8_t have_newest;
+static u32_t last_report_ms;
+#if VIDEO_DROP_PERMILLE > 0
+static u32_t drop_state = 12345;
+#endif
+
+static u16_t get_be16(const u8_t *b) {
+    return (u16_t)((b[0] << 8) | b[1]);
+}
+
+static u32_t get_be32(const u8_t *b) {
+    return ((u32_t)b[0] << 24) | ((u32_t)b[1] << 16) | ((u32_t)b[2] << 8) | b[3];
+}
+
+static void put_be16(u8_t *b, u16_t v) {
+    b[0] = (u8_t)(v >> 8);
+    b[1] = (u8_t)v;
+}
+
+static void put_be32(u8_t *b, u32_t v) {
+    b[0] = (u8_t)(v >> 24);
+    b[1] = (u8_t)(v >> 16);
+    b[2] = (u8_t)(v >> 8);
+    b[3] = (u8_t)v;
+}
+
+static void encode_header(u8_t *b, const video_header_t *h) {
+    memset(b, 0, VIDEO_HEADER_SIZE);
+    put_be16(b, VIDEO_MAGIC);
+    b[2] = h->type;
+    put_be32(b + 4, h->frame_id);
+    put_be32(b + 8, h->frame_size);
+    put_be16(b + 12, h->chunk);
+    put_be16(b + 14, h->chunks);
+    put_be32(b + 16, h->timestamp);
+    put_be16(b + 20, h->deadline);
+}
+
+static int decode_header(const u8_t *b, video_header_t *h) {
+    if (get_be16(b) != VIDEO_MAGIC) {
+        return -1;
+    }
+    h->type = b[2];
+    h->frame_id = get_be32(b + 4);
+    h->frame_size = get_be32(b + 8);
+    h->chunk = get_be16(b + 12);
+    h->chunks = get_be16(b + 14);
+    h->timestamp = get_be32(b + 16);
+    h->deadline = get_be16(b + 20);
+    return 0;
+}
+
+// Pseudo-random loss for the loopback test
+static int simulate_drop(void) {
+#if VIDEO_DROP_PERMILLE > 0
+    drop_state = drop_state * 1103515245 + 12345;
+    if (((drop_state >> 16) % 1000) < VIDEO_DROP_PERMILLE) {
+        stats.simulated_drops++;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+static u32_t chunk_len(const video_slot_t *s, u16_t chunk) {
+    u32_t offset = (u32_t)chunk * VIDEO_CHUNK_SIZE;
+    return LWIP_MIN((u32_t)VIDEO_CHUNK_SIZE, s->size - offset);
+}
+
+static int chunk_present(const video_slot_t *s, u16_t chunk) {
+    return (s->bitmap[chunk / 32] >> (chunk % 32)) & 1;
+}
+
+// Send one stored chunk; the payload pbuf references DDR4 directly
+static err_t send_chunk(video_slot_t *s, u16_t chunk) {
+    struct pbuf *hdr, *data;
+    video_header_t h;
+    u32_t len = chunk_len(s, chunk);
+    err_t err;
+
+    if (simulate_drop()) {
+        return ERR_OK;
+    }
+
+    hdr = pbuf_alloc(PBUF_TRANSPORT, VIDEO_HEADER_SIZE, PBUF_RAM);
+    if (!hdr) {
+        return ERR_MEM;
+    }
+    data = pbuf_alloc(PBUF_RAW, (u16_t)len, PBUF_REF);
+    if (!data) {
+        pbuf_free(hdr);
+        return ERR_MEM;
+    }
+    data->payload = (void *)(s->addr + (u32_t)chunk * VIDEO_CHUNK_SIZE);
+
+    h.type = VIDEO_DATA;
+    h.frame_id = s->frame_id;
+    h.frame_size = s->size;
+    h.chunk = chunk;
+    h.chunks = s->chunks;
+    h.timestamp = s->timestamp;
+    h.deadline = s->deadline;
+    encode_header((u8_t *)hdr->payload, &h);
+    pbuf_cat(hdr, data);
+
+    err = udp_sendto(video_pcb, hdr, &s->peer, s->peer_port);
+    pbuf_free(hdr);
+    return err;
+}
+
+static void send_nack(video_slot_t *s) {
+    struct pbuf *p;
+    video_header_t h;
+    u8_t *b;
+    u16_t count = 0, i;
+
+    p = pbuf_alloc(PBUF_TRANSPORT, VIDEO_HEADER_SIZE + 2 + 2 * VIDEO_NACK_MAX, PBUF_RAM);
+    if (!p) {
+        return;
+    }
+    b = (u8_t *)p->payload;
+    for (i = 0; i < s->chunks && count < VIDEO_NACK_MAX; i++) {
+        if (!chunk_present(s, i)) {
+            put_be16(b + VIDEO_HEADER_SIZE + 2 + 2 * count, i);
+            count++;
+        }
+    }
+
+    h.type = VIDEO_NACK;
+    h.frame_id = s->frame_id;
+    h.frame_size = s->size;
+    h.chunk = 0;
+    h.chunks = s->chunks;
+    h.timestamp = s->timestamp;
+    h.deadline = s->deadline;
+    encode_header(b, &h);
+    put_be16(b + VIDEO_HEADER_SIZE, count);
+    pbuf_realloc(p, VIDEO_HEADER_SIZE + 2 + 2 * count);
+
+    if (udp_sendto(video_pcb, p, &s->peer, s->peer_port) == ERR_OK) {
+        stats.nacks_sent++;
+        stats.nack_chunks_requested += count;
+    }
+    pbuf_free(p);
+}
+
+static video_slot_t *find_slot(u32_t frame_id) {
+    int i;
+    for (i = 0; i < VIDEO_SLOTS; i++) {
+        if (slots[i].state != SLOT_FREE && slots[i].frame_id == frame_id) {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+// Reuse order: free, dropped, echoed, still filling; oldest frame first.
+// The state values are ordered to match.
+static video_slot_t *claim_slot(void) {
+    video_slot_t *victim = NULL;
+    int i;
+
+    for (i = 0; i < VIDEO_SLOTS; i++) {
+        video_slot_t *s = &slots[i];
+        if (s->state == SLOT_FREE) {
+            return s;
+        }
+        if (!victim || s->state < victim->state ||
+            (s->state == victim->state && (s32_t)(s->frame_id - victim->frame_id) < 0)) {
+            victim = s;
+        }
+    }
+    if (victim->state == SLOT_FILLING) {
+        stats.frames_evicted++;
+    }
+    return victim;
+}
+
+static void frame_complete(video_slot_t *s) {
+    u32_t ms = sys_now() - s->first_ms;
+    u16_t i;
+
+    s->state = SLOT_COMPLETE;
+    stats.frames_complete++;
+    stats.assembly_ms_total += ms;
+    if (ms > stats.assembly_ms_max) {
+        stats.assembly_ms_max = ms;
+    }
+
+    // The EMAC reads the echo straight from the slot
+    ddr4_cache_dirty(&video_cache, s->addr, s->size);
+    ddr4_cache_flush(&video_cache);
+
+    for (i = 0; i < s->chunks; i++) {
+        if (send_chunk(s, i) != ERR_OK) {
+            break;                          // Client NACKs whatever did not go out
+        }
+    }
+}
+
+static void handle_data(struct pbuf *p, const video_header_t *h, const ip_addr_t *addr, u16_t port) {
+    video_slot_t *s;
+    u32_t len = p->tot_len - VIDEO_HEADER_SIZE;
+
+    if (h->frame_size == 0 || h->frame_size > VIDEO_SLOT_SIZE || h->chunk >= h->chunks ||
+        h->chunks != (h->frame_size + VIDEO_CHUNK_SIZE - 1) / VIDEO_CHUNK_SIZE) {
+        return;
+    }
+    if (simulate_drop()) {
+        return;
+    }
+
+    s = find_slot(h->frame_id);
+    if (!s) {
+        // Anything older than the slot window is already echoed or dropped
+        if (have_newest && (s32_t)(h->frame_id - newest_id) <= -VIDEO_SLOTS) {
+            stats.stale++;
+            return;
+        }
+        s = claim_slot();
+        s->state = SLOT_FILLING;
+        s->nacks = 0;
+        s->frame_id = h->frame_id;
+        s->size = h->frame_size;
+        s->chunks = h->chunks;
+        s->have = 0;
+        s->timestamp = h->timestamp;
+        s->deadline = h->deadline ? h->deadline : VIDEO_DEADLINE_MS;
+        s->first_ms = sys_now();
+        ip_addr_copy(s->peer, *addr);
+        s->peer_port = port;
+        memset(s->bitmap, 0, sizeof(s->bitmap));
+        if (!have_newest || (s32_t)(h->frame_id - newest_id) > 0) {
+            newest_id = h->frame_id;
+            have_newest = 1;
+        }
+        stats.frames_started++;
+    }
+
+    if (s->state != SLOT_FILLING || s->size != h->frame_size || len != chunk_len(s, h->chunk)) {
+        stats.stale++;
+        return;
+    }
+    s->last_ms = sys_now();
+    if (chunk_present(s, h->chunk)) {
+        stats.duplicates++;
+        return;
+    }
+
+    pbuf_copy_partial(p, (void *)(s->addr + (u32_t)h->chunk * VIDEO_CHUNK_SIZE), (u16_t)len, VIDEO_HEADER_SIZE);
+    s->bitmap[h->chunk / 32] |= 1u << (h->chunk % 32);
+    s->have++;
+
+    if (s->have == s->chunks) {
+        frame_complete(s);
+    }
+}
+
+// Client lost some echo chunks: resend them from the stored frame
+static void handle_nack(struct pbuf *p, const video_header_t *h) {
+    u8_t list[2 + 2 * VIDEO_NACK_MAX];
+    video_slot_t *s = find_slot(h->frame_id);
+    u16_t have = pbuf_copy_partial(p, list, sizeof(list), VIDEO_HEADER_SIZE);
+    u16_t count, i;
+
+    stats.nacks_received++;
+    if (!s || s->state != SLOT_COMPLETE) {
+        stats.retransmit_misses++;
+        return;
+    }
+    if (have < 2) {
+        return;
+    }
+    count = LWIP_MIN(get_be16(list), (u16_t)((have - 2) / 2));
+    for (i = 0; i < count; i++) {
+        u16_t chunk = get_be16(list + 2 + 2 * i);
+        if (chunk < s->chunks && send_chunk(s, chunk) == ERR_OK) {
+            stats.retransmits++;
+        }
+    }
+}
+
+static void handle_stats(const ip_addr_t *addr, u16_t port) {
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, VIDEO_HEADER_SIZE + sizeof(video_stats_t), PBUF_RAM);
+    const u32_t *words = (const u32_t *)&stats;
+    video_header_t h;
+    u8_t *b;
+    u32_t i;
+
+    if (!p) {
+        return;
+    }
+    b = (u8_t *)p->payload;
+    memset(&h, 0, sizeof(h));
+    h.type = VIDEO_STATS;
+    encode_header(b, &h);
+    for (i = 0; i < VIDEO_STAT_WORDS; i++) {
+        put_be32(b + VIDEO_HEADER_SIZE + 4 * i, words[i]);
+    }
+    udp_sendto(video_pcb, p, addr, port);
+    pbuf_free(p);
+}
+
+static void video_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    u8_t raw[VIDEO_HEADER_SIZE];
+    video_header_t h;
+
+    LWIP_UNUSED_ARG(arg);
+    LWIP_UNUSED_ARG(pcb);
+
+    if (!p) {
+        return;
+    }
+    stats.datagrams_in++;
+    if (p->tot_len < VIDEO_HEADER_SIZE ||
+        pbuf_copy_partial(p, raw, VIDEO_HEADER_SIZE, 0) != VIDEO_HEADER_SIZE ||
+        decode_header(raw, &h) != 0) {
+        pbuf_free(p);
+        return;
+    }
+
+    switch (h.type) {
+    case VIDEO_DATA:
+        handle_data(p, &h, addr, port);
+        break;
+    case VIDEO_NACK:
+        handle_nack(p, &h);
+        break;
+    case VIDEO_STATS:
+        handle_stats(addr, port);
+        break;
+    default:
+        break;
+    }
+    pbuf_free(p);
+}
+
+static void video_report(void) {
+    u32_t done = stats.frames_complete - last_stats.frames_complete;
+
+    xil_printf("UDP video: %d frames complete, %d late, %d evicted, %d NACKs (%d chunks), "
+               "%d retransmits, avg assembly %d ms\n\r",
+               done, stats.frames_late - last_stats.frames_late,
+               stats.frames_evicted - last_stats.frames_evicted,
+               stats.nacks_sent - last_stats.nacks_sent,
+               stats.nack_chunks_requested - last_stats.nack_chunks_requested,
+               stats.retransmits - last_stats.retransmits,
+               done ? (stats.assembly_ms_total - last_stats.assembly_ms_total) / done : 0);
+    last_stats = stats;
+}
+
+// NACK stalled frames, drop the ones past their deadline, report once a second
+int transfer_data() {
+    u32_t now = sys_now();
+    int i;
+
+    for (i = 0; i < VIDEO_SLOTS; i++) {
+        video_slot_t *s = &slots[i];
+
+        if (s->state != SLOT_FILLING) {
+            continue;
+        }
+        if (now - s->first_ms >= s->deadline) {
+            stats.frames_late++;
+            s->state = SLOT_DROPPED;
+        } else if (now - s->last_ms >= VIDEO_NACK_DELAY_MS && s->nacks < VIDEO_MAX_NACKS) {
+            send_nack(s);
+            s->nacks++;
+            s->last_ms = now;
+        }
+    }
+
+    if (now - last_report_ms >= VIDEO_REPORT_MS) {
+        if (stats.datagrams_in != last_stats.datagrams_in) {
+            video_report();
+        }
+        last_report_ms = now;
+    }
+    return 0;
+}
+
+int start_application()
+{
+    ddr4_extent_t *extent;
+    err_t err;
+    int i;
+
+    Xil_DCacheFlush();
+    Xil_ICacheInvalidate();
+    ddr4_arena_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    ddr4_cache_region_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    ddr4_cache_init(&video_cache, DDR4_CACHE_DEFAULT_THRESHOLD);
+
+    extent = ddr4_arena_alloc(VIDEO_SLOTS * VIDEO_SLOT_SIZE);
+    if (!extent) {
+        xil_printf("No DDR4 space for %d video slots\n\r", VIDEO_SLOTS);
+        return -1;
+    }
+    memset(slots, 0, sizeof(slots));
+    for (i = 0; i < VIDEO_SLOTS; i++) {
+        slots[i].addr = extent->addr + (u32_t)i * VIDEO_SLOT_SIZE;
+    }
+
+    video_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!video_pcb) {
+        xil_printf("Error creating UDP PCB. Out of Memory\n\r");
+        return -1;
+    }
+    err = udp_bind(video_pcb, IP_ANY_TYPE, SERVER_PORT);
+    if (err != ERR_OK) {
+        xil_printf("Unable to bind to UDP port %d: err = %d\n\r", SERVER_PORT, err);
+        return -2;
+    }
+    udp_recv(video_pcb, video_recv, NULL);
+    last_report_ms = sys_now();
+
+    xil_printf("UDP video server started @ port %d (%d slots of %d KB, drop %d/1000)\n\r",
+               SERVER_PORT, VIDEO_SLOTS, VIDEO_SLOT_SIZE / 1024, VIDEO_DROP_PERMILLE);
+    return 0;
+}
@@ -0,0 +1,194 @@
+import socket
+import struct
+import os
+import time
+import select
+
+# --- Configuration ---
+SERVER_IP = '192.168.1.10'  # Replace with your FPGA's IP address
+SERVER_PORT = 6001          # UDP, see trail257.c
+FRAME_COUNT = 600
+FPS = 30
+FRAME_SIZE = 60 * 1024      # Roughly a 640x480 JPEG at quality 60
+DEADLINE_MS = 100           # Frame must be echoed back within this to count as displayed
+NACK_DELAY_MS = 10          # Silence on a partial echo before NACKing
+CHUNK_SIZE = 1400           # Must match VIDEO_CHUNK_SIZE
+DROP_PERMILLE = 0           # Client-side simulated loss on received echo chunks
+
+MAGIC = 0x5644
+HEADER = struct.Struct('>HBBIIHHIHH')
+TYPE_DATA = 1
+TYPE_NACK = 2
+TYPE_STATS = 3
+BOARD_STATS = ['datagrams_in', 'duplicates', 'stale', 'frames_started', 'frames_complete',
+               'frames_late', 'frames_evicted', 'nacks_sent', 'nack_chunks_requested',
+               'nacks_received', 'retransmits', 'retransmit_misses', 'simulated_drops',
+               'assembly_ms_total', 'assembly_ms_max']
+
+
+def now_ms():
+    return int(time.monotonic() * 1000) & 0xFFFFFFFF
+
+
+def pack_header(kind, frame_id, size, chunk, chunks, timestamp):
+    return HEADER.pack(MAGIC, kind, 0, frame_id, size, chunk, chunks, timestamp, DEADLINE_MS, 0)
+
+
+def chunk_count(size):
+    return (size + CHUNK_SIZE - 1) // CHUNK_SIZE
+
+
+class EchoFrame:
+    """Echo of one sent frame being reassembled on the client."""
+    def __init__(self, frame_id, data, sent):
+        self.frame_id = frame_id
+        self.data = data
+        self.sent = sent
+        self.chunks = chunk_count(len(data))
+        self.buf = bytearray(len(data))
+        self.have = set()
+        self.last = sent
+        self.nacks = 0
+
+
+class VideoClient:
+    def __init__(self):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 * 1024 * 1024)
+        self.server = (SERVER_IP, SERVER_PORT)
+        self.pending = {}           # frame id -> EchoFrame
+        self.sent = {}              # frame id -> payload, kept for the board's NACKs
+        self.latencies = []
+        self.late = 0
+        self.corrupt = 0
+        self.nacks_sent = 0
+        self.resent = 0
+        self.chunks_in = 0
+        self.drop_state = 12345
+        self.board_stats = None
+
+    def send_frame(self, frame_id, data):
+        ts = now_ms()
+        chunks = chunk_count(len(data))
+        for i in range(chunks):
+            payload = data[i * CHUNK_SIZE:(i + 1) * CHUNK_SIZE]
+            self.sock.sendto(pack_header(TYPE_DATA, frame_id, len(data), i, chunks, ts) + payload, self.server)
+        self.sent[frame_id] = data
+        self.sent.pop(frame_id - 64, None)
+        self.pending[frame_id] = EchoFrame(frame_id, data, time.monotonic())
+
+    def simulated_drop(self):
+        if DROP_PERMILLE == 0:
+            return False
+        self.drop_state = (self.drop_state * 1103515245 + 12345) & 0xFFFFFFFF
+        return ((self.drop_state >> 16) % 1000) < DROP_PERMILLE
+
+    def on_data(self, hdr, payload):
+        _, _, _, frame_id, size, chunk, chunks, _, _, _ = hdr
+        frame = self.pending.get(frame_id)
+        if frame is None or chunk in frame.have or self.simulated_drop():
+            return
+        self.chunks_in += 1
+        frame.buf[chunk * CHUNK_SIZE:chunk * CHUNK_SIZE + len(payload)] = payload
+        frame.have.add(chunk)
+        frame.last = time.monotonic()
+        if len(frame.have) == frame.chunks:
+            del self.pending[frame_id]
+            if bytes(frame.buf) != frame.data:
+                self.corrupt += 1
+            self.latencies.append((time.monotonic() - frame.sent) * 1000)
+
+    def on_nack(self, hdr, payload):
+        """Board is missing upload chunks: resend them from our copy."""
+        frame_id = hdr[3]
+        data = self.sent.get(frame_id)
+        if data is None or len(payload) < 2:
+            return
+        (count,) = struct.unpack_from('>H', payload)
+        chunks = chunk_count(len(data))
+        for (i,) in struct.iter_unpack('>H', payload[2:2 + 2 * count]):
+            if i < chunks:
+                self.sock.sendto(pack_header(TYPE_DATA, frame_id, len(data), i, chunks, hdr[7]) +
+                                 data[i * CHUNK_SIZE:(i + 1) * CHUNK_SIZE], self.server)
+                self.resent += 1
+
+    def service_timers(self):
+        """NACK partial echoes, drop the ones past their deadline."""
+        t = time.monotonic()
+        for frame_id in list(self.pending):
+            frame = self.pending[frame_id]
+            if (t - frame.sent) * 1000 >= DEADLINE_MS:
+                del self.pending[frame_id]
+                self.late += 1
+            elif frame.have and (t - frame.last) * 1000 >= NACK_DELAY_MS:
+                missing = [i for i in range(frame.chunks) if i not in frame.have][:256]
+                body = struct.pack('>H', len(missing)) + b''.join(struct.pack('>H', i) for i in missing)
+                self.sock.sendto(pack_header(TYPE_NACK, frame_id, len(frame.data), 0, frame.chunks, 0) + body,
+                                 self.server)
+                frame.last = t
+                frame.nacks += 1
+                self.nacks_sent += 1
+
+    def poll(self, timeout):
+        # Wake often enough to NACK on time
+        ready, _, _ = select.select([self.sock], [], [], min(max(timeout, 0), NACK_DELAY_MS / 2000))
+        while ready:
+            data, _ = self.sock.recvfrom(65536)
+            if len(data) >= HEADER.size:
+                hdr = HEADER.unpack_from(data)
+                if hdr[0] == MAGIC:
+                    if hdr[1] == TYPE_DATA:
+                        self.on_data(hdr, data[HEADER.size:])
+                    elif hdr[1] == TYPE_NACK:
+                        self.on_nack(hdr, data[HEADER.size:])
+                    elif hdr[1] == TYPE_STATS:
+                        words = len(data[HEADER.size:]) // 4
+                        self.board_stats = dict(zip(BOARD_STATS, struct.unpack_from(f'>{words}I', data, HEADER.size)))
+            ready, _, _ = select.select([self.sock], [], [], 0)
+        self.service_timers()
+
+    def fetch_board_stats(self):
+        self.sock.sendto(pack_header(TYPE_STATS, 0, 0, 0, 0, 0), self.server)
+        end = time.monotonic() + 1.0
+        while self.board_stats is None and time.monotonic() < end:
+            self.poll(0.05)
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def run_client():
+    client = VideoClient()
+    print(f"Streaming {FRAME_COUNT} frames of {FRAME_SIZE} bytes at {FPS} fps to {SERVER_IP}:{SERVER_PORT}/udp")
+
+    frames = [os.urandom(FRAME_SIZE) for _ in range(8)]
+    start = time.monotonic()
+    for frame_id in range(FRAME_COUNT):
+        due = start + frame_id / FPS
+        while time.monotonic() < due:
+            client.poll(due - time.monotonic())
+        client.send_frame(frame_id, frames[frame_id % len(frames)])
+
+    # Let the last frames finish or time out
+    end = time.monotonic() + DEADLINE_MS / 1000 + 0.1
+    while client.pending and time.monotonic() < end:
+        client.poll(0.01)
+    client.late += len(client.pending)
+    client.fetch_board_stats()
+
+    lat = client.latencies
+    print(f"Displayed {len(lat)}/{FRAME_COUNT} frames, {client.late} late/lost, {client.corrupt} corrupt")
+    print(f"Frame latency ms: p50 {percentile(lat, 50):.1f}  p95 {percentile(lat, 95):.1f}  "
+          f"p99 {percentile(lat, 99):.1f}  max {max(lat) if lat else 0:.1f}")
+    print(f"Client: {client.nacks_sent} NACKs sent, {client.resent} upload chunks resent on board NACK")
+    if client.board_stats:
+        print("Board: " + ", ".join(f"{k} {v}" for k, v in client.board_stats.items()))
+    return client.corrupt == 0
+
+
+if __name__ == "__main__":
+    run_client()
@@ -0,0 +1,462 @@
+/******************************************************************************
+* Striped Multi-Connection Upload into one DDR4 Object
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* One lwIP connection tops out well below link rate, so a client may split an
+* object into stripes and send each on its own connection. Every connection
+* starts with a 40-byte v2 header (FRAME_FLAG_STRIPE, see frame_parser.h):
+* stream id names the object, length is the stripe length, and offset/total
+* place the stripe inside the object. The first stripe to arrive reserves one
+* contiguous DDR4 extent of `total` bytes and each stripe is written straight
+* to extent + offset.
+*
+* Nothing is echoed. When every byte of the object has arrived the server
+* sends each stripe connection a digest trailer (CRC32C of that stripe, kept
+* while it streams in) and closes it, so the reply also means "object
+* complete". If a stripe connection fails first, the whole object is dropped.
+* Completed objects stay in DDR4 until their table entry is needed again.
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "lwip/err.h"
+#include "lwip/tcp.h"
+#include "lwip/sys.h"
+#include "xil_printf.h"
+#include "xil_cache.h"
+#include "xil_exception.h"
+#include "ddr4_arena.h"
+#include "ddr4_cache.h"
+#include "conn_pool.h"
+#include "conn_watchdog.h"
+#include "pbuf_iov.h"
+#include "rx_window.h"
+#include "trace_log.h"
+#include "frame_parser.h"
+
+#define SERVER_PORT 6001
+#define DDR4_IMAGE_BUFFER_START_ADDR 0x90000000
+#define MAX_OBJECT_SIZE (1024 * 1024 * 1024)    // One object must fit one arena extent
+#define STRIPE_MAX_OBJECTS 4                    // Objects uploading or kept in DDR4
+#define STRIPE_MAX_PER_OBJECT 16                // Parallel connections per object
+#define STRIPE_OBJECT_IDLE_MS (CONN_WATCHDOG_IDLE_POLLS * CONN_WATCHDOG_POLL_INTERVAL * 500)
+
+#define OBJECT_FREE 0
+#define OBJECT_UPLOADING 1
+#define OBJECT_COMPLETE 2
+
+struct stripe_object;
+
+typedef struct {
+    struct tcp_pcb *pcb;
+    struct stripe_object *obj;  // NULL until the header arrives
+    struct pbuf *held;          // Partial header, waiting for the rest
+    u64_t offset;               // Stripe position in the object
+    u64_t length;
+    u64_t received;
+    u32_t crc;                  // CRC32C of the stripe so far
+    ddr4_cache_t cache;         // Dirty DDR4 span not yet flushed
+    rx_window_t win;            // Payload credit, bounded by the stripe
+    conn_watchdog_t wd;         // Idle supervision from tcp_poll
+    u8_t digest[FRAME_DIGEST_SIZE];
+} stripe_connection_t;
+
+// Connection slots, acquired in accept_callback
+CONN_POOL_DECLARE(connections, stripe_connection_t, CONN_POOL_MAX_CONNECTIONS);
+
+typedef struct stripe_object {
+    u8_t state;
+    u32_t object_id;            // v2 stream id
+    u64_t total;
+    u64_t received;             // Bytes stored across all stripes
+    u64_t claimed;              // Sum of announced stripe lengths
+    ddr4_extent_t *extent;
+    u32_t start_ms;
+    u32_t progress_ms;          // Last time any stripe stored bytes
+    u32_t sequence;             // Completion order, oldest complete object is reused first
+    stripe_connection_t *stripes[STRIPE_MAX_PER_OBJECT];
+    u64_t stripe_start[STRIPE_MAX_PER_OBJECT];  // Announced ranges, checked for overlap
+    u64_t stripe_end[STRIPE_MAX_PER_OBJECT];
+    u8_t stripe_count;
+} stripe_object_t;
+
+static stripe_object_t objects[STRIPE_MAX_OBJECTS];
+static u32_t completed_objects;
+
+void init_ddr_memory() {
+    Xil_DCacheFlush();
+    Xil_ICacheInvalidate();
+    ddr4_arena_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    ddr4_cache_region_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    trace_log_init();
+    xil_printf("DDR4 Memory initialized at 0x%08x\n\r", DDR4_IMAGE_BUFFER_START_ADDR);
+}
+
+static void release_object(stripe_object_t *obj) {
+    ddr4_arena_free(obj->extent);
+    memset(obj, 0, sizeof(stripe_object_t));
+}
+
+// Uploading object with this id, or a fresh entry for it. A completed object
+// with the same id is replaced; otherwise the oldest completed one is evicted.
+static stripe_object_t *object_for(u32_t object_id, u64_t total) {
+    stripe_object_t *slot = NULL;
+    int i;
+
+    for (i = 0; i < STRIPE_MAX_OBJECTS; i++) {
+        if (objects[i].state == OBJECT_UPLOADING && objects[i].object_id == object_id) {
+            return (objects[i].total == total) ? &objects[i] : NULL;
+        }
+    }
+    for (i = 0; i < STRIPE_MAX_OBJECTS; i++) {
+        stripe_object_t *o = &objects[i];
+        if (o->state == OBJECT_COMPLETE && o->object_id == object_id) {
+            slot = o;
+            break;
+        }
+        if (o->state == OBJECT_FREE && (!slot || slot->state != OBJECT_FREE)) {
+            slot = o;
+        } else if (o->state == OBJECT_COMPLETE && (!slot || (slot->state == OBJECT_COMPLETE &&
+                   (s32_t)(o->sequence - slot->sequence) < 0))) {
+            slot = o;
+        }
+    }
+    if (!slot) {
+        return NULL;
+    }
+    if (slot->state == OBJECT_COMPLETE) {
+        xil_printf("Evicting object %lu\n\r", (unsigned long)slot->object_id);
+        release_object(slot);
+    }
+
+    slot->extent = ddr4_arena_alloc((u32_t)total);
+    if (!slot->extent) {
+        return NULL;
+    }
+    slot->state = OBJECT_UPLOADING;
+    slot->object_id = object_id;
+    slot->total = total;
+    slot->start_ms = sys_now();
+    slot->progress_ms = slot->start_ms;
+    return slot;
+}
+
+// Register a stripe; rejects overlap and anything past the object end
+static err_t object_add_stripe(stripe_object_t *obj, stripe_connection_t *conn) {
+    u64_t end = conn->offset + conn->length;
+    int i;
+
+    if (end > obj->total || end < conn->offset || obj->stripe_count == STRIPE_MAX_PER_OBJECT) {
+        return ERR_VAL;
+    }
+    for (i = 0; i < obj->stripe_count; i++) {
+        if (conn->offset < obj->stripe_end[i] && obj->stripe_start[i] < end) {
+            return ERR_VAL;
+        }
+    }
+    obj->stripe_start[obj->stripe_count] = conn->offset;
+    obj->stripe_end[obj->stripe_count] = end;
+    obj->stripes[obj->stripe_count++] = conn;
+    obj->claimed += conn->length;
+    conn->obj = obj;
+    return ERR_OK;
+}
+
+static void detach_connection(stripe_connection_t *conn) {
+    tcp_arg(conn->pcb, NULL);
+    tcp_recv(conn->pcb, NULL);
+    tcp_err(conn->pcb, NULL);
+    tcp_poll(conn->pcb, NULL, 0);
+}
+
+// A stripe failed: abort its siblings and give the extent back
+static void object_fail(stripe_object_t *obj, stripe_connection_t *failed) {
+    int i;
+
+    xil_printf("Object %lu failed at %lu/%lu KB, dropping all stripes\n\r",
+               (unsigned long)obj->object_id, (unsigned long)(obj->received / 1024),
+               (unsigned long)(obj->total / 1024));
+    for (i = 0; i < obj->stripe_count; i++) {
+        stripe_connection_t *c = obj->stripes[i];
+        if (c && c != failed) {
+            detach_connection(c);
+            tcp_abort(c->pcb);
+            conn_pool_release(&connections, c);
+        }
+    }
+    release_object(obj);
+}
+
+// Every byte is in: flush, answer each stripe with its digest and close it.
+// Returns ERR_ABRT if current's PCB had to be aborted.
+static err_t object_complete(stripe_object_t *obj, struct tcp_pcb *current) {
+    u32_t ms = sys_now() - obj->start_ms;
+    err_t ret = ERR_OK;
+    int i;
+
+    obj->state = OBJECT_COMPLETE;
+    obj->sequence = completed_objects++;
+    xil_printf("Object %lu complete: %lu KB in %d stripes, %lu ms\n\r",
+               (unsigned long)obj->object_id, (unsigned long)(obj->total / 1024),
+               obj->stripe_count, (unsigned long)ms);
+
+    for (i = 0; i < obj->stripe_count; i++) {
+        stripe_connection_t *c = obj->stripes[i];
+
+        obj->stripes[i] = NULL;
+        ddr4_cache_flush(&c->cache);
+        frame_digest_encode(c->digest, c->crc, c->received);
+        detach_connection(c);
+        if (tcp_write(c->pcb, c->digest, FRAME_DIGEST_SIZE, TCP_WRITE_FLAG_COPY) != ERR_OK ||
+            tcp_close(c->pcb) != ERR_OK) {
+            tcp_abort(c->pcb);
+            if (c->pcb == current) {
+                ret = ERR_ABRT;
+            }
+        }
+        conn_pool_release(&connections, c);
+    }
+    return ret;
+}
+
+static void drop_connection(stripe_connection_t *conn, struct tcp_pcb *tpcb) {
+    if (conn->held) {
+        pbuf_free(conn->held);
+    }
+    if (conn->obj) {
+        object_fail(conn->obj, conn);
+    }
+    detach_connection(conn);
+    conn_pool_release(&connections, conn);
+    tcp_abort(tpcb);
+}
+
+void err_callback(void *arg, err_t err) {
+    stripe_connection_t *conn = (stripe_connection_t *)arg;
+
+    // The PCB is already gone
+    if (conn) {
+        TRACE_ERR(TRACE_EV_ERROR, err, conn->obj ? conn->obj->object_id : 0);
+        if (conn->held) {
+            pbuf_free(conn->held);
+        }
+        if (conn->obj) {
+            object_fail(conn->obj, conn);
+        }
+        conn_pool_release(&connections, conn);
+    }
+}
+
+// A stripe that stops moving holds up its whole object: evict it, which
+// drops the object and returns the extent
+err_t poll_callback(void *arg, struct tcp_pcb *tpcb) {
+    stripe_connection_t *conn = (stripe_connection_t *)arg;
+    u32_t progress;
+
+    if (!conn) {
+        return ERR_OK;
+    }
+
+    // A finished stripe waits on its siblings; a slow one is evicted by its
+    // own watchdog. If no stripe stores anything for as long, the rest of the
+    // object was never sent (stripes announced short of total): drop it.
+    if (conn->obj && conn->received == conn->length) {
+        if (sys_now() - conn->obj->progress_ms >= STRIPE_OBJECT_IDLE_MS) {
+            xil_printf("Object %lu idle with %lu/%lu KB claimed\n\r", (unsigned long)conn->obj->object_id,
+                       (unsigned long)(conn->obj->claimed / 1024), (unsigned long)(conn->obj->total / 1024));
+            conn_watchdog_evict(&conn->wd);
+            drop_connection(conn, tpcb);
+            return ERR_ABRT;
+        }
+        return ERR_OK;
+    }
+
+    progress = (u32_t)conn->received + (conn->held ? conn->held->tot_len : 0);
+    if (conn_watchdog_check(&conn->wd, progress, 0) == CONN_WATCHDOG_EXPIRED) {
+        conn_watchdog_evict(&conn->wd);
+        drop_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+// On success *skip is the header size; the payload follows it in the chain
+static err_t handle_header(stripe_connection_t *conn, const struct pbuf *p, u32_t *skip) {
+    frame_header_t hdr;
+    err_t herr = frame_header_from_pbuf(p, &hdr);
+
+    if (herr == ERR_INPROGRESS) {
+        return herr;
+    }
+    if (herr != ERR_OK || !(hdr.flags & FRAME_FLAG_STRIPE) || hdr.size < FRAME_HEADER_V2_STRIPE_SIZE ||
+        hdr.total == 0 || hdr.total > MAX_OBJECT_SIZE || hdr.length == 0) {
+        xil_printf("Not a stripe header, rejecting\n\r");
+        return ERR_VAL;
+    }
+
+    conn->offset = hdr.offset;
+    conn->length = hdr.length;
+    {
+        stripe_object_t *obj = object_for(hdr.stream_id, hdr.total);
+        if (!obj) {
+            xil_printf("No room for object %lu (%lu KB), rejecting stripe\n\r",
+                       (unsigned long)hdr.stream_id, (unsigned long)(hdr.total / 1024));
+            ddr4_arena_report();
+            return ERR_MEM;
+        }
+        if (object_add_stripe(obj, conn) != ERR_OK) {
+            xil_printf("Stripe %lu+%lu does not fit object %lu, rejecting\n\r",
+                       (unsigned long)conn->offset, (unsigned long)conn->length, (unsigned long)hdr.stream_id);
+            if (obj->stripe_count == 0) {
+                release_object(obj);
+            }
+            return ERR_VAL;
+        }
+    }
+
+    *skip = hdr.size;
+    rx_window_limit(&conn->win, (u32_t)conn->length);
+    xil_printf("Object %lu stripe %d: %lu KB at offset %lu KB\n\r", (unsigned long)hdr.stream_id,
+               conn->obj->stripe_count, (unsigned long)(conn->length / 1024),
+               (unsigned long)(conn->offset / 1024));
+    return ERR_OK;
+}
+
+err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    stripe_connection_t *conn = (stripe_connection_t *)arg;
+    stripe_object_t *obj;
+    u32_t skip = 0, len;
+
+    if (!conn || err != ERR_OK) {
+        if (p) pbuf_free(p);
+        return ERR_ARG;
+    }
+
+    if (!p) {
+        // A finished stripe may half-close; it still gets its digest later
+        if (conn->obj && conn->received == conn->length) {
+            return ERR_OK;
+        }
+        xil_printf("Stripe closed early (%lu/%lu KB)\n\r", (unsigned long)(conn->received / 1024),
+                   (unsigned long)(conn->length / 1024));
+        drop_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    if (!conn->obj) {
+        err_t herr;
+
+        if (conn->held) {
+            pbuf_cat(conn->held, p);
+            p = conn->held;
+            conn->held = NULL;
+        }
+        herr = handle_header(conn, p, &skip);
+        if (herr == ERR_INPROGRESS) {
+            conn->held = p;
+            return ERR_OK;
+        }
+        if (herr != ERR_OK) {
+            pbuf_free(p);
+            drop_connection(conn, tpcb);
+            return ERR_ABRT;
+        }
+    }
+    obj = conn->obj;
+    len = p->tot_len - skip;
+
+    if (conn->received + len > conn->length) {
+        xil_printf("Stripe exceeds its announced length\n\r");
+        pbuf_free(p);
+        drop_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    // Straight into the object at this stripe's offset, the whole chain at once
+    pbuf_iov_store(p, skip, len, obj->extent->addr + (UINTPTR)(conn->offset + conn->received), &conn->cache);
+    conn->crc = pbuf_iov_crc32c(conn->crc, p, skip, len);
+    conn->received += len;
+    obj->received += len;
+    obj->progress_ms = sys_now();
+    TRACE_DBG(TRACE_EV_STORE, len, (u32_t)obj->received);
+
+    // Header bytes go straight back, payload once it is in DDR4
+    tcp_recved(tpcb, skip);
+    rx_window_update(&conn->win, tpcb, (u32_t)conn->received);
+    pbuf_free(p);
+
+    if (obj->received == obj->total && obj->claimed == obj->total) {
+        return object_complete(obj, tpcb);
+    }
+    return ERR_OK;
+}
+
+err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    stripe_connection_t *conn;
+    conn_reject_t reason;
+
+    if (err != ERR_OK || newpcb == NULL) {
+        return ERR_VAL;
+    }
+
+    // Admission control before anything else is allocated
+    conn = (stripe_connection_t *)conn_pool_acquire(&connections, &reason);
+    if (!conn) {
+        xil_printf("Connection rejected: %s (%d/%d in use)\n\r",
+                   conn_pool_reason(reason), connections.in_use, connections.limit);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+    conn->pcb = newpcb;
+    ddr4_cache_init(&conn->cache, DDR4_CACHE_DEFAULT_THRESHOLD);
+    rx_window_init(&conn->win, RX_WINDOW_UNLIMITED);
+    conn_watchdog_init(&conn->wd, CONN_WATCHDOG_IDLE_POLLS);
+
+    tcp_arg(newpcb, conn);
+    tcp_recv(newpcb, recv_callback);
+    tcp_err(newpcb, err_callback);
+    tcp_poll(newpcb, poll_callback, CONN_WATCHDOG_POLL_INTERVAL);
+    return ERR_OK;
+}
+
+// Main-loop hook: format trace records while the link is quiet
+int transfer_data() {
+    trace_log_drain(TRACE_DRAIN_BATCH);
+    return 0;
+}
+
+int start_application()
+{
+    struct tcp_pcb *pcb;
+    err_t err;
+
+    init_ddr_memory();
+    conn_pool_init(&connections, CONN_POOL_MAX_CONNECTIONS);
+    memset(objects, 0, sizeof(objects));
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        xil_printf("Error creating PCB. Out of Memory\n\r");
+        return -1;
+    }
+
+    err = tcp_bind(pcb, IP_ANY_TYPE, SERVER_PORT);
+    if (err != ERR_OK) {
+        xil_printf("Unable to bind to port %d: err = %d\n\r", SERVER_PORT, err);
+        return -2;
+    }
+
+    pcb = tcp_listen(pcb);
+    if (!pcb) {
+        xil_printf("Out of memory while tcp_listen\n\r");
+        return -3;
+    }
+
+    tcp_accept(pcb, accept_callback);
+
+    xil_printf("TCP striped upload server started @ port %d (%d objects, %d stripes each)\n\r",
+               SERVER_PORT, STRIPE_MAX_OBJECTS, STRIPE_MAX_PER_OBJECT);
+    return 0;
+}
@@ -0,0 +1,103 @@
+import socket
+import struct
+import os
+import time
+import threading
+from frame_digest import crc32c_update, parse_digest, DIGEST_SIZE
+
+# --- Configuration ---
+SERVER_IP = '192.168.1.10'  # Replace with your FPGA's IP address
+SERVER_PORT = 6001
+STREAMS = 4                 # Parallel connections for the one object
+OBJECT_SIZE = 64 * 1024 * 1024
+OBJECT_ID = 1               # v2 stream id, names the object on the board
+CHUNK_SIZE = 64 * 1024
+IMAGE_FILE = None           # Upload this file instead of random data
+
+FLAG_STRIPE = 0x40
+
+
+def pack_stripe_header(offset, length, total):
+    """40-byte v2 header: marker, version, header length, flags, u64 length, seq, stream id, u64 offset, u64 total."""
+    return struct.pack('>BBHIQIIQQ', 0xFF, 2, 40, FLAG_STRIPE, length, 0, OBJECT_ID, offset, total)
+
+
+def split_stripes(total, streams):
+    """Contiguous stripes of near-equal size, as (offset, length)."""
+    base, extra = divmod(total, streams)
+    stripes, offset = [], 0
+    for i in range(streams):
+        length = base + (1 if i < extra else 0)
+        if length:
+            stripes.append((offset, length))
+        offset += length
+    return stripes
+
+
+def stripe_thread(data, offset, length, result, index):
+    """Send one stripe on its own connection and wait for the object-complete digest."""
+    try:
+        sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        sock.connect((SERVER_IP, SERVER_PORT))
+        sock.sendall(pack_stripe_header(offset, length, len(data)))
+        view = memoryview(data)
+        pos = offset
+        while pos < offset + length:
+            n = min(CHUNK_SIZE, offset + length - pos)
+            sock.sendall(view[pos:pos + n])
+            pos += n
+        sent = time.time()
+
+        reply = b''
+        while len(reply) < DIGEST_SIZE:
+            chunk = sock.recv(DIGEST_SIZE - len(reply))
+            if not chunk:
+                raise ConnectionError("Server closed without a digest (object failed?)")
+            reply += chunk
+        sock.close()
+        result[index] = (parse_digest(reply), sent, time.time())
+    except Exception as e:
+        print(f"Stripe {index} error: {e}")
+        result[index] = None
+
+
+def run_client():
+    if IMAGE_FILE:
+        with open(IMAGE_FILE, 'rb') as f:
+            data = f.read()
+    else:
+        data = os.urandom(OBJECT_SIZE)
+    stripes = split_stripes(len(data), STREAMS)
+    print(f"Uploading {len(data)} bytes as object {OBJECT_ID} over {len(stripes)} connections "
+          f"to {SERVER_IP}:{SERVER_PORT}")
+
+    result = {}
+    threads = [threading.Thread(target=stripe_thread, args=(data, off, length, result, i))
+               for i, (off, length) in enumerate(stripes)]
+    start = time.time()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.time() - start
+
+    ok = True
+    for i, (off, length) in enumerate(stripes):
+        r = result.get(i)
+        if r is None:
+            ok = False
+            continue
+        (crc, got), sent, done = r
+        expect = crc32c_update(0, data[off:off + length])
+        status = "ok" if (crc, got) == (expect, length) else "MISMATCH"
+        if status != "ok":
+            ok = False
+        print(f"Stripe {i}: {length} bytes at {off}, sent in {sent - start:.2f} s, digest {crc:08x} {status}")
+
+    print(f"Object {'complete' if ok else 'FAILED'}: {len(data)} bytes in {elapsed:.2f} s "
+          f"({len(data) * 8 / elapsed / 1e6:.2f} Mbps with {len(stripes)} streams)")
+    return ok
+
+
+if __name__ == "__main__":
+    run_client()
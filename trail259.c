@@ -0,0 +1,370 @@
+/******************************************************************************
+* Streaming Image Echo Server with a Storage Worker Pipeline
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* Same protocol and zero-copy echo as trail254, but recv_callback no longer
+* does the DDR4 copy and cache flush inline. Each pbuf chain is queued to the
+* storage worker (storage_pipeline.h) and the callback returns at once, so
+* the stack keeps processing packets while the copy runs. Completed ranges
+* come back on the main loop (the tcpip context under NO_SYS), where the pbuf
+* is freed and the echo cursor advances.
+*
+* A connection can go away while its jobs are still with the worker, which
+* is writing into its extent. Such a connection is only marked dead; the
+* struct and the extent are freed when its last job comes back.
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "lwip/err.h"
+#include "lwip/tcp.h"
+#include "xil_printf.h"
+#include "xil_cache.h"
+#include "xil_exception.h"
+#include "ddr4_arena.h"
+#include "ddr4_cache.h"
+#include "conn_pool.h"
+#include "conn_watchdog.h"
+#include "trace_log.h"
+#include "ddr4_echo.h"
+#include "frame_parser.h"
+#include "storage_pipeline.h"
+
+#define SERVER_PORT 6001
+#define MAX_IMAGE_SIZE (512 * 1024 * 1024) // 512MB
+#define DDR4_IMAGE_BUFFER_START_ADDR 0x90000000
+#define ECHO_MODE DDR4_ECHO_ZERO_COPY // Default, v2 header flags can override it
+
+typedef struct {
+    u32_t buffer_addr;     // DDR4 memory address
+    u32_t submitted;       // Bytes handed to the storage worker
+    u32_t received_bytes;  // Bytes the worker has stored
+    u32_t file_size;       // Expected file size
+    u32_t jobs;            // Storage jobs in flight
+    ddr4_echo_t echo;      // Echo cursor over the DDR4 copy
+    conn_watchdog_t wd;    // Stall and idle supervision from tcp_poll
+    struct tcp_pcb *pcb;   // Connection PCB, NULL once dead
+    ddr4_extent_t *extent; // DDR4 region owned by this upload
+    struct pbuf *held;     // Partial header, waiting for the rest
+    u8_t header_received;  // Flag for size header
+    u8_t closing;          // Client sent FIN
+    u8_t dead;             // PCB gone, waiting for jobs to come back
+} image_connection_t;
+
+// Connection slots, acquired in accept_callback
+CONN_POOL_DECLARE(connections, image_connection_t, CONN_POOL_MAX_CONNECTIONS);
+
+static storage_pipeline_t pipeline;
+
+void init_ddr_memory() {
+    Xil_DCacheFlush();
+    Xil_ICacheInvalidate();
+    ddr4_arena_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    ddr4_cache_region_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    trace_log_init();
+    xil_printf("DDR4 Memory initialized at 0x%08x\n\r", DDR4_IMAGE_BUFFER_START_ADDR);
+}
+
+// Free now, or once the worker is done with the extent
+static void release_connection(image_connection_t *conn) {
+    tx_batch_cancel(&conn->echo.tx);
+    if (conn->held) {
+        pbuf_free(conn->held);
+        conn->held = NULL;
+    }
+    conn->pcb = NULL;
+    conn->dead = 1;
+    if (conn->jobs == 0) {
+        ddr4_arena_free(conn->extent);
+        conn_pool_release(&connections, conn);
+    }
+}
+
+static void abort_connection(image_connection_t *conn, struct tcp_pcb *tpcb) {
+    tcp_arg(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_abort(tpcb);
+    release_connection(conn);
+}
+
+static void close_connection(image_connection_t *conn, struct tcp_pcb *tpcb) {
+    xil_printf("Connection closed. Total bytes stored: %d\n\r", conn->received_bytes);
+    ddr4_echo_report(&conn->echo);
+    conn_watchdog_report(&conn->wd);
+    storage_pipeline_report(&pipeline);
+    tcp_arg(tpcb, NULL);
+    tcp_sent(tpcb, NULL);
+    tcp_recv(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_close(tpcb);
+    release_connection(conn);
+}
+
+// Everything the client sent is stored and echoed
+static int all_echoed(const image_connection_t *conn) {
+    return conn->jobs == 0 && conn->echo.acked >= conn->submitted;
+}
+
+// Main loop: the worker finished storing one chain. owner is the
+// connection's handle; the slot stays held (dead) while jobs are in flight,
+// so a stale handle means a completion for an old owner.
+static void storage_done(storage_job_t *job) {
+    image_connection_t *conn = (image_connection_t *)conn_pool_get(&connections, CONN_HANDLE_OF(job->owner));
+
+    if (!conn) {
+        return;
+    }
+    conn->jobs--;
+    if (conn->dead) {
+        release_connection(conn);
+        return;
+    }
+
+    conn->received_bytes += job->len;
+    TRACE_DBG(TRACE_EV_STORE, job->len, conn->received_bytes);
+
+    // The worker flushed the range, the EMAC can read it for the echo
+    ddr4_echo_stored(&conn->echo, conn->received_bytes);
+    if (ddr4_echo_queue(&conn->echo, conn->pcb) != ERR_OK) {
+        xil_printf("Echo failed, aborting connection\n\r");
+        abort_connection(conn, conn->pcb);
+        return;
+    }
+    if (conn->closing && all_echoed(conn)) {
+        close_connection(conn, conn->pcb);
+    }
+}
+
+void err_callback(void *arg, err_t err) {
+    image_connection_t *conn = (image_connection_t *)arg;
+
+    // The PCB is already freed
+    if (conn) {
+        TRACE_ERR(TRACE_EV_ERROR, err, conn->received_bytes);
+        release_connection(conn);
+    }
+}
+
+err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    image_connection_t *conn = (image_connection_t *)arg;
+
+    if (!conn) {
+        return ERR_ARG;
+    }
+
+    // ACK'd bytes are no longer pinned in DDR4
+    ddr4_echo_acked(&conn->echo, len);
+
+    // Room in the send buffer again: resume a parked echo
+    if (ddr4_echo_pump(&conn->echo, tpcb) != ERR_OK) {
+        xil_printf("Echo failed, aborting connection\n\r");
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    if (conn->closing && all_echoed(conn)) {
+        xil_printf("All data echoed, closing connection\n\r");
+        close_connection(conn, tpcb);
+    }
+    return ERR_OK;
+}
+
+err_t poll_callback(void *arg, struct tcp_pcb *tpcb) {
+    image_connection_t *conn = (image_connection_t *)arg;
+    u8_t pending;
+
+    if (!conn) {
+        return ERR_OK;
+    }
+
+    // Evict a client that stopped sending and ACKing; the extent follows
+    // once the worker hands back the jobs still in flight
+    pending = conn->jobs > 0 || (conn->header_received && ddr4_echo_pending(&conn->echo) > 0);
+    if (conn_watchdog_check(&conn->wd, conn->submitted + conn->echo.acked, pending) == CONN_WATCHDOG_EXPIRED) {
+        conn_watchdog_evict(&conn->wd);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    // Resume a parked echo if no ACK arrived to do it, otherwise push
+    // whatever a deferred batch or Nagle still holds
+    if (conn->header_received && ddr4_echo_poll(&conn->echo, tpcb) != ERR_OK) {
+        xil_printf("Echo failed, aborting connection\n\r");
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    image_connection_t *conn = (image_connection_t *)arg;
+    storage_job_t *job;
+
+    if (!conn || err != ERR_OK) {
+        if (p) pbuf_free(p);
+        return ERR_ARG;
+    }
+
+    // Handle connection closure
+    if (!p) {
+        conn->closing = 1;
+        if (all_echoed(conn)) {
+            close_connection(conn, tpcb);
+        } else {
+            xil_printf("Client closed connection, waiting to store and echo remaining data\n\r");
+        }
+        return ERR_OK;
+    }
+
+    // No room to take the data: refuse it untouched, lwIP offers it again
+    // later. Once the header is stripped or credited it can no longer be refused.
+    if (storage_pipeline_full(&pipeline)) {
+        return ERR_MEM;
+    }
+
+    // Handle file size header if not yet received
+    if (!conn->header_received) {
+        frame_header_t hdr;
+        err_t herr;
+
+        // Keep a partial header until the rest arrives; not credited yet
+        if (conn->held) {
+            pbuf_cat(conn->held, p);
+            p = conn->held;
+            conn->held = NULL;
+        }
+        herr = frame_header_from_pbuf(p, &hdr);
+        if (herr == ERR_INPROGRESS) {
+            xil_printf("Waiting for more header data...\n\r");
+            conn->held = p;
+            return ERR_OK;
+        }
+
+        // Legacy 4-byte or v2 header, see frame_parser.h
+        conn->file_size = (u32_t)hdr.length;
+
+        // Reserve a DDR4 extent sized for this upload
+        if (herr != ERR_OK || hdr.length == 0 || hdr.length > MAX_IMAGE_SIZE ||
+            (conn->extent = ddr4_arena_alloc(conn->file_size)) == NULL) {
+            xil_printf("No DDR4 space for %d bytes, rejecting upload\n\r", conn->file_size);
+            ddr4_arena_report();
+            pbuf_free(p);
+            abort_connection(conn, tpcb);
+            return ERR_ABRT;
+        }
+        conn->buffer_addr = (u32_t)conn->extent->addr;
+        conn->header_received = 1;
+        ddr4_echo_init(&conn->echo, conn->buffer_addr, ddr4_echo_mode(&hdr, ECHO_MODE));
+        rx_window_limit(&conn->echo.win, conn->extent->size);
+        xil_printf("Expected file size: %d bytes (header v%d, %s echo, storage worker)\n\r",
+                   conn->file_size, hdr.version,
+                   conn->echo.mode == DDR4_ECHO_ZERO_COPY ? "zero-copy" : "copy");
+
+        // Drop the header, even when it spans segments of the chain
+        p = pbuf_free_header(p, hdr.size);
+        tcp_recved(tpcb, hdr.size);
+        if (p == NULL) {
+            return ERR_OK;
+        }
+    }
+
+    // Check DDR4 space
+    if (conn->submitted + p->tot_len > conn->extent->size) {
+        xil_printf("Image exceeds its DDR4 extent (%d bytes)\n\r", conn->extent->size);
+        pbuf_free(p);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    // Cannot be NULL, the pipeline had a free job above
+    job = storage_pipeline_job(&pipeline);
+
+    // The worker copies and flushes; the pbuf is freed when the job returns
+    job->p = p;
+    job->dst = conn->buffer_addr + conn->submitted;
+    job->len = p->tot_len;
+    job->owner = CONN_HANDLE_ARG(conn_pool_handle(&connections, conn));
+    conn->submitted += p->tot_len;
+    conn->jobs++;
+    storage_pipeline_submit(&pipeline, job);
+    return ERR_OK;
+}
+
+err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    image_connection_t *conn;
+    conn_reject_t reason;
+
+    if (err != ERR_OK || newpcb == NULL) {
+        return ERR_VAL;
+    }
+
+    // Admission control before anything else is allocated
+    conn = (image_connection_t *)conn_pool_acquire(&connections, &reason);
+    if (!conn) {
+        xil_printf("Connection rejected: %s (%d/%d in use)\n\r",
+                   conn_pool_reason(reason), connections.in_use, connections.limit);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+    conn->pcb = newpcb;
+    conn_watchdog_init(&conn->wd, CONN_WATCHDOG_IDLE_POLLS);
+
+    tcp_arg(newpcb, conn);
+    tcp_recv(newpcb, recv_callback);
+    tcp_sent(newpcb, sent_callback);
+    tcp_err(newpcb, err_callback);
+    tcp_poll(newpcb, poll_callback, CONN_WATCHDOG_POLL_INTERVAL);
+
+    // Disable Nagle's algorithm for low latency
+    tcp_nagle_disable(newpcb);
+
+    xil_printf("New connection established\n\r");
+    return ERR_OK;
+}
+
+// Main-loop hook: finish stored ranges, send their echoes, then format
+// trace records
+int transfer_data() {
+    storage_pipeline_poll(&pipeline);
+    tx_batch_run();
+    trace_log_drain(TRACE_DRAIN_BATCH);
+    return 0;
+}
+
+int start_application()
+{
+    struct tcp_pcb *pcb;
+    err_t err;
+
+    init_ddr_memory();
+    conn_pool_init(&connections, CONN_POOL_MAX_CONNECTIONS);
+    if (storage_pipeline_start(&pipeline, storage_done) != 0) {
+        return -1;
+    }
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        xil_printf("Error creating PCB. Out of Memory\n\r");
+        return -1;
+    }
+
+    err = tcp_bind(pcb, IP_ANY_TYPE, SERVER_PORT);
+    if (err != ERR_OK) {
+        xil_printf("Unable to bind to port %d: err = %d\n\r", SERVER_PORT, err);
+        return -2;
+    }
+
+    pcb = tcp_listen(pcb);
+    if (!pcb) {
+        xil_printf("Out of memory while tcp_listen\n\r");
+        return -3;
+    }
+
+    tcp_accept(pcb, accept_callback);
+
+    xil_printf("TCP streaming echo server (storage worker %s) started @ port %d\n\r",
+               STORAGE_PIPELINE_THREADED ? "thread" : "inline", SERVER_PORT);
+    return 0;
+}
@@ -0,0 +1,483 @@
+/******************************************************************************
+* DDR4 Object Store Server: PUT keeps an upload, GET streams it back
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* One connection carries any number of commands, one at a time, as
+* <header><payload> records (trail260.py). Every upload is a PUT: it is
+* stored in the object store (ddr4_store.h) under its v2 stream id, or an
+* assigned id for stream id 0 and legacy headers, and stays there after the
+* connection closes. The reply is a 24-byte receipt with the id and CRC32C.
+*
+* A v2 header with FRAME_FLAG_STORE_GET and no payload asks for object
+* stream id back, from offset for total bytes (0 = to the end). The receipt
+* comes first, then the range straight from DDR4 with zero-copy tcp_write;
+* the object is pinned against eviction until the client has ACK'd it. A
+* missing object or a bad range gets a receipt with no body.
+*
+* The next command is held, with the receive window, until the reply to the
+* previous one is ACK'd.
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "lwip/err.h"
+#include "lwip/tcp.h"
+#include "xil_printf.h"
+#include "xil_cache.h"
+#include "xil_exception.h"
+#include "ddr4_arena.h"
+#include "ddr4_cache.h"
+#include "ddr4_store.h"
+#include "conn_pool.h"
+#include "conn_watchdog.h"
+#include "ddr4_copy.h"
+#include "pbuf_iov.h"
+#include "trace_log.h"
+#include "conn_metrics.h"
+#include "ddr4_echo.h"
+#include "frame_parser.h"
+#include "crc32c.h"
+
+#define SERVER_PORT 6001
+#define DDR4_IMAGE_BUFFER_START_ADDR 0x90000000
+
+#define OP_NONE 0
+#define OP_PUT  1
+#define OP_GET  2
+
+typedef struct {
+    frame_parser_t parser; // Command boundaries across pbufs
+    u8_t op;               // Command being received or answered
+    u8_t pinned;           // Connection holds a writer or reader pin on obj
+    u8_t replying;         // Receipt (and GET body) not fully ACK'd yet
+    ddr4_store_status_t status;
+    ddr4_object_t obj;     // Object of the current command
+    u32_t stored;          // PUT payload bytes stored
+    u32_t crc;             // Running CRC32C of the PUT payload
+    UINTPTR range_addr;    // GET body in DDR4
+    u32_t range_len;
+    u8_t receipt[FRAME_RECEIPT_SIZE];
+    ddr4_echo_t head;      // Receipt, copied into the lwIP heap
+    ddr4_echo_t body;      // GET body, zero-copy from DDR4
+    u32_t header_credited; // Header bytes returned to the receive window
+    u32_t payload_credit;  // PUT payload parsed but not yet credited
+    u32_t puts;
+    u32_t gets;
+    struct pbuf *pending;  // Input not yet parsed (reply in flight)
+    conn_metrics_t metrics; // Counters served on CONN_METRICS_PORT
+    conn_watchdog_t wd;    // Stall and idle supervision from tcp_poll
+    struct tcp_pcb *pcb;   // Connection PCB
+    ddr4_cache_t cache;    // Dirty DDR4 span not yet flushed
+    u8_t closing;          // Client closed its side
+} store_connection_t;
+
+// Connection slots, acquired in accept_callback
+CONN_POOL_DECLARE(connections, store_connection_t, CONN_POOL_MAX_CONNECTIONS);
+
+void init_ddr_memory() {
+    Xil_DCacheFlush();
+    Xil_ICacheInvalidate();
+    ddr4_arena_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    ddr4_cache_region_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    trace_log_init();
+    xil_printf("DDR4 Memory initialized at 0x%08x\n\r", DDR4_IMAGE_BUFFER_START_ADDR);
+}
+
+// Drop the connection's pin: an unfinished upload goes, a read object stays
+static void release_object(store_connection_t *conn) {
+    if (!conn->pinned) {
+        return;
+    }
+    if (conn->op == OP_PUT) {
+        ddr4_store_discard(conn->obj.id);
+    } else {
+        ddr4_store_close(conn->obj.id);
+    }
+    conn->pinned = 0;
+}
+
+static void free_connection(store_connection_t *conn) {
+    if (conn->pending) {
+        pbuf_free(conn->pending);
+    }
+    release_object(conn);
+    conn_metrics_close(&conn->metrics);
+    conn_pool_release(&connections, conn);
+}
+
+static void abort_connection(store_connection_t *conn, struct tcp_pcb *tpcb) {
+    free_connection(conn);
+    tcp_arg(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_abort(tpcb);
+}
+
+// Receipt and GET body both go out through echo cursors. Neither carries
+// received bytes, so they must not credit the window.
+static void start_reply(store_connection_t *conn, u32_t id, u32_t crc, u32_t length) {
+    frame_receipt_encode(conn->receipt, conn->status, id, crc, length);
+    ddr4_echo_init(&conn->head, (UINTPTR)conn->receipt, DDR4_ECHO_COPY);
+    conn->head.win.credited = FRAME_RECEIPT_SIZE;
+    conn->head.metrics = &conn->metrics;
+    ddr4_echo_stored(&conn->head, FRAME_RECEIPT_SIZE);
+
+    ddr4_echo_init(&conn->body, conn->range_addr, DDR4_ECHO_ZERO_COPY);
+    conn->body.win.credited = conn->range_len;
+    conn->body.metrics = &conn->metrics;
+    ddr4_echo_stored(&conn->body, conn->range_len);
+
+    conn->replying = 1;
+}
+
+// Parser callbacks. GET has no payload, so its end follows begin at once.
+static err_t command_begin(void *arg, const frame_header_t *hdr) {
+    store_connection_t *conn = (store_connection_t *)arg;
+
+    if (conn->replying) {
+        return ERR_WOULDBLOCK;
+    }
+
+    conn->stored = 0;
+    conn->crc = 0;
+    conn->range_len = 0;
+    conn->obj.id = hdr->stream_id;
+
+    if (hdr->version == 2 && (hdr->flags & FRAME_FLAG_STORE_GET)) {
+        if (hdr->length != 0) {
+            xil_printf("GET with a %lu byte payload\n\r", (unsigned long)hdr->length);
+            return ERR_VAL;
+        }
+        conn->op = OP_GET;
+        conn->status = ddr4_store_open(hdr->stream_id, &conn->obj);
+        if (conn->status != DDR4_STORE_OK) {
+            return ERR_OK;
+        }
+        conn->pinned = 1;
+        if (hdr->offset > conn->obj.length ||
+            hdr->total > conn->obj.length - hdr->offset) {
+            conn->status = DDR4_STORE_BAD_RANGE;
+            release_object(conn);
+            return ERR_OK;
+        }
+        conn->range_addr = conn->obj.addr + (u32_t)hdr->offset;
+        conn->range_len = hdr->total ? (u32_t)hdr->total : conn->obj.length - (u32_t)hdr->offset;
+        conn->gets++;
+        return ERR_OK;
+    }
+
+    // Anything else is an upload. One that cannot be stored is still read
+    // off the connection, and answered NO_SPACE or BUSY.
+    conn->op = OP_PUT;
+    if (hdr->length > 0xFFFFFFFFu) {
+        conn->status = DDR4_STORE_NO_SPACE;
+    } else {
+        conn->status = ddr4_store_create(hdr->stream_id, (u32_t)hdr->length, &conn->obj);
+    }
+    if (conn->status == DDR4_STORE_OK) {
+        conn->pinned = 1;
+    } else {
+        xil_printf("Object %lu not stored: %s\n\r", (unsigned long)hdr->stream_id,
+                   ddr4_store_status_name(conn->status));
+    }
+    return ERR_OK;
+}
+
+static err_t command_data(void *arg, const u8_t *data, u32_t len) {
+    store_connection_t *conn = (store_connection_t *)arg;
+    UINTPTR dst = conn->obj.addr + conn->stored;
+
+    // Payload is credited as it is parsed; nothing of it is echoed
+    conn->payload_credit += len;
+    if (conn->status != DDR4_STORE_OK) {
+        return ERR_OK;
+    }
+
+    ddr4_copy((void *)dst, data, len);
+    ddr4_cache_dirty(&conn->cache, dst, len);
+    conn->crc = crc32c_update(conn->crc, data, len);
+    conn->stored += len;
+    return ERR_OK;
+}
+
+static err_t command_end(void *arg) {
+    store_connection_t *conn = (store_connection_t *)arg;
+
+    if (conn->op == OP_GET) {
+        start_reply(conn, conn->obj.id, conn->status == DDR4_STORE_OK ? conn->obj.crc : 0, conn->range_len);
+        return ERR_OK;
+    }
+
+    if (conn->status == DDR4_STORE_OK) {
+        // GETs may stream it straight from DDR4 from now on
+        ddr4_cache_flush(&conn->cache);
+        ddr4_store_commit(conn->obj.id, conn->crc);
+        conn->pinned = 0;
+        conn->puts++;
+        TRACE_DBG(TRACE_EV_STORE, conn->stored, conn->obj.id);
+    }
+    start_reply(conn, conn->obj.id, conn->crc, conn->stored);
+    return ERR_OK;
+}
+
+// Receipt first, then the body once the whole receipt is queued
+static err_t pump_reply(store_connection_t *conn, struct tcp_pcb *tpcb) {
+    err_t err;
+
+    if (!conn->replying) {
+        return ERR_OK;
+    }
+    err = ddr4_echo_pump(&conn->head, tpcb);
+    if (err != ERR_OK || conn->head.queued < FRAME_RECEIPT_SIZE) {
+        return err;
+    }
+    return ddr4_echo_pump(&conn->body, tpcb);
+}
+
+// ACKs cover the receipt before the body. A fully ACK'd GET unpins its
+// object and lets the next command in.
+static void reply_acked(store_connection_t *conn, u16_t len) {
+    u16_t n;
+
+    if (!conn->replying) {
+        return;
+    }
+    n = (u16_t)LWIP_MIN(len, conn->head.queued - conn->head.acked);
+    if (n > 0) {
+        ddr4_echo_acked(&conn->head, n);
+        len -= n;
+    }
+    n = (u16_t)LWIP_MIN(len, conn->body.queued - conn->body.acked);
+    if (n > 0) {
+        ddr4_echo_acked(&conn->body, n);
+    }
+
+    if (conn->head.acked == FRAME_RECEIPT_SIZE && conn->body.acked == conn->range_len) {
+        release_object(conn);
+        conn->replying = 0;
+        conn->op = OP_NONE;
+    }
+}
+
+// Parse held input up to the next command that has to wait, credit what
+// was parsed and send the reply
+static err_t process_input(store_connection_t *conn, struct tcp_pcb *tpcb) {
+    u32_t used;
+    err_t err;
+
+    if (conn->pending) {
+        err = frame_parser_input(&conn->parser, conn->pending, &used);
+        pbuf_iov_consume(&conn->pending, used);
+    } else {
+        // A GET header may be waiting for the previous reply
+        err = frame_parser_feed(&conn->parser, NULL, 0, &used);
+    }
+    if (err != ERR_OK && err != ERR_WOULDBLOCK) {
+        return err;
+    }
+
+    pbuf_iov_recved(tpcb, conn->parser.header_bytes - conn->header_credited + conn->payload_credit);
+    conn->header_credited = conn->parser.header_bytes;
+    conn->payload_credit = 0;
+
+    return pump_reply(conn, tpcb);
+}
+
+static int connection_done(const store_connection_t *conn) {
+    return conn->closing && conn->pending == NULL && !conn->replying;
+}
+
+static void close_connection(store_connection_t *conn, struct tcp_pcb *tpcb) {
+    xil_printf("Connection closed after %lu puts, %lu gets\n\r",
+               (unsigned long)conn->puts, (unsigned long)conn->gets);
+    ddr4_store_report();
+    conn_metrics_report(&conn->metrics);
+    conn_watchdog_report(&conn->wd);
+    tcp_arg(tpcb, NULL);
+    tcp_sent(tpcb, NULL);
+    tcp_recv(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_poll(tpcb, NULL, 0);
+    tcp_close(tpcb);
+    free_connection(conn);
+}
+
+err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    store_connection_t *conn = (store_connection_t *)arg;
+
+    if (!conn) {
+        return ERR_ARG;
+    }
+
+    // A finished reply lets the held command in
+    reply_acked(conn, len);
+    if (process_input(conn, tpcb) != ERR_OK) {
+        xil_printf("Reply failed, aborting connection\n\r");
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    if (connection_done(conn)) {
+        close_connection(conn, tpcb);
+    }
+    return ERR_OK;
+}
+
+void err_callback(void *arg, err_t err) {
+    store_connection_t *conn = (store_connection_t *)arg;
+
+    // The PCB is already freed
+    if (conn) {
+        TRACE_ERR(TRACE_EV_ERROR, err, conn->parser.frames);
+        free_connection(conn);
+    }
+}
+
+err_t poll_callback(void *arg, struct tcp_pcb *tpcb) {
+    store_connection_t *conn = (store_connection_t *)arg;
+    u8_t pending;
+
+    if (!conn) {
+        return ERR_OK;
+    }
+
+    conn_metrics_sample(&conn->metrics);
+
+    // Evict a client that stopped sending and ACKing; its object pin goes too
+    pending = conn->pending != NULL || conn->replying;
+    if (conn_watchdog_check(&conn->wd, conn->metrics.bytes_in + conn->metrics.bytes_out, pending) ==
+        CONN_WATCHDOG_EXPIRED) {
+        conn_watchdog_evict(&conn->wd);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    // Resume a parked reply if no ACK arrived to do it
+    if (process_input(conn, tpcb) != ERR_OK) {
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    store_connection_t *conn = (store_connection_t *)arg;
+
+    if (!conn || err != ERR_OK) {
+        if (p) pbuf_free(p);
+        return ERR_ARG;
+    }
+
+    // Client is done sending; close once the last reply is ACK'd
+    if (!p) {
+        conn->closing = 1;
+
+        // An upload cut short is not kept
+        if (conn->parser.in_frame) {
+            xil_printf("Client closed inside a PUT (%lu of %lu bytes), object dropped\n\r",
+                       (unsigned long)conn->stored, (unsigned long)conn->parser.header.length);
+            release_object(conn);
+            conn->parser.in_frame = 0;
+            conn->op = OP_NONE;
+        }
+        if (connection_done(conn)) {
+            close_connection(conn, tpcb);
+        }
+        return ERR_OK;
+    }
+
+    conn_metrics_on_recv(&conn->metrics, p->tot_len);
+
+    // Queue behind a command still waiting for its turn
+    pbuf_iov_append(&conn->pending, p);
+
+    err = process_input(conn, tpcb);
+    if (err != ERR_OK) {
+        xil_printf("Command stream error %d after %lu commands, aborting\n\r", err,
+                   (unsigned long)conn->parser.frames);
+        TRACE_ERR(TRACE_EV_ERROR, err, conn->parser.frames);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    store_connection_t *conn;
+    conn_reject_t reason;
+
+    if (err != ERR_OK || newpcb == NULL) {
+        return ERR_VAL;
+    }
+
+    // Admission control before anything else is allocated
+    conn = (store_connection_t *)conn_pool_acquire(&connections, &reason);
+    if (!conn) {
+        xil_printf("Connection rejected: %s (%d/%d in use)\n\r",
+                   conn_pool_reason(reason), connections.in_use, connections.limit);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+    conn->pcb = newpcb;
+    frame_parser_init(&conn->parser, command_begin, command_data, command_end, conn);
+    ddr4_cache_init(&conn->cache, DDR4_CACHE_DEFAULT_THRESHOLD);
+    conn_metrics_open(&conn->metrics);
+    conn_watchdog_init(&conn->wd, CONN_WATCHDOG_IDLE_POLLS);
+
+    tcp_arg(newpcb, conn);
+    tcp_recv(newpcb, recv_callback);
+    tcp_sent(newpcb, sent_callback);
+    tcp_err(newpcb, err_callback);
+    tcp_poll(newpcb, poll_callback, CONN_WATCHDOG_POLL_INTERVAL);
+
+    // Disable Nagle's algorithm for low latency
+    tcp_nagle_disable(newpcb);
+
+    xil_printf("New object store connection\n\r");
+    return ERR_OK;
+}
+
+// Main-loop hook: format trace records while the link is quiet
+int transfer_data() {
+    trace_log_drain(TRACE_DRAIN_BATCH);
+    return 0;
+}
+
+int start_application()
+{
+    struct tcp_pcb *pcb;
+    err_t err;
+
+    init_ddr_memory();
+    conn_pool_init(&connections, CONN_POOL_MAX_CONNECTIONS);
+    if (ddr4_store_init() != ERR_OK) {
+        return -1;
+    }
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        xil_printf("Error creating PCB. Out of Memory\n\r");
+        return -1;
+    }
+
+    err = tcp_bind(pcb, IP_ANY_TYPE, SERVER_PORT);
+    if (err != ERR_OK) {
+        xil_printf("Unable to bind to port %d: err = %d\n\r", SERVER_PORT, err);
+        return -2;
+    }
+
+    pcb = tcp_listen(pcb);
+    if (!pcb) {
+        xil_printf("Out of memory while tcp_listen\n\r");
+        return -3;
+    }
+
+    tcp_accept(pcb, accept_callback);
+    conn_metrics_server_init(CONN_METRICS_PORT);
+
+    xil_printf("TCP object store server started @ port %d\n\r", SERVER_PORT);
+    xil_printf("Using DDR4 at 0x%08x, up to %d objects, LRU eviction\n\r",
+               DDR4_IMAGE_BUFFER_START_ADDR, DDR4_STORE_MAX_OBJECTS);
+    return 0;
+}
@@ -0,0 +1,116 @@
+import socket
+import struct
+import os
+import time
+from frame_digest import crc32c_update
+
+# --- Configuration ---
+SERVER_IP = '192.168.1.10'  # Replace with your FPGA's IP address
+SERVER_PORT = 6001
+OBJECT_SIZE = 8 * 1024 * 1024
+OBJECT_ID = 0               # 0 = let the board assign one
+CHUNK_SIZE = 64 * 1024
+IMAGE_FILE = None           # Upload this file instead of random data
+GETS = 3                    # Whole-object downloads, to time the TX-only path
+
+FLAG_STORE_PUT = 0x80
+FLAG_STORE_GET = 0x100
+
+RECEIPT_MAGIC = 0x4F424A31
+RECEIPT_SIZE = 24
+STATUS_NAMES = ['ok', 'not found', 'no space', 'busy', 'bad range']
+
+
+def pack_header(flags, length, object_id, offset=0, total=0):
+    """40-byte v2 header: marker, version, header length, flags, u64 length, seq, stream id, u64 offset, u64 total."""
+    return struct.pack('>BBHIQIIQQ', 0xFF, 2, 40, flags, length, 0, object_id, offset, total)
+
+
+def recv_exact(sock, n):
+    buf = bytearray()
+    while len(buf) < n:
+        chunk = sock.recv(min(n - len(buf), 1 << 20))
+        if not chunk:
+            raise ConnectionError(f"Server closed after {len(buf)} of {n} bytes")
+        buf += chunk
+    return bytes(buf)
+
+
+def recv_receipt(sock):
+    """Returns (status, object id, crc32c, length)."""
+    magic, status, object_id, crc, length = struct.unpack('>IIIIQ', recv_exact(sock, RECEIPT_SIZE))
+    if magic != RECEIPT_MAGIC:
+        raise ValueError(f"Bad receipt magic {magic:08x}")
+    return status, object_id, crc, length
+
+
+def status_name(status):
+    return STATUS_NAMES[status] if status < len(STATUS_NAMES) else str(status)
+
+
+def put(sock, data, object_id):
+    sock.sendall(pack_header(FLAG_STORE_PUT, len(data), object_id))
+    view = memoryview(data)
+    for pos in range(0, len(data), CHUNK_SIZE):
+        sock.sendall(view[pos:pos + CHUNK_SIZE])
+    return recv_receipt(sock)
+
+
+def get(sock, object_id, offset=0, total=0):
+    """Returns (receipt, body); body is empty unless the status is ok."""
+    sock.sendall(pack_header(FLAG_STORE_GET, 0, object_id, offset, total))
+    receipt = recv_receipt(sock)
+    body = recv_exact(sock, receipt[3]) if receipt[0] == 0 else b''
+    return receipt, body
+
+
+def run_client():
+    if IMAGE_FILE:
+        with open(IMAGE_FILE, 'rb') as f:
+            data = f.read()
+    else:
+        data = os.urandom(OBJECT_SIZE)
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.connect((SERVER_IP, SERVER_PORT))
+    print(f"Connected to object store at {SERVER_IP}:{SERVER_PORT}")
+    ok = True
+
+    start = time.time()
+    status, object_id, crc, length = put(sock, data, OBJECT_ID)
+    elapsed = time.time() - start
+    expect = crc32c_update(0, data)
+    if status != 0 or crc != expect or length != len(data):
+        print(f"PUT failed: {status_name(status)}, crc {crc:08x} (expected {expect:08x}), {length} bytes")
+        sock.close()
+        return False
+    print(f"PUT {len(data)} bytes as object {object_id} in {elapsed:.2f} s "
+          f"({len(data) * 8 / elapsed / 1e6:.2f} Mbps), crc {crc:08x}")
+
+    for i in range(GETS):
+        start = time.time()
+        (status, _, _, length), body = get(sock, object_id)
+        elapsed = time.time() - start
+        match = status == 0 and body == data
+        ok = ok and match
+        print(f"GET {i}: {status_name(status)}, {length} bytes in {elapsed:.2f} s "
+              f"({length * 8 / max(elapsed, 1e-9) / 1e6:.2f} Mbps) {'ok' if match else 'MISMATCH'}")
+
+    # A range from the middle, then one past the end
+    offset, total = len(data) // 3, min(len(data) // 3, 1024 * 1024)
+    (status, _, _, length), body = get(sock, object_id, offset, total)
+    match = status == 0 and body == data[offset:offset + total]
+    ok = ok and match
+    print(f"GET range {offset}+{total}: {status_name(status)}, {length} bytes {'ok' if match else 'MISMATCH'}")
+
+    (status, _, _, _), _ = get(sock, object_id, len(data) + 1)
+    ok = ok and status == 4
+    print(f"GET past the end: {status_name(status)}")
+
+    sock.close()
+    print(f"Object store {'ok' if ok else 'FAILED'}")
+    return ok
+
+
+if __name__ == "__main__":
+    run_client()
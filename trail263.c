@@ -0,0 +1,388 @@
+/******************************************************************************
+* Frame Fan-out Server: one producer, up to 12 viewers, one DDR4 copy
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* The first connection that sends a frame is the producer (trail06_3jpeg.py
+* or any frame client). A connection whose first header is a v2 header with
+* FRAME_FLAG_SUBSCRIBE is a viewer: from then on it is sent every frame it
+* can keep up with, each behind a 24-byte v2 header (trail263.py). Frames
+* are stored once in a ring of DDR4 slots and sent to every viewer from
+* there (ddr4_fanout.h); a slow viewer skips to the newest frame instead of
+* slowing the producer down.
+*
+* The producer is echoed its own frames, payload only, as the echo servers
+* do, so the webcam client keeps its preview. v2 frames with
+* FRAME_FLAG_BENCH_SINK opt out of that echo.
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "lwip/err.h"
+#include "lwip/tcp.h"
+#include "xil_printf.h"
+#include "xil_cache.h"
+#include "xil_exception.h"
+#include "ddr4_arena.h"
+#include "ddr4_cache.h"
+#include "ddr4_fanout.h"
+#include "conn_pool.h"
+#include "conn_watchdog.h"
+#include "pbuf_iov.h"
+#include "trace_log.h"
+#include "conn_metrics.h"
+#include "frame_parser.h"
+
+#define SERVER_PORT 6001
+#define DDR4_IMAGE_BUFFER_START_ADDR 0x90000000
+#define FRAME_SLOT_SIZE (4 * 1024 * 1024)    // Largest frame accepted, with its header
+#define ECHO_MODE DDR4_ECHO_ZERO_COPY        // Send straight from DDR4, no lwIP heap copy
+
+#define ROLE_NONE       0
+#define ROLE_PRODUCER   1
+#define ROLE_SUBSCRIBER 2
+
+typedef struct {
+    frame_parser_t parser; // Frame boundaries across pbufs
+    u8_t role;
+    ddr4_fanout_sub_t *sub; // Frames going out: a viewer, or the producer's echo
+    u32_t stream_id;       // Producer's v2 stream id, passed on to viewers
+    u32_t header_credited; // Header bytes returned to the receive window
+    u32_t payload_credit;  // Payload parsed but not yet credited
+    struct pbuf *pending;  // Input not yet parsed (no free slot)
+    conn_metrics_t metrics; // Counters served on CONN_METRICS_PORT
+    conn_watchdog_t wd;    // Stall and idle supervision from tcp_poll
+    struct tcp_pcb *pcb;   // Connection PCB
+    u8_t closing;          // Client closed its side
+} fanout_connection_t;
+
+// Connection slots, acquired in accept_callback
+CONN_POOL_DECLARE(connections, fanout_connection_t, CONN_POOL_MAX_CONNECTIONS);
+
+static ddr4_fanout_t fanout;
+static fanout_connection_t *producer;
+
+void init_ddr_memory() {
+    Xil_DCacheFlush();
+    Xil_ICacheInvalidate();
+    ddr4_arena_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    ddr4_cache_region_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    trace_log_init();
+    xil_printf("DDR4 Memory initialized at 0x%08x\n\r", DDR4_IMAGE_BUFFER_START_ADDR);
+}
+
+// Frames in flight are dropped with the subscription: only after they are
+// ACK'd or the PCB is aborted
+static void free_connection(fanout_connection_t *conn) {
+    if (conn->pending) {
+        pbuf_free(conn->pending);
+    }
+    if (conn->sub) {
+        ddr4_fanout_unsubscribe(&fanout, conn->sub);
+    }
+    if (producer == conn) {
+        ddr4_fanout_abandon(&fanout);
+        producer = NULL;
+    }
+    conn_metrics_close(&conn->metrics);
+    conn_pool_release(&connections, conn);
+}
+
+static void abort_connection(fanout_connection_t *conn, struct tcp_pcb *tpcb) {
+    free_connection(conn);
+    tcp_arg(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_abort(tpcb);
+}
+
+// Parser callbacks: a subscribe command, or a frame from the producer
+static err_t frame_begin(void *arg, const frame_header_t *hdr) {
+    fanout_connection_t *conn = (fanout_connection_t *)arg;
+    err_t err;
+
+    if (hdr->version == 2 && (hdr->flags & FRAME_FLAG_SUBSCRIBE)) {
+        if (conn->role != ROLE_NONE || hdr->length != 0) {
+            xil_printf("Unexpected subscribe command\n\r");
+            return ERR_VAL;
+        }
+        conn->sub = ddr4_fanout_subscribe(&fanout, conn->pcb, 0, &conn->metrics);
+        if (!conn->sub) {
+            xil_printf("Subscriber rejected: %d viewers already\n\r", fanout.subscribers);
+            return ERR_MEM;
+        }
+        conn->role = ROLE_SUBSCRIBER;
+        xil_printf("New viewer, %d subscribed\n\r", fanout.subscribers);
+        return ERR_OK;
+    }
+
+    if (conn->role == ROLE_SUBSCRIBER) {
+        xil_printf("Viewer sent a frame\n\r");
+        return ERR_VAL;
+    }
+    if (conn->role == ROLE_NONE) {
+        if (producer) {
+            xil_printf("Second producer rejected\n\r");
+            return ERR_VAL;
+        }
+        producer = conn;
+        conn->role = ROLE_PRODUCER;
+        conn->stream_id = hdr->stream_id;
+        if (!(hdr->version == 2 && (hdr->flags & FRAME_FLAG_BENCH_SINK))) {
+            conn->sub = ddr4_fanout_subscribe(&fanout, conn->pcb, 1, &conn->metrics);
+        }
+        xil_printf("New producer%s\n\r", conn->sub ? ", echoing its frames" : "");
+    }
+
+    err = ddr4_fanout_begin(&fanout, (hdr->length > 0xFFFFFFFFu) ? 0xFFFFFFFFu : (u32_t)hdr->length);
+    if (err == ERR_VAL) {
+        xil_printf("Frame of %lu KB exceeds the %d byte slot\n\r", (unsigned long)(hdr->length / 1024),
+                   FRAME_SLOT_SIZE);
+    }
+    return err;
+}
+
+static err_t frame_data(void *arg, const u8_t *data, u32_t len) {
+    fanout_connection_t *conn = (fanout_connection_t *)arg;
+
+    // Credited as stored: viewers never hold the producer back
+    ddr4_fanout_write(&fanout, data, len);
+    conn->payload_credit += len;
+    return ERR_OK;
+}
+
+static err_t frame_end(void *arg) {
+    fanout_connection_t *conn = (fanout_connection_t *)arg;
+
+    if (conn->role == ROLE_PRODUCER) {
+        ddr4_fanout_publish(&fanout, conn->stream_id);
+    }
+    return ERR_OK;
+}
+
+// Parse held input, credit it and send whatever this connection is owed
+static err_t process_input(fanout_connection_t *conn, struct tcp_pcb *tpcb) {
+    u32_t used;
+    err_t err;
+
+    if (conn->pending) {
+        err = frame_parser_input(&conn->parser, conn->pending, &used);
+        pbuf_iov_consume(&conn->pending, used);
+    } else {
+        // A header may be waiting for a slot with no payload behind it yet
+        err = frame_parser_feed(&conn->parser, NULL, 0, &used);
+    }
+    if (err != ERR_OK && err != ERR_WOULDBLOCK) {
+        return err;
+    }
+
+    pbuf_iov_recved(tpcb, conn->parser.header_bytes - conn->header_credited + conn->payload_credit);
+    conn->header_credited = conn->parser.header_bytes;
+    conn->payload_credit = 0;
+
+    return conn->sub ? ddr4_fanout_pump(&fanout, conn->sub) : ERR_OK;
+}
+
+static int connection_done(const fanout_connection_t *conn) {
+    return conn->closing && conn->pending == NULL && (conn->sub == NULL || conn->sub->count == 0);
+}
+
+static void close_connection(fanout_connection_t *conn, struct tcp_pcb *tpcb) {
+    if (conn->sub) {
+        ddr4_fanout_sub_report(conn->sub);
+    }
+    if (conn->role == ROLE_PRODUCER) {
+        ddr4_fanout_report(&fanout);
+    }
+    conn_metrics_report(&conn->metrics);
+    conn_watchdog_report(&conn->wd);
+    tcp_arg(tpcb, NULL);
+    tcp_sent(tpcb, NULL);
+    tcp_recv(tpcb, NULL);
+    tcp_err(tpcb, NULL);
+    tcp_poll(tpcb, NULL, 0);
+    tcp_close(tpcb);
+    free_connection(conn);
+}
+
+err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    fanout_connection_t *conn = (fanout_connection_t *)arg;
+
+    if (!conn) {
+        return ERR_ARG;
+    }
+
+    // Fully ACK'd frames free their slots; take the newest one
+    if (conn->sub) {
+        ddr4_fanout_acked(&fanout, conn->sub, len);
+    }
+    if (process_input(conn, tpcb) != ERR_OK) {
+        xil_printf("Frame send failed, aborting connection\n\r");
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    if (connection_done(conn)) {
+        close_connection(conn, tpcb);
+    }
+    return ERR_OK;
+}
+
+void err_callback(void *arg, err_t err) {
+    fanout_connection_t *conn = (fanout_connection_t *)arg;
+
+    // The PCB is already freed
+    if (conn) {
+        TRACE_ERR(TRACE_EV_ERROR, err, conn->parser.frames);
+        free_connection(conn);
+    }
+}
+
+err_t poll_callback(void *arg, struct tcp_pcb *tpcb) {
+    fanout_connection_t *conn = (fanout_connection_t *)arg;
+    u8_t pending;
+
+    if (!conn) {
+        return ERR_OK;
+    }
+
+    conn_metrics_sample(&conn->metrics);
+
+    // A viewer that stopped ACKing pins its slots until it is evicted
+    pending = conn->pending != NULL || (conn->sub != NULL && conn->sub->count > 0);
+    if (conn_watchdog_check(&conn->wd, conn->metrics.bytes_in + conn->metrics.bytes_out, pending) ==
+        CONN_WATCHDOG_EXPIRED) {
+        conn_watchdog_evict(&conn->wd);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+
+    // Resume a parked send, or held producer input, if nothing else did
+    if (process_input(conn, tpcb) != ERR_OK) {
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    fanout_connection_t *conn = (fanout_connection_t *)arg;
+
+    if (!conn || err != ERR_OK) {
+        if (p) pbuf_free(p);
+        return ERR_ARG;
+    }
+
+    // Client is done sending; close once the frames in flight are ACK'd
+    if (!p) {
+        conn->closing = 1;
+        if (conn->sub) {
+            conn->sub->stopped = 1;
+        }
+        if (conn->parser.in_frame) {
+            xil_printf("Producer closed inside a frame, frame dropped\n\r");
+            ddr4_fanout_abandon(&fanout);
+            conn->parser.in_frame = 0;
+        }
+        if (producer == conn) {
+            producer = NULL;
+        }
+        if (connection_done(conn)) {
+            close_connection(conn, tpcb);
+        }
+        return ERR_OK;
+    }
+
+    conn_metrics_on_recv(&conn->metrics, p->tot_len);
+
+    // Queue behind anything still waiting for a slot
+    pbuf_iov_append(&conn->pending, p);
+
+    err = process_input(conn, tpcb);
+    if (err != ERR_OK) {
+        xil_printf("Frame stream error %d after %lu frames, aborting\n\r", err,
+                   (unsigned long)conn->parser.frames);
+        TRACE_ERR(TRACE_EV_ERROR, err, conn->parser.frames);
+        abort_connection(conn, tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    fanout_connection_t *conn;
+    conn_reject_t reason;
+
+    if (err != ERR_OK || newpcb == NULL) {
+        return ERR_VAL;
+    }
+
+    // Admission control before anything else is allocated
+    conn = (fanout_connection_t *)conn_pool_acquire(&connections, &reason);
+    if (!conn) {
+        xil_printf("Connection rejected: %s (%d/%d in use)\n\r",
+                   conn_pool_reason(reason), connections.in_use, connections.limit);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+    conn->pcb = newpcb;
+    frame_parser_init(&conn->parser, frame_begin, frame_data, frame_end, conn);
+    conn_metrics_open(&conn->metrics);
+    conn_watchdog_init(&conn->wd, CONN_WATCHDOG_IDLE_POLLS);
+
+    tcp_arg(newpcb, conn);
+    tcp_recv(newpcb, recv_callback);
+    tcp_sent(newpcb, sent_callback);
+    tcp_err(newpcb, err_callback);
+    tcp_poll(newpcb, poll_callback, CONN_WATCHDOG_POLL_INTERVAL);
+
+    // Disable Nagle's algorithm for low latency
+    tcp_nagle_disable(newpcb);
+    return ERR_OK;
+}
+
+// Main-loop hook: format trace records while the link is quiet
+int transfer_data() {
+    trace_log_drain(TRACE_DRAIN_BATCH);
+    return 0;
+}
+
+int start_application()
+{
+    struct tcp_pcb *pcb;
+    err_t err;
+
+    init_ddr_memory();
+    conn_pool_init(&connections, CONN_POOL_MAX_CONNECTIONS);
+    if (ddr4_fanout_init(&fanout, FRAME_SLOT_SIZE, ECHO_MODE) != ERR_OK) {
+        xil_printf("No DDR4 space for %d frame slots\n\r", DDR4_FANOUT_SLOTS);
+        return -1;
+    }
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        xil_printf("Error creating PCB. Out of Memory\n\r");
+        return -1;
+    }
+
+    err = tcp_bind(pcb, IP_ANY_TYPE, SERVER_PORT);
+    if (err != ERR_OK) {
+        xil_printf("Unable to bind to port %d: err = %d\n\r", SERVER_PORT, err);
+        return -2;
+    }
+
+    pcb = tcp_listen(pcb);
+    if (!pcb) {
+        xil_printf("Out of memory while tcp_listen\n\r");
+        return -3;
+    }
+
+    tcp_accept(pcb, accept_callback);
+    conn_metrics_server_init(CONN_METRICS_PORT);
+
+    xil_printf("TCP frame fan-out server started @ port %d\n\r", SERVER_PORT);
+    xil_printf("Using DDR4 at 0x%08x, %d slots of %d MB, up to %d viewers\n\r",
+               DDR4_IMAGE_BUFFER_START_ADDR, DDR4_FANOUT_SLOTS, FRAME_SLOT_SIZE / (1024 * 1024),
+               DDR4_FANOUT_MAX_SUBSCRIBERS);
+    return 0;
+}
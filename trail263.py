@@ -0,0 +1,86 @@
+import socket
+import struct
+import time
+
+# --- Configuration ---
+SERVER_IP = '192.168.1.10'  # Replace with your FPGA's IP address
+SERVER_PORT = 6001
+SHOW = True                 # Display frames as JPEG (needs OpenCV), else just count them
+REPORT_EVERY = 2.0          # Seconds between rate reports
+
+FLAG_SUBSCRIBE = 0x200
+HEADER_SIZE = 24
+
+
+def recv_exact(sock, n):
+    buf = bytearray()
+    while len(buf) < n:
+        chunk = sock.recv(n - len(buf))
+        if not chunk:
+            raise ConnectionError("Server closed connection")
+        buf += chunk
+    return bytes(buf)
+
+
+def run_viewer():
+    """Subscribe to the fan-out server and receive frames until interrupted.
+
+    Each frame comes behind a 24-byte v2 header: marker, version, header
+    length, flags, u64 length, sequence, stream id. A jump in sequence means
+    the board skipped frames because this viewer fell behind.
+    """
+    if SHOW:
+        import cv2
+        import numpy as np
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.connect((SERVER_IP, SERVER_PORT))
+    sock.sendall(struct.pack('>BBHIQII', 0xFF, 2, HEADER_SIZE, FLAG_SUBSCRIBE, 0, 0, 0))
+    print(f"Subscribed to {SERVER_IP}:{SERVER_PORT}")
+
+    frames = skipped = 0
+    total_bytes = 0
+    last_seq = None
+    window_start, window_frames, window_bytes = time.time(), 0, 0
+    try:
+        while True:
+            marker, version, hlen, flags, length, seq, stream_id = struct.unpack(
+                '>BBHIQII', recv_exact(sock, HEADER_SIZE))
+            if marker != 0xFF or version != 2 or hlen != HEADER_SIZE:
+                raise ValueError("Bad frame header")
+            data = recv_exact(sock, length)
+
+            if last_seq is not None and seq != last_seq + 1:
+                skipped += seq - last_seq - 1
+            last_seq = seq
+            frames += 1
+            total_bytes += length
+            window_frames += 1
+            window_bytes += length
+
+            if SHOW:
+                image = cv2.imdecode(np.frombuffer(data, dtype=np.uint8), cv2.IMREAD_COLOR)
+                if image is not None:
+                    cv2.imshow("Fan-out viewer", image)
+                if cv2.waitKey(1) == 27:  # ESC key to exit
+                    break
+
+            now = time.time()
+            if now - window_start >= REPORT_EVERY:
+                elapsed = now - window_start
+                print(f"Frame {seq}: {window_frames / elapsed:.1f} fps, "
+                      f"{window_bytes * 8 / elapsed / 1e6:.2f} Mbps, {skipped} skipped so far")
+                window_start, window_frames, window_bytes = now, 0, 0
+    except KeyboardInterrupt:
+        pass
+    except Exception as e:
+        print(f"Viewer error: {e}")
+    finally:
+        sock.close()
+        if SHOW:
+            cv2.destroyAllWindows()
+        print(f"Viewer done: {frames} frames, {total_bytes} bytes, {skipped} skipped")
+
+
+if __name__ == "__main__":
+    run_viewer()
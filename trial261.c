@@ -10,28 +10,62 @@
 #include "xil_printf.h"
 #include "xil_cache.h"
 #include "xil_exception.h"
+#include "ddr4_arena.h"
+#include "ddr4_cache.h"
+#include "conn_pool.h"
+#include "conn_watchdog.h"
+#include "pbuf_iov.h"
+#include "trace_log.h"
+#include "conn_metrics.h"
+#include "ddr4_echo.h"
+#include "frame_parser.h"
 
 #define SERVER_PORT 6001
 #define MAX_IMAGE_SIZE (512 * 1024 * 1024) // 512MB
 #define DDR4_IMAGE_BUFFER_START_ADDR 0x90000000
-#define HEADER_SIZE 4
+#define ECHO_MODE DDR4_ECHO_ZERO_COPY // Default, v2 header flags can override it
 
 typedef struct {
     u32_t buffer_addr;     // DDR4 memory address
     u32_t received_bytes;  // Total bytes received and stored
     u32_t file_size;       // Expected file size
-    u32_t echoed_bytes;    // Bytes already echoed back from DDR4
+    ddr4_echo_t echo;      // Echo cursor over the DDR4 copy
+    conn_metrics_t metrics; // Counters served on CONN_METRICS_PORT
+    conn_watchdog_t wd;    // Stall and idle supervision from tcp_poll
     struct tcp_pcb *pcb;   // Connection PCB
+    ddr4_extent_t *extent; // DDR4 region owned by this upload
+    ddr4_cache_t cache;    // Dirty DDR4 span not yet flushed
+    struct pbuf *held;     // Partial header, waiting for the rest
     u8_t header_received;  // Flag for size header
     u8_t closing;          // Connection closing flag
+    u8_t verify;           // FRAME_FLAG_VERIFY: reply with a digest, no echo
+    u32_t crc;             // Running CRC32C of the stored bytes (verify mode)
+    u8_t digest[FRAME_DIGEST_SIZE];
 } image_connection_t;
 
+// Connection slots, acquired in accept_callback
+CONN_POOL_DECLARE(connections, image_connection_t, CONN_POOL_MAX_CONNECTIONS);
+
 void init_ddr_memory() {
     Xil_DCacheFlush();
     Xil_ICacheInvalidate();
+    ddr4_arena_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    ddr4_cache_region_init(DDR4_IMAGE_BUFFER_START_ADDR, DDR4_ARENA_SIZE);
+    trace_log_init();
     xil_printf("DDR4 Memory initialized at 0x%08x\n\r", DDR4_IMAGE_BUFFER_START_ADDR);
 }
 
+// Return the connection's DDR4 extent to the arena and free the struct
+static void free_connection(image_connection_t *conn) {
+    tx_batch_cancel(&conn->echo.tx);
+    conn_metrics_close(&conn->metrics);
+    if (conn->held) {
+        pbuf_free(conn->held);
+    }
+    ddr4_arena_free(conn->extent);
+    conn_pool_release(&connections, conn);
+}
+
 err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
     image_connection_t *conn = (image_connection_t *)arg;
     
@@ -39,26 +73,82 @@ err_t sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len) {
         return ERR_ARG;
     }
     
-    // Update echoed bytes count
-    conn->echoed_bytes += len;
-    xil_printf("Sent %d bytes from DDR4 (total echoed: %d)\n\r", len, conn->echoed_bytes);
+    // ACK'd bytes are no longer pinned in DDR4
+    ddr4_echo_acked(&conn->echo, len);
+    
+    // Room in the send buffer again: resume a parked echo
+    if (ddr4_echo_pump(&conn->echo, tpcb) != ERR_OK) {
+        xil_printf("Echo failed, aborting connection\n\r");
+        free_connection(conn);
+        tcp_arg(tpcb, NULL);
+        tcp_abort(tpcb);
+        return ERR_ABRT;
+    }
     
     // Check if we should close the connection
-    if (conn->closing && conn->echoed_bytes >= conn->received_bytes) {
+    if (conn->closing && conn->echo.acked >= conn->received_bytes) {
         xil_printf("All data echoed from DDR4, closing connection\n\r");
+        ddr4_echo_report(&conn->echo);
+        conn_metrics_report(&conn->metrics);
+        conn_watchdog_report(&conn->wd);
         tcp_arg(tpcb, NULL);
         tcp_sent(tpcb, NULL);
         tcp_recv(tpcb, NULL);
+        tcp_err(tpcb, NULL);
         tcp_close(tpcb);
-        mem_free(conn);
+        free_connection(conn);
     }
     
     return ERR_OK;
 }
 
+void err_callback(void *arg, err_t err) {
+    image_connection_t *conn = (image_connection_t *)arg;
+
+    // The PCB is already freed, only the slot and extent are left
+    if (conn) {
+        TRACE_ERR(TRACE_EV_ERROR, err, conn->received_bytes);
+        free_connection(conn);
+    }
+}
+
+err_t poll_callback(void *arg, struct tcp_pcb *tpcb) {
+    image_connection_t *conn = (image_connection_t *)arg;
+    u8_t pending;
+
+    if (!conn) {
+        return ERR_OK;
+    }
+
+    // Rates are sampled here rather than per pbuf
+    conn_metrics_sample(&conn->metrics);
+
+    // Evict a client that stopped sending and ACKing, with its extent
+    pending = conn->header_received && ddr4_echo_pending(&conn->echo) > 0;
+    if (conn_watchdog_check(&conn->wd, conn->metrics.bytes_in + conn->echo.acked, pending) == CONN_WATCHDOG_EXPIRED) {
+        conn_watchdog_evict(&conn->wd);
+        free_connection(conn);
+        tcp_arg(tpcb, NULL);
+        tcp_abort(tpcb);
+        return ERR_ABRT;
+    }
+
+    // Resume a parked echo if no ACK arrived to do it, otherwise push
+    // whatever Nagle still holds
+    if (conn->header_received && ddr4_echo_poll(&conn->echo, tpcb) != ERR_OK) {
+        xil_printf("Echo failed, aborting connection\n\r");
+        free_connection(conn);
+        tcp_arg(tpcb, NULL);
+        tcp_abort(tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
 err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 {
     image_connection_t *conn = (image_connection_t *)arg;
+    u32_t skip = 0, len;
     
     if (!conn || err != ERR_OK) {
         if (p) pbuf_free(p);
@@ -67,109 +157,140 @@ err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 
     // Handle connection closure
     if (!p) {
-        if (conn->echoed_bytes < conn->received_bytes) {
+        if (!conn->verify && conn->echo.acked < conn->received_bytes) {
             // Still have data to echo back from DDR4
             conn->closing = 1;
             xil_printf("Client closed connection, echoing remaining data from DDR4\n\r");
             
-            // Echo any remaining data stored in DDR4
-            u32_t remaining = conn->received_bytes - conn->echoed_bytes;
-            err_t err = tcp_write(tpcb, (void*)(conn->buffer_addr + conn->echoed_bytes), 
-                                remaining, TCP_WRITE_FLAG_COPY);
+            // Queue what fits now, sent_callback drains the rest
+            err_t err = ddr4_echo_pump(&conn->echo, tpcb);
             if (err != ERR_OK) {
                 xil_printf("Failed to queue remaining echo: %d\n\r", err);
-            } else {
-                tcp_output(tpcb);
             }
         } else {
             // All data echoed back, close immediately
             xil_printf("Connection closed. Total bytes stored: %d\n\r", conn->received_bytes);
+            ddr4_echo_report(&conn->echo);
+            conn_metrics_report(&conn->metrics);
+            conn_watchdog_report(&conn->wd);
             tcp_arg(tpcb, NULL);
             tcp_sent(tpcb, NULL);
             tcp_recv(tpcb, NULL);
+            tcp_err(tpcb, NULL);
             tcp_close(tpcb);
-            mem_free(conn);
+            free_connection(conn);
         }
         return ERR_OK;
     }
 
+    conn_metrics_on_recv(&conn->metrics, p->tot_len);
+
     // Handle file size header if not yet received
     if (!conn->header_received) {
-        if (p->tot_len < HEADER_SIZE) {
+        frame_header_t hdr;
+        err_t herr;
+
+        // Keep a partial header until the rest arrives; not credited yet
+        if (conn->held) {
+            pbuf_cat(conn->held, p);
+            p = conn->held;
+            conn->held = NULL;
+        }
+        herr = frame_header_from_pbuf(p, &hdr);
+        if (herr == ERR_INPROGRESS) {
             xil_printf("Waiting for more header data...\n\r");
+            conn->held = p;
             return ERR_OK;
         }
 
-        // Extract file size from header
-        u8_t *header = p->payload;
-        conn->file_size = (header[0] << 24) | (header[1] << 16) | 
-                         (header[2] << 8) | header[3];
-        
-        conn->buffer_addr = DDR4_IMAGE_BUFFER_START_ADDR;
-        conn->header_received = 1;
-        xil_printf("Expected file size: %d bytes\n\r", conn->file_size);
+        // Legacy 4-byte or v2 header, see frame_parser.h
+        conn->file_size = (u32_t)hdr.length;
         
-        // Remove header from pbuf
-        if (pbuf_header(p, -HEADER_SIZE) != 0) {
-            xil_printf("Header removal failed\n\r");
-            tcp_close(tpcb);
+        // Reserve a DDR4 extent sized for this upload
+        if (herr != ERR_OK || hdr.length == 0 || hdr.length > MAX_IMAGE_SIZE ||
+            (conn->extent = ddr4_arena_alloc(conn->file_size)) == NULL) {
+            xil_printf("No DDR4 space for %d bytes, rejecting upload\n\r", conn->file_size);
+            ddr4_arena_report();
             pbuf_free(p);
-            mem_free(conn);
-            return ERR_VAL;
+            free_connection(conn);
+            tcp_arg(tpcb, NULL);
+            tcp_abort(tpcb);
+            return ERR_ABRT;
         }
+        conn->buffer_addr = (u32_t)conn->extent->addr;
+        conn->header_received = 1;
+        conn->verify = (hdr.flags & FRAME_FLAG_VERIFY) ? 1 : 0;
+        ddr4_echo_init(&conn->echo, conn->buffer_addr, ddr4_echo_mode(&hdr, ECHO_MODE));
+        rx_window_limit(&conn->echo.win, conn->extent->size);
+        conn->echo.metrics = &conn->metrics;
+        xil_printf("Expected file size: %d bytes (header v%d, stream %lu, seq %lu, %s)\n\r",
+                   conn->file_size, hdr.version, (unsigned long)hdr.stream_id, (unsigned long)hdr.sequence,
+                   conn->verify ? "verify" : (conn->echo.mode == DDR4_ECHO_ZERO_COPY ? "zero-copy echo" : "copy echo"));
+        
+        // Payload starts after the header, in whichever segment
+        skip = hdr.size;
+        tcp_recved(tpcb, hdr.size);
     }
 
-    // Check DDR4 space
-    if (conn->received_bytes + p->tot_len > MAX_IMAGE_SIZE) {
-        xil_printf("Image exceeds maximum size (%d MB)\n\r", MAX_IMAGE_SIZE/(1024*1024));
+    // Check DDR4 space, once for the whole chain
+    len = p->tot_len - skip;
+    if (conn->received_bytes + len > conn->extent->size) {
+        xil_printf("Image exceeds its DDR4 extent (%d bytes)\n\r", conn->extent->size);
         pbuf_free(p);
-        tcp_close(tpcb);
-        mem_free(conn);
-        return ERR_MEM;
+        // Abort so queued zero-copy segments are dropped before the extent is reused
+        free_connection(conn);
+        tcp_arg(tpcb, NULL);
+        tcp_abort(tpcb);
+        return ERR_ABRT;
     }
 
-    // Process received data
-    u32_t bytes_stored = 0;
-    struct pbuf *q = p;
-    while (q) {
-        u32_t chunk_len = q->len;
-        u32_t ddr_offset = conn->received_bytes + bytes_stored;
-        
-        // Store in DDR4
-        memcpy((void*)(conn->buffer_addr + ddr_offset), q->payload, chunk_len);
-        Xil_DCacheFlushRange(conn->buffer_addr + ddr_offset, chunk_len);
-        
-        bytes_stored += chunk_len;
-        q = q->next;
+    // Store the chain in DDR4 with one copy and one flush; the EMAC reads
+    // these bytes for the echo
+    pbuf_iov_store(p, skip, len, conn->buffer_addr + conn->received_bytes, &conn->cache);
+    if (conn->verify) {
+        conn->crc = pbuf_iov_crc32c(conn->crc, p, skip, len);
     }
+    ddr4_cache_flush(&conn->cache);
 
     // Update total received bytes
-    conn->received_bytes += bytes_stored;
-    xil_printf("Stored %d bytes in DDR4 (total: %d)\n\r", bytes_stored, conn->received_bytes);
+    conn->received_bytes += len;
+    TRACE_DBG(TRACE_EV_STORE, len, conn->received_bytes);
 
-    // Echo the newly stored data from DDR4
-    u32_t echo_start = conn->echoed_bytes;
-    u32_t echo_end = conn->received_bytes;
-    u32_t bytes_to_echo = echo_end - echo_start;
-    
-    if (bytes_to_echo > 0) {
-        err_t err = tcp_write(tpcb, (void*)(conn->buffer_addr + echo_start), 
-                            bytes_to_echo, TCP_WRITE_FLAG_COPY);
-        if (err != ERR_OK) {
-            xil_printf("tcp_write failed: %d\n\r", err);
-            pbuf_free(p);
-            return err;
+    // Verify mode: nothing goes back until the digest, so credit right away
+    if (conn->verify) {
+        tcp_recved(tpcb, len);
+        pbuf_free(p);
+        if (conn->received_bytes == conn->file_size) {
+            frame_digest_encode(conn->digest, conn->crc, conn->received_bytes);
+            err = tcp_write(tpcb, conn->digest, FRAME_DIGEST_SIZE, TCP_WRITE_FLAG_COPY);
+            if (err != ERR_OK) {
+                xil_printf("Digest write failed: %d\n\r", err);
+                free_connection(conn);
+                tcp_arg(tpcb, NULL);
+                tcp_abort(tpcb);
+                return ERR_ABRT;
+            }
+            tcp_output(tpcb);
+            xil_printf("Stored %d bytes, CRC32C 0x%08lx\n\r", conn->received_bytes, (unsigned long)conn->crc);
         }
-        
-        // Send the echoed data immediately
-        tcp_output(tpcb);
+        return ERR_OK;
     }
 
-    // Update TCP receive window
-    tcp_recved(tpcb, p->tot_len);
-    
-    // Free the pbuf
+    // Free the pbuf, the echo is served from the DDR4 copy
     pbuf_free(p);
+
+    // Echo the un-echoed DDR4 range in tcp_sndbuf() sized writes. Whatever does
+    // not fit stays parked until sent_callback/poll_callback, and the receive
+    // window is only reopened for bytes already queued for echo.
+    ddr4_echo_stored(&conn->echo, conn->received_bytes);
+    err = ddr4_echo_pump(&conn->echo, tpcb);
+    if (err != ERR_OK) {
+        xil_printf("tcp_write failed: %d\n\r", err);
+        free_connection(conn);
+        tcp_arg(tpcb, NULL);
+        tcp_abort(tpcb);
+        return ERR_ABRT;
+    }
     
     return ERR_OK;
 }
@@ -177,28 +298,34 @@ err_t recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
 {
     image_connection_t *conn;
+    conn_reject_t reason;
 
     if (err != ERR_OK || newpcb == NULL) {
         return ERR_VAL;
     }
 
-    conn = (image_connection_t *)mem_malloc(sizeof(image_connection_t));
+    // Admission control before anything else is allocated
+    conn = (image_connection_t *)conn_pool_acquire(&connections, &reason);
     if (!conn) {
-        xil_printf("Failed to allocate connection struct\n\r");
-        return ERR_MEM;
+        xil_printf("Connection rejected: %s (%d/%d in use)\n\r",
+                   conn_pool_reason(reason), connections.in_use, connections.limit);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
     }
-
-    memset(conn, 0, sizeof(image_connection_t));
     conn->pcb = newpcb;
     conn->buffer_addr = 0;
     conn->received_bytes = 0;
-    conn->echoed_bytes = 0;
     conn->header_received = 0;
     conn->closing = 0;
+    ddr4_cache_init(&conn->cache, DDR4_CACHE_DEFAULT_THRESHOLD);
+    conn_metrics_open(&conn->metrics);
+    conn_watchdog_init(&conn->wd, CONN_WATCHDOG_IDLE_POLLS);
 
     tcp_arg(newpcb, conn);
     tcp_recv(newpcb, recv_callback);
     tcp_sent(newpcb, sent_callback);
+    tcp_err(newpcb, err_callback);
+    tcp_poll(newpcb, poll_callback, CONN_WATCHDOG_POLL_INTERVAL);
     
     // Disable Nagle's algorithm for low latency
     tcp_nagle_disable(newpcb);
@@ -207,12 +334,19 @@ err_t accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
     return ERR_OK;
 }
 
+// Main-loop hook: format trace records while the link is quiet
+int transfer_data() {
+    trace_log_drain(TRACE_DRAIN_BATCH);
+    return 0;
+}
+
 int start_application()
 {
     struct tcp_pcb *pcb;
     err_t err;
 
     init_ddr_memory();
+    conn_pool_init(&connections, CONN_POOL_MAX_CONNECTIONS);
 
     pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
     if (!pcb) {
@@ -233,6 +367,7 @@ int start_application()
     }
 
     tcp_accept(pcb, accept_callback);
+    conn_metrics_server_init(CONN_METRICS_PORT);
 
     xil_printf("TCP echo server with DDR4 storage started @ port %d\n\r", SERVER_PORT);
     xil_printf("Using DDR4 at 0x%08x (max %d MB)\n\r", 
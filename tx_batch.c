@@ -0,0 +1,195 @@
+/******************************************************************************
+* Coalesced transmit scheduling
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+******************************************************************************/
+
+#include <string.h>
+#include "tx_batch.h"
+#include "lwip/priv/tcp_priv.h"
+#include "xil_printf.h"
+
+#if defined (__arm__) || defined (__aarch64__) || defined (HOST_BUILD)
+#include "xtime_l.h"
+#define TX_TIME_NOW(t) XTime_GetTime(&(t))
+#define TX_BATCH_HOLD_TICKS ((u64)COUNTS_PER_SECOND * TX_BATCH_HOLD_US / 1000000)
+#else
+// No free-running timer: deferred batches go out on the next tx_batch_run()
+#define TX_TIME_NOW(t) ((t) = 0)
+#define TX_BATCH_HOLD_TICKS 0
+#endif
+
+static tx_batch_t *deferred_head;
+
+void tx_batch_init(tx_batch_t *tx, u32_t flush_bytes)
+{
+    memset(tx, 0, sizeof(tx_batch_t));
+    tx->flush_bytes = flush_bytes ? flush_bytes : TX_BATCH_DEFAULT_BYTES;
+}
+
+// Count the segments tcp_write started since the last call. Segments keep
+// their first sequence number while later writes fill them, so each is
+// counted once however many writes it takes. Walks the unsent queue, so it
+// runs once per output rather than once per write.
+static void count_segments(tx_batch_t *tx, struct tcp_pcb *pcb)
+{
+    struct tcp_seg *seg;
+
+    for (seg = pcb->unsent; seg != NULL; seg = seg->next) {
+        u32_t seqno = lwip_ntohl(seg->tcphdr->seqno);
+        if (TCP_SEQ_GEQ(seqno, tx->next_seq)) {
+            tx->segments++;
+            tx->next_seq = seqno + 1;
+        }
+    }
+}
+
+static err_t output(tx_batch_t *tx, struct tcp_pcb *pcb)
+{
+    count_segments(tx, pcb);
+    tx->pending = 0;
+    tx->flushes++;
+    return tcp_output(pcb);
+}
+
+// Queue len bytes without PSH; the segment stays open for the next write
+err_t tx_batch_write(tx_batch_t *tx, struct tcp_pcb *pcb, const void *data, u16_t len, u8_t flags)
+{
+    err_t err;
+
+    if (!tx->started) {
+        tx->next_seq = pcb->snd_lbb;
+        tx->started = 1;
+    }
+    if (tx->pushed) {
+        tcp_nagle_enable(pcb);
+        tx->pushed = 0;
+    }
+
+    err = tcp_write(pcb, data, len, flags | TCP_WRITE_FLAG_MORE);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    if (tx->pending == 0) {
+        TX_TIME_NOW(tx->first_ticks);
+    }
+    tx->pending += len;
+    tx->bytes += len;
+    tx->writes++;
+
+    // Long batches (a whole chain, a deep backlog) start sending early
+    if (tx->pending >= tx->flush_bytes) {
+        output(tx, pcb);
+    }
+    return ERR_OK;
+}
+
+// End of a batch: mark the last segment PSH and send. push also gets a
+// Nagle-held tail out now rather than after the next ACK.
+err_t tx_batch_flush(tx_batch_t *tx, struct tcp_pcb *pcb, u8_t push)
+{
+    struct tcp_seg *last = pcb->unsent;
+
+    if (tx->deferred) {
+        tx_batch_cancel(tx);
+    }
+    if (last == NULL && tx->pending == 0) {
+        return ERR_OK;
+    }
+
+    if (last != NULL) {
+        while (last->next != NULL) {
+            last = last->next;
+        }
+        TCPH_SET_FLAG(last->tcphdr, TCP_PSH);
+    }
+    if (push && !tcp_nagle_disabled(pcb)) {
+        tcp_nagle_disable(pcb);
+        tx->pushed = 1;
+    }
+    return output(tx, pcb);
+}
+
+// Main loop: leave the batch open for tx_batch_run() instead of sending now
+void tx_batch_defer(tx_batch_t *tx, struct tcp_pcb *pcb)
+{
+    // Nothing written since the last flush: nothing to wait for
+    if (tx->pending == 0) {
+        if (tx->deferred) {
+            tx_batch_cancel(tx);
+        }
+        return;
+    }
+    tx->pcb = pcb;
+    if (!tx->deferred) {
+        tx->deferred = 1;
+        tx->next = deferred_head;
+        deferred_head = tx;
+    }
+}
+
+// The connection is going away: forget a deferred batch
+void tx_batch_cancel(tx_batch_t *tx)
+{
+    tx_batch_t **pp;
+
+    for (pp = &deferred_head; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == tx) {
+            *pp = tx->next;
+            break;
+        }
+    }
+    tx->next = NULL;
+    tx->deferred = 0;
+}
+
+// Main-loop hook: flush deferred batches that reached a size or time threshold
+void tx_batch_run(void)
+{
+    tx_batch_t **pp = &deferred_head;
+    u64 now;
+
+    TX_TIME_NOW(now);
+    while (*pp != NULL) {
+        tx_batch_t *tx = *pp;
+
+        if (tx->pending >= tx->flush_bytes || now - tx->first_ticks >= TX_BATCH_HOLD_TICKS) {
+            *pp = tx->next;
+            tx->next = NULL;
+            tx->deferred = 0;
+            tx_batch_flush(tx, tx->pcb, 0);
+        } else {
+            pp = &tx->next;
+        }
+    }
+}
+
+// Called from tcp_poll: nothing is left waiting on a threshold or an ACK
+err_t tx_batch_poll(tx_batch_t *tx, struct tcp_pcb *pcb)
+{
+    if (tx->pending == 0 && pcb->unsent == NULL) {
+        if (tx->deferred) {
+            tx_batch_cancel(tx);
+        }
+        return ERR_OK;
+    }
+    return tx_batch_flush(tx, pcb, 1);
+}
+
+u32_t tx_batch_segments_per_mb(const tx_batch_t *tx)
+{
+    if (tx->bytes == 0) {
+        return 0;
+    }
+    return (u32_t)(((u64)tx->segments << 20) / tx->bytes);
+}
+
+void tx_batch_report(const tx_batch_t *tx)
+{
+    u32_t avg = tx->segments ? (u32_t)(tx->bytes / tx->segments) : 0;
+
+    xil_printf("TX: %lu bytes in %lu writes, %lu segments (%lu per MB, %lu bytes avg), %lu outputs\n\r",
+               (unsigned long)tx->bytes, (unsigned long)tx->writes, (unsigned long)tx->segments,
+               (unsigned long)tx_batch_segments_per_mb(tx), (unsigned long)avg,
+               (unsigned long)tx->flushes);
+}
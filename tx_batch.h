@@ -0,0 +1,73 @@
+/******************************************************************************
+* Coalesced transmit scheduling
+* For Xilinx KCU105 Board with 2GB DDR4 RAM
+*
+* The echo paths used to follow every tcp_write with tcp_output. lwIP's
+* tcp_write already packs consecutive writes into the last unsent segment,
+* but each write without TCP_WRITE_FLAG_MORE sets PSH, and every tcp_output
+* made outside the input path (main loop completions, poll) sends the
+* partial tail segment as a runt before the next write could fill it.
+*
+* A tx_batch_t sits between a connection and tcp_write:
+*
+*   write   tcp_write with TCP_WRITE_FLAG_MORE; output only once
+*           flush_bytes are pending
+*   flush   once per callback or main-loop batch: PSH on the last segment,
+*           then tcp_output. Inside recv/sent callbacks lwIP defers the
+*           output until input processing ends, so this is the one output
+*           per callback either way.
+*   defer   main-loop writers (copy engine, storage worker completions) park
+*           the batch; tx_batch_run() flushes it once flush_bytes are pending
+*           or it is TX_BATCH_HOLD_US old, so completions landing together
+*           share full segments instead of one runt each
+*   poll    from tcp_poll: anything still pending or held back is pushed
+*
+* Nagle: with Nagle on (the default) lwIP holds the runt tail until the
+* previous data is ACK'd, which is what batching wants mid-stream; a push
+* (end of object, poll) switches it off until the next write so the tail
+* does not wait for a delayed ACK. With Nagle off (tcp_nagle_disable, the
+* low-latency servers) the flag is left alone and the runt per flush is
+* what the deferral and thresholds reduce.
+*
+* Segments are counted as the batch outputs them, so segments per MB shows
+* how full they are (1 MB / TCP_MSS ~ 725 is the floor). One that lwIP
+* sends on its own first (a delayed ACK from the fast timer) is missed.
+******************************************************************************/
+
+#ifndef TX_BATCH_H
+#define TX_BATCH_H
+
+#include "lwip/err.h"
+#include "lwip/tcp.h"
+#include "xil_types.h"
+
+#define TX_BATCH_DEFAULT_BYTES (4 * TCP_MSS)  // Output once this much is pending
+#define TX_BATCH_HOLD_US 200                  // Deferred batches wait at most this long
+
+typedef struct tx_batch {
+    struct tx_batch *next;     // Deferred list link
+    struct tcp_pcb *pcb;       // Set while deferred
+    u32_t pending;             // Bytes written since the last flush
+    u32_t flush_bytes;         // Size threshold
+    u64 first_ticks;           // When the oldest pending byte was written
+    u32_t next_seq;            // Segments starting here or later are not yet counted
+    u8_t started;              // next_seq is valid
+    u8_t deferred;             // On the deferred list
+    u8_t pushed;               // Nagle switched off by a push, restore on next write
+    u64 bytes;                 // Bytes handed to tcp_write
+    u32_t writes;              // Successful tcp_write calls
+    u32_t flushes;             // tcp_output calls made by the batch
+    u32_t segments;            // Segments built by tcp_write
+} tx_batch_t;
+
+void tx_batch_init(tx_batch_t *tx, u32_t flush_bytes);
+err_t tx_batch_write(tx_batch_t *tx, struct tcp_pcb *pcb, const void *data, u16_t len, u8_t flags);
+err_t tx_batch_flush(tx_batch_t *tx, struct tcp_pcb *pcb, u8_t push);
+void tx_batch_defer(tx_batch_t *tx, struct tcp_pcb *pcb);
+void tx_batch_cancel(tx_batch_t *tx);
+void tx_batch_run(void);
+err_t tx_batch_poll(tx_batch_t *tx, struct tcp_pcb *pcb);
+u32_t tx_batch_segments_per_mb(const tx_batch_t *tx);
+void tx_batch_report(const tx_batch_t *tx);
+
+#endif